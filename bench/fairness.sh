@@ -0,0 +1,69 @@
+#!/bin/bash
+# Tail latency of small clients next to one deep-pipeline client (make bench-fairness).
+#
+#   fairness.sh <kvstore> <loadgen> <port>
+#
+# For each [server] command_budget in FAIR_BUDGETS (default "0 100", 0 is the
+# old unbounded behaviour) a fresh server is started, one connection floods it
+# with FAIR_DEPTH (default 5000) pipelined requests per round trip, and ten
+# well-behaved connections send FAIR_RATE (default 500) ops/s open loop
+# beside it for FAIR_SECONDS (default 5). Reports the victims' latency and the
+# flooding client's throughput.
+
+set -e
+
+[ $# -eq 3 ] || { echo "usage: $0 <kvstore> <loadgen> <port>" >&2; exit 1; }
+BIN="$1" LOADGEN="$2" PORT="$3"
+BUDGETS=${FAIR_BUDGETS:-"0 100"}
+DEPTH=${FAIR_DEPTH:-5000}
+RATE=${FAIR_RATE:-500}
+SECS=${FAIR_SECONDS:-5}
+
+start_server() {
+    RUN_DIR=$(mktemp -d /tmp/kvs-fair.XXXXXX)
+    cat > "$RUN_DIR/kvstore.conf" <<EOF
+[server]
+port = $PORT
+log_level = 1
+command_budget = $1
+[persist]
+mode = 0
+rdb_save_on_shutdown = false
+rdb_file = $RUN_DIR/kvstore.rdb
+EOF
+    "$BIN" -c "$RUN_DIR/kvstore.conf" > "$RUN_DIR/log" 2>&1 &
+    SERVER_PID=$!
+    trap 'kill -TERM $SERVER_PID; wait $SERVER_PID || true; rm -rf "$RUN_DIR"' EXIT
+    for _ in $(seq 50); do
+        if (exec 3<>"/dev/tcp/127.0.0.1/$PORT") 2>/dev/null; then return 0; fi
+        sleep 0.1
+    done
+    echo "Error: server $BIN did not start, see $RUN_DIR/log" >&2
+    exit 1
+}
+
+stop_server() {
+    trap - EXIT
+    kill -TERM "$SERVER_PID"
+    wait "$SERVER_PID" || true
+    rm -rf "$RUN_DIR"
+}
+
+echo "Victims: 10 conns at $RATE ops/s, flood: 1 conn with pipeline depth $DEPTH, ${SECS}s"
+printf "%-8s %10s %10s %10s %10s %14s\n" budget "p50 us" "p99 us" "p99.9 us" "max us" "flood ops/s"
+for budget in $BUDGETS; do
+    start_server "$budget"
+    "$LOADGEN" -p "$PORT" -c 1 -P "$DEPTH" -d $((SECS + 1)) -r 0.5 > "$RUN_DIR/flood.out" &
+    flood=$!
+    sleep 0.5
+    "$LOADGEN" -p "$PORT" -c 10 -P 1 -R "$RATE" -d "$SECS" -r 0.9 > "$RUN_DIR/victim.out"
+    wait "$flood"
+    awk -v budget="$budget" '
+        FILENAME ~ /flood/ && /^requests:/ { ops = $(NF - 1) }
+        FILENAME ~ /victim/ && /^latency/ {
+            for (i = 3; i <= 6; i++) { split($i, a, "="); v[i] = a[2] }
+        }
+        END { printf "%-8s %10s %10s %10s %10s %14s\n", budget, v[3], v[4], v[5], v[6], ops }
+    ' "$RUN_DIR/flood.out" "$RUN_DIR/victim.out"
+    stop_server
+done
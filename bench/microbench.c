@@ -0,0 +1,283 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "kvs_base.h"
+#include "kvs_hash.h"
+#include "kvs_propagate.h"
+#include "kvs_replication.h"
+#include "kvs_configure.h"
+
+/*
+ * 进程内微基准：直接调用哈希引擎、kvs_protocol 与 RESP 编码，不经过 socket。
+ * 每项运行 RUNS 次，报告每次操作的最短与中位耗时（纳秒），结果以 JSON
+ * 输出到标准输出，便于保存后在提交之间对比。参数为名称子串时只运行匹配项。
+ */
+
+#define RUNS            5
+#define KEY_LEN         14          /* "key:%010ld" */
+#define VALUE_LEN       32
+#define PIPELINE_CMDS   1000
+#define RESP_BUF_SIZE   (4 * 1024 * 1024)
+
+extern int kvs_protocol(char *msg, int length, char *response, int resp_size, int *processed, int *needed);
+extern int init_kvengine(void);
+
+static const char *filter;
+static int first_result = 1;
+static volatile uint64_t sink;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+static int selected(const char *name) {
+    return !filter || strstr(name, filter);
+}
+
+static void report(const char *name, long ops, double *ns_per_op) {
+    qsort(ns_per_op, RUNS, sizeof(double), cmp_double);
+    printf("%s    {\"name\": \"%s\", \"ops\": %ld, \"ns_per_op_min\": %.2f, \"ns_per_op_median\": %.2f}",
+           first_result ? "" : ",\n", name, ops, ns_per_op[0], ns_per_op[RUNS / 2]);
+    first_result = 0;
+    fflush(stdout);
+}
+
+static uint64_t rnd(uint64_t *s) {
+    *s ^= *s >> 12;
+    *s ^= *s << 25;
+    *s ^= *s >> 27;
+    return *s * 2685821657736338717ULL;
+}
+
+/* ---------------- 哈希引擎 ---------------- */
+
+static char *make_keys(const char *prefix, long n) {
+    char *keys = malloc((size_t)n * (KEY_LEN + 1));
+    char key[32];
+    for (long i = 0; i < n; i++) {
+        snprintf(key, sizeof(key), "%s%010ld", prefix, i);
+        memcpy(keys + i * (KEY_LEN + 1), key, KEY_LEN + 1);
+    }
+    return keys;
+}
+
+/* 随机访问顺序，避免按插入顺序访问带来的缓存友好 */
+static long *make_order(long n) {
+    long *order = malloc(sizeof(long) * n);
+    uint64_t seed = 0x9E3779B97F4A7C15ULL;
+    for (long i = 0; i < n; i++) order[i] = i;
+    for (long i = n - 1; i > 0; i--) {
+        long j = rnd(&seed) % (i + 1);
+        long t = order[i];
+        order[i] = order[j];
+        order[j] = t;
+    }
+    return order;
+}
+
+static void fill_hash(kvs_hash_t *h, const char *keys, long n, const char *value) {
+    memset(h, 0, sizeof(*h));
+    kvs_hash_create(h);
+    for (long i = 0; i < n; i++)
+        kvs_hash_set(h, keys + i * (KEY_LEN + 1), KEY_LEN, value, VALUE_LEN);
+}
+
+static void bench_hash(long n) {
+    char name[64];
+    char value[VALUE_LEN];
+    memset(value, 'v', sizeof(value));
+    char *keys = make_keys("key:", n);
+    char *absent = make_keys("abs:", n);
+    long *order = make_order(n);
+    double ns[RUNS];
+    kvs_hash_t h;
+
+    snprintf(name, sizeof(name), "hash_set_%ld", n);
+    if (selected(name)) {
+        for (int r = 0; r < RUNS; r++) {
+            memset(&h, 0, sizeof(h));
+            kvs_hash_create(&h);
+            uint64_t start = now_ns();
+            for (long i = 0; i < n; i++)
+                kvs_hash_set(&h, keys + order[i] * (KEY_LEN + 1), KEY_LEN, value, VALUE_LEN);
+            ns[r] = (double)(now_ns() - start) / n;
+            kvs_hash_destroy(&h);
+        }
+        report(name, n, ns);
+    }
+
+    /* 命中率 100% 与 50%：未命中的 key 与存在的 key 长度相同 */
+    fill_hash(&h, keys, n, value);
+    for (int hit = 100; hit >= 50; hit -= 50) {
+        snprintf(name, sizeof(name), "hash_get_hit%d_%ld", hit, n);
+        if (!selected(name)) continue;
+        for (int r = 0; r < RUNS; r++) {
+            uint64_t sum = 0;
+            uint64_t start = now_ns();
+            for (long i = 0; i < n; i++) {
+                const char *k = (hit == 100 || (i & 1)) ? keys : absent;
+                size_t vlen;
+                kvs_hash_get(&h, k + order[i] * (KEY_LEN + 1), KEY_LEN, &vlen);
+                sum += vlen;
+            }
+            ns[r] = (double)(now_ns() - start) / n;
+            sink += sum;
+        }
+        report(name, n, ns);
+    }
+    kvs_hash_destroy(&h);
+
+    snprintf(name, sizeof(name), "hash_del_%ld", n);
+    if (selected(name)) {
+        for (int r = 0; r < RUNS; r++) {
+            fill_hash(&h, keys, n, value);
+            uint64_t start = now_ns();
+            for (long i = 0; i < n; i++)
+                kvs_hash_del(&h, keys + order[i] * (KEY_LEN + 1), KEY_LEN);
+            ns[r] = (double)(now_ns() - start) / n;
+            kvs_hash_destroy(&h);
+        }
+        report(name, n, ns);
+    }
+
+    free(keys);
+    free(absent);
+    free(order);
+}
+
+/* ---------------- kvs_protocol ---------------- */
+
+static int encode(char *buf, int argc, const char **argv, const size_t *lens) {
+    return (int)kvs_resp_encode(buf, argc, argv, lens);
+}
+
+/* 预先编码的流水线：kind 为 set/get/mixed，value 为 GET 命中的值大小 */
+static char *make_pipeline(const char *kind, int vlen, int *out_len) {
+    char *value = malloc(vlen);
+    memset(value, 'v', vlen);
+    char *buf = malloc((size_t)PIPELINE_CMDS * (vlen + 128));
+    int len = 0;
+    for (int i = 0; i < PIPELINE_CMDS; i++) {
+        char key[32];
+        int klen = snprintf(key, sizeof(key), "key:%010d", i);
+        const char *argv[3] = { NULL, key, value };
+        size_t lens[3] = { 0, (size_t)klen, (size_t)vlen };
+        int argc = 2;
+        if (strcmp(kind, "set") == 0 || (strcmp(kind, "mixed") == 0 && i % 4 == 0)) {
+            argv[0] = "SET";
+            argc = 3;
+        } else if (strcmp(kind, "mixed") == 0 && i % 4 == 1) {
+            argv[0] = "EXISTS";
+        } else {
+            argv[0] = "GET";
+        }
+        lens[0] = strlen(argv[0]);
+        len += encode(buf + len, argc, argv, lens);
+    }
+    free(value);
+    *out_len = len;
+    return buf;
+}
+
+/* 按 reactor 的方式反复调用 kvs_protocol，直到整条流水线处理完 */
+static void run_pipeline(char *pipe, int len, char *resp) {
+    int off = 0;
+    while (off < len) {
+        int processed = 0, needed = 0;
+        int n = kvs_protocol(pipe + off, len - off, resp, RESP_BUF_SIZE, &processed, &needed);
+        if (n < 0 || processed == 0) {
+            fprintf(stderr, "kvs_protocol failed at offset %d\n", off);
+            exit(1);
+        }
+        sink += n;
+        off += processed;
+    }
+}
+
+static void bench_protocol(const char *kind, int vlen, char *resp) {
+    char name[64];
+    snprintf(name, sizeof(name), "protocol_%s_%db", kind, vlen);
+    if (!selected(name)) return;
+
+    /* GET 命中需要先写入同样大小的值 */
+    int len;
+    char *setup = make_pipeline("set", vlen, &len);
+    run_pipeline(setup, len, resp);
+    free(setup);
+
+    char *pipe = make_pipeline(kind, vlen, &len);
+    double ns[RUNS];
+    for (int r = 0; r < RUNS; r++) {
+        uint64_t start = now_ns();
+        for (int rep = 0; rep < 100; rep++) run_pipeline(pipe, len, resp);
+        ns[r] = (double)(now_ns() - start) / (100.0 * PIPELINE_CMDS);
+    }
+    report(name, 100L * PIPELINE_CMDS, ns);
+    free(pipe);
+}
+
+/* ---------------- RESP 编码 ---------------- */
+
+static void bench_encode(int vlen) {
+    char name[64];
+    snprintf(name, sizeof(name), "resp_encode_set_%db", vlen);
+    if (!selected(name)) return;
+
+    char *value = malloc(vlen);
+    memset(value, 'v', vlen);
+    const char *argv[3] = { "SET", "key:0000000001", value };
+    size_t lens[3] = { 3, KEY_LEN, (size_t)vlen };
+    char *buf = malloc(kvs_resp_encoded_len(3, lens));
+    const long iters = 1000000;
+    double ns[RUNS];
+    for (int r = 0; r < RUNS; r++) {
+        uint64_t start = now_ns();
+        for (long i = 0; i < iters; i++) {
+            sink += kvs_resp_encoded_len(3, lens);
+            sink += kvs_resp_encode(buf, 3, argv, lens);
+        }
+        ns[r] = (double)(now_ns() - start) / iters;
+    }
+    report(name, iters, ns);
+    free(buf);
+    free(value);
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1) filter = argv[1];
+
+    /* 日志全部关闭，标准输出只有 JSON；写命令进入复制 backlog，不写 AOF */
+    kvs_config_set_default();
+    g_config.log_level = 0;
+    g_config.persist_mode = PERSIST_OFF;
+    if (init_kvengine() < 0) return 1;
+    kvs_replication_init();
+
+    printf("{\n  \"suite\": \"microbench\",\n  \"runs\": %d,\n  \"results\": [\n", RUNS);
+
+    static const long sizes[] = { 1000, 100000, 1000000 };
+    for (int i = 0; i < 3; i++) bench_hash(sizes[i]);
+
+    char *resp = malloc(RESP_BUF_SIZE);
+    bench_protocol("set", 32, resp);
+    bench_protocol("get", 32, resp);
+    bench_protocol("get", 4096, resp);
+    bench_protocol("mixed", 32, resp);
+    free(resp);
+
+    bench_encode(32);
+    bench_encode(4096);
+
+    printf("\n  ]\n}\n");
+    return 0;
+}
@@ -0,0 +1,253 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <sys/stat.h>
+
+#include "kvs_base.h"
+#include "kvs_hash.h"
+#include "kvs_persist.h"
+#include "kvs_propagate.h"
+#include "kvs_replication.h"
+#include "kvs_configure.h"
+
+/*
+ * 持久化吞吐基准：在进程内生成 N 个 key 的数据集，依次测量 RDB 保存 / 加载、
+ * AOF 重写（RESP 与 RDB 前导两种格式）、AOF 重放，以及三种刷盘策略下的
+ * AOF 追加速率。追加按 reactor 的方式进行：每批 pipeline 条 SET 经 kvs_protocol
+ * 执行后调用一次 kvs_aof_flush()；always / everysec 的 fdatasync 由本程序发出。
+ * 结果以 JSON 输出到标准输出。
+ */
+
+#define KEY_FMT         "key:%010ld"
+#define APPEND_CMDS     4096            /* 预编码的追加流水线条数 */
+#define RESP_BUF_SIZE   (1024 * 1024)
+
+extern kvs_hash_t global_hash;
+extern int kvs_protocol(char *msg, int length, char *response, int resp_size, int *processed, int *needed);
+extern int init_kvengine(void);
+
+static struct {
+    long keys;
+    int value_size;
+    int pipeline;
+    int seconds;            /* 每种刷盘策略的追加时长 */
+    const char *dir;
+} opt = {
+    .keys = 1000000,
+    .value_size = 64,
+    .pipeline = 16,
+    .seconds = 3,
+    .dir = "/tmp",
+};
+
+static int first_result = 1;
+static FILE *out;           /* JSON 结果；库函数的 printf 转到 stderr */
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static long file_size(const char *path) {
+    struct stat st;
+    return stat(path, &st) == 0 ? (long)st.st_size : 0;
+}
+
+/* 一项结果：耗时、处理的 key 或命令数、涉及的字节数 */
+static void report(const char *name, uint64_t ns, long ops, long bytes) {
+    double sec = ns / 1e9;
+    fprintf(out, "%s    {\"name\": \"%s\", \"seconds\": %.4f, \"ops\": %ld, \"bytes\": %ld, "
+           "\"ops_per_sec\": %.0f, \"mb_per_sec\": %.2f}",
+           first_result ? "" : ",\n", name, sec, ops, bytes,
+           sec > 0 ? ops / sec : 0, sec > 0 ? bytes / sec / (1024 * 1024) : 0);
+    first_result = 0;
+    fflush(out);
+}
+
+static void fill_value(char *value, long i) {
+    for (int j = 0; j < opt.value_size; j++)
+        value[j] = 'a' + (i + j) % 26;
+}
+
+static void build_dataset(void) {
+    char key[32];
+    char *value = malloc(opt.value_size);
+    uint64_t start = now_ns();
+    for (long i = 0; i < opt.keys; i++) {
+        int klen = snprintf(key, sizeof(key), KEY_FMT, i);
+        fill_value(value, i);
+        kvs_hash_set(&global_hash, key, klen, value, opt.value_size);
+    }
+    report("dataset_build", now_ns() - start, opt.keys, (long)global_hash.mem_bytes);
+    free(value);
+}
+
+static void reset_keyspace(void) {
+    kvs_hash_destroy(&global_hash);
+    memset(&global_hash, 0, sizeof(global_hash));
+    kvs_hash_create(&global_hash);
+}
+
+static void bench_rdb(void) {
+    uint64_t start = now_ns();
+    kvs_rdb_save();
+    report("rdb_save", now_ns() - start, opt.keys, file_size(g_config.rdb_file));
+
+    kvs_hash_t h;
+    memset(&h, 0, sizeof(h));
+    kvs_hash_create(&h);
+    start = now_ns();
+    int loaded = kvs_hash_load_rdb(&h, g_config.rdb_file);
+    report("rdb_load", now_ns() - start, loaded, file_size(g_config.rdb_file));
+    kvs_hash_destroy(&h);
+}
+
+/* 以 mode 格式重写 AOF，再清空 keyspace 从该文件重放 */
+static void bench_aof_rewrite_replay(persist_mode_t mode, const char *suffix) {
+    char name[64];
+    g_config.persist_mode = mode;
+    unlink(g_config.aof_file);
+
+    uint64_t start = now_ns();
+    kvs_aof_rewrite();
+    long size = file_size(g_config.aof_file);
+    snprintf(name, sizeof(name), "aof_rewrite_%s", suffix);
+    report(name, now_ns() - start, opt.keys, size);
+
+    reset_keyspace();
+    start = now_ns();
+    load_aof_file(g_config.aof_file);
+    snprintf(name, sizeof(name), "aof_replay_%s", suffix);
+    report(name, now_ns() - start, (long)global_hash.count, size);
+}
+
+/* 预编码的 SET 流水线，ends 记录每批（pipeline 条命令）的结束位置 */
+static char *make_append_pipeline(int *ends, int *nbatches) {
+    char *value = malloc(opt.value_size);
+    char *buf = malloc((size_t)APPEND_CMDS * (opt.value_size + 64));
+    int len = 0, n = 0;
+    for (long i = 0; i < APPEND_CMDS; i++) {
+        char key[32];
+        int klen = snprintf(key, sizeof(key), KEY_FMT, i * 7919 % opt.keys);
+        fill_value(value, i + 1);
+        const char *argv[3] = { "SET", key, value };
+        size_t lens[3] = { 3, (size_t)klen, (size_t)opt.value_size };
+        len += (int)kvs_resp_encode(buf + len, 3, argv, lens);
+        if ((i + 1) % opt.pipeline == 0 || i + 1 == APPEND_CMDS) ends[n++] = len;
+    }
+    free(value);
+    *nbatches = n;
+    return buf;
+}
+
+/* policy: 0 = no（只 write），1 = everysec，2 = always */
+static void bench_aof_append(int policy) {
+    static const char *names[] = { "aof_append_no", "aof_append_everysec", "aof_append_always" };
+    g_config.persist_mode = PERSIST_AOF_ONLY;
+    /* 原地截断：kvs_persist 缓存的 AOF fd 仍指向同一个文件 */
+    int sync_fd = open(g_config.aof_file, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (sync_fd < 0) {
+        fprintf(stderr, "cannot open %s\n", g_config.aof_file);
+        exit(1);
+    }
+
+    int nbatches;
+    int *ends = malloc(sizeof(int) * APPEND_CMDS);
+    char *pipe = make_append_pipeline(ends, &nbatches);
+    char *resp = malloc(RESP_BUF_SIZE);
+    unsigned long long written = g_persist_runtime.aof_written_bytes;
+    long cmds = 0;
+
+    uint64_t start = now_ns(), last_sync = start, deadline = start + opt.seconds * 1000000000ULL;
+    for (uint64_t now = start; now < deadline; now = now_ns()) {
+        int off = 0;
+        for (int b = 0; b < nbatches; b++) {
+            int processed = 0, needed = 0;
+            if (kvs_protocol(pipe + off, ends[b] - off, resp, RESP_BUF_SIZE, &processed, &needed) < 0) {
+                fprintf(stderr, "kvs_protocol failed\n");
+                exit(1);
+            }
+            off = ends[b];
+            kvs_aof_flush();
+            if (policy == 2) {
+                fdatasync(sync_fd);
+            } else if (policy == 1) {
+                uint64_t t = now_ns();
+                if (t - last_sync >= 1000000000ULL) {
+                    fdatasync(sync_fd);
+                    last_sync = t;
+                }
+            }
+        }
+        cmds += APPEND_CMDS;
+    }
+    if (policy != 0) fdatasync(sync_fd);
+    report(names[policy], now_ns() - start, cmds,
+           (long)(g_persist_runtime.aof_written_bytes - written));
+
+    close(sync_fd);
+    free(resp);
+    free(ends);
+    free(pipe);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [-n keys] [-v value_size] [-P pipeline] [-t seconds] [-D dir]\n"
+            "  -n  keys in the generated dataset (default 1000000)\n"
+            "  -v  value size in bytes (default 64)\n"
+            "  -P  SETs per AOF flush in the append test (default 16)\n"
+            "  -t  seconds per fsync policy in the append test (default 3)\n"
+            "  -D  directory for the RDB/AOF files (default /tmp)\n", prog);
+}
+
+int main(int argc, char **argv) {
+    int c;
+    while ((c = getopt(argc, argv, "n:v:P:t:D:h")) != -1) {
+        switch (c) {
+        case 'n': opt.keys = atol(optarg); break;
+        case 'v': opt.value_size = atoi(optarg); break;
+        case 'P': opt.pipeline = atoi(optarg); break;
+        case 't': opt.seconds = atoi(optarg); break;
+        case 'D': opt.dir = optarg; break;
+        default: usage(argv[0]); return 1;
+        }
+    }
+    if (opt.keys <= 0 || opt.value_size <= 0 || opt.pipeline <= 0 || opt.seconds <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    /* 写命令同时进入复制 backlog，与主机上的开销一致 */
+    kvs_config_set_default();
+    g_config.log_level = 0;
+    g_config.persist_mode = PERSIST_OFF;
+    snprintf(g_config.rdb_file, sizeof(g_config.rdb_file), "%s/persistbench.rdb", opt.dir);
+    snprintf(g_config.aof_file, sizeof(g_config.aof_file), "%s/persistbench.aof", opt.dir);
+    if (init_kvengine() < 0) return 1;
+    kvs_persist_init();
+    kvs_replication_init();
+
+    out = fdopen(dup(STDOUT_FILENO), "w");
+    dup2(STDERR_FILENO, STDOUT_FILENO);
+    fprintf(out, "{\n  \"suite\": \"persistbench\",\n  \"keys\": %ld,\n  \"value_size\": %d,\n"
+           "  \"pipeline\": %d,\n  \"results\": [\n", opt.keys, opt.value_size, opt.pipeline);
+
+    build_dataset();
+    bench_rdb();
+    bench_aof_rewrite_replay(PERSIST_AOF_ONLY, "resp");
+    bench_aof_rewrite_replay(PERSIST_MIXED, "preamble");
+    for (int policy = 0; policy < 3; policy++) bench_aof_append(policy);
+
+    fprintf(out, "\n  ]\n}\n");
+    fclose(out);
+    unlink(g_config.rdb_file);
+    unlink(g_config.aof_file);
+    return 0;
+}
@@ -0,0 +1,108 @@
+#!/bin/bash
+# Training and comparison workload for `make pgo`.
+#
+#   pgo-workload.sh train   <kvstore> <loadgen> <port>
+#   pgo-workload.sh compare <plain kvstore> <pgo kvstore> <loadgen> <port>
+#
+# Each run starts a fresh server with AOF + RDB (mode 3) in a temp dir, drives
+# pipelined and non-pipelined SET/GET traffic with loadgen and stops the server
+# with SIGTERM so an instrumented binary writes its profile on exit. compare
+# alternates the two binaries for PGO_ROUNDS rounds (default 3) and reports
+# the median of each.
+
+set -e
+
+WORKLOADS=(
+    "pipeline16-mixed:-t 2 -c 50 -P 16 -n 1000000 -r 0.5 -v 16-512"
+    "single-read-heavy:-t 2 -c 50 -P 1 -n 300000 -r 0.9 -v 64"
+    "pipeline32-zipf-large:-t 2 -c 20 -P 32 -n 200000 -r 0.7 -z 0.99 -v 1024-4096"
+)
+
+start_server() {
+    local bin="$1" port="$2"
+    RUN_DIR=$(mktemp -d /tmp/kvs-pgo.XXXXXX)
+    cat > "$RUN_DIR/kvstore.conf" <<EOF
+[server]
+port = $port
+log_level = 1
+[persist]
+mode = 3
+rdb_file = $RUN_DIR/kvstore.rdb
+aof_file = $RUN_DIR/kvstore.aof
+aof_rewrite_size = 64
+EOF
+    "$bin" -c "$RUN_DIR/kvstore.conf" > "$RUN_DIR/log" 2>&1 &
+    SERVER_PID=$!
+    for _ in $(seq 50); do
+        if (exec 3<>"/dev/tcp/127.0.0.1/$port") 2>/dev/null; then return 0; fi
+        sleep 0.1
+    done
+    echo "Error: server $bin did not start, see $RUN_DIR/log" >&2
+    exit 1
+}
+
+stop_server() {
+    kill -TERM "$SERVER_PID"
+    wait "$SERVER_PID" || true
+    rm -rf "$RUN_DIR"
+}
+
+# Prints "<name> <ops/s> <p99 us>" for each workload
+run_workloads() {
+    local bin="$1" loadgen="$2" port="$3"
+    for w in "${WORKLOADS[@]}"; do
+        local name="${w%%:*}" args="${w#*:}"
+        start_server "$bin" "$port"
+        # shellcheck disable=SC2086
+        "$loadgen" -p "$port" $args > "$RUN_DIR/loadgen.out"
+        awk -v name="$name" '
+            /^requests:/ { ops = $(NF - 1) }
+            /^latency/   { split($4, a, "="); p99 = a[2] }
+            END          { print name, ops, p99 }' "$RUN_DIR/loadgen.out"
+        stop_server
+    done
+}
+
+case "$1" in
+train)
+    [ $# -eq 4 ] || { echo "usage: $0 train <kvstore> <loadgen> <port>" >&2; exit 1; }
+    echo "Training $2"
+    run_workloads "$2" "$3" "$4"
+    ;;
+compare)
+    [ $# -eq 5 ] || { echo "usage: $0 compare <plain> <pgo> <loadgen> <port>" >&2; exit 1; }
+    rounds=${PGO_ROUNDS:-3}
+    results=""
+    for _ in $(seq "$rounds"); do
+        results+=$(run_workloads "$2" "$4" "$5" | sed 's/^/plain /')$'\n'
+        results+=$(run_workloads "$3" "$4" "$5" | sed 's/^/pgo /')$'\n'
+    done
+    echo "PGO + LTO build vs plain -O2 build, median of $rounds rounds"
+    printf "%-24s %12s %12s %8s %12s %12s\n" workload "plain ops/s" "pgo ops/s" change "plain p99us" "pgo p99us"
+    echo -n "$results" | awk '
+        function median(list,    n, v, i, j, t) {
+            n = split(list, v, " ")
+            for (i = 1; i <= n; i++)
+                for (j = i + 1; j <= n; j++)
+                    if (v[j] + 0 < v[i] + 0) { t = v[i]; v[i] = v[j]; v[j] = t }
+            return v[int((n + 1) / 2)]
+        }
+        NF == 4 {
+            if (!($2 in seen)) { seen[$2] = 1; order[++count] = $2 }
+            ops[$1, $2] = ops[$1, $2] " " $3
+            p99[$1, $2] = p99[$1, $2] " " $4
+        }
+        END {
+            for (i = 1; i <= count; i++) {
+                w = order[i]
+                a = median(ops["plain", w]); b = median(ops["pgo", w])
+                printf "%-24s %12.0f %12.0f %+7.1f%% %12.1f %12.1f\n", w, a, b, (b / a - 1) * 100,
+                       median(p99["plain", w]), median(p99["pgo", w])
+            }
+        }'
+    ;;
+*)
+    echo "usage: $0 train|compare ..." >&2
+    exit 1
+    ;;
+esac
@@ -0,0 +1,321 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <arpa/inet.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+/*
+ * 复制基准：需要两个已启动的实例。先向主机写入 N 个 key，再对从机执行
+ * SLAVEOF，测量全量同步到从机 offset 追上主机所用的时间；随后按固定速率
+ * 向主机写入 SET，每 100ms 采样一次主机 master_repl_offset 与从机
+ * slave_repl_offset，报告稳态复制延迟（字节）的分布。结果以 JSON 输出。
+ */
+
+#define KEY_FMT             "key:%010ld"
+#define SAMPLE_INTERVAL_NS  100000000ULL
+#define TICK_NS             1000000ULL
+#define MAX_SAMPLES         100000
+
+typedef struct {
+    int fd;
+    char *buf;
+    int len, pos, cap;
+} client_t;
+
+static struct {
+    char master_host[64];
+    int master_port;
+    char replica_host[64];
+    int replica_port;
+    long keys;
+    int value_size;
+    int pipeline;
+    double rate;
+    int seconds;
+} opt = {
+    .master_host = "127.0.0.1",
+    .master_port = 6379,
+    .replica_host = "127.0.0.1",
+    .replica_port = 6380,
+    .keys = 100000,
+    .value_size = 64,
+    .pipeline = 1000,
+    .rate = 50000,
+    .seconds = 10,
+};
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void die(const char *msg) {
+    fprintf(stderr, "replbench: %s\n", msg);
+    exit(1);
+}
+
+static void client_connect(client_t *c, const char *host, int port) {
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, host, &addr.sin_addr) != 1) die("bad address");
+
+    c->fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (c->fd < 0 || connect(c->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        fprintf(stderr, "replbench: connect %s:%d: %s\n", host, port, strerror(errno));
+        exit(1);
+    }
+    int one = 1;
+    setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    c->cap = 1024 * 1024;
+    c->buf = malloc(c->cap);
+    c->len = c->pos = 0;
+}
+
+static void client_send(client_t *c, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(c->fd, data, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) die("write failed");
+        data += n;
+        len -= n;
+    }
+}
+
+/* 已缓冲数据中一条完整回复的长度，不完整返回 0 */
+static int reply_len(const char *p, int avail) {
+    const char *crlf = memmem(p, avail, "\r\n", 2);
+    if (!crlf) return 0;
+    int head = crlf - p + 2;
+    if (p[0] != '$') return head;
+    long blen = atol(p + 1);
+    if (blen < 0) return head;
+    return avail >= head + blen + 2 ? head + blen + 2 : 0;
+}
+
+/* 读取一条回复，返回指向回复起始的指针，内容在下次调用前有效 */
+static const char *client_reply(client_t *c, int *out_len) {
+    for (;;) {
+        int n = c->len > c->pos ? reply_len(c->buf + c->pos, c->len - c->pos) : 0;
+        if (n > 0) {
+            const char *r = c->buf + c->pos;
+            c->pos += n;
+            if (r[0] == '-') {
+                fprintf(stderr, "replbench: server error: %.*s\n", n - 2, r);
+                exit(1);
+            }
+            if (out_len) *out_len = n;
+            return r;
+        }
+        if (c->pos > 0) {
+            memmove(c->buf, c->buf + c->pos, c->len - c->pos);
+            c->len -= c->pos;
+            c->pos = 0;
+        }
+        if (c->len == c->cap) {
+            c->cap *= 2;
+            c->buf = realloc(c->buf, c->cap);
+        }
+        ssize_t r = read(c->fd, c->buf + c->len, c->cap - c->len);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) die("connection closed");
+        c->len += r;
+    }
+}
+
+static int encode(char *buf, int argc, const char **argv) {
+    int len = sprintf(buf, "*%d\r\n", argc);
+    for (int i = 0; i < argc; i++)
+        len += sprintf(buf + len, "$%zu\r\n%s\r\n", strlen(argv[i]), argv[i]);
+    return len;
+}
+
+static void command(client_t *c, int argc, const char **argv) {
+    char buf[512];
+    client_send(c, buf, encode(buf, argc, argv));
+    client_reply(c, NULL);
+}
+
+/* INFO replication 中的数值字段，不存在返回 -1 */
+static long long info_field(client_t *c, const char *field) {
+    char buf[64];
+    const char *argv[] = { "INFO" };
+    client_send(c, buf, encode(buf, 1, argv));
+    int len;
+    const char *r = client_reply(c, &len);
+    char key[64];
+    snprintf(key, sizeof(key), "\r\n%s:", field);
+    const char *p = memmem(r, len, key, strlen(key));
+    return p ? atoll(p + strlen(key)) : -1;
+}
+
+static int replica_link_up(client_t *c) {
+    char buf[64];
+    const char *argv[] = { "INFO" };
+    client_send(c, buf, encode(buf, 1, argv));
+    int len;
+    const char *r = client_reply(c, &len);
+    return memmem(r, len, "master_link_status:up", 21) != NULL;
+}
+
+/* 写入 count 条 SET，key 从 first 开始，每 pipeline 条等待一次回复 */
+static void write_keys(client_t *c, long first, long count, char *value) {
+    char *out = malloc((size_t)opt.pipeline * (opt.value_size + 64));
+    for (long done = 0; done < count;) {
+        int len = 0, batch = 0;
+        for (; batch < opt.pipeline && done < count; batch++, done++) {
+            char key[32];
+            snprintf(key, sizeof(key), KEY_FMT, (first + done) % opt.keys);
+            len += sprintf(out + len, "*3\r\n$3\r\nSET\r\n$%zu\r\n%s\r\n$%d\r\n",
+                           strlen(key), key, opt.value_size);
+            memcpy(out + len, value, opt.value_size);
+            len += opt.value_size;
+            out[len++] = '\r';
+            out[len++] = '\n';
+        }
+        client_send(c, out, len);
+        for (int i = 0; i < batch; i++) client_reply(c, NULL);
+    }
+    free(out);
+}
+
+static int cmp_ll(const void *a, const void *b) {
+    long long x = *(const long long *)a, y = *(const long long *)b;
+    return x < y ? -1 : x > y;
+}
+
+static int parse_addr(const char *s, char *host, size_t size, int *port) {
+    const char *colon = strrchr(s, ':');
+    if (!colon || (size_t)(colon - s) >= size) return -1;
+    memcpy(host, s, colon - s);
+    host[colon - s] = '\0';
+    *port = atoi(colon + 1);
+    return *port > 0 ? 0 : -1;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [-m host:port] [-s host:port] [-n keys] [-v value_size] [-R rate] [-d seconds]\n"
+            "  -m  master (default 127.0.0.1:6379)\n"
+            "  -s  replica, re-pointed with SLAVEOF (default 127.0.0.1:6380)\n"
+            "  -n  keys written before the full sync (default 100000)\n"
+            "  -v  value size in bytes (default 64)\n"
+            "  -P  pipeline depth while loading the dataset (default 1000)\n"
+            "  -R  SET rate in ops/s during the lag test (default 50000)\n"
+            "  -d  lag test duration in seconds (default 10)\n", prog);
+}
+
+int main(int argc, char **argv) {
+    int c;
+    while ((c = getopt(argc, argv, "m:s:n:v:P:R:d:h")) != -1) {
+        switch (c) {
+        case 'm':
+            if (parse_addr(optarg, opt.master_host, sizeof(opt.master_host), &opt.master_port) < 0) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 's':
+            if (parse_addr(optarg, opt.replica_host, sizeof(opt.replica_host), &opt.replica_port) < 0) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'n': opt.keys = atol(optarg); break;
+        case 'v': opt.value_size = atoi(optarg); break;
+        case 'P': opt.pipeline = atoi(optarg); break;
+        case 'R': opt.rate = atof(optarg); break;
+        case 'd': opt.seconds = atoi(optarg); break;
+        default: usage(argv[0]); return 1;
+        }
+    }
+    if (opt.keys <= 0 || opt.value_size <= 0 || opt.pipeline <= 0 || opt.rate <= 0 || opt.seconds <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    client_t master, replica;
+    client_connect(&master, opt.master_host, opt.master_port);
+    client_connect(&replica, opt.replica_host, opt.replica_port);
+
+    char *value = malloc(opt.value_size);
+    memset(value, 'v', opt.value_size);
+
+    /* 数据集 */
+    const char *noone[] = { "SLAVEOF", "NO", "ONE" };
+    command(&replica, 3, noone);
+    uint64_t start = now_ns();
+    write_keys(&master, 0, opt.keys, value);
+    double load_sec = (now_ns() - start) / 1e9;
+
+    /* 全量同步：从 SLAVEOF 到从机 offset 追上主机 */
+    long long target = info_field(&master, "master_repl_offset");
+    long long full_before = info_field(&master, "sync_full");
+    char port[16];
+    snprintf(port, sizeof(port), "%d", opt.master_port);
+    const char *slaveof[] = { "SLAVEOF", opt.master_host, port };
+    start = now_ns();
+    command(&replica, 3, slaveof);
+    for (;;) {
+        if (replica_link_up(&replica) && info_field(&replica, "slave_repl_offset") >= target) break;
+        if (now_ns() - start > 600 * 1000000000ULL) die("replica did not catch up within 600s");
+        usleep(2000);
+    }
+    double sync_sec = (now_ns() - start) / 1e9;
+    long long full_after = info_field(&master, "sync_full");
+    long dataset_bytes = opt.keys * (14 + opt.value_size);
+
+    /* 稳态延迟：按 rate 写入，每 100ms 采样主从 offset 之差 */
+    long long *lag = malloc(sizeof(long long) * MAX_SAMPLES);
+    int samples = 0;
+    long written = 0;
+    double per_tick = opt.rate * TICK_NS / 1e9, due = 0;
+    start = now_ns();
+    uint64_t end = start + opt.seconds * 1000000000ULL, next_sample = start + SAMPLE_INTERVAL_NS;
+    for (uint64_t now = start; now < end; now = now_ns()) {
+        due += per_tick;
+        long batch = (long)due;
+        if (batch > 0) {
+            write_keys(&master, written, batch, value);
+            written += batch;
+            due -= batch;
+        }
+        if (now >= next_sample && samples < MAX_SAMPLES) {
+            long long m = info_field(&master, "master_repl_offset");
+            long long s = info_field(&replica, "slave_repl_offset");
+            lag[samples++] = m > s ? m - s : 0;
+            next_sample += SAMPLE_INTERVAL_NS;
+        }
+        uint64_t spent = now_ns() - now;
+        if (spent < TICK_NS) usleep((TICK_NS - spent) / 1000);
+    }
+    double lag_sec = (now_ns() - start) / 1e9;
+    qsort(lag, samples, sizeof(long long), cmp_ll);
+
+    printf("{\n  \"suite\": \"replbench\",\n  \"keys\": %ld,\n  \"value_size\": %d,\n"
+           "  \"load\": {\"seconds\": %.4f, \"ops_per_sec\": %.0f},\n"
+           "  \"sync\": {\"seconds\": %.4f, \"full_resync\": %s, \"offset\": %lld, \"mb_per_sec\": %.2f},\n"
+           "  \"lag\": {\"target_ops_per_sec\": %.0f, \"ops_per_sec\": %.0f, \"samples\": %d, "
+           "\"bytes_p50\": %lld, \"bytes_p99\": %lld, \"bytes_max\": %lld}\n}\n",
+           opt.keys, opt.value_size,
+           load_sec, opt.keys / load_sec,
+           sync_sec, full_after > full_before ? "true" : "false", target,
+           dataset_bytes / sync_sec / (1024 * 1024),
+           opt.rate, written / lag_sec, samples,
+           samples ? lag[samples / 2] : 0, samples ? lag[samples * 99 / 100] : 0,
+           samples ? lag[samples - 1] : 0);
+
+    free(lag);
+    free(value);
+    close(master.fd);
+    close(replica.fd);
+    return 0;
+}
@@ -0,0 +1,88 @@
+#!/bin/bash
+# Loopback TCP vs Unix domain socket throughput and latency (make bench-uds).
+#
+#   uds.sh <kvstore> <loadgen> <port>
+#
+# Starts one server listening on both 127.0.0.1:<port> and a socket in a temp
+# dir, then alternates the same loadgen workloads over the two transports for
+# UDS_ROUNDS rounds (default 3) and reports the median of each.
+
+set -e
+
+[ $# -eq 3 ] || { echo "usage: $0 <kvstore> <loadgen> <port>" >&2; exit 1; }
+BIN="$1" LOADGEN="$2" PORT="$3"
+ROUNDS=${UDS_ROUNDS:-3}
+
+WORKLOADS=(
+    "single-50c:-c 50 -P 1 -n 200000 -r 0.9 -v 64"
+    "pipeline16-50c:-c 50 -P 16 -n 1000000 -r 0.9 -v 64"
+    "single-1c:-c 1 -P 1 -n 50000 -r 0.9 -v 64"
+    "single-50c-4k:-c 50 -P 1 -n 200000 -r 0.9 -v 4096"
+)
+
+RUN_DIR=$(mktemp -d /tmp/kvs-uds.XXXXXX)
+SOCK="$RUN_DIR/kvstore.sock"
+cat > "$RUN_DIR/kvstore.conf" <<EOF
+[server]
+port = $PORT
+log_level = 1
+unixsocket = $SOCK
+[persist]
+mode = 0
+rdb_save_on_shutdown = false
+rdb_file = $RUN_DIR/kvstore.rdb
+EOF
+"$BIN" -c "$RUN_DIR/kvstore.conf" > "$RUN_DIR/log" 2>&1 &
+SERVER_PID=$!
+trap 'kill -TERM $SERVER_PID; wait $SERVER_PID || true; rm -rf "$RUN_DIR"' EXIT
+for _ in $(seq 50); do
+    [ -S "$SOCK" ] && break
+    sleep 0.1
+done
+[ -S "$SOCK" ] || { echo "Error: server did not start, see $RUN_DIR/log" >&2; exit 1; }
+
+# Prints "<transport> <name> <ops/s> <p50 us> <p99 us>" for each workload
+run_workloads() {
+    local transport="$1"; shift
+    for w in "${WORKLOADS[@]}"; do
+        local name="${w%%:*}" args="${w#*:}"
+        # shellcheck disable=SC2086
+        "$LOADGEN" "$@" $args > "$RUN_DIR/loadgen.out"
+        awk -v t="$transport" -v name="$name" '
+            /^requests:/ { ops = $(NF - 1) }
+            /^latency/   { split($3, a, "="); split($4, b, "="); p50 = a[2]; p99 = b[2] }
+            END          { print t, name, ops, p50, p99 }' "$RUN_DIR/loadgen.out"
+    done
+}
+
+results=""
+for _ in $(seq "$ROUNDS"); do
+    results+=$(run_workloads tcp -h 127.0.0.1 -p "$PORT")$'\n'
+    results+=$(run_workloads uds -s "$SOCK")$'\n'
+done
+
+echo "Loopback TCP vs Unix domain socket, median of $ROUNDS rounds"
+printf "%-16s %11s %11s %8s %9s %9s %9s %9s\n" workload "tcp ops/s" "uds ops/s" change \
+       "tcp p50" "uds p50" "tcp p99" "uds p99"
+echo -n "$results" | awk '
+    function median(list,    n, v, i, j, t) {
+        n = split(list, v, " ")
+        for (i = 1; i <= n; i++)
+            for (j = i + 1; j <= n; j++)
+                if (v[j] + 0 < v[i] + 0) { t = v[i]; v[i] = v[j]; v[j] = t }
+        return v[int((n + 1) / 2)]
+    }
+    NF == 5 {
+        if (!($2 in seen)) { seen[$2] = 1; order[++count] = $2 }
+        ops[$1, $2] = ops[$1, $2] " " $3
+        p50[$1, $2] = p50[$1, $2] " " $4
+        p99[$1, $2] = p99[$1, $2] " " $5
+    }
+    END {
+        for (i = 1; i <= count; i++) {
+            w = order[i]
+            a = median(ops["tcp", w]); b = median(ops["uds", w])
+            printf "%-16s %11.0f %11.0f %+7.1f%% %9.1f %9.1f %9.1f %9.1f\n", w, a, b, (b / a - 1) * 100,
+                   median(p50["tcp", w]), median(p50["uds", w]), median(p99["tcp", w]), median(p99["uds", w])
+        }
+    }'
@@ -0,0 +1,51 @@
+#ifndef __KVS_BITCASK_H__
+#define __KVS_BITCASK_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct hashtable_s;
+
+/* On-disk record header, followed by key bytes and value bytes */
+typedef struct {
+    uint32_t crc;
+    uint32_t key_len;
+    uint32_t val_len;
+    uint32_t flags;
+} bitcask_rec_t;
+
+#define BITCASK_TOMBSTONE   0x1
+
+#define BITCASK_REC_SIZE(klen, vlen)  (sizeof(bitcask_rec_t) + (klen) + (vlen))
+
+typedef struct kvs_bitcask_s kvs_bitcask_t;
+
+kvs_bitcask_t *kvs_bitcask_open(const char *dir, size_t segment_size, int compact_ratio);
+void kvs_bitcask_close(kvs_bitcask_t *bc);
+
+/* Append a record to the active segment; seg_id and val_off locate the value bytes */
+int  kvs_bitcask_append(kvs_bitcask_t *bc, const void *key, size_t key_len,
+                        const void *val, size_t val_len,
+                        uint32_t *seg_id, uint64_t *val_off);
+int  kvs_bitcask_append_tombstone(kvs_bitcask_t *bc, const void *key, size_t key_len);
+
+/* Returned pointer is valid until the next read or until the segment is compacted */
+const void *kvs_bitcask_read(kvs_bitcask_t *bc, uint32_t seg_id, uint64_t val_off, size_t val_len);
+
+/* fd backing a segment, for readers running off the reactor thread */
+int  kvs_bitcask_segment_fd(kvs_bitcask_t *bc, uint32_t seg_id);
+
+/* Remove every segment and hint file under dir */
+void kvs_bitcask_wipe(const char *dir);
+
+void kvs_bitcask_mark_dead(kvs_bitcask_t *bc, uint32_t seg_id, size_t bytes);
+
+/* Rebuild the in-memory index from hint files (or segment scans) */
+int  kvs_bitcask_rebuild(kvs_bitcask_t *bc, struct hashtable_s *T);
+
+/* Incremental compaction, copies at most `budget` bytes of live records per call */
+void kvs_bitcask_compact_step(kvs_bitcask_t *bc, struct hashtable_s *T, size_t budget);
+
+void kvs_bitcask_stats(kvs_bitcask_t *bc, int *segments, uint64_t *disk_bytes, uint64_t *dead_bytes);
+
+#endif
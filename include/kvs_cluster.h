@@ -0,0 +1,39 @@
+#ifndef __KVS_CLUSTER_H__
+#define __KVS_CLUSTER_H__
+
+#include <stddef.h>
+
+#define KVS_CLUSTER_SLOTS       16384
+#define KVS_CLUSTER_MAX_NODES   64
+
+void kvs_cluster_init(void);
+int  kvs_cluster_enabled(void);
+
+/* CRC16(key) mod 16384; only the part inside the first non-empty {...} is hashed */
+unsigned int kvs_cluster_keyslot(const char *key, size_t len);
+
+/*
+ * Checks whether the key may be served by this node for client fd. Returns 0
+ * to execute the command, the length of a -MOVED/-ASK reply written to resp,
+ * or -1 when fd was blocked until in-flight migrated keys are acknowledged.
+ * resp must hold at least 64 bytes.
+ */
+int  kvs_cluster_redirect(int fd, const char *key, size_t len, char *resp);
+/* RESTORE is accepted for slots this node owns or imports */
+int  kvs_cluster_can_restore(const char *key, size_t len);
+/* ASKING: the next command of fd may touch an importing slot */
+void kvs_cluster_asking(int fd);
+
+/*
+ * CLUSTER subcommands. Same contract as the executor: returns the reply length,
+ * or -2 with *needed set when resp_size is too small (no side effect yet).
+ */
+int  kvs_cluster_command(char **argv, size_t *lens, int argc,
+                         char *resp, int resp_size, int *needed);
+
+void kvs_cluster_conn_closed(int fd);
+/* Called once a second: times out a migration whose target never answered the connect */
+void kvs_cluster_cron(void);
+int  kvs_cluster_info(char *buf, int size);
+
+#endif
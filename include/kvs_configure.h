@@ -3,6 +3,7 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include "kvs_log.h"
 
 typedef enum {
     LOG_LEVEL_INFO = 1,
@@ -27,9 +28,26 @@ typedef enum {
     REPL_ON = 1
 } repl_switch_t;
 
+typedef enum {
+    STORAGE_MEMORY = 0,
+    STORAGE_BITCASK = 1
+} storage_engine_t;
+
+#define KVS_CONFIG_MAX_NODES 16
+
 typedef struct {
     int port;
     log_level_t log_level;
+    char log_file[256];             /* empty = stdout, "stderr" = stderr */
+    int log_rate_limit;             /* records per second per call site, 0 disables */
+    int watchdog_ms;                /* event loop stall report threshold, 0 disables */
+    int command_budget;             /* commands per client per loop iteration, 0 unlimited */
+    int client_obuf_hard_limit;     /* MB of unsent replies per normal client, 0 unlimited */
+    int client_obuf_soft_limit;     /* MB, disconnect after client_obuf_soft_seconds over it */
+    int client_obuf_soft_seconds;
+    int query_buffer_limit;         /* MB of unexecuted input per client */
+    char unixsocket[108];           /* AF_UNIX listener path, empty disables */
+    char unixsocket_perm[8];        /* octal mode of the socket file */
 
     persist_mode_t persist_mode;
     char rdb_file[256];
@@ -44,6 +62,45 @@ typedef struct {
     server_role_t repl_role;
     char master_ip[64];
     int master_port;
+    int repl_backlog_size;
+    int repl_obuf_hard_limit;
+    int repl_obuf_soft_limit;
+    int repl_obuf_soft_seconds;
+    bool repl_read_only;
+
+    storage_engine_t storage_engine;
+    char bitcask_dir[256];
+    int bitcask_segment_size;
+    int bitcask_compact_ratio;
+
+    bool tier_enabled;
+    char tier_dir[256];
+    int tier_idle_seconds;
+    int tier_max_memory;
+    int tier_min_value_size;
+    int tier_sample_size;
+    int tier_io_threads;
+
+    bool cluster_enabled;
+    char cluster_announce_ip[16];
+    char cluster_nodes[KVS_CONFIG_MAX_NODES][256];  /* "ip:port slots" per node */
+    int cluster_node_count;
+
+    bool proxy_enabled;
+    char proxy_backends[KVS_CONFIG_MAX_NODES][64];  /* "ip:port" per backend */
+    int proxy_backend_count;
+    int proxy_connections;                          /* links per backend */
+
+    int slowlog_log_slower_than;    /* microseconds, negative disables */
+    int slowlog_max_len;
+
+    bool hotkeys_enabled;
+    int hotkeys_sample;             /* count one in N keyed commands */
+    int hotkeys_top_k;              /* keys reported by HOTKEYS / BIGKEYS */
+    int hotkeys_decay_seconds;      /* access counts are halved this often, 0 never */
+    int hotkeys_big_value_kb;       /* values at least this large count as big keys */
+
+    int metrics_port;               /* Prometheus endpoint, 0 disables */
 } kvs_config_t;
 
 extern kvs_config_t g_config;
@@ -52,10 +109,23 @@ void kvs_config_set_default(void);
 int kvs_config_load(const char *filename);
 const char* kvs_config_find(void);
 void kvs_config_print(void);
-void kvs_log(log_level_t level, const char *format, ...);
+/*
+ * CONFIG GET pattern... | SET name value [name value ...] | REWRITE. Parameters
+ * are named "section.key" after the config file. Same contract as the executor:
+ * returns the reply length, or -2 with *needed set when resp_size is too small.
+ */
+int  kvs_config_command_reply(char **argv, size_t *lens, int argc,
+                              char *resp, int resp_size, int *needed);
+void kvs_log(log_level_t level, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+/* 每个调用点一份限速状态 */
+#define LOG_AT(level, fmt, ...) do { \
+        static kvs_log_site_t _kvs_log_site; \
+        kvs_log_site(&_kvs_log_site, level, fmt, ##__VA_ARGS__); \
+    } while (0)
 
-#define LOG_INFO(fmt, ...)   kvs_log(LOG_LEVEL_INFO, fmt, ##__VA_ARGS__)
-#define LOG_WARN(fmt, ...)   kvs_log(LOG_LEVEL_WARN, fmt, ##__VA_ARGS__)
-#define LOG_DEBUG(fmt, ...)  kvs_log(LOG_LEVEL_DEBUG, fmt, ##__VA_ARGS__)
+#define LOG_INFO(fmt, ...)   LOG_AT(LOG_LEVEL_INFO, fmt, ##__VA_ARGS__)
+#define LOG_WARN(fmt, ...)   LOG_AT(LOG_LEVEL_WARN, fmt, ##__VA_ARGS__)
+#define LOG_DEBUG(fmt, ...)  LOG_AT(LOG_LEVEL_DEBUG, fmt, ##__VA_ARGS__)
 
 #endif
\ No newline at end of file
@@ -3,27 +3,41 @@
 
 #include <pthread.h>
 #include <stddef.h>
+#include <stdint.h>
 
 #define MAX_KEY_LEN     128
 #define MAX_VALUE_LEN   512
 #define MAX_TABLE_SIZE  65536
 
+#define HASHNODE_ON_DISK    0x1
+
 typedef struct hashnode_s {
     void *key;
-    void *value;
+    void *value;            /* NULL while the value lives in a bitcask segment */
     size_t key_len;
     size_t value_len;
+    uint64_t seg_off;
+    uint32_t seg_id;
+    uint32_t flags;
+    uint32_t atime;         /* last access, in kvs_hash_t clock seconds */
     struct hashnode_s *next;
 } hashnode_t;
 
+struct kvs_bitcask_s;
+
 typedef struct hashtable_s {
     hashnode_t **nodes;
     int max_slots;
     int count;
+    struct kvs_bitcask_s *bc;   /* NULL for the in-memory engine */
+    int tiered;                 /* bc only holds values spilled by the tier */
+    uint32_t clock;
+    size_t mem_bytes;           /* value bytes held in memory */
 } kvs_hash_t;
 
 int  kvs_hash_create(kvs_hash_t *T);
 void kvs_hash_destroy(kvs_hash_t *T);
+void kvs_hash_flush(kvs_hash_t *T);
 int  kvs_hash_set(kvs_hash_t *T, const void *key, size_t key_len, const void *val, size_t val_len);
 void *kvs_hash_get(kvs_hash_t *T, const void *key, size_t key_len, size_t *val_len);
 int  kvs_hash_del(kvs_hash_t *T, const void *key, size_t key_len);
@@ -34,6 +48,20 @@ void kvs_hash_foreach(kvs_hash_t *T,
                       void (*cb)(const void *key, size_t key_len, const void *val, size_t val_len, void *arg),
                       void *arg);
 
+hashnode_t *kvs_hash_lookup(kvs_hash_t *T, const void *key, size_t key_len);
+const void *kvs_hash_node_value(kvs_hash_t *T, hashnode_t *node);
+
+/* Index-only updates used when rebuilding from bitcask segments */
+int  kvs_hash_index(kvs_hash_t *T, const void *key, size_t key_len,
+                    uint32_t seg_id, uint64_t seg_off, size_t val_len);
+int  kvs_hash_unindex(kvs_hash_t *T, const void *key, size_t key_len);
+
+/* Move a value between memory and the attached value log */
+int  kvs_hash_spill(kvs_hash_t *T, hashnode_t *node);
+int  kvs_hash_promote(kvs_hash_t *T, hashnode_t *node, const void *val);
+
+void kvs_hash_cron(kvs_hash_t *T);
+
 int kvs_hash_save(kvs_hash_t *hash, const char *filename);
 int kvs_hash_load_rdb(kvs_hash_t *hash, const char *filename);
 
@@ -0,0 +1,34 @@
+#ifndef __KVS_HOTKEYS_H__
+#define __KVS_HOTKEYS_H__
+
+#include <stddef.h>
+
+#define KVS_HOTKEYS_MAX     64      /* upper bound of [hotkeys] top_k */
+
+/*
+ * Hot keys: every keyed command bumps a count-min sketch, and keys whose
+ * estimate beats the smallest tracked one enter a top-K min-heap. Counts are
+ * halved every [hotkeys] decay_seconds so they follow recent traffic.
+ */
+void kvs_hotkeys_touch(const char *key, size_t key_len);
+
+/*
+ * Big keys: kvs_hotkeys_cron() scans a slice of the keyspace per timer tick
+ * and keeps the top-K largest values of the last complete pass.
+ */
+void kvs_hotkeys_cron(void);
+
+/*
+ * HOTKEYS [count] | HOTKEYS RESET and BIGKEYS [count]. Same contract as the
+ * executor: returns the reply length, or -2 with *needed set when resp_size
+ * is too small.
+ */
+int  kvs_hotkeys_command_reply(char **argv, size_t *lens, int argc,
+                               char *resp, int resp_size, int *needed);
+int  kvs_bigkeys_command_reply(char **argv, size_t *lens, int argc,
+                               char *resp, int resp_size, int *needed);
+
+/* "# Keystats" INFO section */
+int  kvs_hotkeys_info(char *buf, int size);
+
+#endif
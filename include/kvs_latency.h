@@ -0,0 +1,40 @@
+#ifndef __KVS_LATENCY_H__
+#define __KVS_LATENCY_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define KVS_LATENCY_MAX_COMMANDS    32
+
+/* Phases of a request, recorded across all commands */
+typedef enum {
+    KVS_LAT_PARSE = 0,      /* parse_resp of one command */
+    KVS_LAT_EXECUTE,        /* kvs_executor, including propagation */
+    KVS_LAT_PROPAGATE,      /* encoding for AOF and replicas */
+    KVS_LAT_SEND,           /* request received -> first reply byte sent */
+    KVS_LAT_PHASES
+} kvs_lat_phase_t;
+
+/* CLOCK_MONOTONIC in nanoseconds */
+uint64_t kvs_clock_ns(void);
+
+/* names[i] labels command index i in the stats */
+void kvs_latency_init(const char **names, int count);
+void kvs_latency_phase(int phase, uint64_t ns);
+void kvs_latency_command(int cmd, uint64_t ns);
+/* Total nanoseconds recorded for a phase since the last reset */
+uint64_t kvs_latency_phase_sum(int phase);
+
+/* "# Commandstats" and "# Latencystats" INFO sections */
+int  kvs_latency_info(char *buf, int size);
+/* The same counters in Prometheus text format */
+int  kvs_latency_metrics(char *buf, int size);
+
+/*
+ * LATENCY HISTOGRAM [name ...] | LATENCY RESET. Same contract as the executor:
+ * returns the reply length, or -2 with *needed set when resp_size is too small.
+ */
+int  kvs_latency_command_reply(char **argv, size_t *lens, int argc,
+                               char *resp, int resp_size, int *needed);
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef __KVS_LOG_H__
+#define __KVS_LOG_H__
+
+#include <stdint.h>
+
+/*
+ * Asynchronous logger. Callers format a record into a slot of a lock-free
+ * multi-producer ring; a background thread writes the slots to stdout, stderr
+ * or [server] log_file. Until kvs_log_start() (and in tests) records are
+ * written synchronously. When the ring is full the record is dropped and
+ * counted rather than blocking the caller.
+ */
+
+/* Rate limiting state, one static instance per LOG_* call site */
+typedef struct {
+    _Atomic uint64_t window;            /* second the counters belong to */
+    _Atomic unsigned int count;         /* records emitted in this window */
+    _Atomic unsigned int suppressed;    /* records skipped since the last emitted one */
+} kvs_log_site_t;
+
+int  kvs_log_start(void);
+/* Waits until every record queued before the call has been written */
+void kvs_log_flush(void);
+void kvs_log_stop(void);
+
+void kvs_log_site(kvs_log_site_t *site, int level, const char *format, ...)
+    __attribute__((format(printf, 3, 4)));
+
+unsigned long long kvs_log_dropped(void);       /* ring full */
+unsigned long long kvs_log_suppressed(void);    /* over the per call site rate */
+
+/* "# Log" INFO section */
+int  kvs_log_info(char *buf, int size);
+
+#endif
@@ -4,20 +4,54 @@
 #include "kvs_hash.h"
 #include <stdbool.h>
 #include <time.h>
+#include <stdint.h>
 
 typedef struct {
     time_t last_save_time;
     int dirty;
+    long aof_base_size;
+    /* Timings for monitoring, durations in nanoseconds */
+    unsigned long rdb_saves;
+    uint64_t rdb_last_save_ns;
+    uint64_t rdb_save_ns;
+    unsigned long aof_rewrites;
+    uint64_t aof_last_rewrite_ns;
+    uint64_t aof_rewrite_ns;
+    unsigned long aof_writes;           /* write() calls flushing the AOF buffer */
+    uint64_t aof_write_ns;
+    unsigned long long aof_written_bytes;
 } persist_runtime_t;
 
 extern bool g_is_loading;
 extern persist_runtime_t g_persist_runtime;
 
 void kvs_persist_init(void);
-void kvs_aof_append(const char *cmd, const char *key, const char *value);
-void load_aof_file(const char *filename);
+void kvs_persist_load(void);
+void kvs_aof_feed(const char *data, size_t len);
+void kvs_aof_flush(void);
+/* Bytes allocated for the AOF buffer */
+size_t kvs_aof_buffer_size(void);
+/* Returns -1 when an RDB preamble is truncated; replay stops there */
+int  load_aof_file(const char *filename);
 void kvs_rdb_save(void);
 void kvs_rdb_check_and_save(void);
 void kvs_aof_check_and_rewrite(void);
+int  kvs_aof_rewrite(void);
+/* Applies a runtime persist.mode change, g_config already holds the new mode */
+int  kvs_persist_reconfigure(int old_mode);
+int  kvs_aof_has_preamble(const char *filename);
+/*
+ * Loads complete RDB items from buf. *consumed is the end of the last complete
+ * item, or just past the EOF marker; *eof (may be NULL) is set to 1 only when
+ * the marker was read. A key over 1 MB or a value over 10 MB is treated as
+ * corrupt and stops the load there.
+ */
+int  kvs_rdb_load_buffer(kvs_hash_t *hash, const char *buf, size_t len, size_t *consumed,
+                         int *eof);
+
+/* In-memory form of one RDB item, as read back by kvs_rdb_load_buffer */
+#define KVS_RDB_ITEM_SIZE(klen, vlen)   (2 * sizeof(size_t) + (klen) + (vlen))
+size_t kvs_rdb_encode_item(char *buf, const void *key, size_t key_len,
+                           const void *val, size_t val_len);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,24 @@
+#ifndef __KVS_PROPAGATE_H__
+#define __KVS_PROPAGATE_H__
+
+#include <stddef.h>
+
+/* Refcounted read-only buffer, shared by the AOF buffer, the backlog and replica queues */
+typedef struct kvs_sbuf_s {
+    int refcount;
+    size_t len;
+    char data[];
+} kvs_sbuf_t;
+
+kvs_sbuf_t *kvs_sbuf_new(const void *data, size_t len);
+void kvs_sbuf_retain(kvs_sbuf_t *b);
+void kvs_sbuf_release(kvs_sbuf_t *b);
+
+/* Binary-safe RESP array encoding */
+size_t kvs_resp_encoded_len(int argc, const size_t *lens);
+size_t kvs_resp_encode(char *buf, int argc, const char **argv, const size_t *lens);
+
+/* Encode a write command once and hand it to the AOF and the replication stream */
+void kvs_propagate(int argc, const char **argv, const size_t *lens);
+
+#endif
@@ -0,0 +1,22 @@
+#ifndef __KVS_PROXY_H__
+#define __KVS_PROXY_H__
+
+#define KVS_PROXY_MAX_LINKS     8
+
+/* Connects to the configured backends. Returns -1 when the config is unusable. */
+int  kvs_proxy_init(void);
+int  kvs_proxy_enabled(void);
+
+/*
+ * msg_handler for client connections in proxy mode. Commands are forwarded to
+ * the backend owning their key and replies are queued on the client later, in
+ * request order, so nothing is ever written to response.
+ */
+int  kvs_proxy_protocol(char *msg, int length, char *response, int resp_size,
+                        int *processed, int *needed);
+
+/* Once a second: reconnects backend links that went down */
+void kvs_proxy_cron(void);
+void kvs_proxy_conn_closed(int fd);
+
+#endif
@@ -1,25 +1,80 @@
 #ifndef __KVS_REPLICATION_H__
 #define __KVS_REPLICATION_H__
 
+#include "kvs_propagate.h"
+
 #define KVS_MAX_SLAVES 128
 #define KVS_ROLE_MASTER 0
 #define KVS_ROLE_SLAVE  1
 
+#define KVS_REPLID_LEN  40
+
+/* Slave link state */
+#define KVS_REPL_NONE       0   /* not connected to a master */
+#define KVS_REPL_CONNECTING 3   /* non-blocking connect in flight, PSYNC queued */
+#define KVS_REPL_SYNCING    1   /* FULLRESYNC received, loading the snapshot */
+#define KVS_REPL_CONNECTED  2   /* streaming writes */
+
+/* Per-replica state on the master */
+#define KVS_SLAVE_SYNCING   0   /* receiving the snapshot, writes are held in pending */
+#define KVS_SLAVE_ONLINE    1   /* receiving the command stream */
+
+typedef struct {
+    int fd;
+    int state;
+    int sync_cursor;            /* next hash bucket to snapshot */
+    char *pending;              /* stream produced while the snapshot is in flight */
+    size_t pending_len;
+    size_t pending_cap;
+    long long ack_offset;       /* last offset acknowledged by REPLCONF ACK */
+    long ack_time;              /* when that ACK arrived */
+} kvs_slave_t;
+
 typedef struct {
     int role;
     int master_fd;
     char master_ip[64];
     int master_port;
-    int slave_fds[KVS_MAX_SLAVES];
+    kvs_slave_t slaves[KVS_MAX_SLAVES];
     int slave_count;
+    int link_state;
+
+    /* Replication history: replid names the stream, offset counts its bytes */
+    char replid[KVS_REPLID_LEN + 1];
+    char replid2[KVS_REPLID_LEN + 1];   /* history inherited before the last promotion */
+    long long second_replid_offset;     /* replid2 is valid up to this offset */
+    long long master_repl_offset;       /* bytes produced (master) or applied (slave) */
+
+    /* Circular backlog holding the last backlog_size bytes of the stream */
+    char *backlog;
+    long long backlog_size;
+    long long backlog_idx;              /* next write position */
+    long long backlog_histlen;          /* valid bytes, <= backlog_size */
 } kvs_replication_t;
 
 extern kvs_replication_t g_repl;
 
 void kvs_replication_init(void);
 void kvs_slaveof(char *ip, int port);
-int kvs_replication_accept_master(int fd);
-void kvs_replication_add_slave(int fd);
-void kvs_replication_feed_slaves(char *cmd, char *key, char *value);
+void kvs_replication_cron(void);
+
+/* Master: handle PSYNC <replid> <offset> from client fd, which becomes a slave */
+int  kvs_replication_psync(int fd, const char *replid, long long offset);
+/* Reactor closed fd: a replica connection or our link to the master */
+void kvs_replication_slave_closed(int fd);
+/* REPLCONF ACK <offset> from a replica connection */
+void kvs_replication_ack(int fd, long long offset);
+/* Replica: REPLCONF GETACK seen in the stream, answer once the batch is applied */
+void kvs_replication_getack(void);
+/*
+ * WAIT numreplicas timeout_ms. Returns the number of replicas that acknowledged
+ * every write issued so far, or -1 when fd was blocked and will be answered later.
+ */
+int  kvs_replication_wait(int fd, int numreplicas, long timeout_ms);
+void kvs_replication_feed(kvs_sbuf_t *b);
+/* Resizes the backlog to [replication] backlog_size keeping the newest history */
+int  kvs_replication_resize_backlog(void);
+
+int  kvs_replication_info(char *buf, int size);
 
-#endif
\ No newline at end of file
+#endif
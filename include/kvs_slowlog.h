@@ -0,0 +1,24 @@
+#ifndef __KVS_SLOWLOG_H__
+#define __KVS_SLOWLOG_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Records a command whose parse + execute time reached
+ * [slowlog] log_slower_than. Phase times are in nanoseconds.
+ */
+void kvs_slowlog_command(char **argv, size_t *lens, int argc, int fd,
+                         uint64_t parse_ns, uint64_t exec_ns, uint64_t propagate_ns);
+
+/* Records work done on the reactor thread outside any command (RDB save, ...) */
+void kvs_slowlog_event(const char *name, int fd, uint64_t ns);
+
+/*
+ * SLOWLOG GET [n] | LEN | RESET. Same contract as the executor: returns the
+ * reply length, or -2 with *needed set when resp_size is too small.
+ */
+int  kvs_slowlog_command_reply(char **argv, size_t *lens, int argc,
+                               char *resp, int resp_size, int *needed);
+
+#endif
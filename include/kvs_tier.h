@@ -0,0 +1,28 @@
+#ifndef __KVS_TIER_H__
+#define __KVS_TIER_H__
+
+#include "kvs_hash.h"
+
+typedef struct {
+    unsigned long hot_hits;
+    unsigned long cold_hits;
+    unsigned long misses;
+    unsigned long spilled;
+    unsigned long promoted;
+    unsigned long inflight;
+} kvs_tier_stats_t;
+
+int  kvs_tier_init(kvs_hash_t *T);
+int  kvs_tier_enabled(void);
+
+/*
+ * Account a GET against the tiers. Returns 1 when the value is cold and an
+ * asynchronous fetch was queued for client_fd; the client stays blocked until
+ * the reply is delivered. Returns 0 when the caller should reply inline.
+ */
+int  kvs_tier_get(hashnode_t *node, int client_fd);
+
+void kvs_tier_cron(void);
+int  kvs_tier_info(char *buf, int size);
+
+#endif
@@ -0,0 +1,20 @@
+#ifndef __KVS_WATCHDOG_H__
+#define __KVS_WATCHDOG_H__
+
+#include <stdint.h>
+
+/*
+ * Starts a thread that reports when the reactor thread (the caller) stays out
+ * of epoll_wait for more than period_ms: the callback it is in, and a
+ * backtrace printed from the reactor thread itself via SIGUSR1.
+ */
+int  kvs_watchdog_start(int period_ms);
+
+/* Called by the reactor: iteration starts at now_ns, callback being run, back to epoll_wait */
+void kvs_watchdog_busy(uint64_t now_ns);
+void kvs_watchdog_callback(const char *what, int fd);
+void kvs_watchdog_idle(void);
+
+unsigned long long kvs_watchdog_stalls(void);
+
+#endif
@@ -2,7 +2,7 @@
 #define __SERVER_H__
 
 #define INIT_BUFFER_SIZE    (64 * 1024)
-#define CONNECTION_SIZE      256
+#define CONNECTION_SIZE      16384
 
 #define ENABLE_HTTP          0
 #define ENABLE_WEBSOCKET     0
@@ -10,6 +10,9 @@
 
 typedef int (*RCALLBACK)(int fd);
 
+struct kvs_sbuf_s;
+struct conn_oq_node;
+
 struct conn {
     int fd;
     char *rbuffer;
@@ -18,22 +21,93 @@ struct conn {
     char *wbuffer;
     int wlength;
     int wcapacity;
+    int wsent;              /* bytes of wbuffer already sent */
+    struct conn_oq_node *oq_head;   /* shared buffers queued after wbuffer */
+    struct conn_oq_node *oq_tail;
+    long oq_bytes;          /* unsent bytes in the queue */
+    long oq_off;            /* bytes of oq_head already sent */
     RCALLBACK send_callback;
+    RCALLBACK drain_callback;   /* called once the write buffer is fully sent */
     union {
         RCALLBACK recv_callback;
         RCALLBACK accept_callback;
     } r_action;
     int status;
+    int blocked;
+    unsigned int id;
+    int replica;            /* output is the replication stream */
+    long obuf_soft_since;   /* when output first went over the soft limit */
+    unsigned long long recv_ns; /* arrival of the oldest request not yet answered */
+    int budget;             /* commands left in this event loop iteration */
+    int deferred;           /* budget ran out with commands left, on the deferred list */
+    int paused;             /* output over the high-water mark, resumed by send_cb */
 #if 1
     char *payload;
     char mask[4];
 #endif
 };
 
-#if ENABLE_HTTP
+/* fd of the client whose commands are being executed, -1 outside the reactor */
+extern int g_client_fd;
+
+/* Connection id, changes whenever the fd is reused; 0 if fd is not open */
+unsigned int kvs_client_id(int fd);
+unsigned int kvs_block_client(int fd);
+void kvs_unblock_client(int fd, unsigned int id, const char *reply, int len);
+int  kvs_client_blocked(int fd);
+/*
+ * Charges one executed command to fd's budget. Returns 1 when the caller should
+ * stop executing: the budget is used up, or the unsent output plus reply_bytes
+ * not yet queued has reached the high-water mark.
+ */
+int  kvs_client_charge(int fd, long reply_bytes);
+void kvs_close_client(int fd);
+
+/* Queue data on a connection, flushed on EPOLLOUT. Returns -1 and closes the
+ * connection when its output buffer limits are exceeded. */
+int  kvs_client_write(int fd, const void *data, int len);
+/* Same, but queues a reference to b instead of copying it */
+int  kvs_client_write_shared(int fd, struct kvs_sbuf_s *b);
+int  kvs_client_output_len(int fd);
+void kvs_client_set_replica(int fd);
+void kvs_client_set_drain(int fd, RCALLBACK cb);
+
+/* Initial read/write buffer size of connections registered from now on */
+void kvs_set_conn_buffer_size(int size);
+/* Non-blocking outbound TCP connection; timeout_ms 0 returns before the
+ * handshake completes. Returns the fd or -1. */
+int  kvs_connect(const char *ip, int port, int timeout_ms);
+/* "# Eventloop" INFO section: per-iteration time breakdown of the reactor */
+int  kvs_eventloop_info(char *buf, int size);
+
+/* Connection table totals, for monitoring */
+typedef struct {
+    int clients;                /* command protocol connections, replicas included */
+    int blocked;
+    int replicas;
+    int other;                  /* listeners, timers, outbound and HTTP connections */
+    long rbuffer_bytes;         /* allocated read buffers */
+    long wbuffer_bytes;         /* allocated write buffers */
+    long pending_bytes;         /* output not yet sent, queued shared buffers included */
+    long max_pending;           /* largest single client's unsent output */
+    int paused;                 /* clients not executing until their output drains */
+    unsigned long long accepted;
+    unsigned long long obuf_disconnects;        /* normal clients over output_buffer_* */
+    unsigned long long repl_obuf_disconnects;   /* replicas over output_buffer_* */
+    unsigned long long qbuf_disconnects;        /* over query_buffer_limit */
+} kvs_conn_stats_t;
+
+void kvs_conn_stats(kvs_conn_stats_t *st);
+/* "# Clients" INFO section */
+int  kvs_clients_info(char *buf, int size);
+
+/*
+ * HTTP path: connections accepted on the [metrics] port. http_request parses
+ * rbuffer and queues one response; returns 1 once it has, 0 while the request
+ * is incomplete, -1 to drop the connection.
+ */
 int http_request(struct conn *c);
 int http_response(struct conn *c);
-#endif
 
 #if ENABLE_WEBSOCKET
 int ws_request(struct conn *c);
@@ -0,0 +1,562 @@
+#include "../include/kvs_base.h"
+#include "../include/kvs_bitcask.h"
+#include "../include/kvs_hash.h"
+#include "../include/kvs_configure.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+
+/*
+ * Bitcask 风格的日志结构存储：
+ *   - 值只追加写入 <dir>/<id>.data 段文件，内存索引只保留 key 与 (段号, 偏移, 长度)
+ *   - 段写满后封存：fsync、生成 <id>.hint（不含 value 的索引文件）、只读 mmap
+ *   - 活跃段用 pread 读取，封存段直接从映射区返回指针
+ *   - 定时器驱动的增量压缩把垃圾比例最高的段中仍存活的记录搬到活跃段
+ */
+
+#define BITCASK_DATA_EXT    ".data"
+#define BITCASK_HINT_EXT    ".hint"
+
+typedef struct {
+    uint32_t key_len;
+    uint32_t val_len;
+    uint32_t flags;
+    uint32_t reserved;
+    uint64_t val_off;
+} bitcask_hint_t;
+
+typedef struct {
+    uint32_t id;
+    int fd;
+    uint64_t size;
+    uint64_t dead;
+    char *map;              /* read-only mapping once sealed */
+} bitcask_segment_t;
+
+struct kvs_bitcask_s {
+    char dir[256];
+    size_t segment_size;
+    int compact_ratio;
+    bitcask_segment_t **segs;   /* indexed by segment id */
+    uint32_t seg_cap;
+    uint32_t next_id;
+    bitcask_segment_t *active;
+    char *scratch;
+    size_t scratch_cap;
+    bitcask_segment_t *victim;  /* segment being compacted */
+    uint64_t victim_pos;
+};
+
+static uint32_t crc_table[256];
+
+static void crc32_init(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++)
+            c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        crc_table[i] = c;
+    }
+}
+
+static uint32_t crc32_update(uint32_t crc, const void *buf, size_t len) {
+    const unsigned char *p = buf;
+    crc = ~crc;
+    while (len--) crc = crc_table[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+static uint32_t rec_crc(const bitcask_rec_t *hdr, const void *key, const void *val) {
+    uint32_t crc = crc32_update(0, &hdr->key_len, sizeof(*hdr) - sizeof(hdr->crc));
+    crc = crc32_update(crc, key, hdr->key_len);
+    return crc32_update(crc, val, hdr->val_len);
+}
+
+static void seg_path(kvs_bitcask_t *bc, uint32_t id, const char *ext, char *buf, size_t size) {
+    snprintf(buf, size, "%s/%010u%s", bc->dir, id, ext);
+}
+
+static bitcask_segment_t *seg_get(kvs_bitcask_t *bc, uint32_t id) {
+    return id < bc->seg_cap ? bc->segs[id] : NULL;
+}
+
+static int seg_register(kvs_bitcask_t *bc, bitcask_segment_t *seg) {
+    if (seg->id >= bc->seg_cap) {
+        uint32_t cap = bc->seg_cap ? bc->seg_cap : 64;
+        while (cap <= seg->id) cap *= 2;
+        bitcask_segment_t **segs = kvs_realloc(bc->segs, cap * sizeof(*segs));
+        if (!segs) return -1;
+        memset(segs + bc->seg_cap, 0, (cap - bc->seg_cap) * sizeof(*segs));
+        bc->segs = segs;
+        bc->seg_cap = cap;
+    }
+    bc->segs[seg->id] = seg;
+    if (seg->id >= bc->next_id) bc->next_id = seg->id + 1;
+    return 0;
+}
+
+static int seg_map(bitcask_segment_t *seg) {
+    if (seg->size == 0) return 0;
+    void *p = mmap(NULL, seg->size, PROT_READ, MAP_SHARED, seg->fd, 0);
+    if (p == MAP_FAILED) {
+        LOG_WARN("[Bitcask] mmap segment %u failed: %s\n", seg->id, strerror(errno));
+        return -1;
+    }
+    seg->map = p;
+    return 0;
+}
+
+static void seg_free(bitcask_segment_t *seg) {
+    if (seg->map) munmap(seg->map, seg->size);
+    if (seg->fd >= 0) close(seg->fd);
+    kvs_free(seg);
+}
+
+/* 顺序遍历映射区中的记录，遇到截断或校验失败的记录即停止，返回有效长度 */
+static uint64_t seg_scan(const char *base, uint64_t len,
+                         void (*cb)(const bitcask_rec_t *hdr, const char *key,
+                                    uint64_t val_off, void *arg),
+                         void *arg) {
+    uint64_t pos = 0;
+    while (pos + sizeof(bitcask_rec_t) <= len) {
+        const bitcask_rec_t *hdr = (const bitcask_rec_t *)(base + pos);
+        uint64_t rec = BITCASK_REC_SIZE((uint64_t)hdr->key_len, (uint64_t)hdr->val_len);
+        if (rec > len - pos) break;
+        const char *key = base + pos + sizeof(bitcask_rec_t);
+        if (rec_crc(hdr, key, key + hdr->key_len) != hdr->crc) break;
+        if (cb) cb(hdr, key, pos + sizeof(bitcask_rec_t) + hdr->key_len, arg);
+        pos += rec;
+    }
+    return pos;
+}
+
+static void hint_write_cb(const bitcask_rec_t *hdr, const char *key, uint64_t val_off, void *arg) {
+    FILE *fp = arg;
+    bitcask_hint_t h = { hdr->key_len, hdr->val_len, hdr->flags, 0, val_off };
+    fwrite(&h, sizeof(h), 1, fp);
+    fwrite(key, 1, hdr->key_len, fp);
+}
+
+static int seg_write_hint(kvs_bitcask_t *bc, bitcask_segment_t *seg) {
+    char path[512], tmp[520];
+    seg_path(bc, seg->id, BITCASK_HINT_EXT, path, sizeof(path));
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+
+    FILE *fp = fopen(tmp, "wb");
+    if (!fp) return -1;
+    seg_scan(seg->map, seg->size, hint_write_cb, fp);
+    int err = ferror(fp);
+    if (fclose(fp) != 0 || err || rename(tmp, path) != 0) {
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+static bitcask_segment_t *seg_create(kvs_bitcask_t *bc) {
+    char path[512];
+    bitcask_segment_t *seg = kvs_calloc(sizeof(*seg));
+    if (!seg) return NULL;
+    seg->id = bc->next_id;
+    seg_path(bc, seg->id, BITCASK_DATA_EXT, path, sizeof(path));
+    seg->fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_APPEND, 0644);
+    if (seg->fd < 0 || seg_register(bc, seg) < 0) {
+        LOG_WARN("[Bitcask] Cannot create segment %s: %s\n", path, strerror(errno));
+        if (seg->fd >= 0) close(seg->fd);
+        kvs_free(seg);
+        return NULL;
+    }
+    return seg;
+}
+
+static int seg_seal(kvs_bitcask_t *bc, bitcask_segment_t *seg) {
+    fsync(seg->fd);
+    if (seg_map(seg) < 0) return -1;
+    if (seg_write_hint(bc, seg) < 0)
+        LOG_WARN("[Bitcask] Failed to write hint for segment %u\n", seg->id);
+    return 0;
+}
+
+static int bitcask_roll(kvs_bitcask_t *bc) {
+    bitcask_segment_t *next = seg_create(bc);
+    if (!next) return -1;
+    seg_seal(bc, bc->active);
+    LOG_DEBUG("[Bitcask] Sealed segment %u (%lu bytes), active=%u\n",
+              bc->active->id, (unsigned long)bc->active->size, next->id);
+    bc->active = next;
+    return 0;
+}
+
+static int bitcask_write(kvs_bitcask_t *bc, const void *key, size_t key_len,
+                         const void *val, size_t val_len, uint32_t flags,
+                         uint32_t *seg_id, uint64_t *val_off) {
+    size_t rec = BITCASK_REC_SIZE(key_len, val_len);
+    if (bc->active->size > 0 && bc->active->size + rec > bc->segment_size) {
+        if (bitcask_roll(bc) < 0) return -1;
+    }
+
+    bitcask_segment_t *seg = bc->active;
+    bitcask_rec_t hdr = { 0, (uint32_t)key_len, (uint32_t)val_len, flags };
+    hdr.crc = rec_crc(&hdr, key, val);
+
+    struct iovec iov[3] = {
+        { &hdr, sizeof(hdr) },
+        { (void *)key, key_len },
+        { (void *)val, val_len }
+    };
+    ssize_t n = writev(seg->fd, iov, 3);
+    if (n != (ssize_t)rec) {
+        LOG_WARN("[Bitcask] Write to segment %u failed: %s\n", seg->id,
+                 n < 0 ? strerror(errno) : "short write");
+        if (ftruncate(seg->fd, seg->size) < 0) {
+            LOG_WARN("[Bitcask] Cannot roll back segment %u\n", seg->id);
+        }
+        return -1;
+    }
+
+    if (seg_id) *seg_id = seg->id;
+    if (val_off) *val_off = seg->size + sizeof(hdr) + key_len;
+    seg->size += rec;
+    return 0;
+}
+
+int kvs_bitcask_append(kvs_bitcask_t *bc, const void *key, size_t key_len,
+                       const void *val, size_t val_len,
+                       uint32_t *seg_id, uint64_t *val_off) {
+    if (key_len > UINT32_MAX || val_len > UINT32_MAX) return -1;
+    return bitcask_write(bc, key, key_len, val, val_len, 0, seg_id, val_off);
+}
+
+int kvs_bitcask_append_tombstone(kvs_bitcask_t *bc, const void *key, size_t key_len) {
+    uint32_t seg_id;
+    if (bitcask_write(bc, key, key_len, "", 0, BITCASK_TOMBSTONE, &seg_id, NULL) < 0)
+        return -1;
+    kvs_bitcask_mark_dead(bc, seg_id, BITCASK_REC_SIZE(key_len, 0));
+    return 0;
+}
+
+const void *kvs_bitcask_read(kvs_bitcask_t *bc, uint32_t seg_id, uint64_t val_off, size_t val_len) {
+    bitcask_segment_t *seg = seg_get(bc, seg_id);
+    if (!seg || val_off + val_len > seg->size) return NULL;
+    if (seg->map) return seg->map + val_off;
+
+    if (bc->scratch_cap < val_len + 1) {
+        char *buf = kvs_realloc(bc->scratch, val_len + 1);
+        if (!buf) return NULL;
+        bc->scratch = buf;
+        bc->scratch_cap = val_len + 1;
+    }
+    size_t done = 0;
+    while (done < val_len) {
+        ssize_t n = pread(seg->fd, bc->scratch + done, val_len - done, val_off + done);
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR) continue;
+            LOG_WARN("[Bitcask] pread segment %u failed\n", seg_id);
+            return NULL;
+        }
+        done += n;
+    }
+    return bc->scratch;
+}
+
+int kvs_bitcask_segment_fd(kvs_bitcask_t *bc, uint32_t seg_id) {
+    bitcask_segment_t *seg = seg_get(bc, seg_id);
+    return seg ? seg->fd : -1;
+}
+
+void kvs_bitcask_wipe(const char *dir) {
+    DIR *d = opendir(dir);
+    if (!d) return;
+    struct dirent *de;
+    char path[512];
+    while ((de = readdir(d)) != NULL) {
+        if (strstr(de->d_name, BITCASK_DATA_EXT) || strstr(de->d_name, BITCASK_HINT_EXT)) {
+            snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+            unlink(path);
+        }
+    }
+    closedir(d);
+}
+
+void kvs_bitcask_mark_dead(kvs_bitcask_t *bc, uint32_t seg_id, size_t bytes) {
+    bitcask_segment_t *seg = seg_get(bc, seg_id);
+    if (seg) seg->dead += bytes;
+}
+
+static int id_cmp(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+/* 打开目录下已有的段：截断尾部残缺记录，补齐缺失的 hint 文件，全部以只读方式映射 */
+static int bitcask_load_segments(kvs_bitcask_t *bc) {
+    DIR *dir = opendir(bc->dir);
+    if (!dir) return -1;
+
+    uint32_t *ids = NULL;
+    size_t n = 0, cap = 0;
+    struct dirent *de;
+    while ((de = readdir(dir)) != NULL) {
+        size_t len = strlen(de->d_name);
+        size_t ext = strlen(BITCASK_DATA_EXT);
+        if (len <= ext || strcmp(de->d_name + len - ext, BITCASK_DATA_EXT) != 0) continue;
+        if (n == cap) {
+            cap = cap ? cap * 2 : 64;
+            uint32_t *tmp = kvs_realloc(ids, cap * sizeof(uint32_t));
+            if (!tmp) break;
+            ids = tmp;
+        }
+        ids[n++] = (uint32_t)strtoul(de->d_name, NULL, 10);
+    }
+    closedir(dir);
+    if (n > 0) qsort(ids, n, sizeof(uint32_t), id_cmp);
+
+    for (size_t i = 0; i < n; i++) {
+        char path[512], hint[512];
+        seg_path(bc, ids[i], BITCASK_DATA_EXT, path, sizeof(path));
+        seg_path(bc, ids[i], BITCASK_HINT_EXT, hint, sizeof(hint));
+
+        int fd = open(path, O_RDWR);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) < 0) {
+            LOG_WARN("[Bitcask] Cannot open segment %s\n", path);
+            if (fd >= 0) close(fd);
+            continue;
+        }
+        if (st.st_size == 0) {
+            close(fd);
+            unlink(path);
+            unlink(hint);
+            continue;
+        }
+
+        bitcask_segment_t *seg = kvs_calloc(sizeof(*seg));
+        if (!seg) {
+            close(fd);
+            break;
+        }
+        seg->id = ids[i];
+        seg->fd = fd;
+        seg->size = st.st_size;
+        if (seg_map(seg) < 0 || seg_register(bc, seg) < 0) {
+            seg_free(seg);
+            continue;
+        }
+
+        if (access(hint, F_OK) != 0) {
+            uint64_t valid = seg_scan(seg->map, seg->size, NULL, NULL);
+            if (valid < seg->size) {
+                LOG_WARN("[Bitcask] Segment %u truncated from %lu to %lu bytes\n",
+                         seg->id, (unsigned long)seg->size, (unsigned long)valid);
+                munmap(seg->map, seg->size);
+                seg->map = NULL;
+                if (ftruncate(fd, valid) < 0) {
+                    LOG_WARN("[Bitcask] ftruncate segment %u failed\n", seg->id);
+                }
+                seg->size = valid;
+                seg_map(seg);
+            }
+            if (seg->size > 0) seg_write_hint(bc, seg);
+        }
+    }
+    kvs_free(ids);
+    return 0;
+}
+
+kvs_bitcask_t *kvs_bitcask_open(const char *dir, size_t segment_size, int compact_ratio) {
+    if (mkdir(dir, 0755) < 0 && errno != EEXIST) {
+        LOG_WARN("[Bitcask] Cannot create directory %s: %s\n", dir, strerror(errno));
+        return NULL;
+    }
+    crc32_init();
+
+    kvs_bitcask_t *bc = kvs_calloc(sizeof(*bc));
+    if (!bc) return NULL;
+    strncpy(bc->dir, dir, sizeof(bc->dir) - 1);
+    bc->segment_size = segment_size;
+    bc->compact_ratio = compact_ratio;
+
+    if (bitcask_load_segments(bc) < 0 || !(bc->active = seg_create(bc))) {
+        kvs_bitcask_close(bc);
+        return NULL;
+    }
+    LOG_INFO("[Bitcask] Opened %s, active segment %u\n", dir, bc->active->id);
+    return bc;
+}
+
+void kvs_bitcask_close(kvs_bitcask_t *bc) {
+    if (!bc) return;
+    if (bc->active) fsync(bc->active->fd);
+    for (uint32_t i = 0; i < bc->seg_cap; i++) {
+        if (bc->segs[i]) seg_free(bc->segs[i]);
+    }
+    kvs_free(bc->segs);
+    kvs_free(bc->scratch);
+    kvs_free(bc);
+}
+
+static int bitcask_load_hint(kvs_bitcask_t *bc, bitcask_segment_t *seg, kvs_hash_t *T) {
+    char path[512];
+    seg_path(bc, seg->id, BITCASK_HINT_EXT, path, sizeof(path));
+    FILE *fp = fopen(path, "rb");
+    if (!fp) return -1;
+
+    char key[64 * 1024];
+    char *big = NULL;
+    int count = 0;
+    bitcask_hint_t h;
+    while (fread(&h, sizeof(h), 1, fp) == 1) {
+        char *kbuf = key;
+        if (h.key_len > sizeof(key)) {
+            kvs_free(big);
+            big = kvs_malloc(h.key_len);
+            if (!big) break;
+            kbuf = big;
+        }
+        if (fread(kbuf, 1, h.key_len, fp) != h.key_len) break;
+        if (h.flags & BITCASK_TOMBSTONE) {
+            kvs_hash_unindex(T, kbuf, h.key_len);
+            seg->dead += BITCASK_REC_SIZE(h.key_len, 0);
+        } else {
+            kvs_hash_index(T, kbuf, h.key_len, seg->id, h.val_off, h.val_len);
+        }
+        count++;
+    }
+    kvs_free(big);
+    fclose(fp);
+    return count;
+}
+
+typedef struct {
+    kvs_hash_t *T;
+    bitcask_segment_t *seg;
+    int count;
+} scan_index_t;
+
+static void scan_index_cb(const bitcask_rec_t *hdr, const char *key, uint64_t val_off, void *arg) {
+    scan_index_t *s = arg;
+    if (hdr->flags & BITCASK_TOMBSTONE) {
+        kvs_hash_unindex(s->T, key, hdr->key_len);
+        s->seg->dead += BITCASK_REC_SIZE(hdr->key_len, 0);
+    } else {
+        kvs_hash_index(s->T, key, hdr->key_len, s->seg->id, val_off, hdr->val_len);
+    }
+    s->count++;
+}
+
+int kvs_bitcask_rebuild(kvs_bitcask_t *bc, kvs_hash_t *T) {
+    int records = 0;
+    for (uint32_t id = 0; id < bc->seg_cap; id++) {
+        bitcask_segment_t *seg = bc->segs[id];
+        if (!seg || seg == bc->active) continue;
+        int n = bitcask_load_hint(bc, seg, T);
+        if (n < 0) {
+            /* 生成 hint 失败的段直接扫描记录 */
+            LOG_WARN("[Bitcask] Missing hint for segment %u, scanning records\n", id);
+            scan_index_t s = { T, seg, 0 };
+            seg_scan(seg->map, seg->size, scan_index_cb, &s);
+            n = s.count;
+        }
+        records += n;
+    }
+    LOG_INFO("[Bitcask] Index rebuilt: %d records, %d keys\n", records, T->count);
+    return T->count;
+}
+
+static bitcask_segment_t *bitcask_pick_victim(kvs_bitcask_t *bc) {
+    bitcask_segment_t *victim = NULL;
+    for (uint32_t id = 0; id < bc->seg_cap; id++) {
+        bitcask_segment_t *seg = bc->segs[id];
+        if (!seg || seg == bc->active || seg->size == 0) continue;
+        if (seg->dead * 100 < seg->size * (uint64_t)bc->compact_ratio) continue;
+        if (!victim || seg->dead * victim->size > victim->dead * seg->size)
+            victim = seg;
+    }
+    return victim;
+}
+
+static int bitcask_is_oldest(kvs_bitcask_t *bc, bitcask_segment_t *seg) {
+    for (uint32_t id = 0; id < seg->id; id++) {
+        if (bc->segs[id]) return 0;
+    }
+    return 1;
+}
+
+static void bitcask_drop_segment(kvs_bitcask_t *bc, bitcask_segment_t *seg) {
+    char path[512];
+    bc->segs[seg->id] = NULL;
+    seg_path(bc, seg->id, BITCASK_DATA_EXT, path, sizeof(path));
+    unlink(path);
+    seg_path(bc, seg->id, BITCASK_HINT_EXT, path, sizeof(path));
+    unlink(path);
+    seg_free(seg);
+}
+
+void kvs_bitcask_compact_step(kvs_bitcask_t *bc, kvs_hash_t *T, size_t budget) {
+    if (!bc->victim) {
+        bc->victim = bitcask_pick_victim(bc);
+        if (!bc->victim) return;
+        bc->victim_pos = 0;
+        LOG_INFO("[Bitcask] Compacting segment %u (%lu/%lu bytes dead)\n", bc->victim->id,
+                 (unsigned long)bc->victim->dead, (unsigned long)bc->victim->size);
+    }
+
+    bitcask_segment_t *seg = bc->victim;
+    int oldest = bitcask_is_oldest(bc, seg);
+    size_t copied = 0;
+
+    while (bc->victim_pos < seg->size && copied < budget) {
+        const bitcask_rec_t *hdr = (const bitcask_rec_t *)(seg->map + bc->victim_pos);
+        const char *key = (const char *)(hdr + 1);
+        uint64_t val_off = bc->victim_pos + sizeof(*hdr) + hdr->key_len;
+        size_t rec = BITCASK_REC_SIZE(hdr->key_len, hdr->val_len);
+        hashnode_t *node = kvs_hash_lookup(T, key, hdr->key_len);
+
+        if (hdr->flags & BITCASK_TOMBSTONE) {
+            /* 旧段中可能还有该 key 的记录，墓碑要随之前移；最老的段无需保留 */
+            if (!node && !oldest) {
+                if (kvs_bitcask_append_tombstone(bc, key, hdr->key_len) < 0) return;
+                copied += rec;
+            }
+        } else if (node && (node->flags & HASHNODE_ON_DISK) &&
+                   node->seg_id == seg->id && node->seg_off == val_off) {
+            uint32_t new_id;
+            uint64_t new_off;
+            if (bitcask_write(bc, key, hdr->key_len, seg->map + val_off, hdr->val_len,
+                              0, &new_id, &new_off) < 0)
+                return;
+            node->seg_id = new_id;
+            node->seg_off = new_off;
+            copied += rec;
+        }
+        bc->victim_pos += rec;
+    }
+
+    if (bc->victim_pos >= seg->size) {
+        LOG_INFO("[Bitcask] Segment %u compacted\n", seg->id);
+        bc->victim = NULL;
+        fsync(bc->active->fd);
+        bitcask_drop_segment(bc, seg);
+    }
+}
+
+void kvs_bitcask_stats(kvs_bitcask_t *bc, int *segments, uint64_t *disk_bytes, uint64_t *dead_bytes) {
+    int n = 0;
+    uint64_t disk = 0, dead = 0;
+    for (uint32_t id = 0; id < bc->seg_cap; id++) {
+        bitcask_segment_t *seg = bc->segs[id];
+        if (!seg) continue;
+        n++;
+        disk += seg->size;
+        dead += seg->dead;
+    }
+    if (segments) *segments = n;
+    if (disk_bytes) *disk_bytes = disk;
+    if (dead_bytes) *dead_bytes = dead;
+}
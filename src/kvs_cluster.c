@@ -0,0 +1,791 @@
+#include "../include/kvs_base.h"
+#include "../include/kvs_cluster.h"
+#include "../include/kvs_hash.h"
+#include "../include/kvs_configure.h"
+#include "../include/kvs_propagate.h"
+#include "../include/server.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+/*
+ * 集群模式：键空间按 CRC16(key) mod 16384 划分为槽位，每个槽位归属一个节点。
+ * 拓扑来自配置文件中的 node 行，运行期可用 CLUSTER SETSLOT 修改。
+ * 节点之间没有 gossip，迁移完成后由源节点通知目标节点，其余节点由管理员更新，
+ * 在此之前客户端会经由旧节点的 MOVED 多跳一次。
+ */
+
+#define MYSELF                      0
+#define MIGRATE_CONNECT_TIMEOUT     5               /* 秒，连接目标并发出 SETSLOT IMPORTING 的期限 */
+#define MIGRATE_BATCH               (256 * 1024)    /* 每次写入的 RESTORE 命令 */
+#define MIGRATE_WATERMARK           (1024 * 1024)   /* 已发送未确认的键值上限 */
+
+extern kvs_hash_t global_hash;
+extern void event_register_read(int fd, int (*handler)(int));
+
+typedef struct {
+    char ip[16];
+    int port;
+} cluster_node_t;
+
+static struct {
+    int enabled;
+    cluster_node_t nodes[KVS_CLUSTER_MAX_NODES];    /* nodes[0] 是本节点 */
+    int node_count;
+    short owner[KVS_CLUSTER_SLOTS];                 /* 节点下标，-1 表示未分配 */
+    short migrating[KVS_CLUSTER_SLOTS];             /* 迁出目标，-1 表示无 */
+    short importing[KVS_CLUSTER_SLOTS];             /* 迁入来源，-1 表示无 */
+    unsigned int asking[CONNECTION_SIZE];           /* 发送了 ASKING 的连接 id */
+} cluster;
+
+/* 等待在途键被目标确认后再收到 -ASK 的客户端 */
+typedef struct {
+    int fd;
+    unsigned int id;
+    unsigned int slot;
+    long long seq;              /* 需要确认到的命令序号 */
+} ask_waiter_t;
+
+/*
+ * 进行中的槽位迁移。命令序列为 SETSLOT IMPORTING、逐键 RESTORE、SETSLOT NODE，
+ * 目标对每条命令回复一行，按顺序计数即可对应。键在发送时从本地删除，
+ * 未确认的键值保留在 inflight 中，连接中断时写回本地。
+ */
+static struct {
+    int fd;                     /* -1 表示没有迁移 */
+    int connected;              /* SETSLOT IMPORTING 已发出，槽位已标记 MIGRATING */
+    long started;
+    int target;
+    int start, end;
+    int cursor;                 /* 下一个要扫描的哈希桶 */
+    int done;                   /* 已发送最后的 SETSLOT NODE */
+    long long sent;
+    long long acked;
+    int line_start;
+    int error;
+    char errmsg[128];
+    int errlen;
+    char *inflight;             /* [klen u32][vlen u32][key][val] 按发送顺序 */
+    size_t head, len, cap;
+    long long inflight_keys;
+    char *out;
+    size_t out_len, out_cap;
+    ask_waiter_t *waiters;
+    int nwaiters, waiters_cap;
+    unsigned long keys_moved;
+} mig = { .fd = -1 };
+
+/* ---------------- slots ---------------- */
+
+static uint16_t crc16_table[256];
+
+/* CRC16-CCITT (XMODEM)，与 Redis Cluster 的槽位计算一致 */
+static void crc16_init(void) {
+    for (int i = 0; i < 256; i++) {
+        uint16_t crc = i << 8;
+        for (int j = 0; j < 8; j++)
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+        crc16_table[i] = crc;
+    }
+}
+
+static uint16_t crc16(const char *buf, size_t len) {
+    uint16_t crc = 0;
+    if (!crc16_table[1]) crc16_init();
+    for (size_t i = 0; i < len; i++)
+        crc = (crc << 8) ^ crc16_table[((crc >> 8) ^ (unsigned char)buf[i]) & 0xff];
+    return crc;
+}
+
+unsigned int kvs_cluster_keyslot(const char *key, size_t len) {
+    /* {tag} 让相关的键落在同一个槽位 */
+    const char *open = memchr(key, '{', len);
+    if (open) {
+        size_t rest = len - (open - key) - 1;
+        const char *close = memchr(open + 1, '}', rest);
+        if (close && close > open + 1) {
+            key = open + 1;
+            len = close - open - 1;
+        }
+    }
+    return crc16(key, len) & (KVS_CLUSTER_SLOTS - 1);
+}
+
+int kvs_cluster_enabled(void) {
+    return cluster.enabled;
+}
+
+/* "ip:port"，只接受 IPv4 地址 */
+static int node_parse(const char *s, size_t len, char *ip, int *port) {
+    const char *colon = memrchr(s, ':', len);
+    if (!colon || colon == s || (size_t)(colon - s) >= 16) return -1;
+    memcpy(ip, s, colon - s);
+    ip[colon - s] = '\0';
+    struct in_addr addr;
+    if (inet_pton(AF_INET, ip, &addr) != 1) return -1;
+    *port = 0;
+    for (const char *p = colon + 1; p < s + len; p++) {
+        if (*p < '0' || *p > '9') return -1;
+        *port = *port * 10 + (*p - '0');
+        if (*port > 65535) return -1;
+    }
+    return *port > 0 ? 0 : -1;
+}
+
+/* 返回节点下标，未知节点自动加入 */
+static int node_get(const char *s, size_t len) {
+    char ip[16];
+    int port;
+    if (node_parse(s, len, ip, &port) < 0) return -1;
+    for (int i = 0; i < cluster.node_count; i++) {
+        if (cluster.nodes[i].port == port && strcmp(cluster.nodes[i].ip, ip) == 0) return i;
+    }
+    if (cluster.node_count >= KVS_CLUSTER_MAX_NODES) return -1;
+    cluster_node_t *n = &cluster.nodes[cluster.node_count];
+    memcpy(n->ip, ip, sizeof(n->ip));
+    n->port = port;
+    return cluster.node_count++;
+}
+
+/* "a-b" 或 "a" */
+static int range_parse(const char *s, size_t len, int *start, int *end) {
+    char buf[32];
+    if (len == 0 || len >= sizeof(buf)) return -1;
+    memcpy(buf, s, len);
+    buf[len] = '\0';
+    char *p;
+    long a = strtol(buf, &p, 10), b = a;
+    if (p == buf) return -1;
+    if (*p == '-') {
+        char *q = p + 1;
+        b = strtol(q, &p, 10);
+        if (p == q) return -1;
+    }
+    if (*p != '\0' || a < 0 || b < a || b >= KVS_CLUSTER_SLOTS) return -1;
+    *start = a;
+    *end = b;
+    return 0;
+}
+
+void kvs_cluster_init(void) {
+    cluster.enabled = g_config.cluster_enabled;
+    for (int i = 0; i < KVS_CLUSTER_SLOTS; i++)
+        cluster.owner[i] = cluster.migrating[i] = cluster.importing[i] = -1;
+    if (!cluster.enabled) return;
+
+    char self[32];
+    int n = snprintf(self, sizeof(self), "%s:%d", g_config.cluster_announce_ip, g_config.port);
+    if (node_get(self, n) != MYSELF) {
+        LOG_WARN("[Cluster] Invalid announce address %s, cluster disabled\n", self);
+        cluster.enabled = 0;
+        return;
+    }
+
+    /* node = ip:port 0-5460,5461 ... */
+    for (int i = 0; i < g_config.cluster_node_count; i++) {
+        const char *line = g_config.cluster_nodes[i];
+        size_t alen = strcspn(line, " \t");
+        int node = node_get(line, alen);
+        if (node < 0) {
+            LOG_WARN("[Cluster] Ignoring node line: %s\n", line);
+            continue;
+        }
+        const char *p = line + alen;
+        while (*p) {
+            p += strspn(p, " \t,");
+            size_t tlen = strcspn(p, " \t,");
+            if (tlen == 0) break;
+            int start, end;
+            if (range_parse(p, tlen, &start, &end) < 0) {
+                LOG_WARN("[Cluster] Bad slot range '%.*s' for node %.*s\n",
+                         (int)tlen, p, (int)alen, line);
+            } else {
+                for (int s = start; s <= end; s++) cluster.owner[s] = node;
+            }
+            p += tlen;
+        }
+    }
+
+    int owned = 0;
+    for (int i = 0; i < KVS_CLUSTER_SLOTS; i++) owned += cluster.owner[i] == MYSELF;
+    LOG_INFO("[Cluster] Enabled as %s, %d nodes, %d slots owned\n",
+             self, cluster.node_count, owned);
+}
+
+/* ---------------- redirection ---------------- */
+
+static int redirect_reply(char *resp, const char *type, unsigned int slot, int node) {
+    return sprintf(resp, "-%s %u %s:%d\r\n", type, slot,
+                   cluster.nodes[node].ip, cluster.nodes[node].port);
+}
+
+/* 按当前槽位状态给出重定向，用于被阻塞的客户端 */
+static int redirect_current(char *resp, unsigned int slot) {
+    int owner = cluster.owner[slot];
+    if (owner == MYSELF && cluster.migrating[slot] >= 0)
+        return redirect_reply(resp, "ASK", slot, cluster.migrating[slot]);
+    if (owner > MYSELF)
+        return redirect_reply(resp, "MOVED", slot, owner);
+    return sprintf(resp, "-TRYAGAIN Slot state changed, retry\r\n");
+}
+
+int kvs_cluster_redirect(int fd, const char *key, size_t len, char *resp) {
+    unsigned int slot = kvs_cluster_keyslot(key, len);
+    int asking = 0;
+    if (fd >= 0 && fd < CONNECTION_SIZE) {
+        asking = cluster.asking[fd] != 0 && cluster.asking[fd] == kvs_client_id(fd);
+        cluster.asking[fd] = 0;
+    }
+
+    int owner = cluster.owner[slot];
+    if (owner == MYSELF) {
+        int to = cluster.migrating[slot];
+        if (to < 0 || kvs_hash_exist(&global_hash, key, len) == 0) return 0;
+        /* 键可能刚被迁出，目标确认收到之前不能让客户端去目标读 */
+        if (mig.fd >= 0 && mig.acked < mig.sent && fd >= 0) {
+            if (mig.nwaiters == mig.waiters_cap) {
+                int cap = mig.waiters_cap ? mig.waiters_cap * 2 : 16;
+                ask_waiter_t *w = kvs_realloc(mig.waiters, cap * sizeof(*w));
+                if (!w) return sprintf(resp, "-TRYAGAIN Out of memory\r\n");
+                mig.waiters = w;
+                mig.waiters_cap = cap;
+            }
+            ask_waiter_t *w = &mig.waiters[mig.nwaiters++];
+            w->fd = fd;
+            w->id = kvs_block_client(fd);
+            w->slot = slot;
+            w->seq = mig.sent;
+            return -1;
+        }
+        return redirect_reply(resp, "ASK", slot, to);
+    }
+    if (cluster.importing[slot] >= 0 && asking) return 0;
+    if (owner < 0) return sprintf(resp, "-CLUSTERDOWN Hash slot not served\r\n");
+    return redirect_reply(resp, "MOVED", slot, owner);
+}
+
+int kvs_cluster_can_restore(const char *key, size_t len) {
+    unsigned int slot = kvs_cluster_keyslot(key, len);
+    return cluster.owner[slot] == MYSELF || cluster.importing[slot] >= 0;
+}
+
+void kvs_cluster_asking(int fd) {
+    if (fd >= 0 && fd < CONNECTION_SIZE) cluster.asking[fd] = kvs_client_id(fd);
+}
+
+/* ---------------- migration ---------------- */
+
+/* 唤醒序号已确认的等待者；all 为真时全部唤醒，err 非空时统一回复 err */
+static void migrate_wake(int all, const char *err) {
+    if (mig.nwaiters == 0) return;
+
+    /* 唤醒会执行客户端后续命令，可能再次加入等待列表，先摘出再回复 */
+    ask_waiter_t *ready = kvs_malloc(mig.nwaiters * sizeof(*ready));
+    if (!ready) return;
+    int nready = 0, keep = 0;
+    for (int i = 0; i < mig.nwaiters; i++) {
+        if (all || mig.waiters[i].seq <= mig.acked) ready[nready++] = mig.waiters[i];
+        else mig.waiters[keep++] = mig.waiters[i];
+    }
+    mig.nwaiters = keep;
+
+    char reply[64];
+    for (int i = 0; i < nready; i++) {
+        int n = err ? (int)strlen(strcpy(reply, err)) : redirect_current(reply, ready[i].slot);
+        kvs_unblock_client(ready[i].fd, ready[i].id, reply, n);
+    }
+    kvs_free(ready);
+}
+
+static void migrate_reset(void) {
+    kvs_free(mig.inflight);
+    kvs_free(mig.out);
+    mig.inflight = mig.out = NULL;
+    mig.head = mig.len = mig.cap = 0;
+    mig.out_len = mig.out_cap = 0;
+    mig.inflight_keys = 0;
+    mig.fd = -1;
+}
+
+static int buf_reserve(char **buf, size_t *cap, size_t need) {
+    if (*cap >= need) return 0;
+    size_t ncap = *cap ? *cap : 64 * 1024;
+    while (ncap < need) ncap *= 2;
+    char *p = kvs_realloc(*buf, ncap);
+    if (!p) return -1;
+    *buf = p;
+    *cap = ncap;
+    return 0;
+}
+
+static int migrate_append_cmd(int argc, const char **argv, const size_t *lens) {
+    size_t need = mig.out_len + kvs_resp_encoded_len(argc, lens);
+    if (buf_reserve(&mig.out, &mig.out_cap, need) < 0) return -1;
+    mig.out_len += kvs_resp_encode(mig.out + mig.out_len, argc, argv, lens);
+    mig.sent++;
+    return 0;
+}
+
+/* SETSLOT <start-end> <state> <node> */
+static int migrate_append_setslot(const char *state, int node) {
+    char range[32], addr[32];
+    const char *argv[5] = { "CLUSTER", "SETSLOT", range, state, addr };
+    size_t lens[5] = { 7, 7, 0, strlen(state), 0 };
+    lens[2] = sprintf(range, "%d-%d", mig.start, mig.end);
+    lens[4] = sprintf(addr, "%s:%d", cluster.nodes[node].ip, cluster.nodes[node].port);
+    return migrate_append_cmd(5, argv, lens);
+}
+
+/* 编码一个桶内属于迁移范围的键，发送后即从本地删除 */
+static int migrate_bucket(int bucket) {
+    hashnode_t *node = global_hash.nodes[bucket];
+    while (node) {
+        hashnode_t *next = node->next;
+        unsigned int slot = kvs_cluster_keyslot(node->key, node->key_len);
+        if ((int)slot < mig.start || (int)slot > mig.end) {
+            node = next;
+            continue;
+        }
+        const void *val = kvs_hash_node_value(&global_hash, node);
+        if (!val) {
+            LOG_WARN("[Cluster] Cannot read value of key in slot %u, left behind\n", slot);
+            node = next;
+            continue;
+        }
+
+        uint32_t klen = node->key_len, vlen = node->value_len;
+        size_t rec = 8 + klen + vlen;
+        if (buf_reserve(&mig.inflight, &mig.cap, mig.len + rec) < 0) return -1;
+        char *r = mig.inflight + mig.len;
+        memcpy(r, &klen, 4);
+        memcpy(r + 4, &vlen, 4);
+        memcpy(r + 8, node->key, klen);
+        memcpy(r + 8 + klen, val, vlen);
+
+        const char *argv[3] = { "RESTORE", r + 8, r + 8 + klen };
+        size_t lens[3] = { 7, klen, vlen };
+        if (migrate_append_cmd(3, argv, lens) < 0) return -1;
+        mig.len += rec;
+        mig.inflight_keys++;
+        mig.keys_moved++;
+
+        /* 本地删除同样写入 AOF 并传播给从机 */
+        const char *del[2] = { "DEL", r + 8 };
+        size_t dlens[2] = { 3, klen };
+        kvs_hash_del(&global_hash, r + 8, klen);
+        kvs_propagate(2, del, dlens);
+        node = next;
+    }
+    return 0;
+}
+
+/* drain 回调：输出发空且在途数据低于水位时继续扫描 */
+static int migrate_produce(int fd) {
+    if (fd != mig.fd) return 0;
+    while (!mig.done && mig.len - mig.head < MIGRATE_WATERMARK &&
+           kvs_client_output_len(fd) < MIGRATE_WATERMARK) {
+        mig.out_len = 0;
+        while (mig.cursor < global_hash.max_slots && mig.out_len < MIGRATE_BATCH) {
+            if (migrate_bucket(mig.cursor) < 0) {
+                LOG_WARN("[Cluster] Out of memory migrating slots %d-%d\n", mig.start, mig.end);
+                kvs_close_client(fd);
+                return -1;
+            }
+            mig.cursor++;
+        }
+        if (mig.cursor >= global_hash.max_slots) {
+            /* 扫描结束，让目标接管槽位，确认后本地再改归属 */
+            if (migrate_append_setslot("NODE", mig.target) < 0) {
+                kvs_close_client(fd);
+                return -1;
+            }
+            mig.done = 1;
+        }
+        if (mig.out_len > 0 && kvs_client_write(fd, mig.out, mig.out_len) < 0) return -1;
+    }
+    return 0;
+}
+
+static void migrate_finish(void) {
+    int fd = mig.fd;
+    for (int s = mig.start; s <= mig.end; s++) {
+        cluster.owner[s] = mig.target;
+        cluster.migrating[s] = -1;
+    }
+    LOG_INFO("[Cluster] Slots %d-%d migrated to %s:%d, %lld commands\n",
+             mig.start, mig.end, cluster.nodes[mig.target].ip,
+             cluster.nodes[mig.target].port, mig.sent);
+    migrate_reset();
+    migrate_wake(1, NULL);
+    kvs_close_client(fd);
+}
+
+/* 连接中断：在途的键写回本地，槽位保持 MIGRATING，可重新发起迁移 */
+static void migrate_abort(void) {
+    size_t p = mig.head;
+    long long restored = 0;
+    while (p < mig.len) {
+        uint32_t klen, vlen;
+        memcpy(&klen, mig.inflight + p, 4);
+        memcpy(&vlen, mig.inflight + p + 4, 4);
+        const char *argv[3] = { "SET", mig.inflight + p + 8, mig.inflight + p + 8 + klen };
+        size_t lens[3] = { 3, klen, vlen };
+        if (kvs_hash_set(&global_hash, argv[1], klen, argv[2], vlen) == 0) {
+            kvs_propagate(3, argv, lens);
+            restored++;
+        }
+        p += 8 + klen + vlen;
+    }
+    if (!mig.connected)
+        LOG_WARN("[Cluster] Cannot connect to migration target %s:%d, slots %d-%d unchanged\n",
+                 cluster.nodes[mig.target].ip, cluster.nodes[mig.target].port,
+                 mig.start, mig.end);
+    else
+        LOG_WARN("[Cluster] Migration of slots %d-%d to %s:%d aborted, %lld keys restored; "
+                 "slots stay MIGRATING until CLUSTER MIGRATE is retried or SETSLOT STABLE\n",
+                 mig.start, mig.end, cluster.nodes[mig.target].ip,
+                 cluster.nodes[mig.target].port, restored);
+    migrate_reset();
+    migrate_wake(1, "-TRYAGAIN Slot migration aborted\r\n");
+}
+
+/* 目标确认一条命令 */
+static void migrate_ack(void) {
+    mig.acked++;
+    if (mig.acked == 1) return;     /* SETSLOT IMPORTING */
+    if (mig.inflight_keys > 0) {
+        uint32_t klen, vlen;
+        memcpy(&klen, mig.inflight + mig.head, 4);
+        memcpy(&vlen, mig.inflight + mig.head + 4, 4);
+        mig.head += 8 + klen + vlen;
+        if (--mig.inflight_keys == 0) mig.head = mig.len = 0;
+    }
+}
+
+/* 读取目标的回复：每行一条，以 '-' 开头即失败 */
+static int migrate_read_cb(int fd) {
+    char buf[16 * 1024];
+    ssize_t n = recv(fd, buf, sizeof(buf), 0);
+    if (n < 0 && (errno == EAGAIN || errno == EINTR)) return 0;
+    if (fd != mig.fd) {
+        kvs_close_client(fd);
+        return -1;
+    }
+    if (n <= 0) {
+        LOG_WARN("[Cluster] Migration target closed the connection\n");
+        kvs_close_client(fd);
+        return -1;
+    }
+
+    for (ssize_t i = 0; i < n; i++) {
+        char ch = buf[i];
+        if (mig.line_start && ch == '-') {
+            mig.error = 1;
+            mig.errlen = 0;
+        }
+        mig.line_start = ch == '\n';
+        if (mig.error && ch != '\r' && ch != '\n' && mig.errlen < (int)sizeof(mig.errmsg))
+            mig.errmsg[mig.errlen++] = ch;
+        if (ch != '\n') continue;
+
+        if (mig.error) {
+            LOG_WARN("[Cluster] Migration target replied %.*s\n", mig.errlen, mig.errmsg);
+            kvs_close_client(fd);
+            return -1;
+        }
+        migrate_ack();
+        if (mig.done && mig.acked == mig.sent) {
+            migrate_finish();
+            return 0;
+        }
+    }
+
+    /* 在途数据已压缩到 inflight 头部之后，需要时整理空间 */
+    if (mig.head > 0 && mig.head >= mig.len / 2) {
+        memmove(mig.inflight, mig.inflight + mig.head, mig.len - mig.head);
+        mig.len -= mig.head;
+        mig.head = 0;
+    }
+    migrate_wake(0, NULL);
+    if (mig.fd == fd) migrate_produce(fd);
+    return 0;
+}
+
+/* drain 回调：连接建立且 SETSLOT IMPORTING 已发出，标记槽位迁出后开始扫描 */
+static int migrate_connected(int fd) {
+    if (fd != mig.fd) return 0;
+    mig.connected = 1;
+    for (int s = mig.start; s <= mig.end; s++) cluster.migrating[s] = mig.target;
+    kvs_client_set_drain(fd, migrate_produce);
+    LOG_INFO("[Cluster] Migrating slots %d-%d to %s:%d\n", mig.start, mig.end,
+             cluster.nodes[mig.target].ip, cluster.nodes[mig.target].port);
+    return migrate_produce(fd);
+}
+
+/*
+ * CLUSTER MIGRATE：非阻塞连接目标，SETSLOT IMPORTING 先进入写缓冲区，
+ * 连接建立后由 Reactor 发出，键由 drain 回调分批发送
+ */
+static int migrate_start(int target, int start, int end, char *resp) {
+    if (mig.fd >= 0)
+        return sprintf(resp, "-ERR Another migration is in progress\r\n");
+    if (target == MYSELF)
+        return sprintf(resp, "-ERR Cannot migrate to myself\r\n");
+    for (int s = start; s <= end; s++) {
+        if (cluster.owner[s] != MYSELF)
+            return sprintf(resp, "-ERR Slot %d is not owned by me\r\n", s);
+        if (cluster.migrating[s] >= 0 && cluster.migrating[s] != target)
+            return sprintf(resp, "-ERR Slot %d is migrating elsewhere\r\n", s);
+    }
+
+    int fd = kvs_connect(cluster.nodes[target].ip, cluster.nodes[target].port, 0);
+    if (fd < 0)
+        return sprintf(resp, "-ERR Cannot connect to target\r\n");
+    event_register_read(fd, migrate_read_cb);
+
+    mig.fd = fd;
+    mig.connected = 0;
+    mig.started = time(NULL);
+    mig.target = target;
+    mig.start = start;
+    mig.end = end;
+    mig.cursor = 0;
+    mig.done = 0;
+    mig.sent = mig.acked = 0;
+    mig.line_start = 1;
+    mig.error = 0;
+    mig.out_len = 0;
+
+    if (migrate_append_setslot("IMPORTING", MYSELF) < 0 ||
+        kvs_client_write(fd, mig.out, mig.out_len) < 0) {
+        if (mig.fd == fd) kvs_close_client(fd);
+        return sprintf(resp, "-ERR Cannot start migration\r\n");
+    }
+    kvs_client_set_drain(fd, migrate_connected);
+
+    LOG_INFO("[Cluster] Connecting to migration target %s:%d\n",
+             cluster.nodes[target].ip, cluster.nodes[target].port);
+    return sprintf(resp, "+OK\r\n");
+}
+
+/* 目标不可达时非阻塞 connect 可能长时间挂起，超时后放弃 */
+void kvs_cluster_cron(void) {
+    if (mig.fd >= 0 && !mig.connected && time(NULL) - mig.started >= MIGRATE_CONNECT_TIMEOUT)
+        kvs_close_client(mig.fd);
+}
+
+void kvs_cluster_conn_closed(int fd) {
+    if (fd == mig.fd) migrate_abort();
+}
+
+/* ---------------- CLUSTER command ---------------- */
+
+typedef struct {
+    char *data;
+    size_t len, cap;
+} cluster_str_t;
+
+static void str_printf(cluster_str_t *s, const char *fmt, ...) {
+    va_list ap;
+    for (;;) {
+        size_t room = s->cap - s->len;
+        va_start(ap, fmt);
+        int n = s->data ? vsnprintf(s->data + s->len, room, fmt, ap) : -1;
+        va_end(ap);
+        if (n >= 0 && (size_t)n < room) {
+            s->len += n;
+            return;
+        }
+        if (buf_reserve(&s->data, &s->cap, s->len + (n > 0 ? n + 1 : 256)) < 0) return;
+    }
+}
+
+/* 拷贝到回复缓冲区，空间不足时返回 -2 */
+static int str_reply(cluster_str_t *s, int bulk, char *resp, int resp_size, int *needed) {
+    int need = s->len + (bulk ? 32 : 0);
+    int n;
+    if (need > resp_size) {
+        *needed = need;
+        n = -2;
+    } else if (bulk) {
+        n = sprintf(resp, "$%zu\r\n", s->len);
+        memcpy(resp + n, s->data, s->len);
+        n += s->len;
+        resp[n++] = '\r';
+        resp[n++] = '\n';
+    } else {
+        memcpy(resp, s->data, s->len);
+        n = s->len;
+    }
+    kvs_free(s->data);
+    return n;
+}
+
+static void cluster_nodes(cluster_str_t *s) {
+    for (int i = 0; i < cluster.node_count; i++) {
+        str_printf(s, "%s:%d%s", cluster.nodes[i].ip, cluster.nodes[i].port,
+                   i == MYSELF ? " myself" : "");
+        for (int a = 0; a < KVS_CLUSTER_SLOTS; a++) {
+            if (cluster.owner[a] != i) continue;
+            int b = a;
+            while (b + 1 < KVS_CLUSTER_SLOTS && cluster.owner[b + 1] == i) b++;
+            if (a == b) str_printf(s, " %d", a);
+            else str_printf(s, " %d-%d", a, b);
+            a = b;
+        }
+        if (i == MYSELF) {
+            for (int a = 0; a < KVS_CLUSTER_SLOTS; a++) {
+                int m = cluster.migrating[a], im = cluster.importing[a];
+                if (m >= 0)
+                    str_printf(s, " [%d->-%s:%d]", a, cluster.nodes[m].ip, cluster.nodes[m].port);
+                if (im >= 0)
+                    str_printf(s, " [%d-<-%s:%d]", a, cluster.nodes[im].ip, cluster.nodes[im].port);
+            }
+        }
+        str_printf(s, "\n");
+    }
+}
+
+/* [[start, end, [ip, port]], ...] */
+static void cluster_slots(cluster_str_t *s) {
+    int runs = 0;
+    for (int a = 0; a < KVS_CLUSTER_SLOTS; a++) {
+        if (cluster.owner[a] >= 0 && (a == 0 || cluster.owner[a - 1] != cluster.owner[a])) runs++;
+    }
+    str_printf(s, "*%d\r\n", runs);
+    for (int a = 0; a < KVS_CLUSTER_SLOTS; a++) {
+        int o = cluster.owner[a];
+        if (o < 0) continue;
+        int b = a;
+        while (b + 1 < KVS_CLUSTER_SLOTS && cluster.owner[b + 1] == o) b++;
+        str_printf(s, "*3\r\n:%d\r\n:%d\r\n*2\r\n$%zu\r\n%s\r\n:%d\r\n", a, b,
+                   strlen(cluster.nodes[o].ip), cluster.nodes[o].ip, cluster.nodes[o].port);
+        a = b;
+    }
+}
+
+static int arg_is(char **argv, size_t *lens, int i, const char *name) {
+    return lens[i] == strlen(name) && strncasecmp(argv[i], name, lens[i]) == 0;
+}
+
+/* CLUSTER SETSLOT <slot|start-end> NODE|MIGRATING|IMPORTING <ip:port> | STABLE */
+static int cluster_setslot(char **argv, size_t *lens, int argc, char *resp) {
+    int start, end, node = -1;
+    if (argc < 4 || range_parse(argv[2], lens[2], &start, &end) < 0)
+        return sprintf(resp, "-ERR Invalid slot range\r\n");
+    if (!arg_is(argv, lens, 3, "STABLE")) {
+        if (argc < 5 || (node = node_get(argv[4], lens[4])) < 0)
+            return sprintf(resp, "-ERR Invalid node address\r\n");
+    }
+    if (mig.fd >= 0 && start <= mig.end && end >= mig.start)
+        return sprintf(resp, "-ERR Slots are being migrated\r\n");
+
+    if (arg_is(argv, lens, 3, "NODE")) {
+        for (int s = start; s <= end; s++) {
+            cluster.owner[s] = node;
+            cluster.migrating[s] = cluster.importing[s] = -1;
+        }
+    } else if (arg_is(argv, lens, 3, "MIGRATING")) {
+        for (int s = start; s <= end; s++) {
+            if (cluster.owner[s] != MYSELF)
+                return sprintf(resp, "-ERR Slot %d is not owned by me\r\n", s);
+        }
+        for (int s = start; s <= end; s++) cluster.migrating[s] = node;
+    } else if (arg_is(argv, lens, 3, "IMPORTING")) {
+        for (int s = start; s <= end; s++) {
+            if (cluster.owner[s] == MYSELF)
+                return sprintf(resp, "-ERR Slot %d is already mine\r\n", s);
+        }
+        for (int s = start; s <= end; s++) cluster.importing[s] = node;
+    } else if (arg_is(argv, lens, 3, "STABLE")) {
+        for (int s = start; s <= end; s++) cluster.migrating[s] = cluster.importing[s] = -1;
+    } else {
+        return sprintf(resp, "-ERR Unknown SETSLOT state\r\n");
+    }
+    return sprintf(resp, "+OK\r\n");
+}
+
+int kvs_cluster_command(char **argv, size_t *lens, int argc,
+                        char *resp, int resp_size, int *needed) {
+    if (!cluster.enabled)
+        return sprintf(resp, "-ERR This instance has cluster support disabled\r\n");
+    if (argc < 2)
+        return sprintf(resp, "-ERR wrong number of arguments\r\n");
+
+    cluster_str_t s = {0};
+    int start, end;
+
+    if (arg_is(argv, lens, 1, "KEYSLOT") && argc >= 3) {
+        return sprintf(resp, ":%u\r\n", kvs_cluster_keyslot(argv[2], lens[2]));
+    } else if (arg_is(argv, lens, 1, "INFO")) {
+        char info[1024];
+        int n = kvs_cluster_info(info, sizeof(info));
+        str_printf(&s, "%.*s", n, info);
+        return str_reply(&s, 1, resp, resp_size, needed);
+    } else if (arg_is(argv, lens, 1, "NODES")) {
+        cluster_nodes(&s);
+        return str_reply(&s, 1, resp, resp_size, needed);
+    } else if (arg_is(argv, lens, 1, "SLOTS")) {
+        cluster_slots(&s);
+        return str_reply(&s, 0, resp, resp_size, needed);
+    } else if (arg_is(argv, lens, 1, "ADDSLOTSRANGE") && argc >= 4) {
+        /* CLUSTER ADDSLOTSRANGE <start> <end> */
+        int unused;
+        if (range_parse(argv[2], lens[2], &start, &unused) < 0 ||
+            range_parse(argv[3], lens[3], &end, &unused) < 0 || end < start)
+            return sprintf(resp, "-ERR Invalid slot range\r\n");
+        for (int i = start; i <= end; i++) {
+            if (cluster.owner[i] >= 0)
+                return sprintf(resp, "-ERR Slot %d is already busy\r\n", i);
+        }
+        for (int i = start; i <= end; i++) cluster.owner[i] = MYSELF;
+        return sprintf(resp, "+OK\r\n");
+    } else if (arg_is(argv, lens, 1, "SETSLOT")) {
+        return cluster_setslot(argv, lens, argc, resp);
+    } else if (arg_is(argv, lens, 1, "MIGRATE") && argc >= 4) {
+        /* CLUSTER MIGRATE <ip:port> <slot|start-end> */
+        int target = node_get(argv[2], lens[2]);
+        if (target < 0) return sprintf(resp, "-ERR Invalid node address\r\n");
+        if (range_parse(argv[3], lens[3], &start, &end) < 0)
+            return sprintf(resp, "-ERR Invalid slot range\r\n");
+        return migrate_start(target, start, end, resp);
+    }
+    return sprintf(resp, "-ERR Unknown CLUSTER subcommand\r\n");
+}
+
+int kvs_cluster_info(char *buf, int size) {
+    if (!cluster.enabled)
+        return snprintf(buf, size, "# Cluster\r\ncluster_enabled:0\r\n");
+
+    int assigned = 0, owned = 0, migrating = 0, importing = 0;
+    for (int i = 0; i < KVS_CLUSTER_SLOTS; i++) {
+        assigned += cluster.owner[i] >= 0;
+        owned += cluster.owner[i] == MYSELF;
+        migrating += cluster.migrating[i] >= 0;
+        importing += cluster.importing[i] >= 0;
+    }
+    int len = snprintf(buf, size,
+                       "# Cluster\r\n"
+                       "cluster_enabled:1\r\n"
+                       "cluster_state:%s\r\n"
+                       "cluster_slots_assigned:%d\r\n"
+                       "cluster_slots_owned:%d\r\n"
+                       "cluster_known_nodes:%d\r\n"
+                       "cluster_slots_migrating:%d\r\n"
+                       "cluster_slots_importing:%d\r\n"
+                       "migrate_in_progress:%d\r\n"
+                       "migrate_keys_moved:%lu\r\n"
+                       "migrate_inflight_keys:%lld\r\n",
+                       assigned == KVS_CLUSTER_SLOTS ? "ok" : "fail",
+                       assigned, owned, cluster.node_count, migrating, importing,
+                       mig.fd >= 0, mig.keys_moved, mig.inflight_keys);
+    return len < size ? len : size - 1;
+}
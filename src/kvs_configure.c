@@ -1,31 +1,87 @@
 #include "../include/kvs_configure.h"
+#include "../include/kvs_persist.h"
+#include "../include/kvs_replication.h"
+#include "../include/kvs_hotkeys.h"
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <ctype.h>
-#include <stdarg.h>
+#include <errno.h>
+#include <fnmatch.h>
 #include <unistd.h>
 #include <libgen.h>
 
 kvs_config_t g_config;
 
-void kvs_config_set_default(void) {
-    g_config.port = 6379;
-    g_config.log_level = LOG_LEVEL_INFO;
+static void config_defaults(kvs_config_t *c) {
+    c->port = 6379;
+    c->log_level = LOG_LEVEL_INFO;
+    c->log_file[0] = '\0';
+    c->log_rate_limit = 100;
+    c->watchdog_ms = 0;
+    c->command_budget = 100;
+    c->client_obuf_hard_limit = 64;
+    c->client_obuf_soft_limit = 16;
+    c->client_obuf_soft_seconds = 10;
+    c->query_buffer_limit = 128;
+    c->unixsocket[0] = '\0';
+    strcpy(c->unixsocket_perm, "700");
+
+    c->persist_mode = PERSIST_MIXED;
+    strcpy(c->rdb_file, "../data/kvstore.rdb");
+    c->rdb_save_interval = 300;
+    c->rdb_min_changes = 100;
+    c->rdb_save_on_shutdown = true;
+    strcpy(c->aof_file, "../data/kvstore.aof");
+    c->aof_rewrite_size = 1;
+    c->aof_auto_rewrite = true;
+
+    c->repl_switch = REPL_OFF;
+    c->repl_role = ROLE_MASTER;
+    c->master_ip[0] = '\0';
+    c->master_port = 0;
+    c->repl_backlog_size = 1;
+    c->repl_obuf_hard_limit = 256;
+    c->repl_obuf_soft_limit = 64;
+    c->repl_obuf_soft_seconds = 60;
+    c->repl_read_only = true;
+
+    c->storage_engine = STORAGE_MEMORY;
+    strcpy(c->bitcask_dir, "../data/bitcask");
+    c->bitcask_segment_size = 64;
+    c->bitcask_compact_ratio = 50;
+
+    c->tier_enabled = false;
+    strcpy(c->tier_dir, "../data/tier");
+    c->tier_idle_seconds = 3600;
+    c->tier_max_memory = 0;
+    c->tier_min_value_size = 64;
+    c->tier_sample_size = 16;
+    c->tier_io_threads = 2;
 
-    g_config.persist_mode = PERSIST_MIXED;
-    strcpy(g_config.rdb_file, "../data/kvstore.rdb");
-    g_config.rdb_save_interval = 300;
-    g_config.rdb_min_changes = 100;
-    g_config.rdb_save_on_shutdown = true;
-    strcpy(g_config.aof_file, "../data/kvstore.aof");
-    g_config.aof_rewrite_size = 1;
-    g_config.aof_auto_rewrite = true;
+    c->cluster_enabled = false;
+    strcpy(c->cluster_announce_ip, "127.0.0.1");
+    c->cluster_node_count = 0;
 
-    g_config.repl_switch = REPL_OFF;
-    g_config.repl_role = ROLE_MASTER;
-    g_config.master_ip[0] = '\0';
-    g_config.master_port = 0;
+    c->proxy_enabled = false;
+    c->proxy_backend_count = 0;
+    c->proxy_connections = 2;
+
+    c->slowlog_log_slower_than = 10000;
+    c->slowlog_max_len = 128;
+
+    c->hotkeys_enabled = true;
+    c->hotkeys_sample = 8;
+    c->hotkeys_top_k = 16;
+    c->hotkeys_decay_seconds = 60;
+    c->hotkeys_big_value_kb = 1024;
+
+    c->metrics_port = 0;
+}
+
+void kvs_config_set_default(void) {
+    config_defaults(&g_config);
 }
 
 static char* trim(char *str) {
@@ -38,43 +94,250 @@ static char* trim(char *str) {
     return str;
 }
 
-static bool parse_bool(const char *value) {
-    if (strcasecmp(value, "true") == 0 ||
-        strcasecmp(value, "yes") == 0 ||
-        strcasecmp(value, "on") == 0 ||
-        strcasecmp(value, "1") == 0) {
-        return true;
+/*
+ * 参数表：配置文件的 [段] 键 与 CONFIG GET/SET 的 "段.键" 名字都由它解析。
+ * 运行时修改只发生在 reactor 线程，整数字段以原子写入，热路径直接读 g_config
+ * 不加锁；字符串参数只在启动时设置。
+ */
+typedef enum { CFG_INT, CFG_BOOL, CFG_ENUM, CFG_STRING } config_type_t;
+
+#define CFG_MUTABLE     1       /* 可由 CONFIG SET 修改 */
+
+typedef struct {
+    const char *section;
+    const char *key;
+    config_type_t type;
+    size_t offset;
+    size_t size;                /* 字段宽度，字符串为缓冲区大小 */
+    long min, max;
+    const char *const *names;   /* CFG_ENUM 的取值，下标即枚举值 */
+    int flags;
+    /* 新值写入后调用，失败时恢复旧值 */
+    int (*apply)(const kvs_config_t *old, char *err, int err_size);
+} config_param_t;
+
+static const char *const role_names[] = { "master", "slave", NULL };
+static const char *const engine_names[] = { "memory", "bitcask", NULL };
+
+static int apply_persist_mode(const kvs_config_t *old, char *err, int err_size) {
+    if (g_config.storage_engine == STORAGE_BITCASK && g_config.persist_mode != PERSIST_OFF) {
+        snprintf(err, err_size, "the bitcask engine requires persist.mode 0");
+        return -1;
+    }
+    if (kvs_persist_reconfigure(old->persist_mode) < 0) {
+        snprintf(err, err_size, "AOF rewrite failed, see the server log");
+        return -1;
+    }
+    return 0;
+}
+
+static int apply_backlog_size(const kvs_config_t *old, char *err, int err_size) {
+    (void)old;
+    if (kvs_replication_resize_backlog() < 0) {
+        snprintf(err, err_size, "out of memory");
+        return -1;
+    }
+    return 0;
+}
+
+#define FIELD(f)    offsetof(kvs_config_t, f), sizeof(((kvs_config_t *)0)->f)
+#define P_INT(s, k, f, lo, hi, fl)      { s, k, CFG_INT, FIELD(f), lo, hi, NULL, fl, NULL }
+#define P_BOOL(s, k, f, fl)             { s, k, CFG_BOOL, FIELD(f), 0, 1, NULL, fl, NULL }
+#define P_ENUM(s, k, f, names)          { s, k, CFG_ENUM, FIELD(f), 0, 0, names, 0, NULL }
+#define P_STR(s, k, f)                  { s, k, CFG_STRING, FIELD(f), 0, 0, NULL, 0, NULL }
+
+static const config_param_t config_params[] = {
+    P_INT ("server", "port", port, 1, 65535, 0),
+    P_INT ("server", "log_level", log_level, LOG_LEVEL_INFO, LOG_LEVEL_DEBUG, CFG_MUTABLE),
+    P_STR ("server", "log_file", log_file),
+    P_INT ("server", "log_rate_limit", log_rate_limit, 0, 1000000, CFG_MUTABLE),
+    P_INT ("server", "watchdog_ms", watchdog_ms, 0, 60000, 0),
+    P_INT ("server", "command_budget", command_budget, 0, 100000000, CFG_MUTABLE),
+    P_INT ("server", "output_buffer_hard_limit", client_obuf_hard_limit, 0, 1048576, CFG_MUTABLE),
+    P_INT ("server", "output_buffer_soft_limit", client_obuf_soft_limit, 0, 1048576, CFG_MUTABLE),
+    P_INT ("server", "output_buffer_soft_seconds", client_obuf_soft_seconds, 0, 86400, CFG_MUTABLE),
+    P_INT ("server", "query_buffer_limit", query_buffer_limit, 1, 1024, CFG_MUTABLE),
+    P_STR ("server", "unixsocket", unixsocket),
+    P_STR ("server", "unixsocket_perm", unixsocket_perm),
+
+    { "persist", "mode", CFG_INT, FIELD(persist_mode), PERSIST_OFF, PERSIST_MIXED, NULL,
+      CFG_MUTABLE, apply_persist_mode },
+    P_STR ("persist", "rdb_file", rdb_file),
+    P_INT ("persist", "rdb_save_interval", rdb_save_interval, 1, 86400 * 365, CFG_MUTABLE),
+    P_INT ("persist", "rdb_min_changes", rdb_min_changes, 0, 1000000000, CFG_MUTABLE),
+    P_BOOL("persist", "rdb_save_on_shutdown", rdb_save_on_shutdown, CFG_MUTABLE),
+    P_STR ("persist", "aof_file", aof_file),
+    P_INT ("persist", "aof_rewrite_size", aof_rewrite_size, 1, 1048576, CFG_MUTABLE),
+    P_BOOL("persist", "aof_auto_rewrite", aof_auto_rewrite, CFG_MUTABLE),
+
+    P_BOOL("replication", "enabled", repl_switch, 0),
+    P_ENUM("replication", "role", repl_role, role_names),
+    P_STR ("replication", "master_ip", master_ip),
+    P_INT ("replication", "master_port", master_port, 0, 65535, 0),
+    { "replication", "backlog_size", CFG_INT, FIELD(repl_backlog_size), 1, 4096, NULL,
+      CFG_MUTABLE, apply_backlog_size },
+    P_INT ("replication", "output_buffer_hard_limit", repl_obuf_hard_limit, 0, 1048576, CFG_MUTABLE),
+    P_INT ("replication", "output_buffer_soft_limit", repl_obuf_soft_limit, 0, 1048576, CFG_MUTABLE),
+    P_INT ("replication", "output_buffer_soft_seconds", repl_obuf_soft_seconds, 0, 86400, CFG_MUTABLE),
+    P_BOOL("replication", "replica_read_only", repl_read_only, CFG_MUTABLE),
+
+    P_ENUM("storage", "engine", storage_engine, engine_names),
+    P_STR ("storage", "bitcask_dir", bitcask_dir),
+    P_INT ("storage", "segment_size", bitcask_segment_size, 1, 4096, 0),
+    P_INT ("storage", "compact_ratio", bitcask_compact_ratio, 1, 100, 0),
+
+    P_BOOL("tier", "enabled", tier_enabled, 0),
+    P_STR ("tier", "dir", tier_dir),
+    P_INT ("tier", "idle_seconds", tier_idle_seconds, 0, 86400 * 365, CFG_MUTABLE),
+    P_INT ("tier", "max_memory", tier_max_memory, 0, 1048576, CFG_MUTABLE),
+    P_INT ("tier", "min_value_size", tier_min_value_size, 0, 1 << 30, CFG_MUTABLE),
+    P_INT ("tier", "sample_size", tier_sample_size, 1, 1024, CFG_MUTABLE),
+    P_INT ("tier", "io_threads", tier_io_threads, 1, 64, 0),
+
+    P_BOOL("cluster", "enabled", cluster_enabled, 0),
+    P_STR ("cluster", "announce_ip", cluster_announce_ip),
+
+    P_BOOL("proxy", "enabled", proxy_enabled, 0),
+    P_INT ("proxy", "connections", proxy_connections, 1, 64, 0),
+
+    P_INT ("slowlog", "log_slower_than", slowlog_log_slower_than, -1, 1000000000, CFG_MUTABLE),
+    P_INT ("slowlog", "max_len", slowlog_max_len, 1, 1000000, CFG_MUTABLE),
+
+    P_BOOL("hotkeys", "enabled", hotkeys_enabled, CFG_MUTABLE),
+    P_INT ("hotkeys", "sample", hotkeys_sample, 1, 1024, CFG_MUTABLE),
+    P_INT ("hotkeys", "top_k", hotkeys_top_k, 1, KVS_HOTKEYS_MAX, CFG_MUTABLE),
+    P_INT ("hotkeys", "decay_seconds", hotkeys_decay_seconds, 0, 86400, CFG_MUTABLE),
+    P_INT ("hotkeys", "big_value_kb", hotkeys_big_value_kb, 0, 1048576, CFG_MUTABLE),
+
+    P_INT ("metrics", "port", metrics_port, 0, 65535, 0),
+};
+
+#define CONFIG_PARAM_COUNT  (int)(sizeof(config_params) / sizeof(config_params[0]))
+
+/* 最近一次加载的配置文件，CONFIG REWRITE 写回这里 */
+static char config_path[512];
+
+static const config_param_t *config_lookup(const char *section, const char *key) {
+    for (int i = 0; i < CONFIG_PARAM_COUNT; i++) {
+        if (strcmp(config_params[i].section, section) == 0 &&
+            strcmp(config_params[i].key, key) == 0)
+            return &config_params[i];
+    }
+    return NULL;
+}
+
+/* "persist.mode" 形式的名字 */
+static const config_param_t *config_lookup_name(const char *name) {
+    const char *dot = strchr(name, '.');
+    char section[32];
+    if (!dot || dot - name >= (int)sizeof(section)) return NULL;
+    memcpy(section, name, dot - name);
+    section[dot - name] = '\0';
+    for (char *p = section; *p; p++) *p = tolower((unsigned char)*p);
+    for (int i = 0; i < CONFIG_PARAM_COUNT; i++) {
+        if (strcmp(config_params[i].section, section) == 0 &&
+            strcasecmp(config_params[i].key, dot + 1) == 0)
+            return &config_params[i];
     }
-    return false;
+    return NULL;
 }
 
-static log_level_t parse_log_level(const char *value) {
-    int level = atoi(value);
-    if (level >= 1 && level <= 3) return (log_level_t)level;
-    return LOG_LEVEL_INFO;
+static int parse_bool(const char *value) {
+    if (strcasecmp(value, "true") == 0 || strcasecmp(value, "yes") == 0 ||
+        strcasecmp(value, "on") == 0 || strcmp(value, "1") == 0)
+        return 1;
+    if (strcasecmp(value, "false") == 0 || strcasecmp(value, "no") == 0 ||
+        strcasecmp(value, "off") == 0 || strcmp(value, "0") == 0)
+        return 0;
+    return -1;
 }
 
-static persist_mode_t parse_persist_mode(const char *value) {
-    int mode = atoi(value);
-    switch (mode) {
-        case 0: return PERSIST_OFF;
-        case 1: return PERSIST_AOF_ONLY;
-        case 2: return PERSIST_RDB_ONLY;
-        case 3: return PERSIST_MIXED;
-        default: return PERSIST_MIXED;
+/*
+ * 校验 value，整数类参数的结果放入 *out。字符串参数只检查长度。
+ * 失败时返回 -1 并在 err 中说明原因。
+ */
+static int config_parse(const config_param_t *p, const char *value, long *out,
+                        char *err, int err_size) {
+    char *end;
+    switch (p->type) {
+    case CFG_INT:
+        errno = 0;
+        *out = strtol(value, &end, 10);
+        if (errno || end == value || *end || *out < p->min || *out > p->max) {
+            snprintf(err, err_size, "must be an integer between %ld and %ld", p->min, p->max);
+            return -1;
+        }
+        return 0;
+    case CFG_BOOL:
+        *out = parse_bool(value);
+        if (*out < 0) {
+            snprintf(err, err_size, "must be true or false");
+            return -1;
+        }
+        return 0;
+    case CFG_ENUM:
+        for (int i = 0; p->names[i]; i++) {
+            if (strcasecmp(value, p->names[i]) == 0 ||
+                (isdigit((unsigned char)value[0]) && !value[1] && value[0] - '0' == i)) {
+                *out = i;
+                return 0;
+            }
+        }
+        snprintf(err, err_size, "must be %s or %s", p->names[0], p->names[1]);
+        return -1;
+    case CFG_STRING:
+        if (strlen(value) >= p->size) {
+            snprintf(err, err_size, "longer than %zu bytes", p->size - 1);
+            return -1;
+        }
+        return 0;
     }
+    return -1;
 }
 
-static server_role_t parse_role(const char *value) {
-    if (strcasecmp(value, "master") == 0 || strcmp(value, "0") == 0)
-        return ROLE_MASTER;
-    else if (strcasecmp(value, "slave") == 0 || strcmp(value, "1") == 0)
-        return ROLE_SLAVE;
-    return ROLE_MASTER;
+static long config_read(const config_param_t *p, const kvs_config_t *c) {
+    const char *field = (const char *)c + p->offset;
+    if (p->size == sizeof(bool)) return *(const bool *)field;
+    return *(const int *)field;
 }
 
-static repl_switch_t parse_repl_switch(const char *value) {
-    return parse_bool(value) ? REPL_ON : REPL_OFF;
+static void config_store(const config_param_t *p, const char *value, long v) {
+    char *field = (char *)&g_config + p->offset;
+    if (p->type == CFG_STRING) {
+        strcpy(field, value);
+    } else if (p->size == sizeof(bool)) {
+        __atomic_store_n((bool *)field, v != 0, __ATOMIC_RELAXED);
+    } else {
+        __atomic_store_n((int *)field, (int)v, __ATOMIC_RELAXED);
+    }
+}
+
+static int config_format(const config_param_t *p, const kvs_config_t *c, char *buf, int size) {
+    const char *field = (const char *)c + p->offset;
+    switch (p->type) {
+    case CFG_STRING: return snprintf(buf, size, "%s", field);
+    case CFG_BOOL:   return snprintf(buf, size, "%s", config_read(p, c) ? "true" : "false");
+    case CFG_ENUM:   return snprintf(buf, size, "%s", p->names[config_read(p, c)]);
+    default:         return snprintf(buf, size, "%ld", config_read(p, c));
+    }
+}
+
+/* 文件中的 key = value 是否就是 c 中的值 */
+static int config_line_matches(const config_param_t *p, const char *value, const kvs_config_t *c) {
+    char err[128];
+    long v;
+    if (config_parse(p, value, &v, err, sizeof(err)) < 0) return 0;
+    if (p->type == CFG_STRING) return strcmp(value, (const char *)c + p->offset) == 0;
+    return v == config_read(p, c);
+}
+
+/* 去掉首尾空白；返回 key，value 通过 *value 返回；注释、空行和段头返回 NULL */
+static char *split_line(char *line, char **value) {
+    char *equals = strchr(line, '=');
+    if (!equals || *line == '#' || *line == ';' || *line == '[') return NULL;
+    *equals = '\0';
+    *value = trim(equals + 1);
+    return trim(line);
 }
 
 int kvs_config_load(const char *filename) {
@@ -85,16 +348,15 @@ int kvs_config_load(const char *filename) {
     }
 
     printf("[Config] Loading from: %s\n", filename);
+    snprintf(config_path, sizeof(config_path), "%s", filename);
 
     char line[512];
     char current_section[64] = "";
+    int lineno = 0;
 
     while (fgets(line, sizeof(line), fp)) {
-        char *p = line;
-        while (*p && isspace((unsigned char)*p)) p++;
-        if (*p == '#' || *p == ';' || *p == '\n' || *p == '\0')
-            continue;
-
+        lineno++;
+        char *p = trim(line);
         if (*p == '[') {
             char *end = strchr(p, ']');
             if (end) {
@@ -104,56 +366,188 @@ int kvs_config_load(const char *filename) {
             continue;
         }
 
-        char *equals = strchr(p, '=');
-        if (!equals) continue;
-
-        *equals = '\0';
-        char *key = trim(p);
-        char *value = trim(equals + 1);
+        char *value;
+        char *key = split_line(p, &value);
+        if (!key) continue;
 
-        if (strcmp(current_section, "server") == 0) {
-            if (strcmp(key, "port") == 0) {
-                g_config.port = atoi(value);
-            } else if (strcmp(key, "log_level") == 0) {
-                g_config.log_level = parse_log_level(value);
+        /* 可重复出现的列表项：每行描述一个节点及其槽位 / 一个后端 */
+        if (strcmp(current_section, "cluster") == 0 && strcmp(key, "node") == 0) {
+            if (g_config.cluster_node_count < KVS_CONFIG_MAX_NODES) {
+                char *dst = g_config.cluster_nodes[g_config.cluster_node_count++];
+                strncpy(dst, value, sizeof(g_config.cluster_nodes[0])-1);
             }
+            continue;
         }
-        else if (strcmp(current_section, "persist") == 0) {
-            if (strcmp(key, "mode") == 0) {
-                g_config.persist_mode = parse_persist_mode(value);
-            } else if (strcmp(key, "rdb_file") == 0) {
-                strncpy(g_config.rdb_file, value, sizeof(g_config.rdb_file)-1);
-            } else if (strcmp(key, "rdb_save_interval") == 0) {
-                g_config.rdb_save_interval = atoi(value);
-            } else if (strcmp(key, "rdb_min_changes") == 0) {
-                g_config.rdb_min_changes = atoi(value);
-            } else if (strcmp(key, "rdb_save_on_shutdown") == 0) {
-                g_config.rdb_save_on_shutdown = parse_bool(value);
-            } else if (strcmp(key, "aof_file") == 0) {
-                strncpy(g_config.aof_file, value, sizeof(g_config.aof_file)-1);
-            } else if (strcmp(key, "aof_rewrite_size") == 0) {
-                g_config.aof_rewrite_size = atoi(value);
-            } else if (strcmp(key, "aof_auto_rewrite") == 0) {
-                g_config.aof_auto_rewrite = parse_bool(value);
+        if (strcmp(current_section, "proxy") == 0 && strcmp(key, "backend") == 0) {
+            if (g_config.proxy_backend_count < KVS_CONFIG_MAX_NODES) {
+                char *dst = g_config.proxy_backends[g_config.proxy_backend_count++];
+                strncpy(dst, value, sizeof(g_config.proxy_backends[0])-1);
             }
+            continue;
         }
-        else if (strcmp(current_section, "replication") == 0) {
-            if (strcmp(key, "enabled") == 0) {
-                g_config.repl_switch = parse_repl_switch(value);
-            } else if (strcmp(key, "role") == 0) {
-                g_config.repl_role = parse_role(value);
-            } else if (strcmp(key, "master_ip") == 0) {
-                strncpy(g_config.master_ip, value, sizeof(g_config.master_ip)-1);
-            } else if (strcmp(key, "master_port") == 0) {
-                g_config.master_port = atoi(value);
-            }
+
+        const config_param_t *param = config_lookup(current_section, key);
+        if (!param) continue;
+        char err[128];
+        long v;
+        if (config_parse(param, value, &v, err, sizeof(err)) < 0) {
+            printf("[Config] %s:%d: %s.%s %s, ignored\n", filename, lineno,
+                   param->section, param->key, err);
+            continue;
         }
+        config_store(param, value, v);
     }
 
     fclose(fp);
     return 0;
 }
 
+/*
+ * 当前值不是默认值时写出 "key = value" 并返回 1。open_section 非空时，
+ * 参数所在段与 *open_section 不同则先写段头。
+ */
+static int config_write_changed(FILE *out, const config_param_t *p, const kvs_config_t *defaults,
+                                const char **open_section) {
+    char cur[256], def[256];
+    config_format(p, &g_config, cur, sizeof(cur));
+    config_format(p, defaults, def, sizeof(def));
+    if (strcmp(cur, def) == 0) return 0;
+    if (open_section && (!*open_section || strcmp(*open_section, p->section) != 0)) {
+        fprintf(out, "\n[%s]\n", p->section);
+        *open_section = p->section;
+    }
+    fprintf(out, "%s = %s\n", p->key, cur);
+    return 1;
+}
+
+/*
+ * 把当前值写回配置文件：已有的行原地替换，注释和顺序保持不变；文件里没有、
+ * 且不是默认值的参数追加到所在段的末尾（段不存在时新建）。写临时文件后 rename。
+ */
+static int config_rewrite(char *err, int err_size) {
+    if (!config_path[0]) {
+        snprintf(err, err_size, "The server is running without a config file");
+        return -1;
+    }
+
+    kvs_config_t defaults;
+    config_defaults(&defaults);
+
+    FILE *in = fopen(config_path, "r");
+    char **lines = NULL;
+    int nlines = 0, cap = 0;
+    if (in) {
+        char *line = NULL;
+        size_t n = 0;
+        while (getline(&line, &n, in) > 0) {
+            if (nlines == cap) {
+                cap = cap ? cap * 2 : 64;
+                lines = realloc(lines, sizeof(char *) * cap);
+            }
+            lines[nlines++] = strdup(line);
+        }
+        free(line);
+        fclose(in);
+    }
+
+    /* 第一遍：每个参数是否已出现在文件中 */
+    char seen[CONFIG_PARAM_COUNT];
+    memset(seen, 0, sizeof(seen));
+    char section[64] = "";
+    for (int i = 0; i < nlines; i++) {
+        char buf[512], *value;
+        snprintf(buf, sizeof(buf), "%s", lines[i]);
+        char *p = trim(buf);
+        if (*p == '[') {
+            char *end = strchr(p, ']');
+            if (end) *end = '\0';
+            snprintf(section, sizeof(section), "%s", p + 1);
+            continue;
+        }
+        char *key = split_line(p, &value);
+        const config_param_t *param = key ? config_lookup(section, key) : NULL;
+        if (param) seen[param - config_params] = 1;
+    }
+
+    char tmpfile[600];
+    snprintf(tmpfile, sizeof(tmpfile), "%s.tmp", config_path);
+    FILE *out = fopen(tmpfile, "w");
+    int ret = -1;
+    if (!out) {
+        snprintf(err, err_size, "Cannot write %.96s: %s", tmpfile, strerror(errno));
+        goto done;
+    }
+
+    /*
+     * 第二遍：替换值已改变的行。段尾的空行先暂存，遇到下一个段头时
+     * 把该段缺少的参数写在空行之前。
+     */
+    section[0] = '\0';
+    int blank = 0;
+    for (int i = 0; i <= nlines; i++) {
+        char buf[512], *value;
+        char *p = "";
+        if (i < nlines) {
+            snprintf(buf, sizeof(buf), "%s", lines[i]);
+            p = trim(buf);
+            if (!*p) {
+                blank++;
+                continue;
+            }
+        }
+        if (i == nlines || *p == '[') {
+            for (int k = 0; k < CONFIG_PARAM_COUNT; k++) {
+                if (seen[k] || strcmp(config_params[k].section, section) != 0) continue;
+                if (config_write_changed(out, &config_params[k], &defaults, NULL)) seen[k] = 1;
+            }
+        }
+        for (; blank > 0; blank--) fputc('\n', out);
+        if (i == nlines) break;
+
+        if (*p == '[') {
+            char *end = strchr(p, ']');
+            if (end) *end = '\0';
+            snprintf(section, sizeof(section), "%s", p + 1);
+            fputs(lines[i], out);
+            continue;
+        }
+        char *key = split_line(p, &value);
+        const config_param_t *param = key ? config_lookup(section, key) : NULL;
+        if (param && !config_line_matches(param, value, &g_config)) {
+            char cur[256];
+            config_format(param, &g_config, cur, sizeof(cur));
+            fprintf(out, "%s = %s\n", param->key, cur);
+        } else {
+            fputs(lines[i], out);
+        }
+    }
+
+    /* 文件中没有的段 */
+    const char *open_section = NULL;
+    for (int k = 0; k < CONFIG_PARAM_COUNT; k++) {
+        if (!seen[k]) config_write_changed(out, &config_params[k], &defaults, &open_section);
+    }
+
+    if (fflush(out) != 0 || fsync(fileno(out)) != 0) {
+        snprintf(err, err_size, "Cannot write %.96s: %s", tmpfile, strerror(errno));
+        fclose(out);
+        unlink(tmpfile);
+        goto done;
+    }
+    fclose(out);
+    if (rename(tmpfile, config_path) < 0) {
+        snprintf(err, err_size, "Cannot replace %.96s: %s", config_path, strerror(errno));
+        unlink(tmpfile);
+        goto done;
+    }
+    ret = 0;
+
+done:
+    for (int i = 0; i < nlines; i++) free(lines[i]);
+    free(lines);
+    return ret;
+}
+
 const char* kvs_config_find(void) {
     if (access("./kvstore.conf", F_OK) == 0) {
         return "./kvstore.conf";
@@ -180,6 +574,16 @@ void kvs_config_print(void) {
     printf("Server:\n");
     printf("  port = %d\n", g_config.port);
     printf("  log_level = %d\n", g_config.log_level);
+    printf("  log_file = %s\n", g_config.log_file[0] ? g_config.log_file : "(stdout)");
+    printf("  log_rate_limit = %d/s\n", g_config.log_rate_limit);
+    printf("  watchdog_ms = %d\n", g_config.watchdog_ms);
+    printf("  command_budget = %d\n", g_config.command_budget);
+    printf("  output_buffer_limit = %d MB hard, %d MB soft for %d s\n",
+           g_config.client_obuf_hard_limit, g_config.client_obuf_soft_limit,
+           g_config.client_obuf_soft_seconds);
+    printf("  query_buffer_limit = %d MB\n", g_config.query_buffer_limit);
+    if (g_config.unixsocket[0])
+        printf("  unixsocket = %s (%s)\n", g_config.unixsocket, g_config.unixsocket_perm);
 
     printf("Persistence:\n");
     printf("  mode = %d\n", g_config.persist_mode);
@@ -198,28 +602,182 @@ void kvs_config_print(void) {
         printf("  master_ip = %s\n", g_config.master_ip);
         printf("  master_port = %d\n", g_config.master_port);
     }
+    printf("  backlog_size = %d MB\n", g_config.repl_backlog_size);
+    printf("  output_buffer_limit = %d MB hard, %d MB soft for %d s\n",
+           g_config.repl_obuf_hard_limit, g_config.repl_obuf_soft_limit,
+           g_config.repl_obuf_soft_seconds);
+    printf("  replica_read_only = %s\n", g_config.repl_read_only ? "true" : "false");
+
+    printf("Storage:\n");
+    printf("  engine = %s\n", g_config.storage_engine == STORAGE_BITCASK ? "bitcask" : "memory");
+    if (g_config.storage_engine == STORAGE_BITCASK) {
+        printf("  bitcask_dir = %s\n", g_config.bitcask_dir);
+        printf("  segment_size = %d MB\n", g_config.bitcask_segment_size);
+        printf("  compact_ratio = %d%%\n", g_config.bitcask_compact_ratio);
+    }
+
+    printf("Tier:\n");
+    printf("  enabled = %s\n", g_config.tier_enabled ? "true" : "false");
+    if (g_config.tier_enabled) {
+        printf("  dir = %s\n", g_config.tier_dir);
+        printf("  idle_seconds = %d\n", g_config.tier_idle_seconds);
+        printf("  max_memory = %d MB\n", g_config.tier_max_memory);
+        printf("  min_value_size = %d\n", g_config.tier_min_value_size);
+        printf("  sample_size = %d\n", g_config.tier_sample_size);
+        printf("  io_threads = %d\n", g_config.tier_io_threads);
+    }
+
+    printf("Cluster:\n");
+    printf("  enabled = %s\n", g_config.cluster_enabled ? "true" : "false");
+    if (g_config.cluster_enabled) {
+        printf("  announce_ip = %s\n", g_config.cluster_announce_ip);
+        for (int i = 0; i < g_config.cluster_node_count; i++)
+            printf("  node = %s\n", g_config.cluster_nodes[i]);
+    }
+
+    printf("Proxy:\n");
+    printf("  enabled = %s\n", g_config.proxy_enabled ? "true" : "false");
+    if (g_config.proxy_enabled) {
+        for (int i = 0; i < g_config.proxy_backend_count; i++)
+            printf("  backend = %s\n", g_config.proxy_backends[i]);
+        printf("  connections = %d\n", g_config.proxy_connections);
+    }
+
+    printf("Slowlog:\n");
+    printf("  log_slower_than = %d us\n", g_config.slowlog_log_slower_than);
+    printf("  max_len = %d\n", g_config.slowlog_max_len);
+
+    printf("Hotkeys:\n");
+    printf("  enabled = %s\n", g_config.hotkeys_enabled ? "true" : "false");
+    if (g_config.hotkeys_enabled) {
+        printf("  sample = 1/%d\n", g_config.hotkeys_sample);
+        printf("  top_k = %d\n", g_config.hotkeys_top_k);
+        printf("  decay_seconds = %d\n", g_config.hotkeys_decay_seconds);
+        printf("  big_value_kb = %d\n", g_config.hotkeys_big_value_kb);
+    }
+
+    printf("Metrics:\n");
+    printf("  port = %d\n", g_config.metrics_port);
     printf("============================================\n\n");
 }
 
-void kvs_log(log_level_t level, const char *format, ...) {
-    if (level > g_config.log_level) return;
-
-    va_list args;
-    va_start(args, format);
-
-    switch (level) {
-        case LOG_LEVEL_INFO:
-            printf("[INFO] ");
-            break;
-        case LOG_LEVEL_WARN:
-            printf("[WARN] ");
-            break;
-        case LOG_LEVEL_DEBUG:
-            printf("[DEBUG] ");
-            break;
-        default:
-            break;
-    }
-    vprintf(format, args);
-    va_end(args);
-}
\ No newline at end of file
+static int bulk(char *p, const char *data, size_t len) {
+    int n = sprintf(p, "$%zu\r\n", len);
+    memcpy(p + n, data, len);
+    n += len;
+    p[n++] = '\r';
+    p[n++] = '\n';
+    return n;
+}
+
+static int config_matches(const config_param_t *p, char **patterns, int count) {
+    char name[96];
+    snprintf(name, sizeof(name), "%s.%s", p->section, p->key);
+    for (int i = 0; i < count; i++) {
+        if (fnmatch(patterns[i], name, FNM_CASEFOLD) == 0) return 1;
+    }
+    return 0;
+}
+
+/* CONFIG GET pattern [pattern ...]：名字与值交替的数组 */
+static int config_get_reply(char **patterns, int count, char *resp, int resp_size, int *needed) {
+    char value[300];
+    int matched = 0, need = 32;
+    for (int i = 0; i < CONFIG_PARAM_COUNT; i++) {
+        if (!config_matches(&config_params[i], patterns, count)) continue;
+        matched++;
+        need += 2 * 32 + (int)sizeof(value);
+    }
+    if (need > resp_size) {
+        *needed = need;
+        return -2;
+    }
+
+    char *p = resp + sprintf(resp, "*%d\r\n", matched * 2);
+    for (int i = 0; i < CONFIG_PARAM_COUNT; i++) {
+        const config_param_t *param = &config_params[i];
+        if (!config_matches(param, patterns, count)) continue;
+        char name[96];
+        int n = snprintf(name, sizeof(name), "%s.%s", param->section, param->key);
+        p += bulk(p, name, n);
+        n = config_format(param, &g_config, value, sizeof(value));
+        p += bulk(p, value, n);
+    }
+    return p - resp;
+}
+
+#define CONFIG_SET_MAX_PAIRS    16
+#define CONFIG_REPLY_MAX        512     /* SET / REWRITE 的回复上限 */
+
+/*
+ * CONFIG SET name value [name value ...]：先校验全部参数，任何一个无效都不做修改；
+ * 然后逐个写入并调用 apply，apply 失败时恢复该参数并停止。
+ */
+static int config_set_reply(char **argv, int argc, char *resp) {
+    const config_param_t *params[CONFIG_SET_MAX_PAIRS];
+    long values[CONFIG_SET_MAX_PAIRS];
+    char err[160];
+    int pairs = (argc - 2) / 2;
+
+    if (argc < 4 || (argc - 2) % 2 != 0)
+        return sprintf(resp, "-ERR wrong number of arguments for 'config|set' command\r\n");
+    if (pairs > CONFIG_SET_MAX_PAIRS)
+        return sprintf(resp, "-ERR at most %d parameters per CONFIG SET\r\n", CONFIG_SET_MAX_PAIRS);
+
+    for (int i = 0; i < pairs; i++) {
+        const char *name = argv[2 + i * 2], *value = argv[3 + i * 2];
+        params[i] = config_lookup_name(name);
+        if (!params[i])
+            return snprintf(resp, CONFIG_REPLY_MAX, "-ERR Unknown option '%.64s'\r\n", name);
+        if (!(params[i]->flags & CFG_MUTABLE))
+            return snprintf(resp, CONFIG_REPLY_MAX, "-ERR '%s.%s' can only be changed in the config file\r\n",
+                            params[i]->section, params[i]->key);
+        if (config_parse(params[i], value, &values[i], err, sizeof(err)) < 0)
+            return snprintf(resp, CONFIG_REPLY_MAX, "-ERR Invalid argument '%.32s' for '%s.%s': %s\r\n",
+                            value, params[i]->section, params[i]->key, err);
+    }
+
+    for (int i = 0; i < pairs; i++) {
+        const config_param_t *param = params[i];
+        kvs_config_t old = g_config;
+        config_store(param, argv[3 + i * 2], values[i]);
+        if (param->apply && param->apply(&old, err, sizeof(err)) < 0) {
+            config_store(param, NULL, config_read(param, &old));
+            return snprintf(resp, CONFIG_REPLY_MAX, "-ERR Failed to apply '%s.%s': %s\r\n",
+                            param->section, param->key, err);
+        }
+        LOG_INFO("[Config] %s.%s = %s\n", param->section, param->key, argv[3 + i * 2]);
+    }
+    return sprintf(resp, "+OK\r\n");
+}
+
+int kvs_config_command_reply(char **argv, size_t *lens, int argc,
+                             char *resp, int resp_size, int *needed) {
+    (void)lens;
+    if (argc < 2)
+        return sprintf(resp, "-ERR wrong number of arguments for 'config' command\r\n");
+
+    if (resp_size < CONFIG_REPLY_MAX) {
+        *needed = CONFIG_REPLY_MAX;
+        return -2;
+    }
+
+    if (strcasecmp(argv[1], "GET") == 0) {
+        if (argc < 3)
+            return sprintf(resp, "-ERR wrong number of arguments for 'config|get' command\r\n");
+        return config_get_reply(argv + 2, argc - 2, resp, resp_size, needed);
+    }
+
+    if (strcasecmp(argv[1], "SET") == 0)
+        return config_set_reply(argv, argc, resp);
+
+    if (strcasecmp(argv[1], "REWRITE") == 0) {
+        char err[160];
+        if (config_rewrite(err, sizeof(err)) < 0)
+            return snprintf(resp, CONFIG_REPLY_MAX, "-ERR %s\r\n", err);
+        LOG_INFO("[Config] Rewritten %s\n", config_path);
+        return sprintf(resp, "+OK\r\n");
+    }
+
+    return sprintf(resp, "-ERR Try CONFIG GET|SET|REWRITE\r\n");
+}
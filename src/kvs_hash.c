@@ -1,13 +1,23 @@
 #include "../include/kvstore.h"
 #include "../include/kvs_hash.h"
 #include "../include/kvs_base.h"
+#include "../include/kvs_bitcask.h"
 
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <time.h>
 
 kvs_hash_t global_hash;
 
+#define BITCASK_COMPACT_BUDGET  (8 * 1024 * 1024)
+
+static uint32_t _clock_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)ts.tv_sec;
+}
+
 static int _hash(const void *key, size_t len, int size) {
     unsigned int hash = 5381;
     const unsigned char *p = key;
@@ -21,8 +31,46 @@ static int key_equal(const void *k1, size_t len1, const void *k2, size_t len2) {
     return (len1 == len2) && (memcmp(k1, k2, len1) == 0);
 }
 
-static hashnode_t *_create_node(const void *key, size_t key_len, const void *val, size_t val_len) {
-    hashnode_t *node = (hashnode_t*)kvs_malloc(sizeof(hashnode_t));
+static void _release_value(kvs_hash_t *hash, hashnode_t *node) {
+    if (node->flags & HASHNODE_ON_DISK) {
+        kvs_bitcask_mark_dead(hash->bc, node->seg_id,
+                              BITCASK_REC_SIZE(node->key_len, node->value_len));
+        node->flags &= ~HASHNODE_ON_DISK;
+    } else if (node->value) {
+        kvs_free(node->value);
+        hash->mem_bytes -= node->value_len;
+    }
+    node->value = NULL;
+}
+
+static int _store_value(kvs_hash_t *hash, hashnode_t *node, const void *val, size_t val_len) {
+    node->atime = hash->clock;
+    if (hash->bc && !hash->tiered) {
+        uint32_t seg_id;
+        uint64_t seg_off;
+        if (kvs_bitcask_append(hash->bc, node->key, node->key_len, val, val_len,
+                               &seg_id, &seg_off) < 0)
+            return -1;
+        _release_value(hash, node);
+        node->seg_id = seg_id;
+        node->seg_off = seg_off;
+        node->flags |= HASHNODE_ON_DISK;
+        node->value_len = val_len;
+        return 0;
+    }
+
+    void *copy = kvs_malloc(val_len);
+    if (!copy) return -1;
+    memcpy(copy, val, val_len);
+    _release_value(hash, node);
+    node->value = copy;
+    node->value_len = val_len;
+    hash->mem_bytes += val_len;
+    return 0;
+}
+
+static hashnode_t *_create_node(const void *key, size_t key_len) {
+    hashnode_t *node = (hashnode_t*)kvs_calloc(sizeof(hashnode_t));
     if (!node) return NULL;
 
     node->key = kvs_malloc(key_len);
@@ -32,20 +80,40 @@ static hashnode_t *_create_node(const void *key, size_t key_len, const void *val
     }
     memcpy(node->key, key, key_len);
     node->key_len = key_len;
+    return node;
+}
 
-    node->value = kvs_malloc(val_len);
-    if (!node->value) {
-        kvs_free(node->key);
-        kvs_free(node);
-        return NULL;
-    }
-    memcpy(node->value, val, val_len);
-    node->value_len = val_len;
+static void _free_node(kvs_hash_t *hash, hashnode_t *node) {
+    _release_value(hash, node);
+    kvs_free(node->key);
+    kvs_free(node);
+}
 
-    node->next = NULL;
+static hashnode_t *_insert_node(kvs_hash_t *hash, int idx, const void *key, size_t key_len) {
+    hashnode_t *node = _create_node(key, key_len);
+    if (!node) return NULL;
+    node->next = hash->nodes[idx];
+    hash->nodes[idx] = node;
+    hash->count++;
     return node;
 }
 
+static int _remove_node(kvs_hash_t *hash, const void *key, size_t key_len) {
+    int idx = _hash(key, key_len, hash->max_slots);
+    hashnode_t **pp = &hash->nodes[idx];
+    while (*pp) {
+        hashnode_t *curr = *pp;
+        if (key_equal(curr->key, curr->key_len, key, key_len)) {
+            *pp = curr->next;
+            _free_node(hash, curr);
+            hash->count--;
+            return 0;
+        }
+        pp = &curr->next;
+    }
+    return -1;
+}
+
 int kvs_hash_create(kvs_hash_t *hash) {
     if (!hash) return -1;
     hash->nodes = (hashnode_t**)kvs_malloc(sizeof(hashnode_t*) * MAX_TABLE_SIZE);
@@ -53,6 +121,10 @@ int kvs_hash_create(kvs_hash_t *hash) {
     for (int i = 0; i < MAX_TABLE_SIZE; i++) hash->nodes[i] = NULL;
     hash->max_slots = MAX_TABLE_SIZE;
     hash->count = 0;
+    hash->bc = NULL;
+    hash->tiered = 0;
+    hash->clock = _clock_now();
+    hash->mem_bytes = 0;
     return 0;
 }
 
@@ -63,51 +135,77 @@ void kvs_hash_destroy(kvs_hash_t *hash) {
         while (node) {
             hashnode_t *tmp = node;
             node = node->next;
+            if (!(tmp->flags & HASHNODE_ON_DISK)) kvs_free(tmp->value);
             kvs_free(tmp->key);
-            kvs_free(tmp->value);
             kvs_free(tmp);
         }
     }
     kvs_free(hash->nodes);
     hash->nodes = NULL;
     hash->count = 0;
+    hash->mem_bytes = 0;
+    if (hash->bc) {
+        kvs_bitcask_close(hash->bc);
+        hash->bc = NULL;
+    }
 }
 
-int kvs_hash_set(kvs_hash_t *hash, const void *key, size_t key_len, const void *val, size_t val_len) {
-    if (!hash || !key || !val) return -1;
-    int idx = _hash(key, key_len, hash->max_slots);
+/* 清空所有 key，bitcask 引擎下为每个 key 追加墓碑 */
+void kvs_hash_flush(kvs_hash_t *hash) {
+    if (!hash || !hash->nodes) return;
+    for (int i = 0; i < hash->max_slots; i++) {
+        hashnode_t *node = hash->nodes[i];
+        while (node) {
+            hashnode_t *tmp = node;
+            node = node->next;
+            if (hash->bc && !hash->tiered)
+                kvs_bitcask_append_tombstone(hash->bc, tmp->key, tmp->key_len);
+            _free_node(hash, tmp);
+        }
+        hash->nodes[i] = NULL;
+    }
+    hash->count = 0;
+}
 
+hashnode_t *kvs_hash_lookup(kvs_hash_t *hash, const void *key, size_t key_len) {
+    if (!hash || !key) return NULL;
+    int idx = _hash(key, key_len, hash->max_slots);
     hashnode_t *node = hash->nodes[idx];
     while (node) {
-        if (key_equal(node->key, node->key_len, key, key_len)) {
-            kvs_free(node->value);
-            node->value = kvs_malloc(val_len);
-            if (!node->value) return -1;
-            memcpy(node->value, val, val_len);
-            node->value_len = val_len;
-            return 0;
-        }
+        if (key_equal(node->key, node->key_len, key, key_len)) return node;
         node = node->next;
     }
+    return NULL;
+}
 
-    hashnode_t *new_node = _create_node(key, key_len, val, val_len);
-    if (!new_node) return -1;
-    new_node->next = hash->nodes[idx];
-    hash->nodes[idx] = new_node;
-    hash->count++;
+const void *kvs_hash_node_value(kvs_hash_t *hash, hashnode_t *node) {
+    if (node->flags & HASHNODE_ON_DISK)
+        return kvs_bitcask_read(hash->bc, node->seg_id, node->seg_off, node->value_len);
+    return node->value;
+}
+
+int kvs_hash_set(kvs_hash_t *hash, const void *key, size_t key_len, const void *val, size_t val_len) {
+    if (!hash || !key || !val) return -1;
+
+    hashnode_t *node = kvs_hash_lookup(hash, key, key_len);
+    if (node) return _store_value(hash, node, val, val_len);
+
+    node = _insert_node(hash, _hash(key, key_len, hash->max_slots), key, key_len);
+    if (!node) return -1;
+    if (_store_value(hash, node, val, val_len) < 0) {
+        _remove_node(hash, key, key_len);
+        return -1;
+    }
     return 0;
 }
 
 void *kvs_hash_get(kvs_hash_t *hash, const void *key, size_t key_len, size_t *val_len) {
-    if (!hash || !key) return NULL;
-    int idx = _hash(key, key_len, hash->max_slots);
-    hashnode_t *node = hash->nodes[idx];
-    while (node) {
-        if (key_equal(node->key, node->key_len, key, key_len)) {
-            *val_len = node->value_len;
-            return node->value;
-        }
-        node = node->next;
+    hashnode_t *node = kvs_hash_lookup(hash, key, key_len);
+    if (node) {
+        node->atime = hash->clock;
+        const void *val = kvs_hash_node_value(hash, node);
+        *val_len = val ? node->value_len : 0;
+        return (void *)val;
     }
     *val_len = 0;
     return NULL;
@@ -115,57 +213,74 @@ void *kvs_hash_get(kvs_hash_t *hash, const void *key, size_t key_len, size_t *va
 
 int kvs_hash_del(kvs_hash_t *hash, const void *key, size_t key_len) {
     if (!hash || !key) return -2;
-    int idx = _hash(key, key_len, hash->max_slots);
-    hashnode_t *head = hash->nodes[idx];
-    if (!head) return -1;
-
-    if (key_equal(head->key, head->key_len, key, key_len)) {
-        hash->nodes[idx] = head->next;
-        kvs_free(head->key);
-        kvs_free(head->value);
-        kvs_free(head);
-        hash->count--;
-        return 0;
-    }
-
-    hashnode_t *prev = head;
-    hashnode_t *curr = head->next;
-    while (curr) {
-        if (key_equal(curr->key, curr->key_len, key, key_len)) {
-            prev->next = curr->next;
-            kvs_free(curr->key);
-            kvs_free(curr->value);
-            kvs_free(curr);
-            hash->count--;
-            return 0;
-        }
-        prev = curr;
-        curr = curr->next;
-    }
-    return -1;
+    if (!kvs_hash_lookup(hash, key, key_len)) return -1;
+    if (hash->bc && !hash->tiered && kvs_bitcask_append_tombstone(hash->bc, key, key_len) < 0)
+        return -2;
+    return _remove_node(hash, key, key_len);
 }
 
 int kvs_hash_mod(kvs_hash_t *hash, const void *key, size_t key_len, const void *val, size_t val_len) {
     if (!hash || !key || !val) return -1;
-    int idx = _hash(key, key_len, hash->max_slots);
-    hashnode_t *node = hash->nodes[idx];
-    while (node) {
-        if (key_equal(node->key, node->key_len, key, key_len)) {
-            kvs_free(node->value);
-            node->value = kvs_malloc(val_len);
-            if (!node->value) return -1;
-            memcpy(node->value, val, val_len);
-            node->value_len = val_len;
-            return 0;
-        }
-        node = node->next;
-    }
-    return 1;
+    hashnode_t *node = kvs_hash_lookup(hash, key, key_len);
+    if (!node) return 1;
+    return _store_value(hash, node, val, val_len);
 }
 
 int kvs_hash_exist(kvs_hash_t *hash, const void *key, size_t key_len) {
-    size_t dummy;
-    return (kvs_hash_get(hash, key, key_len, &dummy) != NULL) ? 0 : 1;
+    return kvs_hash_lookup(hash, key, key_len) ? 0 : 1;
+}
+
+int kvs_hash_index(kvs_hash_t *hash, const void *key, size_t key_len,
+                   uint32_t seg_id, uint64_t seg_off, size_t val_len) {
+    hashnode_t *node = kvs_hash_lookup(hash, key, key_len);
+    if (node) {
+        _release_value(hash, node);
+    } else {
+        node = _insert_node(hash, _hash(key, key_len, hash->max_slots), key, key_len);
+        if (!node) return -1;
+    }
+    node->seg_id = seg_id;
+    node->seg_off = seg_off;
+    node->value_len = val_len;
+    node->flags |= HASHNODE_ON_DISK;
+    return 0;
+}
+
+int kvs_hash_unindex(kvs_hash_t *hash, const void *key, size_t key_len) {
+    return _remove_node(hash, key, key_len);
+}
+
+int kvs_hash_spill(kvs_hash_t *hash, hashnode_t *node) {
+    uint32_t seg_id;
+    uint64_t seg_off;
+    if (!hash->bc || (node->flags & HASHNODE_ON_DISK)) return -1;
+    if (kvs_bitcask_append(hash->bc, node->key, node->key_len, node->value,
+                           node->value_len, &seg_id, &seg_off) < 0)
+        return -1;
+    _release_value(hash, node);
+    node->seg_id = seg_id;
+    node->seg_off = seg_off;
+    node->flags |= HASHNODE_ON_DISK;
+    return 0;
+}
+
+int kvs_hash_promote(kvs_hash_t *hash, hashnode_t *node, const void *val) {
+    if (!(node->flags & HASHNODE_ON_DISK)) return 0;
+    void *copy = kvs_malloc(node->value_len);
+    if (!copy) return -1;
+    memcpy(copy, val, node->value_len);
+    _release_value(hash, node);
+    node->value = copy;
+    node->atime = hash->clock;
+    hash->mem_bytes += node->value_len;
+    return 0;
+}
+
+void kvs_hash_cron(kvs_hash_t *hash) {
+    hash->clock = _clock_now();
+    /* 分层模式下由 tier 模块在没有在途读取时驱动压缩 */
+    if (hash->bc && !hash->tiered)
+        kvs_bitcask_compact_step(hash->bc, hash, BITCASK_COMPACT_BUDGET);
 }
 
 void kvs_hash_foreach(kvs_hash_t *T,
@@ -175,7 +290,8 @@ void kvs_hash_foreach(kvs_hash_t *T,
     for (int i = 0; i < T->max_slots; i++) {
         hashnode_t *node = T->nodes[i];
         while (node) {
-            cb(node->key, node->key_len, node->value, node->value_len, arg);
+            const void *val = kvs_hash_node_value(T, node);
+            if (val) cb(node->key, node->key_len, val, node->value_len, arg);
             node = node->next;
         }
     }
@@ -188,10 +304,12 @@ int kvs_hash_save(kvs_hash_t *hash, const char *filename) {
     for (int i = 0; i < hash->max_slots; i++) {
         hashnode_t *node = hash->nodes[i];
         while (node) {
+            const void *val = kvs_hash_node_value(hash, node);
+            if (!val) goto error;
             if (fwrite(&node->key_len, sizeof(size_t), 1, fp) != 1) goto error;
             if (fwrite(node->key, 1, node->key_len, fp) != node->key_len) goto error;
             if (fwrite(&node->value_len, sizeof(size_t), 1, fp) != 1) goto error;
-            if (fwrite(node->value, 1, node->value_len, fp) != node->value_len) goto error;
+            if (fwrite(val, 1, node->value_len, fp) != node->value_len) goto error;
             node = node->next;
         }
     }
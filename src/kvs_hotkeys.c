@@ -0,0 +1,368 @@
+#include "../include/kvs_base.h"
+#include "../include/kvs_hotkeys.h"
+#include "../include/kvs_hash.h"
+#include "../include/kvs_latency.h"
+#include "../include/kvs_configure.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <time.h>
+
+/*
+ * 热 key：按 1/sample 随机抽样的访问计入 count-min sketch，估计值超过 top-K
+ * 小顶堆堆顶的 key 才进入堆，冷 key 在命令路径上只付出一次哈希和 4 次计数器
+ * 自增。计数器采用保守更新（只增加等于最小值的行），并定期减半，反映的是
+ * 最近的流量；回复时按抽样率放大。
+ * 大 key：定时器每次扫描一段哈希桶，一轮结束后保存 value 最大的 K 个 key。
+ */
+
+#define CMS_DEPTH           4
+#define CMS_WIDTH           16384           /* 2 的幂，4 x 16384 x 4B = 256KB */
+#define HOTKEY_KEY_MAX      128             /* 堆中保存的 key 前缀长度 */
+#define HOTKEY_ENTRY_REPLY  (HOTKEY_KEY_MAX + 128)
+#define BIGKEYS_SCAN_NS     1000000         /* 每个定时器周期的扫描时间上限 */
+
+typedef struct {
+    uint64_t hash;
+    uint64_t score;                 /* 访问次数估计或 value 字节数 */
+    size_t key_len;                 /* 原始长度 */
+    char key[HOTKEY_KEY_MAX];
+} topk_entry_t;
+
+/* 按 score 的小顶堆 */
+typedef struct {
+    topk_entry_t entries[KVS_HOTKEYS_MAX];
+    int len;
+} topk_t;
+
+static uint32_t cms[CMS_DEPTH][CMS_WIDTH];
+
+static struct {
+    topk_t hot;
+    unsigned long long accesses;    /* 抽中的访问数，与计数器一起衰减 */
+    uint32_t rng;
+    time_t last_decay;
+
+    topk_t big_scan;                /* 进行中的一轮 */
+    topk_t big;                     /* 上一轮的结果 */
+    int cursor;
+    unsigned long scan_keys, scan_over;
+    unsigned long long scan_bytes;
+    unsigned long passes;
+    unsigned long pass_keys, pass_over;
+    unsigned long long pass_bytes;
+    time_t pass_end;
+} hk;
+
+extern kvs_hash_t global_hash;
+
+static uint64_t key_hash(const char *key, size_t len) {
+    uint64_t h = 1469598103934665603ULL;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)key[i];
+        h *= 1099511628211ULL;
+    }
+    /* murmur3 fmix64，让高低 32 位都充分混合 */
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+static int topk_cap(void) {
+    int k = g_config.hotkeys_top_k;
+    if (k < 1) return 1;
+    return k > KVS_HOTKEYS_MAX ? KVS_HOTKEYS_MAX : k;
+}
+
+static void topk_swap(topk_t *t, int a, int b) {
+    topk_entry_t tmp = t->entries[a];
+    t->entries[a] = t->entries[b];
+    t->entries[b] = tmp;
+}
+
+static void topk_sift_up(topk_t *t, int i) {
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (t->entries[parent].score <= t->entries[i].score) break;
+        topk_swap(t, parent, i);
+        i = parent;
+    }
+}
+
+static void topk_sift_down(topk_t *t, int i) {
+    for (;;) {
+        int l = 2 * i + 1, r = l + 1, min = i;
+        if (l < t->len && t->entries[l].score < t->entries[min].score) min = l;
+        if (r < t->len && t->entries[r].score < t->entries[min].score) min = r;
+        if (min == i) break;
+        topk_swap(t, i, min);
+        i = min;
+    }
+}
+
+static int topk_find(const topk_t *t, uint64_t hash, const char *key, size_t key_len) {
+    size_t cmp = key_len < HOTKEY_KEY_MAX ? key_len : HOTKEY_KEY_MAX;
+    for (int i = 0; i < t->len; i++) {
+        const topk_entry_t *e = &t->entries[i];
+        if (e->hash == hash && e->key_len == key_len && memcmp(e->key, key, cmp) == 0)
+            return i;
+    }
+    return -1;
+}
+
+/* top_k 被调小后弹出多余的 */
+static void topk_trim(topk_t *t, int cap) {
+    while (t->len > cap) {
+        t->entries[0] = t->entries[--t->len];
+        topk_sift_down(t, 0);
+    }
+}
+
+/* score 大于堆中最小值时放入，堆满则替换堆顶 */
+static void topk_push(topk_t *t, int cap, uint64_t hash, const char *key, size_t key_len,
+                      uint64_t score) {
+    int i;
+    if (t->len < cap) {
+        i = t->len++;
+    } else if (score > t->entries[0].score) {
+        i = 0;
+    } else {
+        return;
+    }
+    topk_entry_t *e = &t->entries[i];
+    e->hash = hash;
+    e->score = score;
+    e->key_len = key_len;
+    memcpy(e->key, key, key_len < HOTKEY_KEY_MAX ? key_len : HOTKEY_KEY_MAX);
+    if (i == 0) topk_sift_down(t, 0);
+    else topk_sift_up(t, i);
+}
+
+void kvs_hotkeys_touch(const char *key, size_t key_len) {
+    if (!g_config.hotkeys_enabled) return;
+    if (g_config.hotkeys_sample > 1) {
+        /* xorshift32，避免固定间隔抽样与周期性的访问模式重合 */
+        uint32_t x = hk.rng ? hk.rng : 2463534242u;
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        hk.rng = x;
+        if (x % (uint32_t)g_config.hotkeys_sample != 0) return;
+    }
+
+    uint64_t h = key_hash(key, key_len);
+    uint32_t h1 = (uint32_t)h, h2 = (uint32_t)(h >> 32) | 1;
+    uint32_t *c[CMS_DEPTH];
+    uint32_t min = UINT32_MAX;
+    for (int d = 0; d < CMS_DEPTH; d++) {
+        c[d] = &cms[d][(h1 + d * h2) & (CMS_WIDTH - 1)];
+        if (*c[d] < min) min = *c[d];
+    }
+    if (min == UINT32_MAX) return;
+    for (int d = 0; d < CMS_DEPTH; d++) {
+        if (*c[d] == min) (*c[d])++;
+    }
+    hk.accesses++;
+
+    /* 绝大多数 key 的估计值到不了堆顶，在这里返回 */
+    topk_t *t = &hk.hot;
+    uint64_t est = (uint64_t)min + 1;
+    int cap = topk_cap();
+    topk_trim(t, cap);
+    if (t->len >= cap && est <= t->entries[0].score) return;
+
+    int i = topk_find(t, h, key, key_len);
+    if (i >= 0) {
+        t->entries[i].score = est;
+        topk_sift_down(t, i);
+    } else {
+        topk_push(t, cap, h, key, key_len, est);
+    }
+}
+
+static void hotkeys_decay(void) {
+    time_t now = time(NULL);
+    if (hk.last_decay == 0) hk.last_decay = now;
+    if (g_config.hotkeys_decay_seconds <= 0 || now - hk.last_decay < g_config.hotkeys_decay_seconds)
+        return;
+    hk.last_decay = now;
+
+    for (int d = 0; d < CMS_DEPTH; d++) {
+        for (int i = 0; i < CMS_WIDTH; i++) cms[d][i] >>= 1;
+    }
+    /* 整体减半不改变堆序 */
+    for (int i = 0; i < hk.hot.len; i++) hk.hot.entries[i].score >>= 1;
+    hk.accesses >>= 1;
+}
+
+static void bigkeys_scan_step(void) {
+    kvs_hash_t *T = &global_hash;
+    if (!T->nodes) return;
+
+    uint64_t start = kvs_clock_ns();
+    size_t threshold = (size_t)g_config.hotkeys_big_value_kb * 1024;
+    int cap = topk_cap();
+    topk_trim(&hk.big_scan, cap);
+    for (; hk.cursor < T->max_slots; hk.cursor++) {
+        if ((hk.cursor & 255) == 0 && kvs_clock_ns() - start >= BIGKEYS_SCAN_NS) return;
+        for (hashnode_t *node = T->nodes[hk.cursor]; node; node = node->next) {
+            hk.scan_keys++;
+            hk.scan_bytes += node->value_len;
+            if (threshold > 0 && node->value_len >= threshold) hk.scan_over++;
+            topk_push(&hk.big_scan, cap, 0, node->key, node->key_len, node->value_len);
+        }
+    }
+
+    /* 一轮结束：发布结果，下一个周期从头开始 */
+    hk.big = hk.big_scan;
+    hk.big_scan.len = 0;
+    hk.cursor = 0;
+    hk.passes++;
+    hk.pass_keys = hk.scan_keys;
+    hk.pass_over = hk.scan_over;
+    hk.pass_bytes = hk.scan_bytes;
+    hk.pass_end = time(NULL);
+    hk.scan_keys = hk.scan_over = 0;
+    hk.scan_bytes = 0;
+}
+
+void kvs_hotkeys_cron(void) {
+    if (!g_config.hotkeys_enabled) return;
+    hotkeys_decay();
+    bigkeys_scan_step();
+}
+
+static unsigned long long sample_scale(void) {
+    return g_config.hotkeys_sample > 1 ? (unsigned long long)g_config.hotkeys_sample : 1;
+}
+
+static int score_desc(const void *a, const void *b) {
+    uint64_t x = ((const topk_entry_t *)a)->score, y = ((const topk_entry_t *)b)->score;
+    return x < y ? 1 : x > y ? -1 : 0;
+}
+
+/* 取前 count 个（不超过 top_k），按 score 从大到小 */
+static int topk_sorted(const topk_t *t, topk_entry_t *out, int count) {
+    memcpy(out, t->entries, sizeof(topk_entry_t) * t->len);
+    qsort(out, t->len, sizeof(topk_entry_t), score_desc);
+    if (count > topk_cap()) count = topk_cap();
+    return count < t->len ? count : t->len;
+}
+
+static int bulk(char *p, const char *data, size_t len) {
+    int n = sprintf(p, "$%zu\r\n", len);
+    memcpy(p + n, data, len);
+    n += len;
+    p[n++] = '\r';
+    p[n++] = '\n';
+    return n;
+}
+
+/* 超过保存长度的 key 标注被截掉的字节数 */
+static int key_reply(char *p, const topk_entry_t *e) {
+    if (e->key_len <= HOTKEY_KEY_MAX) return bulk(p, e->key, e->key_len);
+    char buf[HOTKEY_KEY_MAX + 48];
+    int n = snprintf(buf, sizeof(buf), "%.*s... (%zu more bytes)", HOTKEY_KEY_MAX, e->key,
+                     e->key_len - HOTKEY_KEY_MAX);
+    return bulk(p, buf, n);
+}
+
+/* 可选的 count 参数，默认全部 */
+static int parse_count(char **argv, int argc, int *count, char *resp) {
+    *count = KVS_HOTKEYS_MAX;
+    if (argc < 2) return 0;
+    char *end;
+    long v = strtol(argv[1], &end, 10);
+    if (*end || v < 1) return sprintf(resp, "-ERR count should be a positive integer\r\n");
+    *count = v < KVS_HOTKEYS_MAX ? (int)v : KVS_HOTKEYS_MAX;
+    return 0;
+}
+
+/* [key, 估计访问次数（已按抽样率放大）, 占最近访问的比例] */
+int kvs_hotkeys_command_reply(char **argv, size_t *lens, int argc,
+                              char *resp, int resp_size, int *needed) {
+    (void)lens;
+    if (argc > 1 && strcasecmp(argv[1], "RESET") == 0) {
+        memset(cms, 0, sizeof(cms));
+        hk.hot.len = 0;
+        hk.accesses = 0;
+        return sprintf(resp, "+OK\r\n");
+    }
+
+    int count, len = parse_count(argv, argc, &count, resp);
+    if (len > 0) return len;
+    topk_entry_t sorted[KVS_HOTKEYS_MAX];
+    count = topk_sorted(&hk.hot, sorted, count);
+
+    int need = 32 + count * HOTKEY_ENTRY_REPLY;
+    if (need > resp_size) {
+        *needed = need;
+        return -2;
+    }
+    char *p = resp + sprintf(resp, "*%d\r\n", count);
+    for (int i = 0; i < count; i++) {
+        char share[32];
+        int n = snprintf(share, sizeof(share), "%.2f%%",
+                         hk.accesses ? sorted[i].score * 100.0 / hk.accesses : 0.0);
+        p += sprintf(p, "*3\r\n");
+        p += key_reply(p, &sorted[i]);
+        p += sprintf(p, ":%llu\r\n", (unsigned long long)sorted[i].score * sample_scale());
+        p += bulk(p, share, n);
+    }
+    return p - resp;
+}
+
+/* [key, value 字节数]，来自上一轮扫描，已删除的 key 不再返回 */
+int kvs_bigkeys_command_reply(char **argv, size_t *lens, int argc,
+                              char *resp, int resp_size, int *needed) {
+    (void)lens;
+    int count, len = parse_count(argv, argc, &count, resp);
+    if (len > 0) return len;
+    topk_entry_t sorted[KVS_HOTKEYS_MAX];
+    count = topk_sorted(&hk.big, sorted, count);
+
+    int need = 32 + count * HOTKEY_ENTRY_REPLY;
+    if (need > resp_size) {
+        *needed = need;
+        return -2;
+    }
+    int shown = 0;
+    char *p = resp + 16;        /* 数组头最后写，长度取决于仍存在的 key */
+    for (int i = 0; i < count; i++) {
+        uint64_t size = sorted[i].score;
+        if (sorted[i].key_len <= HOTKEY_KEY_MAX) {
+            hashnode_t *node = kvs_hash_lookup(&global_hash, sorted[i].key, sorted[i].key_len);
+            if (!node) continue;
+            size = node->value_len;
+        }
+        p += sprintf(p, "*2\r\n");
+        p += key_reply(p, &sorted[i]);
+        p += sprintf(p, ":%llu\r\n", (unsigned long long)size);
+        shown++;
+    }
+    int head = sprintf(resp, "*%d\r\n", shown);
+    memmove(resp + head, resp + 16, p - (resp + 16));
+    return head + (p - (resp + 16));
+}
+
+int kvs_hotkeys_info(char *buf, int size) {
+    int len = snprintf(buf, size,
+                       "# Keystats\r\n"
+                       "hotkeys_enabled:%d\r\n"
+                       "hotkeys_tracked:%d\r\n"
+                       "hotkeys_recent_accesses:%llu\r\n"
+                       "bigkeys_scan_passes:%lu\r\n"
+                       "bigkeys_last_pass_time:%ld\r\n"
+                       "bigkeys_last_pass_keys:%lu\r\n"
+                       "bigkeys_last_pass_avg_value:%llu\r\n"
+                       "bigkeys_last_pass_over_threshold:%lu\r\n",
+                       g_config.hotkeys_enabled, hk.hot.len, hk.accesses * sample_scale(),
+                       hk.passes, (long)hk.pass_end, hk.pass_keys,
+                       hk.pass_keys ? hk.pass_bytes / hk.pass_keys : 0, hk.pass_over);
+    return len < size ? len : size - 1;
+}
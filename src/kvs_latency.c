@@ -0,0 +1,276 @@
+#include "../include/kvs_base.h"
+#include "../include/kvs_latency.h"
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+/*
+ * 延迟直方图：对数-线性分桶（HDR 风格），每个 2 的幂区间再等分 16 个子桶，
+ * 相对误差约 6%。记录一次只是一次下标计算和一次自增，全部在 reactor 线程上，
+ * 不加锁，可以常开。单位为纳秒，超过 2^40ns（约 18 分钟）的值计入最后一个桶。
+ */
+
+#define HIST_SUB_BITS       4
+#define HIST_SUB            (1 << HIST_SUB_BITS)
+#define HIST_MAX_BITS       40
+#define HIST_BUCKETS        ((HIST_MAX_BITS - HIST_SUB_BITS + 1) * HIST_SUB)
+#define HIST_MAX_VALUE      ((1ULL << HIST_MAX_BITS) - 1)
+#define HIST_REPLY_SIZE     2048    /* LATENCY HISTOGRAM 每个条目的回复上限 */
+
+typedef struct {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+    uint64_t buckets[HIST_BUCKETS];
+} kvs_hist_t;
+
+static const char *phase_names[KVS_LAT_PHASES] = { "parse", "execute", "propagate", "send" };
+
+static struct {
+    const char **names;
+    int count;
+    kvs_hist_t commands[KVS_LATENCY_MAX_COMMANDS];
+    kvs_hist_t phases[KVS_LAT_PHASES];
+} lat;
+
+uint64_t kvs_clock_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int hist_index(uint64_t v) {
+    if (v < HIST_SUB) return (int)v;
+    if (v > HIST_MAX_VALUE) v = HIST_MAX_VALUE;
+    int shift = 63 - __builtin_clzll(v) - HIST_SUB_BITS;
+    return (shift + 1) * HIST_SUB + (int)((v >> shift) & (HIST_SUB - 1));
+}
+
+/* 桶内的最大值，百分位按它报告，宁高勿低 */
+static uint64_t hist_upper(int idx) {
+    if (idx < HIST_SUB) return idx;
+    int shift = idx / HIST_SUB - 1;
+    uint64_t low = (uint64_t)(HIST_SUB + idx % HIST_SUB) << shift;
+    return low + (1ULL << shift) - 1;
+}
+
+static void hist_record(kvs_hist_t *h, uint64_t ns) {
+    h->count++;
+    h->sum += ns;
+    if (ns > h->max) h->max = ns;
+    h->buckets[hist_index(ns)]++;
+}
+
+static uint64_t hist_percentile(const kvs_hist_t *h, double p) {
+    if (h->count == 0) return 0;
+    uint64_t rank = (uint64_t)(h->count * p / 100.0 + 0.5);
+    if (rank < 1) rank = 1;
+    uint64_t seen = 0;
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen >= rank) return hist_upper(i) < h->max ? hist_upper(i) : h->max;
+    }
+    return h->max;
+}
+
+void kvs_latency_init(const char **names, int count) {
+    lat.names = names;
+    lat.count = count < KVS_LATENCY_MAX_COMMANDS ? count : KVS_LATENCY_MAX_COMMANDS;
+}
+
+void kvs_latency_phase(int phase, uint64_t ns) {
+    if (phase >= 0 && phase < KVS_LAT_PHASES) hist_record(&lat.phases[phase], ns);
+}
+
+uint64_t kvs_latency_phase_sum(int phase) {
+    return phase >= 0 && phase < KVS_LAT_PHASES ? lat.phases[phase].sum : 0;
+}
+
+void kvs_latency_command(int cmd, uint64_t ns) {
+    if (cmd >= 0 && cmd < lat.count) hist_record(&lat.commands[cmd], ns);
+}
+
+static int hist_percentiles(char *buf, int size, const kvs_hist_t *h) {
+    return snprintf(buf, size, "p50=%.3f,p99=%.3f,p99.9=%.3f",
+                    hist_percentile(h, 50.0) / 1000.0,
+                    hist_percentile(h, 99.0) / 1000.0,
+                    hist_percentile(h, 99.9) / 1000.0);
+}
+
+int kvs_latency_info(char *buf, int size) {
+    int len = snprintf(buf, size, "# Commandstats\r\n");
+    for (int i = 0; i < lat.count && len < size; i++) {
+        const kvs_hist_t *h = &lat.commands[i];
+        if (h->count == 0) continue;
+        len += snprintf(buf + len, size - len, "cmdstat_%s:calls=%llu,usec=%llu,usec_per_call=%.2f\r\n",
+                        lat.names[i], (unsigned long long)h->count,
+                        (unsigned long long)(h->sum / 1000), h->sum / 1000.0 / h->count);
+    }
+
+    if (len < size) len += snprintf(buf + len, size - len, "\r\n# Latencystats\r\n");
+    for (int i = 0; i < lat.count && len < size; i++) {
+        const kvs_hist_t *h = &lat.commands[i];
+        if (h->count == 0) continue;
+        len += snprintf(buf + len, size - len, "latency_percentiles_usec_%s:", lat.names[i]);
+        if (len < size) len += hist_percentiles(buf + len, size - len, h);
+        if (len < size) len += snprintf(buf + len, size - len, "\r\n");
+    }
+    for (int i = 0; i < KVS_LAT_PHASES && len < size; i++) {
+        const kvs_hist_t *h = &lat.phases[i];
+        len += snprintf(buf + len, size - len, "latency_phase_%s:calls=%llu,",
+                        phase_names[i], (unsigned long long)h->count);
+        if (len < size) len += hist_percentiles(buf + len, size - len, h);
+        if (len < size) len += snprintf(buf + len, size - len, ",max=%.3f\r\n", h->max / 1000.0);
+    }
+    return len < size ? len : size - 1;
+}
+
+/* Prometheus 文本格式：每条命令的调用数与累计耗时，各阶段为 summary */
+int kvs_latency_metrics(char *buf, int size) {
+    int len = snprintf(buf, size,
+                       "# HELP kvstore_commands_total Commands executed.\n"
+                       "# TYPE kvstore_commands_total counter\n");
+    for (int i = 0; i < lat.count && len < size; i++) {
+        if (lat.commands[i].count == 0) continue;
+        len += snprintf(buf + len, size - len, "kvstore_commands_total{cmd=\"%s\"} %llu\n",
+                        lat.names[i], (unsigned long long)lat.commands[i].count);
+    }
+    if (len < size)
+        len += snprintf(buf + len, size - len,
+                        "# HELP kvstore_command_duration_seconds_total Time spent executing commands.\n"
+                        "# TYPE kvstore_command_duration_seconds_total counter\n");
+    for (int i = 0; i < lat.count && len < size; i++) {
+        if (lat.commands[i].count == 0) continue;
+        len += snprintf(buf + len, size - len, "kvstore_command_duration_seconds_total{cmd=\"%s\"} %.9f\n",
+                        lat.names[i], lat.commands[i].sum / 1e9);
+    }
+
+    if (len < size)
+        len += snprintf(buf + len, size - len,
+                        "# HELP kvstore_phase_duration_seconds Request phase latency.\n"
+                        "# TYPE kvstore_phase_duration_seconds summary\n");
+    static const double quantiles[] = { 0.5, 0.99, 0.999 };
+    for (int i = 0; i < KVS_LAT_PHASES && len < size; i++) {
+        const kvs_hist_t *h = &lat.phases[i];
+        for (int q = 0; q < 3 && len < size; q++)
+            len += snprintf(buf + len, size - len,
+                            "kvstore_phase_duration_seconds{phase=\"%s\",quantile=\"%g\"} %.9f\n",
+                            phase_names[i], quantiles[q], hist_percentile(h, quantiles[q] * 100) / 1e9);
+        if (len < size)
+            len += snprintf(buf + len, size - len,
+                            "kvstore_phase_duration_seconds_sum{phase=\"%s\"} %.9f\n"
+                            "kvstore_phase_duration_seconds_count{phase=\"%s\"} %llu\n",
+                            phase_names[i], h->sum / 1e9, phase_names[i], (unsigned long long)h->count);
+    }
+    return len < size ? len : size - 1;
+}
+
+static int bulk(char *p, const char *s) {
+    return sprintf(p, "$%zu\r\n%s\r\n", strlen(s), s);
+}
+
+/*
+ * 与 Redis 相同的输出格式：[name, [calls, n, histogram_usec, [上界, 累计数, ...]]]，
+ * 细粒度桶按上界归入 1、2、4、8... 微秒的区间。
+ */
+static int hist_reply(char *p, const char *name, const kvs_hist_t *h) {
+    uint64_t counts[HIST_MAX_BITS] = {0};
+    int top = -1;
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        if (!h->buckets[i]) continue;
+        uint64_t us = (hist_upper(i) + 999) / 1000;
+        int b = 0;
+        while ((1ULL << b) < us) b++;
+        counts[b] += h->buckets[i];
+        if (b > top) top = b;
+    }
+
+    char *start = p;
+    p += bulk(p, name);
+    p += sprintf(p, "*4\r\n");
+    p += bulk(p, "calls");
+    p += sprintf(p, ":%llu\r\n", (unsigned long long)h->count);
+    p += bulk(p, "histogram_usec");
+    int n = 0;
+    for (int b = 0; b <= top; b++) if (counts[b]) n++;
+    p += sprintf(p, "*%d\r\n", n * 2);
+    uint64_t cum = 0;
+    for (int b = 0; b <= top; b++) {
+        if (!counts[b]) continue;
+        cum += counts[b];
+        p += sprintf(p, ":%llu\r\n:%llu\r\n", 1ULL << b, (unsigned long long)cum);
+    }
+    return p - start;
+}
+
+/* 名字可以是命令名（不区分大小写）或阶段名 parse/execute/propagate/send */
+static const kvs_hist_t *hist_find(const char *name, size_t len, const char **label) {
+    for (int i = 0; i < lat.count; i++) {
+        if (strlen(lat.names[i]) == len && strncasecmp(lat.names[i], name, len) == 0) {
+            *label = lat.names[i];
+            return &lat.commands[i];
+        }
+    }
+    for (int i = 0; i < KVS_LAT_PHASES; i++) {
+        if (strlen(phase_names[i]) == len && strncasecmp(phase_names[i], name, len) == 0) {
+            *label = phase_names[i];
+            return &lat.phases[i];
+        }
+    }
+    return NULL;
+}
+
+int kvs_latency_command_reply(char **argv, size_t *lens, int argc,
+                              char *resp, int resp_size, int *needed) {
+    if (argc < 2)
+        return sprintf(resp, "-ERR wrong number of arguments for 'latency' command\r\n");
+
+    if (strcasecmp(argv[1], "RESET") == 0) {
+        int n = 0;
+        for (int i = 0; i < lat.count; i++) {
+            if (lat.commands[i].count) n++;
+            memset(&lat.commands[i], 0, sizeof(kvs_hist_t));
+        }
+        memset(lat.phases, 0, sizeof(lat.phases));
+        return sprintf(resp, ":%d\r\n", n);
+    }
+
+    if (strcasecmp(argv[1], "HISTOGRAM") != 0)
+        return sprintf(resp, "-ERR Try LATENCY HISTOGRAM|RESET\r\n");
+
+    /* 不带参数时列出所有有记录的命令和全部阶段 */
+    const kvs_hist_t *hists[KVS_LATENCY_MAX_COMMANDS + KVS_LAT_PHASES];
+    const char *labels[KVS_LATENCY_MAX_COMMANDS + KVS_LAT_PHASES];
+    int n = 0;
+    if (argc == 2) {
+        for (int i = 0; i < lat.count; i++) {
+            if (!lat.commands[i].count) continue;
+            hists[n] = &lat.commands[i];
+            labels[n++] = lat.names[i];
+        }
+        for (int i = 0; i < KVS_LAT_PHASES; i++) {
+            hists[n] = &lat.phases[i];
+            labels[n++] = phase_names[i];
+        }
+    } else {
+        for (int i = 2; i < argc && n < KVS_LATENCY_MAX_COMMANDS + KVS_LAT_PHASES; i++) {
+            const char *label;
+            const kvs_hist_t *h = hist_find(argv[i], lens[i], &label);
+            if (h && h->count) {
+                hists[n] = h;
+                labels[n++] = label;
+            }
+        }
+    }
+
+    int need = 32 + n * HIST_REPLY_SIZE;
+    if (need > resp_size) {
+        *needed = need;
+        return -2;
+    }
+    char *p = resp;
+    p += sprintf(p, "*%d\r\n", n * 2);
+    for (int i = 0; i < n; i++) p += hist_reply(p, labels[i], hists[i]);
+    return p - resp;
+}
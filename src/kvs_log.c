@@ -0,0 +1,258 @@
+#include "../include/kvs_log.h"
+#include "../include/kvs_configure.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+/*
+ * 异步日志：调用线程在环形缓冲区中占一个槽，把记录格式化进槽内即返回，
+ * write() 与磁盘 / 终端的延迟都由后台线程承担。占槽使用按序号的无锁多生产者
+ * 协议（每个槽的 seq 表示它可写还是可读），环满时丢弃并计数，不阻塞 reactor。
+ * 后台线程只在队列为空时在条件变量上睡眠，生产者看到它在睡眠时才加锁唤醒。
+ */
+
+#define LOG_SLOTS           4096            /* 2 的幂 */
+#define LOG_SLOT_SIZE       512             /* 超长的记录截断 */
+#define LOG_IDLE_WAIT_MS    100
+
+typedef struct {
+    _Atomic size_t seq;
+    int len;
+    char data[LOG_SLOT_SIZE];
+} log_slot_t;
+
+static struct {
+    log_slot_t *slots;
+    _Atomic size_t tail;                /* 下一个可占用的序号 */
+    _Atomic size_t written;             /* 后台线程已写出的序号 */
+    _Atomic int running;
+    _Atomic int sleeping;
+    _Atomic int stopping;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    FILE *out;
+    _Atomic unsigned long long dropped;
+    _Atomic unsigned long long suppressed;
+} lg = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+};
+
+static const char *level_prefix(int level) {
+    switch (level) {
+    case LOG_LEVEL_INFO:  return "[INFO] ";
+    case LOG_LEVEL_WARN:  return "[WARN] ";
+    case LOG_LEVEL_DEBUG: return "[DEBUG] ";
+    default:              return "";
+    }
+}
+
+/* 把一条记录格式化到 buf，返回长度，截断时以 "...\n" 结尾 */
+static int log_format(char *buf, int size, int level, const char *format, va_list args) {
+    int len = snprintf(buf, size, "%s", level_prefix(level));
+    int n = vsnprintf(buf + len, size - len, format, args);
+    if (n < 0) return len;
+    if (len + n < size) return len + n;
+    memcpy(buf + size - 5, "...\n", 4);
+    return size - 1;
+}
+
+static void log_wake(void) {
+    if (!atomic_load(&lg.sleeping)) return;
+    pthread_mutex_lock(&lg.lock);
+    pthread_cond_signal(&lg.cond);
+    pthread_mutex_unlock(&lg.lock);
+}
+
+static void log_write(int level, const char *format, va_list args) {
+    if (!atomic_load_explicit(&lg.running, memory_order_acquire)) {
+        char buf[LOG_SLOT_SIZE];
+        int len = log_format(buf, sizeof(buf), level, format, args);
+        fwrite(buf, 1, len, lg.out ? lg.out : stdout);
+        return;
+    }
+
+    size_t pos = atomic_load_explicit(&lg.tail, memory_order_relaxed);
+    log_slot_t *slot;
+    for (;;) {
+        slot = &lg.slots[pos & (LOG_SLOTS - 1)];
+        size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&lg.tail, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed))
+                break;
+        } else if (diff < 0) {
+            atomic_fetch_add_explicit(&lg.dropped, 1, memory_order_relaxed);
+            return;
+        } else {
+            pos = atomic_load_explicit(&lg.tail, memory_order_relaxed);
+        }
+    }
+    slot->len = log_format(slot->data, sizeof(slot->data), level, format, args);
+    atomic_store(&slot->seq, pos + 1);
+    log_wake();
+}
+
+static void *log_main(void *arg) {
+    (void)arg;
+    size_t head = atomic_load(&lg.written);
+    for (;;) {
+        log_slot_t *slot = &lg.slots[head & (LOG_SLOTS - 1)];
+        if (atomic_load_explicit(&slot->seq, memory_order_acquire) == head + 1) {
+            fwrite(slot->data, 1, slot->len, lg.out);
+            atomic_store_explicit(&slot->seq, head + LOG_SLOTS, memory_order_release);
+            head++;
+            continue;
+        }
+
+        /* 队列已空（或下一个槽还在格式化）：先把这一批写出去 */
+        fflush(lg.out);
+        atomic_store(&lg.written, head);
+        if (atomic_load(&lg.stopping) && atomic_load(&lg.tail) == head) break;
+
+        pthread_mutex_lock(&lg.lock);
+        atomic_store(&lg.sleeping, 1);
+        if (atomic_load(&slot->seq) != head + 1 && !atomic_load(&lg.stopping)) {
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_nsec += LOG_IDLE_WAIT_MS * 1000000L;
+            if (ts.tv_nsec >= 1000000000L) {
+                ts.tv_sec++;
+                ts.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&lg.cond, &lg.lock, &ts);
+        }
+        atomic_store(&lg.sleeping, 0);
+        pthread_mutex_unlock(&lg.lock);
+    }
+    return NULL;
+}
+
+int kvs_log_start(void) {
+    if (atomic_load(&lg.running)) return 0;
+
+    lg.out = stdout;
+    if (strcmp(g_config.log_file, "stderr") == 0) {
+        lg.out = stderr;
+    } else if (g_config.log_file[0]) {
+        FILE *fp = fopen(g_config.log_file, "a");
+        if (!fp) {
+            fprintf(stderr, "[Log] Failed to open %s: %s, logging to stdout\n",
+                    g_config.log_file, strerror(errno));
+        } else {
+            lg.out = fp;
+        }
+    }
+
+    lg.slots = calloc(LOG_SLOTS, sizeof(log_slot_t));
+    if (!lg.slots) return -1;
+    for (size_t i = 0; i < LOG_SLOTS; i++) atomic_init(&lg.slots[i].seq, i);
+
+    if (pthread_create(&lg.thread, NULL, log_main, NULL) != 0) {
+        free(lg.slots);
+        lg.slots = NULL;
+        return -1;
+    }
+    atomic_store_explicit(&lg.running, 1, memory_order_release);
+    /* exit() 时写完队列中剩余的记录 */
+    atexit(kvs_log_stop);
+    return 0;
+}
+
+void kvs_log_flush(void) {
+    if (!atomic_load(&lg.running)) {
+        fflush(lg.out ? lg.out : stdout);
+        return;
+    }
+    size_t target = atomic_load(&lg.tail);
+    for (int i = 0; i < 1000 && atomic_load(&lg.written) < target; i++) {
+        atomic_store(&lg.sleeping, 1);      /* 强制唤醒 */
+        log_wake();
+        usleep(1000);
+    }
+}
+
+void kvs_log_stop(void) {
+    if (!atomic_exchange(&lg.running, 0)) return;
+    atomic_store(&lg.stopping, 1);
+    atomic_store(&lg.sleeping, 1);
+    log_wake();
+    pthread_join(lg.thread, NULL);
+    fflush(lg.out);
+}
+
+void kvs_log(log_level_t level, const char *format, ...) {
+    if (level > g_config.log_level) return;
+    va_list args;
+    va_start(args, format);
+    log_write(level, format, args);
+    va_end(args);
+}
+
+static void log_printf(int level, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    log_write(level, format, args);
+    va_end(args);
+}
+
+void kvs_log_site(kvs_log_site_t *site, int level, const char *format, ...) {
+    if (level > (int)g_config.log_level) return;
+
+    if (g_config.log_rate_limit > 0) {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+        uint64_t now = ts.tv_sec;
+        uint64_t window = atomic_load_explicit(&site->window, memory_order_relaxed);
+        if (window != now &&
+            atomic_compare_exchange_strong(&site->window, &window, now))
+            atomic_store_explicit(&site->count, 0, memory_order_relaxed);
+
+        if (atomic_fetch_add_explicit(&site->count, 1, memory_order_relaxed) >=
+            (unsigned int)g_config.log_rate_limit) {
+            atomic_fetch_add_explicit(&site->suppressed, 1, memory_order_relaxed);
+            atomic_fetch_add_explicit(&lg.suppressed, 1, memory_order_relaxed);
+            return;
+        }
+        unsigned int skipped = atomic_exchange_explicit(&site->suppressed, 0, memory_order_relaxed);
+        if (skipped > 0) {
+            int flen = strcspn(format, "\n");
+            log_printf(level, "[Log] %u records suppressed like: %.*s\n",
+                                skipped, flen > 60 ? 60 : flen, format);
+        }
+    }
+
+    va_list args;
+    va_start(args, format);
+    log_write(level, format, args);
+    va_end(args);
+}
+
+unsigned long long kvs_log_dropped(void) {
+    return atomic_load_explicit(&lg.dropped, memory_order_relaxed);
+}
+
+unsigned long long kvs_log_suppressed(void) {
+    return atomic_load_explicit(&lg.suppressed, memory_order_relaxed);
+}
+
+int kvs_log_info(char *buf, int size) {
+    size_t tail = atomic_load(&lg.tail), written = atomic_load(&lg.written);
+    int len = snprintf(buf, size,
+                       "# Log\r\n"
+                       "log_async:%d\r\n"
+                       "log_queued:%zu\r\n"
+                       "log_dropped:%llu\r\n"
+                       "log_suppressed:%llu\r\n",
+                       atomic_load(&lg.running), tail - written,
+                       kvs_log_dropped(), kvs_log_suppressed());
+    return len < size ? len : size - 1;
+}
@@ -0,0 +1,229 @@
+#include "../include/kvs_base.h"
+#include "../include/server.h"
+#include "../include/kvs_hash.h"
+#include "../include/kvs_latency.h"
+#include "../include/kvs_persist.h"
+#include "../include/kvs_replication.h"
+#include "../include/kvs_watchdog.h"
+#include "../include/kvs_configure.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Prometheus 指标：[metrics] port 上的 HTTP 连接由 reactor 接收，GET /metrics
+ * 在 reactor 线程上生成一次文本（只读取计数器，不遍历 key），回复排入连接的
+ * 输出缓冲区后由 EPOLLOUT 非阻塞发送，不会让命令处理等待慢速的抓取端。
+ */
+
+#define METRICS_BUFFER_SIZE     (64 * 1024)
+
+extern kvs_hash_t global_hash;
+
+#if ENABLE_JEMALLOC
+/* 弱引用：未链接 jemalloc 时为 NULL，只输出进程 RSS */
+extern int mallctl(const char *name, void *oldp, size_t *oldlenp, void *newp, size_t newlen)
+    __attribute__((weak));
+#endif
+
+static int metric(char *buf, int size, const char *name, const char *type,
+                  const char *help, double value) {
+    return snprintf(buf, size, "# HELP %s %s\n# TYPE %s %s\n%s %.15g\n",
+                    name, help, name, type, name, value);
+}
+
+static int memory_metrics(char *buf, int size) {
+    int len = snprintf(buf, size,
+                       "# HELP kvstore_memory_bytes Memory reported by the allocator and the kernel.\n"
+                       "# TYPE kvstore_memory_bytes gauge\n");
+    long pages = 0, resident = 0;
+    FILE *fp = fopen("/proc/self/statm", "r");
+    if (fp) {
+        if (fscanf(fp, "%ld %ld", &pages, &resident) != 2) resident = 0;
+        fclose(fp);
+    }
+    if (len < size)
+        len += snprintf(buf + len, size - len, "kvstore_memory_bytes{allocator=\"process\",stat=\"resident\"} %ld\n",
+                        resident * sysconf(_SC_PAGESIZE));
+#if ENABLE_JEMALLOC
+    if (mallctl) {
+        static const char *stats[] = { "allocated", "active", "resident", "mapped" };
+        uint64_t epoch = 1;
+        size_t sz = sizeof(epoch);
+        mallctl("epoch", &epoch, &sz, &epoch, sz);
+        for (int i = 0; i < 4 && len < size; i++) {
+            char name[32];
+            size_t value = 0;
+            sz = sizeof(value);
+            snprintf(name, sizeof(name), "stats.%s", stats[i]);
+            if (mallctl(name, &value, &sz, NULL, 0) != 0) continue;
+            len += snprintf(buf + len, size - len, "kvstore_memory_bytes{allocator=\"jemalloc\",stat=\"%s\"} %zu\n",
+                            stats[i], value);
+        }
+    }
+#endif
+    if (len < size)
+        len += snprintf(buf + len, size - len, "kvstore_memory_bytes{allocator=\"kvstore\",stat=\"values\"} %zu\n",
+                        global_hash.mem_bytes);
+    return len < size ? len : size - 1;
+}
+
+static int conn_metrics(char *buf, int size) {
+    kvs_conn_stats_t st;
+    kvs_conn_stats(&st);
+    int len = metric(buf, size, "kvstore_connected_clients", "gauge",
+                     "Command protocol connections, replicas included.", st.clients);
+    if (len < size) len += metric(buf + len, size - len, "kvstore_blocked_clients", "gauge",
+                                  "Clients waiting on WAIT or a proxied reply.", st.blocked);
+    if (len < size) len += metric(buf + len, size - len, "kvstore_other_connections", "gauge",
+                                  "Listeners, timers, outbound links and HTTP connections.", st.other);
+    if (len < size) len += metric(buf + len, size - len, "kvstore_paused_clients", "gauge",
+                                  "Clients not executing until their output drains.", st.paused);
+    if (len < size) len += metric(buf + len, size - len, "kvstore_connections_accepted_total", "counter",
+                                  "Client connections accepted.", (double)st.accepted);
+    if (len < size)
+        len += snprintf(buf + len, size - len,
+                        "# HELP kvstore_buffer_limit_disconnects_total Connections closed over a buffer limit.\n"
+                        "# TYPE kvstore_buffer_limit_disconnects_total counter\n"
+                        "kvstore_buffer_limit_disconnects_total{limit=\"output\",class=\"normal\"} %llu\n"
+                        "kvstore_buffer_limit_disconnects_total{limit=\"output\",class=\"replica\"} %llu\n"
+                        "kvstore_buffer_limit_disconnects_total{limit=\"query\",class=\"normal\"} %llu\n",
+                        st.obuf_disconnects, st.repl_obuf_disconnects, st.qbuf_disconnects);
+    if (len < size)
+        len += snprintf(buf + len, size - len,
+                        "# HELP kvstore_buffer_bytes Connection and AOF buffers.\n"
+                        "# TYPE kvstore_buffer_bytes gauge\n"
+                        "kvstore_buffer_bytes{kind=\"read\"} %ld\n"
+                        "kvstore_buffer_bytes{kind=\"write\"} %ld\n"
+                        "kvstore_buffer_bytes{kind=\"output_pending\"} %ld\n"
+                        "kvstore_buffer_bytes{kind=\"output_pending_max\"} %ld\n"
+                        "kvstore_buffer_bytes{kind=\"aof\"} %zu\n",
+                        st.rbuffer_bytes, st.wbuffer_bytes, st.pending_bytes, st.max_pending,
+                        kvs_aof_buffer_size());
+    return len < size ? len : size - 1;
+}
+
+static int persist_metrics(char *buf, int size) {
+    const persist_runtime_t *r = &g_persist_runtime;
+    int len = metric(buf, size, "kvstore_rdb_saves_total", "counter",
+                     "RDB snapshots written.", r->rdb_saves);
+    if (len < size) len += metric(buf + len, size - len, "kvstore_rdb_save_duration_seconds_total", "counter",
+                                  "Time spent writing RDB snapshots.", r->rdb_save_ns / 1e9);
+    if (len < size) len += metric(buf + len, size - len, "kvstore_rdb_last_save_duration_seconds", "gauge",
+                                  "Duration of the last RDB snapshot.", r->rdb_last_save_ns / 1e9);
+    if (len < size) len += metric(buf + len, size - len, "kvstore_rdb_last_save_timestamp_seconds", "gauge",
+                                  "Unix time of the last RDB snapshot.", (double)r->last_save_time);
+    if (len < size) len += metric(buf + len, size - len, "kvstore_aof_rewrites_total", "counter",
+                                  "AOF rewrites.", r->aof_rewrites);
+    if (len < size) len += metric(buf + len, size - len, "kvstore_aof_rewrite_duration_seconds_total", "counter",
+                                  "Time spent rewriting the AOF.", r->aof_rewrite_ns / 1e9);
+    if (len < size) len += metric(buf + len, size - len, "kvstore_aof_last_rewrite_duration_seconds", "gauge",
+                                  "Duration of the last AOF rewrite.", r->aof_last_rewrite_ns / 1e9);
+    if (len < size) len += metric(buf + len, size - len, "kvstore_aof_writes_total", "counter",
+                                  "write() calls flushing the AOF buffer.", r->aof_writes);
+    if (len < size) len += metric(buf + len, size - len, "kvstore_aof_write_duration_seconds_total", "counter",
+                                  "Time spent in AOF write() calls.", r->aof_write_ns / 1e9);
+    if (len < size) len += metric(buf + len, size - len, "kvstore_aof_written_bytes_total", "counter",
+                                  "Bytes appended to the AOF.", (double)r->aof_written_bytes);
+    return len < size ? len : size - 1;
+}
+
+#if ENABLE_REPL
+static int repl_metrics(char *buf, int size) {
+    int len = metric(buf, size, "kvstore_repl_offset_bytes", "gauge",
+                     "Replication offset produced (master) or applied (replica).",
+                     (double)g_repl.master_repl_offset);
+    if (len < size) len += metric(buf + len, size - len, "kvstore_master_link_up", "gauge",
+                                  "1 when this replica streams from its master.",
+                                  g_repl.role == KVS_ROLE_SLAVE && g_repl.link_state == KVS_REPL_CONNECTED);
+    if (len < size)
+        len += snprintf(buf + len, size - len,
+                        "# HELP kvstore_replica_lag_bytes Stream bytes not yet acknowledged by each replica.\n"
+                        "# TYPE kvstore_replica_lag_bytes gauge\n");
+    for (int i = 0; i < g_repl.slave_count && len < size; i++) {
+        const kvs_slave_t *s = &g_repl.slaves[i];
+        len += snprintf(buf + len, size - len, "kvstore_replica_lag_bytes{replica=\"%d\",state=\"%s\"} %lld\n",
+                        s->fd, s->state == KVS_SLAVE_ONLINE ? "online" : "sync",
+                        g_repl.master_repl_offset - s->ack_offset);
+    }
+    if (len < size)
+        len += snprintf(buf + len, size - len,
+                        "# HELP kvstore_replica_ack_age_seconds Seconds since each replica's last ACK.\n"
+                        "# TYPE kvstore_replica_ack_age_seconds gauge\n");
+    long now = time(NULL);
+    for (int i = 0; i < g_repl.slave_count && len < size; i++) {
+        const kvs_slave_t *s = &g_repl.slaves[i];
+        len += snprintf(buf + len, size - len, "kvstore_replica_ack_age_seconds{replica=\"%d\"} %ld\n",
+                        s->fd, now - s->ack_time);
+    }
+    return len < size ? len : size - 1;
+}
+#endif
+
+static int metrics_render(char *buf, int size) {
+    int len = metric(buf, size, "kvstore_keys", "gauge", "Keys in the keyspace.", global_hash.count);
+    if (len < size) len += memory_metrics(buf + len, size - len);
+    if (len < size) len += conn_metrics(buf + len, size - len);
+    if (len < size) len += kvs_latency_metrics(buf + len, size - len);
+    if (len < size) len += persist_metrics(buf + len, size - len);
+#if ENABLE_REPL
+    if (len < size) len += repl_metrics(buf + len, size - len);
+#endif
+    if (len < size) len += metric(buf + len, size - len, "kvstore_watchdog_stalls_total", "counter",
+                                  "Event loop iterations reported by the watchdog.",
+                                  (double)kvs_watchdog_stalls());
+    if (len < size) len += metric(buf + len, size - len, "kvstore_log_dropped_total", "counter",
+                                  "Log records dropped because the log ring was full.",
+                                  (double)kvs_log_dropped());
+    if (len < size) len += metric(buf + len, size - len, "kvstore_log_suppressed_total", "counter",
+                                  "Log records skipped by the per call site rate limit.",
+                                  (double)kvs_log_suppressed());
+    return len;
+}
+
+static int http_reply(int fd, const char *status, const char *type, const char *body, int len) {
+    char header[256];
+    int n = snprintf(header, sizeof(header),
+                     "HTTP/1.1 %s\r\n"
+                     "Content-Type: %s\r\n"
+                     "Content-Length: %d\r\n"
+                     "Connection: close\r\n"
+                     "\r\n", status, type, len);
+    if (kvs_client_write(fd, header, n) < 0) return -1;
+    if (len > 0 && kvs_client_write(fd, body, len) < 0) return -1;
+    return 1;
+}
+
+int http_request(struct conn *c) {
+    if (!memmem(c->rbuffer, c->rlength, "\r\n\r\n", 4)) return 0;
+
+    const char *text = "text/plain; charset=utf-8";
+    if (c->rlength < 4 || memcmp(c->rbuffer, "GET ", 4) != 0)
+        return http_reply(c->fd, "405 Method Not Allowed", text, "GET only\n", 9);
+
+    const char *path = c->rbuffer + 4;
+    size_t plen = strcspn(path, " ?\r");
+    if (!(plen == 8 && memcmp(path, "/metrics", 8) == 0) && !(plen == 1 && path[0] == '/'))
+        return http_reply(c->fd, "404 Not Found", text, "try /metrics\n", 13);
+
+    int size = METRICS_BUFFER_SIZE;
+    for (;;) {
+        char *body = kvs_malloc(size);
+        if (!body) return -1;
+        int len = metrics_render(body, size);
+        if (len < size - 1) {
+            int ret = http_reply(c->fd, "200 OK", "text/plain; version=0.0.4; charset=utf-8", body, len);
+            kvs_free(body);
+            return ret;
+        }
+        /* 输出被截断（副本很多时），加大缓冲区重新生成 */
+        kvs_free(body);
+        size *= 2;
+    }
+}
+
+int http_response(struct conn *c) {
+    (void)c;
+    return 0;
+}
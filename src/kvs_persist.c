@@ -2,95 +2,130 @@
 #include "../include/kvs_persist.h"
 #include "../include/kvs_hash.h"
 #include "../include/kvs_configure.h"
+#include "../include/kvs_propagate.h"
+#include "../include/kvs_latency.h"
+#include "../include/kvs_slowlog.h"
 #include <stdio.h>
 #include <string.h>
 #include <stdbool.h>
 #include <unistd.h>
 #include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
 #include <time.h>
 
 bool g_is_loading = false;
 persist_runtime_t g_persist_runtime;
 
+/* 混合模式 AOF 文件头：RDB 前导 + RESP 增量 */
+#define AOF_PREAMBLE_MAGIC      "KVS-RDB-PREAMBLE"
+#define AOF_PREAMBLE_MAGIC_LEN  16
+#define RDB_ITEM_EOF            ((size_t)-1)
+#define RDB_MAX_KEY_LEN         (1024 * 1024)          /* 与 kvs_hash_load_rdb 的上限一致 */
+#define RDB_MAX_VALUE_LEN       (10 * 1024 * 1024)
+
 extern kvs_hash_t global_hash;
 extern int kvs_protocol(char *msg, int length, char *response, int resp_size, int *processed, int *needed);
 
-/* 二进制安全 RESP 编码（内部使用） */
-static int resp_encode(char *buffer, size_t buf_size,
-                       const char *cmd,
-                       const void *key, size_t key_len,
-                       const void *val, size_t val_len) {
-    int pos = 0;
-    int argc = val ? 3 : 2;
-    size_t cmd_len = strlen(cmd);
-
-    if (buf_size < 64) return -1;
-
-    pos += snprintf(buffer + pos, buf_size - pos, "*%d\r\n", argc);
-    pos += snprintf(buffer + pos, buf_size - pos, "$%zu\r\n", cmd_len);
-    if (pos + cmd_len + 2 > buf_size) return -1;
-    memcpy(buffer + pos, cmd, cmd_len);
-    pos += cmd_len;
-    buffer[pos++] = '\r';
-    buffer[pos++] = '\n';
-
-    pos += snprintf(buffer + pos, buf_size - pos, "$%zu\r\n", key_len);
-    if (pos + key_len + 2 > buf_size) return -1;
-    memcpy(buffer + pos, key, key_len);
-    pos += key_len;
-    buffer[pos++] = '\r';
-    buffer[pos++] = '\n';
-
-    if (val) {
-        pos += snprintf(buffer + pos, buf_size - pos, "$%zu\r\n", val_len);
-        if (pos + val_len + 2 > buf_size) return -1;
-        memcpy(buffer + pos, val, val_len);
-        pos += val_len;
-        buffer[pos++] = '\r';
-        buffer[pos++] = '\n';
+/* AOF 缓冲区：写命令先追加到内存，回复发出前由 kvs_aof_flush() 一次 write() 写入文件 */
+static struct {
+    char *buf;
+    size_t len;
+    size_t cap;
+    int fd;
+} aof = { .fd = -1 };
+
+void kvs_aof_feed(const char *data, size_t len) {
+    if (aof.len + len > aof.cap) {
+        size_t cap = aof.cap ? aof.cap * 2 : 64 * 1024;
+        while (cap < aof.len + len) cap *= 2;
+        char *buf = kvs_realloc(aof.buf, cap);
+        if (!buf) {
+            LOG_WARN("[Persist] Out of memory growing AOF buffer, flushing inline\n");
+            kvs_aof_flush();
+            if (aof.len + len > aof.cap) return;
+        } else {
+            aof.buf = buf;
+            aof.cap = cap;
+        }
     }
-
-    return pos;
+    memcpy(aof.buf + aof.len, data, len);
+    aof.len += len;
 }
 
-/* 真正的二进制安全 AOF 追加函数 */
-static void kvs_aof_append_bin(const char *cmd, const void *key, size_t key_len,
-                               const void *val, size_t val_len) {
-    if (g_is_loading) return;
-    if (g_config.persist_mode != PERSIST_AOF_ONLY &&
-        g_config.persist_mode != PERSIST_MIXED)
-        return;
-
-    FILE *fp = fopen(g_config.aof_file, "ab");
-    if (!fp) {
-        LOG_WARN("[Persist] Failed to open AOF file: %s\n", g_config.aof_file);
-        return;
+void kvs_aof_flush(void) {
+    if (aof.len == 0) return;
+    if (aof.fd < 0) {
+        aof.fd = open(g_config.aof_file, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+        if (aof.fd < 0) {
+            LOG_WARN("[Persist] Failed to open AOF file: %s\n", g_config.aof_file);
+            return;
+        }
     }
 
-    char buffer[KVS_MAX_MSG_LEN];
-    int len = resp_encode(buffer, sizeof(buffer), cmd, key, key_len, val, val_len);
-    if (len > 0) {
-        fwrite(buffer, 1, len, fp);
-    } else {
-        LOG_WARN("[Persist] AOF encode failed\n");
+    uint64_t start = kvs_clock_ns();
+    size_t done = 0;
+    while (done < aof.len) {
+        ssize_t n = write(aof.fd, aof.buf + done, aof.len - done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            /* 保留未写入的部分，下次再试 */
+            LOG_WARN("[Persist] AOF write failed: %s\n", strerror(errno));
+            break;
+        }
+        done += n;
     }
-    fclose(fp);
+    g_persist_runtime.aof_writes++;
+    g_persist_runtime.aof_write_ns += kvs_clock_ns() - start;
+    g_persist_runtime.aof_written_bytes += done;
+    if (done < aof.len) memmove(aof.buf, aof.buf + done, aof.len - done);
+    aof.len -= done;
 }
 
-/* 对外接口：兼容旧调用（三个字符串参数） */
-void kvs_aof_append(const char *cmd, const char *key, const char *value) {
-    size_t key_len = key ? strlen(key) : 0;
-    size_t val_len = value ? strlen(value) : 0;
-    kvs_aof_append_bin(cmd, key, key_len, value, val_len);
+size_t kvs_aof_buffer_size(void) {
+    return aof.cap;
 }
 
 void kvs_persist_init(void) {
+    struct stat st;
     memset(&g_persist_runtime, 0, sizeof(g_persist_runtime));
     g_persist_runtime.last_save_time = time(NULL);
+    if (stat(g_config.aof_file, &st) == 0)
+        g_persist_runtime.aof_base_size = st.st_size;
     g_is_loading = false;
+    if (g_config.storage_engine == STORAGE_BITCASK && g_config.persist_mode != PERSIST_OFF) {
+        LOG_WARN("[Persist] Bitcask segments are the source of truth, disabling RDB/AOF\n");
+        g_config.persist_mode = PERSIST_OFF;
+    }
     LOG_INFO("[Persist] Initialized, mode=%d\n", g_config.persist_mode);
 }
 
+void kvs_persist_load(void) {
+    int load_rdb = g_config.persist_mode == PERSIST_RDB_ONLY ||
+                   g_config.persist_mode == PERSIST_MIXED;
+    int load_aof = (g_config.persist_mode == PERSIST_AOF_ONLY ||
+                    g_config.persist_mode == PERSIST_MIXED) &&
+                   strlen(g_config.aof_file) > 0;
+
+    /* 带 RDB 前导的 AOF 已包含完整数据集，RDB 文件只会更旧或等价 */
+    if (load_aof && g_config.persist_mode == PERSIST_MIXED &&
+        kvs_aof_has_preamble(g_config.aof_file)) {
+        LOG_INFO("[Persist] AOF has RDB preamble, skipping %s\n", g_config.rdb_file);
+        load_rdb = 0;
+    }
+
+    if (load_rdb) kvs_hash_load_rdb(&global_hash, g_config.rdb_file);
+    if (load_aof && load_aof_file(g_config.aof_file) < 0) {
+        /* 之后的追加会排在残缺数据后面，下次启动仍读不到；保留原文件后重写 */
+        char saved[512];
+        snprintf(saved, sizeof(saved), "%s.truncated", g_config.aof_file);
+        unlink(saved);
+        if (link(g_config.aof_file, saved) == 0)
+            LOG_INFO("[Persist] Damaged AOF kept as %s\n", saved);
+        kvs_aof_rewrite();
+    }
+}
+
 static int save_item(FILE *fp, const void *key, size_t key_len,
                      const void *val, size_t val_len) {
     if (fwrite(&key_len, sizeof(size_t), 1, fp) != 1) return -1;
@@ -100,24 +135,30 @@ static int save_item(FILE *fp, const void *key, size_t key_len,
     return 0;
 }
 
-void kvs_rdb_save(void) {
+static int save_items(FILE *fp) {
+    for (int i = 0; i < global_hash.max_slots; i++) {
+        hashnode_t *node = global_hash.nodes[i];
+        while (node) {
+            const void *val = kvs_hash_node_value(&global_hash, node);
+            if (!val || save_item(fp, node->key, node->key_len, val, node->value_len) < 0)
+                return -1;
+            node = node->next;
+        }
+    }
+    return 0;
+}
+
+static void rdb_save(void) {
     FILE *fp = fopen(g_config.rdb_file, "wb");
     if (!fp) {
         LOG_WARN("[Persist] Failed to open RDB file for write: %s\n", g_config.rdb_file);
         return;
     }
 
-    for (int i = 0; i < global_hash.max_slots; i++) {
-        hashnode_t *node = global_hash.nodes[i];
-        while (node) {
-            if (save_item(fp, node->key, node->key_len,
-                          node->value, node->value_len) < 0) {
-                LOG_WARN("[Persist] Error writing RDB entry\n");
-                fclose(fp);
-                return;
-            }
-            node = node->next;
-        }
+    if (save_items(fp) < 0) {
+        LOG_WARN("[Persist] Error writing RDB entry\n");
+        fclose(fp);
+        return;
     }
 
     fflush(fp);
@@ -126,12 +167,77 @@ void kvs_rdb_save(void) {
     LOG_INFO("[Persist] RDB snapshot saved to %s\n", g_config.rdb_file);
 }
 
-void load_aof_file(const char *filename) {
-    if (!filename) return;
+/* 快照在 reactor 线程上同步写出，耗时记入慢日志 */
+void kvs_rdb_save(void) {
+    uint64_t start = kvs_clock_ns();
+    rdb_save();
+    uint64_t ns = kvs_clock_ns() - start;
+    g_persist_runtime.rdb_saves++;
+    g_persist_runtime.rdb_last_save_ns = ns;
+    g_persist_runtime.rdb_save_ns += ns;
+    kvs_slowlog_event("rdb-save", -1, ns);
+}
+
+/* 从内存缓冲区批量加载 RDB 条目，直到结束标记或数据耗尽，返回加载条数 */
+size_t kvs_rdb_encode_item(char *buf, const void *key, size_t key_len,
+                           const void *val, size_t val_len) {
+    char *p = buf;
+    memcpy(p, &key_len, sizeof(size_t));
+    p += sizeof(size_t);
+    memcpy(p, key, key_len);
+    p += key_len;
+    memcpy(p, &val_len, sizeof(size_t));
+    p += sizeof(size_t);
+    memcpy(p, val, val_len);
+    return p + val_len - buf;
+}
+
+int kvs_rdb_load_buffer(kvs_hash_t *hash, const char *buf, size_t len, size_t *consumed,
+                        int *eof) {
+    size_t pos = 0;
+    int loaded = 0;
+
+    if (eof) *eof = 0;
+    while (pos + sizeof(size_t) <= len) {
+        size_t klen, vlen;
+        memcpy(&klen, buf + pos, sizeof(size_t));
+        if (klen == RDB_ITEM_EOF) {
+            pos += sizeof(size_t);
+            if (eof) *eof = 1;
+            break;
+        }
+        /* 长度来自文件或复制流，超过上限视为损坏；用减法比较避免溢出 */
+        if (klen > RDB_MAX_KEY_LEN) break;
+        if (len - pos < 2 * sizeof(size_t) || klen > len - pos - 2 * sizeof(size_t)) break;
+        const char *key = buf + pos + sizeof(size_t);
+        memcpy(&vlen, key + klen, sizeof(size_t));
+        const char *val = key + klen + sizeof(size_t);
+        if (vlen > RDB_MAX_VALUE_LEN || vlen > len - (size_t)(val - buf)) break;
+
+        if (kvs_hash_set(hash, key, klen, val, vlen) < 0) break;
+        loaded++;
+        pos = (val - buf) + vlen;
+    }
+
+    if (consumed) *consumed = pos;
+    return loaded;
+}
+
+int kvs_aof_has_preamble(const char *filename) {
+    char magic[AOF_PREAMBLE_MAGIC_LEN];
+    FILE *fp = fopen(filename, "rb");
+    if (!fp) return 0;
+    size_t n = fread(magic, 1, sizeof(magic), fp);
+    fclose(fp);
+    return n == sizeof(magic) && memcmp(magic, AOF_PREAMBLE_MAGIC, sizeof(magic)) == 0;
+}
+
+int load_aof_file(const char *filename) {
+    if (!filename) return 0;
     FILE *fp = fopen(filename, "rb");
     if (!fp) {
         LOG_INFO("[Persist] AOF file not found: %s\n", filename);
-        return;
+        return 0;
     }
 
     fseek(fp, 0, SEEK_END);
@@ -139,19 +245,19 @@ void load_aof_file(const char *filename) {
     fseek(fp, 0, SEEK_SET);
     if (fsize <= 0) {
         fclose(fp);
-        return;
+        return 0;
     }
 
     char *buffer = kvs_malloc(fsize + 1);
     if (!buffer) {
         fclose(fp);
-        return;
+        return 0;
     }
     size_t bytes_read = fread(buffer, 1, fsize, fp);
     fclose(fp);
     if (bytes_read != (size_t)fsize) {
         kvs_free(buffer);
-        return;
+        return 0;
     }
     buffer[fsize] = '\0';
 
@@ -160,6 +266,24 @@ void load_aof_file(const char *filename) {
     int offset = 0;
     int cmd_count = 0;
 
+    if (fsize >= AOF_PREAMBLE_MAGIC_LEN &&
+        memcmp(buffer, AOF_PREAMBLE_MAGIC, AOF_PREAMBLE_MAGIC_LEN) == 0) {
+        size_t consumed = 0;
+        int eof = 0;
+        int loaded = kvs_rdb_load_buffer(&global_hash, buffer + AOF_PREAMBLE_MAGIC_LEN,
+                                         fsize - AOF_PREAMBLE_MAGIC_LEN, &consumed, &eof);
+        offset = AOF_PREAMBLE_MAGIC_LEN + consumed;
+        /* 前导不完整时其后是二进制数据的残余，不能当作 RESP 重放 */
+        if (!eof) {
+            LOG_INFO("[Persist] AOF preamble truncated at offset %d (%d keys loaded), "
+                     "ignoring the rest of %s\n", offset, loaded, filename);
+            kvs_free(buffer);
+            g_is_loading = 0;
+            return -1;
+        }
+        LOG_INFO("[Persist] AOF preamble loaded: %d keys, %d bytes\n", loaded, offset);
+    }
+
     while (offset < fsize) {
         int processed = 0;
         int needed = 0;
@@ -186,6 +310,7 @@ void load_aof_file(const char *filename) {
     LOG_INFO("[Persist] AOF replay completed: %d commands\n", cmd_count);
     kvs_free(buffer);
     g_is_loading = 0;
+    return 0;
 }
 
 void kvs_rdb_check_and_save(void) {
@@ -201,74 +326,121 @@ static int kvs_aof_needs_rewrite(void) {
     if (!g_config.aof_auto_rewrite) return 0;
     if (stat(g_config.aof_file, &st) == 0) {
         long threshold = g_config.aof_rewrite_size * 1024L * 1024L;
-        return st.st_size > threshold;
+        /* 重写后的基准大小本身可能超过阈值，需增长一倍才再次触发 */
+        return st.st_size > threshold && st.st_size > 2 * g_persist_runtime.aof_base_size;
+    }
+    return 0;
+}
+
+static int aof_rewrite_resp(FILE *fp) {
+    char buf[KVS_MAX_MSG_LEN];
+    for (int i = 0; i < global_hash.max_slots; i++) {
+        hashnode_t *node = global_hash.nodes[i];
+        while (node) {
+            const void *val = kvs_hash_node_value(&global_hash, node);
+            if (!val) return -1;
+            const char *argv[3] = { "SET", node->key, val };
+            size_t lens[3] = { 3, node->key_len, node->value_len };
+            if (kvs_resp_encoded_len(3, lens) > sizeof(buf)) {
+                LOG_WARN("[Persist] Buffer too small for key\n");
+                return -1;
+            }
+            size_t len = kvs_resp_encode(buf, 3, argv, lens);
+            if (fwrite(buf, 1, len, fp) != (size_t)len) return -1;
+            node = node->next;
+        }
     }
     return 0;
 }
 
-void kvs_aof_rewrite(void) {
+static int aof_rewrite_preamble(FILE *fp) {
+    size_t eof = RDB_ITEM_EOF;
+    if (fwrite(AOF_PREAMBLE_MAGIC, 1, AOF_PREAMBLE_MAGIC_LEN, fp) != AOF_PREAMBLE_MAGIC_LEN)
+        return -1;
+    if (save_items(fp) < 0) return -1;
+    if (fwrite(&eof, sizeof(size_t), 1, fp) != 1) return -1;
+    return 0;
+}
+
+static int aof_rewrite(void) {
     static int rewrite_in_progress = 0;
-    if (rewrite_in_progress) return;
+    if (rewrite_in_progress) return 0;
     rewrite_in_progress = 1;
 
     LOG_INFO("[Persist] Starting AOF rewrite...\n");
+    kvs_aof_flush();
 
     char tmpfile[512];
     snprintf(tmpfile, sizeof(tmpfile), "%s.tmp", g_config.aof_file);
 
-    FILE *fp = fopen(tmpfile, "w");
+    FILE *fp = fopen(tmpfile, "wb");
     if (!fp) {
         perror("[Persist] Failed to create temp AOF");
         rewrite_in_progress = 0;
-        return;
-    }
-
-    char buf[KVS_MAX_MSG_LEN];
-    for (int i = 0; i < global_hash.max_slots; i++) {
-        hashnode_t *node = global_hash.nodes[i];
-        while (node) {
-            int pos = 0;
-            int remaining = sizeof(buf) - pos;
-            pos += snprintf(buf + pos, remaining, "*3\r\n$4\r\nHSET\r\n");
-
-            remaining = sizeof(buf) - pos;
-            pos += snprintf(buf + pos, remaining, "$%zu\r\n", node->key_len);
-            if (pos + node->key_len + 2 > sizeof(buf)) {
-                LOG_WARN("[Persist] Buffer too small for key\n");
-                break;
-            }
-            memcpy(buf + pos, node->key, node->key_len);
-            pos += node->key_len;
-            buf[pos++] = '\r';
-            buf[pos++] = '\n';
-
-            remaining = sizeof(buf) - pos;
-            pos += snprintf(buf + pos, remaining, "$%zu\r\n", node->value_len);
-            if (pos + node->value_len + 2 > sizeof(buf)) {
-                LOG_WARN("[Persist] Buffer too small for value\n");
-                break;
-            }
-            memcpy(buf + pos, node->value, node->value_len);
-            pos += node->value_len;
-            buf[pos++] = '\r';
-            buf[pos++] = '\n';
-
-            fwrite(buf, 1, pos, fp);
-            node = node->next;
-        }
+        return -1;
     }
 
+    int ret = (g_config.persist_mode == PERSIST_MIXED) ?
+              aof_rewrite_preamble(fp) : aof_rewrite_resp(fp);
     fflush(fp);
+    long size = ftell(fp);
     fclose(fp);
+    if (ret < 0) {
+        LOG_WARN("[Persist] AOF rewrite failed, keeping old file\n");
+        unlink(tmpfile);
+        rewrite_in_progress = 0;
+        return -1;
+    }
 
     if (rename(tmpfile, g_config.aof_file) == 0) {
-        LOG_INFO("[Persist] AOF rewrite completed\n");
+        /* 旧 fd 仍指向被替换的文件，下次写入时重新打开 */
+        if (aof.fd >= 0) {
+            close(aof.fd);
+            aof.fd = -1;
+        }
+        g_persist_runtime.aof_base_size = size;
+        LOG_INFO("[Persist] AOF rewrite completed, %ld bytes\n", size);
     } else {
         perror("[Persist] Failed to replace AOF");
         unlink(tmpfile);
+        ret = -1;
     }
 
     rewrite_in_progress = 0;
+    return ret;
+}
+
+int kvs_aof_rewrite(void) {
+    uint64_t start = kvs_clock_ns();
+    int ret = aof_rewrite();
+    uint64_t ns = kvs_clock_ns() - start;
+    g_persist_runtime.aof_rewrites++;
+    g_persist_runtime.aof_last_rewrite_ns = ns;
+    g_persist_runtime.aof_rewrite_ns += ns;
+    kvs_slowlog_event("aof-rewrite", -1, ns);
+    return ret;
+}
+
+/*
+ * 运行时切换持久化模式。新开启 AOF 时先重写出完整数据集，之后的写命令追加
+ * 在它后面；关闭 AOF 时写出缓冲区并关闭文件。RDB 由定时器按当前模式决定。
+ */
+int kvs_persist_reconfigure(int old_mode) {
+    int had_aof = old_mode == PERSIST_AOF_ONLY || old_mode == PERSIST_MIXED;
+    int has_aof = g_config.persist_mode == PERSIST_AOF_ONLY ||
+                  g_config.persist_mode == PERSIST_MIXED;
+
+    if (has_aof && !had_aof) {
+        if (kvs_aof_rewrite() < 0) return -1;
+    } else if (had_aof && !has_aof) {
+        kvs_aof_flush();
+        if (aof.fd >= 0) {
+            close(aof.fd);
+            aof.fd = -1;
+        }
+    }
+    LOG_INFO("[Persist] Mode changed %d -> %d\n", old_mode, g_config.persist_mode);
+    return 0;
 }
 
 void kvs_aof_check_and_rewrite(void) {
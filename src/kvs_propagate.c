@@ -0,0 +1,93 @@
+#include "../include/kvs_base.h"
+#include "../include/kvs_propagate.h"
+#include "../include/kvs_persist.h"
+#include "../include/kvs_configure.h"
+#include "../include/kvs_latency.h"
+#if ENABLE_REPL
+#include "../include/kvs_replication.h"
+#endif
+#include <stdio.h>
+#include <string.h>
+
+/*
+ * 写命令的传播阶段：每条写命令只编码一次 RESP，编码结果放进引用计数的缓冲区，
+ * 交给 AOF 缓冲区、复制 backlog 以及每个从机的输出队列共用，
+ * 从机数量增加时每次写入的编码开销不变。
+ */
+
+kvs_sbuf_t *kvs_sbuf_new(const void *data, size_t len) {
+    kvs_sbuf_t *b = kvs_malloc(sizeof(kvs_sbuf_t) + len);
+    if (!b) return NULL;
+    b->refcount = 1;
+    b->len = len;
+    if (data) memcpy(b->data, data, len);
+    return b;
+}
+
+void kvs_sbuf_retain(kvs_sbuf_t *b) {
+    b->refcount++;
+}
+
+void kvs_sbuf_release(kvs_sbuf_t *b) {
+    if (b && --b->refcount == 0) kvs_free(b);
+}
+
+static size_t resp_digits(size_t n) {
+    size_t d = 1;
+    while (n >= 10) {
+        n /= 10;
+        d++;
+    }
+    return d;
+}
+
+size_t kvs_resp_encoded_len(int argc, const size_t *lens) {
+    size_t len = 3 + resp_digits(argc);                         /* *<argc>\r\n */
+    for (int i = 0; i < argc; i++)
+        len += 5 + resp_digits(lens[i]) + lens[i];              /* $<len>\r\n<data>\r\n */
+    return len;
+}
+
+size_t kvs_resp_encode(char *buf, int argc, const char **argv, const size_t *lens) {
+    char *p = buf;
+    p += sprintf(p, "*%d\r\n", argc);
+    for (int i = 0; i < argc; i++) {
+        p += sprintf(p, "$%zu\r\n", lens[i]);
+        memcpy(p, argv[i], lens[i]);
+        p += lens[i];
+        *p++ = '\r';
+        *p++ = '\n';
+    }
+    return p - buf;
+}
+
+void kvs_propagate(int argc, const char **argv, const size_t *lens) {
+    int to_aof = 0, to_repl = 0;
+#if ENABLE_PERSIST
+    to_aof = !g_is_loading && (g_config.persist_mode == PERSIST_AOF_ONLY ||
+                               g_config.persist_mode == PERSIST_MIXED);
+#endif
+#if ENABLE_REPL
+    /* 启动时重放的 AOF 不是新的写入，不进入 backlog，也不推进 master_repl_offset */
+    to_repl = !g_is_loading && g_repl.role == KVS_ROLE_MASTER;
+#endif
+    if (!to_aof && !to_repl) return;
+
+    uint64_t start = kvs_clock_ns();
+    /* 编码长度可精确预知，一次分配 */
+    kvs_sbuf_t *b = kvs_sbuf_new(NULL, kvs_resp_encoded_len(argc, lens));
+    if (!b) {
+        LOG_WARN("[Propagate] Out of memory encoding %.*s\n", (int)lens[0], argv[0]);
+        return;
+    }
+    b->len = kvs_resp_encode(b->data, argc, argv, lens);
+
+#if ENABLE_PERSIST
+    if (to_aof) kvs_aof_feed(b->data, b->len);
+#endif
+#if ENABLE_REPL
+    if (to_repl) kvs_replication_feed(b);
+#endif
+    kvs_sbuf_release(b);
+    if (!g_is_loading) kvs_latency_phase(KVS_LAT_PROPAGATE, kvs_clock_ns() - start);
+}
@@ -0,0 +1,588 @@
+#include "../include/kvs_base.h"
+#include "../include/kvs_proxy.h"
+#include "../include/kvs_cluster.h"
+#include "../include/kvs_configure.h"
+#include "../include/server.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/socket.h>
+
+extern void event_register_read(int fd, int (*handler)(int));
+
+/*
+ * 代理模式：同一个二进制、同一个 reactor，不加载存储引擎。客户端的命令按
+ * key 的槽位（与集群相同的 CRC16 mod 16384）均分到配置的后端，每个后端只保持
+ * 少量长连接，所有客户端的请求在这些连接上流水线发送，回复按 FIFO 对应回请求。
+ *
+ * 顺序保证：同一客户端发往同一后端的请求固定走同一条连接（client id 取模），
+ * 后端按序执行；发往不同后端的请求可能乱序完成，回复先挂在客户端的请求链表上，
+ * 只有链表头完成时才按序写回客户端。
+ */
+
+#define PROXY_MAX_BACKENDS          KVS_CONFIG_MAX_NODES
+#define PROXY_BUFFER_SIZE           (16 * 1024)     /* 客户端连接的初始读写缓冲区 */
+#define PROXY_READ_CHUNK            (64 * 1024)
+#define PROXY_CLIENT_MAX_PENDING    1024            /* 单个客户端在途请求上限，超过则暂停读取 */
+
+typedef struct proxy_req_s {
+    struct proxy_req_s *next;       /* 同一客户端的请求，按发送顺序 */
+    struct proxy_req_s *link_next;  /* 同一后端连接上等待回复的请求 */
+    int fd;                         /* 客户端 fd，-1 表示客户端已断开 */
+    int done;
+    char *reply;
+    size_t len;
+} proxy_req_t;
+
+typedef struct {
+    unsigned int id;
+    proxy_req_t *head, *tail;
+    int pending;
+} proxy_client_t;
+
+typedef struct {
+    int fd;                         /* -1 表示未连接 */
+    char *in;
+    size_t in_len, in_cap;
+    proxy_req_t *head, *tail;
+    long pending;
+} proxy_link_t;
+
+typedef struct {
+    char ip[16];
+    int port;
+    proxy_link_t links[KVS_PROXY_MAX_LINKS];
+    unsigned long long requests;
+    unsigned long long errors;
+} proxy_backend_t;
+
+static struct {
+    int enabled;
+    int nbackends;
+    int nlinks;
+    proxy_backend_t backends[PROXY_MAX_BACKENDS];
+    proxy_client_t *clients[CONNECTION_SIZE];
+    int nclients;
+    unsigned long long requests;
+} proxy;
+
+static const char ERR_UNAVAILABLE[] = "-ERR backend unavailable\r\n";
+static const char ERR_LOST[] = "-ERR backend connection lost\r\n";
+static const char ERR_OOM[] = "-ERR out of memory\r\n";
+
+int kvs_proxy_enabled(void) {
+    return proxy.enabled;
+}
+
+/* ---------------- 客户端 ---------------- */
+
+static proxy_client_t *client_get(int fd) {
+    proxy_client_t *c = proxy.clients[fd];
+    if (c) return c;
+    c = kvs_malloc(sizeof(*c));
+    if (!c) return NULL;
+    c->id = kvs_client_id(fd);
+    c->head = c->tail = NULL;
+    c->pending = 0;
+    proxy.clients[fd] = c;
+    proxy.nclients++;
+    return c;
+}
+
+/* 客户端断开：已完成的回复直接释放，仍在后端排队的请求留给后端回复时释放 */
+static void client_free(int fd) {
+    proxy_client_t *c = proxy.clients[fd];
+    proxy_req_t *r = c->head;
+    while (r) {
+        proxy_req_t *next = r->next;
+        if (r->done) {
+            kvs_free(r->reply);
+            kvs_free(r);
+        } else {
+            r->fd = -1;
+            r->next = NULL;
+        }
+        r = next;
+    }
+    kvs_free(c);
+    proxy.clients[fd] = NULL;
+    proxy.nclients--;
+}
+
+static proxy_req_t *client_push(int fd, proxy_client_t *c) {
+    proxy_req_t *r = kvs_malloc(sizeof(*r));
+    if (!r) return NULL;
+    r->next = r->link_next = NULL;
+    r->fd = fd;
+    r->done = 0;
+    r->reply = NULL;
+    r->len = 0;
+    if (c->tail) c->tail->next = r;
+    else c->head = r;
+    c->tail = r;
+    c->pending++;
+    return r;
+}
+
+static proxy_req_t *client_pop(proxy_client_t *c) {
+    proxy_req_t *r = c->head;
+    c->head = r->next;
+    if (!c->head) c->tail = NULL;
+    c->pending--;
+    return r;
+}
+
+/* 写出链表头部已完成的回复，在途请求降到一半以下时恢复读取 */
+static void client_flush(int fd, proxy_client_t *c) {
+    unsigned int id = c->id;
+    while (c->head && c->head->done) {
+        proxy_req_t *r = client_pop(c);
+        int ret = kvs_client_write(fd, r->reply, r->len);
+        kvs_free(r->reply);
+        kvs_free(r);
+        if (ret < 0) return;
+    }
+    if (c->pending < PROXY_CLIENT_MAX_PENDING / 2 && kvs_client_blocked(fd))
+        kvs_unblock_client(fd, id, NULL, 0);
+}
+
+/* 代理自己生成的回复也要排在之前转发的请求之后 */
+static void client_reply(int fd, proxy_client_t *c, const char *data, size_t len) {
+    if (!c->head) {
+        kvs_client_write(fd, data, len);
+        return;
+    }
+    proxy_req_t *r = client_push(fd, c);
+    char *copy = kvs_malloc(len);
+    if (!r || !copy) {
+        kvs_free(copy);
+        if (r) {
+            r->done = 1;
+            r->reply = NULL;
+        }
+        kvs_close_client(fd);
+        return;
+    }
+    memcpy(copy, data, len);
+    r->reply = copy;
+    r->len = len;
+    r->done = 1;
+}
+
+/* 后端回复到达：请求位于链表头时直接写回，否则暂存 */
+static void proxy_deliver(proxy_req_t *r, const char *data, size_t len) {
+    if (r->fd < 0) {
+        kvs_free(r);
+        return;
+    }
+    int fd = r->fd;
+    proxy_client_t *c = proxy.clients[fd];
+    if (c->head != r) {
+        r->reply = kvs_malloc(len);
+        if (r->reply) {
+            memcpy(r->reply, data, len);
+            r->len = len;
+        } else {
+            r->reply = kvs_malloc(sizeof(ERR_OOM) - 1);
+            if (r->reply) memcpy(r->reply, ERR_OOM, sizeof(ERR_OOM) - 1);
+            r->len = r->reply ? sizeof(ERR_OOM) - 1 : 0;
+        }
+        r->done = 1;
+        return;
+    }
+    client_pop(c);
+    kvs_free(r);
+    if (kvs_client_write(fd, data, len) < 0) return;
+    client_flush(fd, c);
+}
+
+/* ---------------- 后端连接 ---------------- */
+
+static proxy_link_t *link_find(int fd, proxy_backend_t **owner) {
+    for (int i = 0; i < proxy.nbackends; i++) {
+        proxy_backend_t *b = &proxy.backends[i];
+        for (int j = 0; j < proxy.nlinks; j++) {
+            if (b->links[j].fd == fd) {
+                if (owner) *owner = b;
+                return &b->links[j];
+            }
+        }
+    }
+    return NULL;
+}
+
+static proxy_req_t *link_pop(proxy_link_t *l) {
+    proxy_req_t *r = l->head;
+    l->head = r->link_next;
+    if (!l->head) l->tail = NULL;
+    l->pending--;
+    return r;
+}
+
+/* 连接断开：先标记不可用，再给所有等待中的请求回复错误 */
+static void link_down(proxy_backend_t *b, proxy_link_t *l) {
+    l->fd = -1;
+    kvs_free(l->in);
+    l->in = NULL;
+    l->in_len = l->in_cap = 0;
+    while (l->head) {
+        b->errors++;
+        proxy_deliver(link_pop(l), ERR_LOST, sizeof(ERR_LOST) - 1);
+    }
+}
+
+/* 一条完整回复的长度，0 表示尚未收全，-1 表示格式错误 */
+static long reply_len(const char *p, size_t len) {
+    if (len == 0) return 0;
+    const char *nl = memchr(p, '\n', len);
+    if (!nl) return 0;
+    if (nl == p || nl[-1] != '\r') return -1;
+    long line = nl - p + 1;
+
+    switch (p[0]) {
+    case '+':
+    case '-':
+    case ':':
+        return line;
+    case '$':
+    case '*': {
+        char *end;
+        long n = strtol(p + 1, &end, 10);
+        if (end == p + 1 || *end != '\r') return -1;
+        if (n < 0) return line;
+        if (p[0] == '$')
+            return (size_t)line + n + 2 <= len ? line + n + 2 : 0;
+        long off = line;
+        for (long i = 0; i < n; i++) {
+            long r = reply_len(p + off, len - off);
+            if (r <= 0) return r;
+            off += r;
+        }
+        return off;
+    }
+    default:
+        return -1;
+    }
+}
+
+static int link_read_cb(int fd) {
+    proxy_backend_t *b = NULL;
+    proxy_link_t *l = link_find(fd, &b);
+    if (!l) {
+        kvs_close_client(fd);
+        return -1;
+    }
+
+    if (l->in_cap - l->in_len < PROXY_READ_CHUNK) {
+        size_t cap = l->in_cap ? l->in_cap * 2 : PROXY_READ_CHUNK * 2;
+        while (cap - l->in_len < PROXY_READ_CHUNK) cap *= 2;
+        char *buf = kvs_realloc(l->in, cap);
+        if (!buf) {
+            LOG_WARN("[Proxy] Out of memory reading from backend %s:%d\n", b->ip, b->port);
+            kvs_close_client(fd);
+            return -1;
+        }
+        l->in = buf;
+        l->in_cap = cap;
+    }
+
+    ssize_t n = recv(fd, l->in + l->in_len, l->in_cap - l->in_len, 0);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) return 0;
+    if (n <= 0) {
+        /* 连接被拒绝说明后端尚未启动，由 cron 每秒重试，不重复告警 */
+        if (n < 0 && errno == ECONNREFUSED)
+            LOG_DEBUG("[Proxy] Backend %s:%d refused connection\n", b->ip, b->port);
+        else
+            LOG_WARN("[Proxy] Backend %s:%d connection lost\n", b->ip, b->port);
+        kvs_close_client(fd);
+        return -1;
+    }
+    l->in_len += n;
+
+    size_t off = 0;
+    while (off < l->in_len) {
+        long r = reply_len(l->in + off, l->in_len - off);
+        if (r == 0) break;
+        if (r < 0 || !l->head) {
+            LOG_WARN("[Proxy] Unexpected reply from backend %s:%d, reconnecting\n", b->ip, b->port);
+            kvs_close_client(fd);
+            return -1;
+        }
+        proxy_deliver(link_pop(l), l->in + off, r);
+        /* 写回客户端时可能触发新的转发，期间该连接可能被关闭 */
+        if (l->fd != fd) return 0;
+        off += r;
+    }
+    if (off > 0) {
+        memmove(l->in, l->in + off, l->in_len - off);
+        l->in_len -= off;
+    }
+    return n;
+}
+
+static void link_connect(proxy_backend_t *b, proxy_link_t *l) {
+    int fd = kvs_connect(b->ip, b->port, 0);
+    if (fd < 0) {
+        LOG_DEBUG("[Proxy] Cannot connect to backend %s:%d\n", b->ip, b->port);
+        return;
+    }
+    l->fd = fd;
+    event_register_read(fd, link_read_cb);
+}
+
+void kvs_proxy_conn_closed(int fd) {
+    if (!proxy.enabled || fd < 0 || fd >= CONNECTION_SIZE) return;
+    proxy_backend_t *b = NULL;
+    proxy_link_t *l = link_find(fd, &b);
+    if (l) {
+        link_down(b, l);
+        return;
+    }
+    if (proxy.clients[fd]) client_free(fd);
+}
+
+void kvs_proxy_cron(void) {
+    for (int i = 0; i < proxy.nbackends; i++) {
+        proxy_backend_t *b = &proxy.backends[i];
+        for (int j = 0; j < proxy.nlinks; j++) {
+            if (b->links[j].fd < 0) link_connect(b, &b->links[j]);
+        }
+    }
+}
+
+/* ---------------- 转发 ---------------- */
+
+static int is_key_command(const char *name, int len) {
+    static const char *cmds[] = { "SET", "GET", "DEL", "MOD", "EXISTS" };
+    for (size_t i = 0; i < sizeof(cmds) / sizeof(cmds[0]); i++) {
+        if ((int)strlen(cmds[i]) == len && memcmp(cmds[i], name, len) == 0) return 1;
+    }
+    return 0;
+}
+
+static int proxy_info(char *buf, int size) {
+    long pending = 0;
+    for (int i = 0; i < proxy.nbackends; i++)
+        for (int j = 0; j < proxy.nlinks; j++) pending += proxy.backends[i].links[j].pending;
+
+    int len = snprintf(buf, size,
+                       "# Proxy\r\n"
+                       "proxy_clients:%d\r\n"
+                       "proxy_backends:%d\r\n"
+                       "proxy_links_per_backend:%d\r\n"
+                       "proxy_requests:%llu\r\n"
+                       "proxy_pending:%ld\r\n",
+                       proxy.nclients, proxy.nbackends, proxy.nlinks,
+                       proxy.requests, pending);
+    for (int i = 0; i < proxy.nbackends && len < size; i++) {
+        proxy_backend_t *b = &proxy.backends[i];
+        int up = 0;
+        long waiting = 0;
+        for (int j = 0; j < proxy.nlinks; j++) {
+            if (b->links[j].fd >= 0) up++;
+            waiting += b->links[j].pending;
+        }
+        len += snprintf(buf + len, size - len,
+                        "backend%d:addr=%s:%d,links=%d/%d,pending=%ld,requests=%llu,errors=%llu\r\n",
+                        i, b->ip, b->port, up, proxy.nlinks, waiting, b->requests, b->errors);
+    }
+    return len < size ? len : size - 1;
+}
+
+static void proxy_dispatch(int fd, proxy_client_t *c, const char *req, int len,
+                           int argc, const char **argv, const int *lens) {
+    proxy.requests++;
+
+    if (argc >= 2 && is_key_command(argv[0], lens[0])) {
+        unsigned int slot = kvs_cluster_keyslot(argv[1], lens[1]);
+        proxy_backend_t *b = &proxy.backends[slot * proxy.nbackends / KVS_CLUSTER_SLOTS];
+        proxy_link_t *l = &b->links[c->id % proxy.nlinks];
+        if (l->fd < 0) {
+            b->errors++;
+            client_reply(fd, c, ERR_UNAVAILABLE, sizeof(ERR_UNAVAILABLE) - 1);
+            return;
+        }
+        proxy_req_t *r = client_push(fd, c);
+        if (!r) {
+            kvs_close_client(fd);
+            return;
+        }
+        if (l->tail) l->tail->link_next = r;
+        else l->head = r;
+        l->tail = r;
+        l->pending++;
+        b->requests++;
+        /* 原样转发；写失败时连接被关闭，该请求由 link_down 回复错误 */
+        kvs_client_write(l->fd, req, len);
+        return;
+    }
+
+    if (argc == 1 && lens[0] == 4 && memcmp(argv[0], "INFO", 4) == 0) {
+        char info[4096];
+        char reply[4200];
+        int ilen = proxy_info(info, sizeof(info));
+        int rlen = snprintf(reply, sizeof(reply), "$%d\r\n%.*s\r\n", ilen, ilen, info);
+        client_reply(fd, c, reply, rlen);
+        return;
+    }
+
+    static const char err[] = "-ERR command not supported by proxy\r\n";
+    client_reply(fd, c, err, sizeof(err) - 1);
+}
+
+/* 读取 "<数字>\r\n"，超过 max 视为格式错误，避免溢出成负数 */
+static int parse_num(const char **pp, const char *end, long max, int *out) {
+    const char *p = *pp;
+    long n = 0;
+    const char *start = p;
+    while (p < end && *p >= '0' && *p <= '9') {
+        n = n * 10 + (*p - '0');
+        if (n > max) return -1;
+        p++;
+    }
+    if (p >= end) return 0;
+    if (p == start || *p != '\r') return -1;
+    p++;
+    if (p >= end) return 0;
+    if (*p != '\n') return -1;
+    *pp = p + 1;
+    *out = (int)n;
+    return 1;
+}
+
+/*
+ * 找出一条 RESP 请求的边界，只取命令名与第一个参数，请求本身原样转发。
+ * 返回请求长度，0 表示尚未收全，-1 表示格式错误。
+ */
+static int request_parse(const char *msg, int len, const char **argv, int *lens, int *argc) {
+    const char *p = msg + 1;
+    const char *end = msg + len;
+    int n, ret;
+
+    /* 参数长度不会超过单个连接允许的输入缓冲区 */
+    long max_bulk = (long)g_config.query_buffer_limit * 1024 * 1024;
+    if ((ret = parse_num(&p, end, KVS_MAX_TOKENS, &n)) <= 0) return ret;
+    for (int i = 0; i < n; i++) {
+        int blen;
+        if (p >= end) return 0;
+        if (*p != '$') return -1;
+        p++;
+        if ((ret = parse_num(&p, end, max_bulk < INT_MAX ? max_bulk : INT_MAX, &blen)) <= 0)
+            return ret;
+        if (end - p < (long)blen + 2) return 0;
+        if (i < 2) {
+            argv[i] = p;
+            lens[i] = blen;
+        }
+        p += blen + 2;
+    }
+    *argc = n;
+    return p - msg;
+}
+
+int kvs_proxy_protocol(char *msg, int length, char *response, int resp_size,
+                       int *processed, int *needed) {
+    (void)response;
+    (void)resp_size;
+    if (!msg || !processed || !needed) return -1;
+    *processed = 0;
+    *needed = 0;
+
+    int fd = g_client_fd;
+    if (fd < 0) return -1;
+    unsigned int id = kvs_client_id(fd);
+    proxy_client_t *c = client_get(fd);
+    if (!c) return -1;
+
+    char *p = msg;
+    int remain = length;
+    while (remain > 0) {
+        while (remain > 0 && isspace((unsigned char)*p)) {
+            p++;
+            remain--;
+            (*processed)++;
+        }
+        if (remain <= 0) break;
+
+        if (*p != '*') {
+            char *next_star = memchr(p, '*', remain);
+            if (!next_star) break;
+            int junk = next_star - p;
+            p = next_star;
+            remain -= junk;
+            *processed += junk;
+            continue;
+        }
+
+        const char *argv[2] = { NULL, NULL };
+        int lens[2] = { 0, 0 };
+        int argc = 0;
+        int consumed = request_parse(p, remain, argv, lens, &argc);
+        if (consumed == 0) break;
+        if (consumed < 0) {
+            char *next_line = memchr(p, '\n', remain);
+            if (!next_line) break;
+            int skip = next_line - p + 1;
+            p += skip;
+            remain -= skip;
+            *processed += skip;
+            continue;
+        }
+
+        proxy_dispatch(fd, c, p, consumed, argc, argv, lens);
+        p += consumed;
+        remain -= consumed;
+        *processed += consumed;
+
+        /* 转发或回复过程中客户端可能已被关闭 */
+        if (kvs_client_id(fd) != id) return 0;
+        if (c->pending >= PROXY_CLIENT_MAX_PENDING) {
+            kvs_block_client(fd);
+            break;
+        }
+    }
+    return 0;
+}
+
+/* ---------------- 初始化 ---------------- */
+
+static int backend_parse(const char *s, proxy_backend_t *b) {
+    const char *colon = strrchr(s, ':');
+    if (!colon || colon == s || (size_t)(colon - s) >= sizeof(b->ip)) return -1;
+    memcpy(b->ip, s, colon - s);
+    b->ip[colon - s] = '\0';
+    b->port = atoi(colon + 1);
+    return b->port > 0 && b->port < 65536 ? 0 : -1;
+}
+
+int kvs_proxy_init(void) {
+    if (g_config.proxy_backend_count == 0) {
+        LOG_WARN("[Proxy] No backend configured\n");
+        return -1;
+    }
+
+    proxy.nlinks = g_config.proxy_connections;
+    if (proxy.nlinks < 1) proxy.nlinks = 1;
+    if (proxy.nlinks > KVS_PROXY_MAX_LINKS) proxy.nlinks = KVS_PROXY_MAX_LINKS;
+
+    for (int i = 0; i < g_config.proxy_backend_count; i++) {
+        proxy_backend_t *b = &proxy.backends[proxy.nbackends];
+        if (backend_parse(g_config.proxy_backends[i], b) < 0) {
+            LOG_WARN("[Proxy] Invalid backend: %s\n", g_config.proxy_backends[i]);
+            return -1;
+        }
+        for (int j = 0; j < KVS_PROXY_MAX_LINKS; j++) b->links[j].fd = -1;
+        proxy.nbackends++;
+    }
+
+    proxy.enabled = 1;
+    /* 客户端连接数量大，初始缓冲区按需扩容 */
+    kvs_set_conn_buffer_size(PROXY_BUFFER_SIZE);
+    kvs_proxy_cron();
+
+    LOG_INFO("[Proxy] %d backends, %d links each\n", proxy.nbackends, proxy.nlinks);
+    return 0;
+}
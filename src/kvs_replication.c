@@ -2,262 +2,780 @@
 #include "../include/kvs_replication.h"
 #include "../include/kvs_hash.h"
 #include "../include/kvs_configure.h"
+#include "../include/kvs_persist.h"
+#include "../include/kvs_propagate.h"
+#include "../include/kvs_latency.h"
+#include "../include/kvs_slowlog.h"
+#include "../include/server.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <sys/timerfd.h>
 #include <sys/socket.h>
 #include <fcntl.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <errno.h>
+#include <limits.h>
+
+#define REPL_CONNECT_TIMEOUT     5                  /* 秒，连接建立并收到 PSYNC 回复的期限 */
+#define REPL_MIN_BACKLOG         (16 * 1024)
+#define REPL_SYNC_CHUNK          (256 * 1024)       /* 快照块的目标大小 */
+#define REPL_SYNC_WATERMARK      (1024 * 1024)      /* 输出缓冲区低于此值时继续生产 */
+#define REPL_SYNC_MAX_CHUNK      (1024LL * 1024 * 1024)
+#define REPL_INPUT_INIT          (64 * 1024)
+#define REPL_INPUT_READ          (16 * 1024)        /* 每次 recv 前至少留出的空间 */
+#define REPL_INPUT_MAX           (256 * 1024 * 1024)
+#define REPL_PING_PERIOD         10                 /* 秒，空闲时主机发送 GETACK 保活 */
+#define REPL_GETACK_CMD          "*3\r\n$8\r\nREPLCONF\r\n$6\r\nGETACK\r\n$1\r\n*\r\n"
 
 extern kvs_hash_t global_hash;
 extern void event_register_read(int fd, int (*handler)(int));
 extern void event_unregister_read(int fd);
-extern int kvs_protocol(char *msg, int length, char *response, int resp_size, int *processed, int *needed);
+extern int kvs_apply_command(char *msg, int length);
 
 kvs_replication_t g_repl = {
     .role = KVS_ROLE_MASTER,
     .master_fd = -1,
-    .slave_count = 0
+    .slave_count = 0,
+    .link_state = KVS_REPL_NONE
 };
 
-typedef struct slave_buffer {
-    char data[8192];
-    int len;
-} slave_buffer_t;
-static slave_buffer_t slave_buf = {0};
+/* 从机接收复制流的输入缓冲区，按需增长以容纳任意大小的命令 */
+static struct {
+    char *data;
+    size_t len;
+    size_t cap;
+} slave_buf;
+
+/* FULLRESYNC 宣告的历史，快照加载完成后才生效 */
+static char sync_replid[KVS_REPLID_LEN + 1];
+static long long sync_offset = -1;
+/* 从机：当前历史来自某个主机（完成过全量同步或续传） */
+static int repl_synced;
+
+/* 从机正在接收的快照块 */
+static struct {
+    char *data;
+    size_t len;
+    size_t need;
+    size_t cap;
+    int active;
+} sync_chunk;
+
+/* 主机编码快照块的暂存区，所有从机共用 */
+static struct {
+    char *data;
+    size_t len;
+    size_t cap;
+} sync_encode;
+
+/* 从机：复制流中出现 GETACK，本批数据应用完后回复 ACK */
+static int ack_requested;
+static long master_last_io;
+
+/* 主机：阻塞在 WAIT 上的客户端 */
+typedef struct {
+    int fd;
+    unsigned int id;
+    int numreplicas;
+    long long target;           /* 需要从机确认到的 offset */
+    long long deadline;         /* CLOCK_MONOTONIC 毫秒，0 表示不超时 */
+} repl_waiter_t;
+
+static struct {
+    repl_waiter_t *list;
+    int count;
+    int cap;
+    int tfd;
+} waiters = { .tfd = -1 };
+
+static struct {
+    unsigned long sync_full;
+    unsigned long sync_partial_ok;
+    unsigned long sync_partial_err;
+} repl_stats;
 
-static void kvs_replication_send_full_sync(int slave_fd);
-static void kvs_replication_send_key_value(const void *key, size_t key_len,
-                                          const void *val, size_t val_len, void *arg);
 static void kvs_replication_reconnect(void);
-static int kvs_connect_master(const char *ip, int port);
+static void repl_drop_master(void);
+
+static void repl_gen_replid(char *out) {
+    static const char hex[] = "0123456789abcdef";
+    unsigned char raw[KVS_REPLID_LEN / 2];
+    int fd = open("/dev/urandom", O_RDONLY);
+    if (fd < 0 || read(fd, raw, sizeof(raw)) != (ssize_t)sizeof(raw)) {
+        srandom((unsigned)time(NULL) ^ (unsigned)getpid());
+        for (size_t i = 0; i < sizeof(raw); i++) raw[i] = random() & 0xff;
+    }
+    if (fd >= 0) close(fd);
+    for (size_t i = 0; i < sizeof(raw); i++) {
+        out[i * 2] = hex[raw[i] >> 4];
+        out[i * 2 + 1] = hex[raw[i] & 0xf];
+    }
+    out[KVS_REPLID_LEN] = '\0';
+}
+
+/* ---------------- backlog ---------------- */
+
+static void backlog_create(void) {
+    long long size = (long long)g_config.repl_backlog_size * 1024 * 1024;
+    if (size < REPL_MIN_BACKLOG) size = REPL_MIN_BACKLOG;
+    g_repl.backlog = kvs_malloc(size);
+    g_repl.backlog_size = g_repl.backlog ? size : 0;
+    g_repl.backlog_idx = 0;
+    g_repl.backlog_histlen = 0;
+}
+
+/* 追加到复制流：推进 offset 并写入环形缓冲区 */
+static void backlog_feed(const char *p, size_t len) {
+    g_repl.master_repl_offset += len;
+    if (!g_repl.backlog) return;
+
+    while (len > 0) {
+        size_t thislen = g_repl.backlog_size - g_repl.backlog_idx;
+        if (thislen > len) thislen = len;
+        memcpy(g_repl.backlog + g_repl.backlog_idx, p, thislen);
+        g_repl.backlog_idx += thislen;
+        if (g_repl.backlog_idx == g_repl.backlog_size) g_repl.backlog_idx = 0;
+        g_repl.backlog_histlen += thislen;
+        p += thislen;
+        len -= thislen;
+    }
+    if (g_repl.backlog_histlen > g_repl.backlog_size)
+        g_repl.backlog_histlen = g_repl.backlog_size;
+}
+
+static void backlog_reset(long long offset) {
+    g_repl.master_repl_offset = offset;
+    g_repl.backlog_idx = 0;
+    g_repl.backlog_histlen = 0;
+}
+
+/* CONFIG SET replication.backlog_size：最新的历史按顺序搬到新缓冲区，offset 不变 */
+int kvs_replication_resize_backlog(void) {
+    long long size = (long long)g_config.repl_backlog_size * 1024 * 1024;
+    if (size < REPL_MIN_BACKLOG) size = REPL_MIN_BACKLOG;
+    if (!g_repl.backlog || size == g_repl.backlog_size) return 0;
+
+    char *backlog = kvs_malloc(size);
+    if (!backlog) return -1;
+    long long keep = g_repl.backlog_histlen < size ? g_repl.backlog_histlen : size;
+    long long j = (g_repl.backlog_idx - keep + g_repl.backlog_size) % g_repl.backlog_size;
+    for (long long done = 0; done < keep; j = 0) {
+        long long thislen = g_repl.backlog_size - j;
+        if (thislen > keep - done) thislen = keep - done;
+        memcpy(backlog + done, g_repl.backlog + j, thislen);
+        done += thislen;
+    }
+    kvs_free(g_repl.backlog);
+    g_repl.backlog = backlog;
+    g_repl.backlog_size = size;
+    g_repl.backlog_idx = keep % size;
+    g_repl.backlog_histlen = keep;
+    LOG_INFO("[REPL] Backlog resized to %lld bytes, %lld bytes of history kept\n", size, keep);
+    return 0;
+}
+
+static long long backlog_first_offset(void) {
+    return g_repl.master_repl_offset - g_repl.backlog_histlen;
+}
+
+/* 把 backlog 中 [offset, master_repl_offset) 这一段写入从机的输出缓冲区 */
+static int backlog_send_from(int fd, long long offset) {
+    long long skip = offset - backlog_first_offset();
+    long long len = g_repl.master_repl_offset - offset;
+    long long j = (g_repl.backlog_idx - g_repl.backlog_histlen + skip + g_repl.backlog_size)
+                  % g_repl.backlog_size;
+
+    while (len > 0) {
+        long long thislen = g_repl.backlog_size - j;
+        if (thislen > len) thislen = len;
+        if (kvs_client_write(fd, g_repl.backlog + j, thislen) < 0) return -1;
+        len -= thislen;
+        j = 0;
+    }
+    return 0;
+}
 
 void kvs_replication_init(void) {
+    repl_gen_replid(g_repl.replid);
+    g_repl.replid2[0] = '\0';
+    g_repl.second_replid_offset = -1;
+    g_repl.master_repl_offset = 0;
+    backlog_create();
+
     if (g_config.repl_switch == REPL_ON && g_config.repl_role == ROLE_SLAVE) {
         kvs_slaveof(g_config.master_ip, g_config.master_port);
     } else {
         g_repl.role = KVS_ROLE_MASTER;
         g_repl.master_fd = -1;
         g_repl.slave_count = 0;
-        memset(g_repl.slave_fds, 0, sizeof(g_repl.slave_fds));
-        LOG_INFO("[REPL] Initialized as MASTER\n");
+        memset(g_repl.slaves, 0, sizeof(g_repl.slaves));
+        LOG_INFO("[REPL] Initialized as MASTER, replid=%s\n", g_repl.replid);
     }
 }
 
-int kvs_replication_accept_master(int fd) {
-    char buf[16];
-    ssize_t n = recv(fd, buf, sizeof(buf)-1, MSG_PEEK);
-    if (n <= 0) {
-        close(fd);
-        return -1;
-    }
-    buf[n] = '\0';
-    if (strstr(buf, "PSYNC") == buf) {
-        recv(fd, buf, strlen("PSYNC\r\n"), 0);
-        kvs_replication_add_slave(fd);
-        return 0;
+/* ---------------- master ---------------- */
+
+static int repl_can_partial(const char *replid, long long offset) {
+    if (!g_repl.backlog) return 0;
+    if (strcmp(replid, g_repl.replid) != 0) {
+        /* 提升前的历史：从机可能还停留在旧主机的 replid 上 */
+        if (g_repl.replid2[0] == '\0' || strcmp(replid, g_repl.replid2) != 0 ||
+            offset > g_repl.second_replid_offset)
+            return 0;
     }
-    return -1;
+    return offset >= backlog_first_offset() && offset <= g_repl.master_repl_offset;
 }
 
-void kvs_replication_add_slave(int fd) {
-    if (g_repl.role != KVS_ROLE_MASTER) {
-        close(fd);
-        return;
-    }
-    if (g_repl.slave_count >= KVS_MAX_SLAVES) {
-        close(fd);
-        return;
-    }
+static kvs_slave_t *repl_find_slave(int fd) {
     for (int i = 0; i < g_repl.slave_count; i++) {
-        if (g_repl.slave_fds[i] == fd) {
-            close(fd);
-            return;
-        }
+        if (g_repl.slaves[i].fd == fd) return &g_repl.slaves[i];
     }
-    g_repl.slave_fds[g_repl.slave_count++] = fd;
-    LOG_INFO("[REPL] Slave added, fd=%d, total=%d\n", fd, g_repl.slave_count);
-    kvs_replication_send_full_sync(fd);
-}
-
-static void kvs_replication_send_key_value(const void *key, size_t key_len,
-                                          const void *val, size_t val_len, void *arg) {
-    int fd = *(int*)arg;
-    char buf[8192];
-    int pos = 0;
-
-    pos += snprintf(buf + pos, sizeof(buf) - pos, "*3\r\n$3\r\nSET\r\n");
-    pos += snprintf(buf + pos, sizeof(buf) - pos, "$%zu\r\n", key_len);
-    if (pos + key_len + 2 <= sizeof(buf)) {
-        memcpy(buf + pos, key, key_len);
-        pos += key_len;
-        buf[pos++] = '\r';
-        buf[pos++] = '\n';
-    } else {
-        LOG_DEBUG("[REPL] Key too large for buffer\n");
-        return;
+    return NULL;
+}
+
+static int sync_encode_reserve(size_t need) {
+    if (sync_encode.cap >= need) return 0;
+    size_t cap = sync_encode.cap ? sync_encode.cap : REPL_SYNC_CHUNK;
+    while (cap < need) cap *= 2;
+    char *data = kvs_realloc(sync_encode.data, cap);
+    if (!data) return -1;
+    sync_encode.data = data;
+    sync_encode.cap = cap;
+    return 0;
+}
+
+/* 从 sync_cursor 开始编码整桶，直到块达到目标大小或遍历结束 */
+static int repl_encode_chunk(kvs_slave_t *s) {
+    sync_encode.len = 0;
+    while (s->sync_cursor < global_hash.max_slots && sync_encode.len < REPL_SYNC_CHUNK) {
+        for (hashnode_t *node = global_hash.nodes[s->sync_cursor]; node; node = node->next) {
+            const void *val = kvs_hash_node_value(&global_hash, node);
+            if (!val) continue;
+            size_t need = sync_encode.len + KVS_RDB_ITEM_SIZE(node->key_len, node->value_len);
+            if (sync_encode_reserve(need) < 0) return -1;
+            sync_encode.len += kvs_rdb_encode_item(sync_encode.data + sync_encode.len,
+                                                   node->key, node->key_len,
+                                                   val, node->value_len);
+        }
+        s->sync_cursor++;
     }
+    return 0;
+}
 
-    pos += snprintf(buf + pos, sizeof(buf) - pos, "$%zu\r\n", val_len);
-    if (pos + val_len + 2 <= sizeof(buf)) {
-        memcpy(buf + pos, val, val_len);
-        pos += val_len;
-        buf[pos++] = '\r';
-        buf[pos++] = '\n';
-    } else {
-        LOG_DEBUG("[REPL] Value too large for buffer\n");
-        return;
+/*
+ * 全量同步的生产者，注册为从机连接的 drain 回调：输出缓冲区发空时编码下一批桶，
+ * 每块以 "#<len>\r\n" 开头，"#0\r\n" 结束快照，随后补发同步期间积累的写入。
+ * 写入失败时连接已关闭，s 可能已被其他从机覆盖，必须立即返回。
+ */
+static int repl_sync_produce_batch(int fd) {
+    kvs_slave_t *s = repl_find_slave(fd);
+    if (!s || s->state != KVS_SLAVE_SYNCING) {
+        kvs_client_set_drain(fd, NULL);
+        return 0;
     }
 
-    if (send(fd, buf, pos, 0) < 0) {
-        LOG_DEBUG("[REPL] Failed to send key-value to fd=%d\n", fd);
+    char hdr[32];
+    int n;
+    while (kvs_client_output_len(fd) < REPL_SYNC_WATERMARK) {
+        if (s->sync_cursor >= global_hash.max_slots) {
+            if (kvs_client_write(fd, "#0\r\n", 4) < 0) return -1;
+            if (s->pending_len > 0 && kvs_client_write(fd, s->pending, s->pending_len) < 0)
+                return -1;
+            kvs_free(s->pending);
+            s->pending = NULL;
+            s->pending_len = s->pending_cap = 0;
+            s->state = KVS_SLAVE_ONLINE;
+            kvs_client_set_drain(fd, NULL);
+            LOG_INFO("[REPL] Full sync completed for fd=%d\n", fd);
+            return 0;
+        }
+
+        if (repl_encode_chunk(s) < 0) {
+            LOG_WARN("[REPL] Out of memory encoding snapshot for fd=%d\n", fd);
+            kvs_close_client(fd);
+            return -1;
+        }
+        if (sync_encode.len == 0) continue;
+        n = snprintf(hdr, sizeof(hdr), "#%zu\r\n", sync_encode.len);
+        if (kvs_client_write(fd, hdr, n) < 0) return -1;
+        if (kvs_client_write(fd, sync_encode.data, sync_encode.len) < 0) return -1;
     }
+    return 0;
 }
 
-static void kvs_replication_send_full_sync(int slave_fd) {
-    LOG_INFO("[REPL] Starting full sync for fd=%d\n", slave_fd);
+/* 每批快照在 reactor 线程上编码，耗时记入慢日志 */
+static int repl_sync_produce(int fd) {
+    uint64_t start = kvs_clock_ns();
+    int ret = repl_sync_produce_batch(fd);
+    kvs_slowlog_event("full-sync", fd, kvs_clock_ns() - start);
+    return ret;
+}
 
-    if (send(slave_fd, "+FULLSYNC\r\n", 12, 0) < 0) {
-        LOG_DEBUG("[REPL] Failed to send FULLSYNC marker\n");
-        return;
+/* 快照传输期间的写入先暂存，快照结束后原样补发 */
+static int repl_slave_pending(kvs_slave_t *s, const char *buf, size_t len) {
+    size_t limit = (size_t)g_config.repl_obuf_hard_limit * 1024 * 1024;
+    if (limit > 0 && s->pending_len + len > limit) {
+        LOG_WARN("[REPL] Slave fd=%d buffered %zu bytes during full sync, closing\n",
+                 s->fd, s->pending_len + len);
+        kvs_close_client(s->fd);
+        return -1;
     }
+    if (s->pending_len + len > s->pending_cap) {
+        size_t cap = s->pending_cap ? s->pending_cap * 2 : 64 * 1024;
+        while (cap < s->pending_len + len) cap *= 2;
+        char *p = kvs_realloc(s->pending, cap);
+        if (!p) {
+            kvs_close_client(s->fd);
+            return -1;
+        }
+        s->pending = p;
+        s->pending_cap = cap;
+    }
+    memcpy(s->pending + s->pending_len, buf, len);
+    s->pending_len += len;
+    return 0;
+}
 
-    kvs_hash_foreach(&global_hash,
-                     (void (*)(const void *, size_t, const void *, size_t, void *))kvs_replication_send_key_value,
-                     &slave_fd);
+int kvs_replication_psync(int fd, const char *replid, long long offset) {
+    if (g_repl.role != KVS_ROLE_MASTER || fd < 0) return -1;
+    if (g_repl.slave_count >= KVS_MAX_SLAVES) return -1;
+    if (repl_find_slave(fd)) return -1;
+
+    /* 此后该连接的输出只有复制流，由 Reactor 在可写时发送 */
+    kvs_client_set_replica(fd);
+    /* GETACK/ACK 往返决定 WAIT 的延迟，不能等 Nagle 合并 */
+    int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    kvs_slave_t *s = &g_repl.slaves[g_repl.slave_count++];
+    memset(s, 0, sizeof(*s));
+    s->fd = fd;
+    s->ack_offset = -1;
+    s->ack_time = time(NULL);
+    LOG_INFO("[REPL] Slave added, fd=%d, total=%d\n", fd, g_repl.slave_count);
 
-    if (send(slave_fd, "+OK\r\n", 5, 0) < 0) {
-        LOG_DEBUG("[REPL] Failed to send OK marker\n");
+    /* 写入失败时连接已被关闭并移出从机列表 */
+    char line[128];
+    int n;
+    if (repl_can_partial(replid, offset)) {
+        s->state = KVS_SLAVE_ONLINE;
+        n = snprintf(line, sizeof(line), "+CONTINUE %s\r\n", g_repl.replid);
+        repl_stats.sync_partial_ok++;
+        LOG_INFO("[REPL] Partial resync for fd=%d, sending %lld bytes from offset %lld\n",
+                 fd, g_repl.master_repl_offset - offset, offset);
+        if (kvs_client_write(fd, line, n) == 0)
+            backlog_send_from(fd, offset);
+    } else {
+        s->state = KVS_SLAVE_SYNCING;
+        if (strcmp(replid, "?") != 0) repl_stats.sync_partial_err++;
+        repl_stats.sync_full++;
+        LOG_INFO("[REPL] Starting full sync for fd=%d, %d keys\n", fd, global_hash.count);
+        n = snprintf(line, sizeof(line), "+FULLRESYNC %s %lld\r\n",
+                     g_repl.replid, g_repl.master_repl_offset);
+        if (kvs_client_write(fd, line, n) == 0) {
+            kvs_client_set_drain(fd, repl_sync_produce);
+            repl_sync_produce(fd);
+        }
     }
+    return 0;
+}
 
-    LOG_INFO("[REPL] Full sync completed for fd=%d\n", slave_fd);
+void kvs_replication_slave_closed(int fd) {
+    if (fd == g_repl.master_fd) {
+        /* 到主机的连接被 Reactor 关闭（如 PSYNC 发送失败），fd 已由其关闭 */
+        LOG_INFO("[REPL] Master connection closed\n");
+        g_repl.master_fd = -1;
+        repl_drop_master();
+        return;
+    }
+    kvs_slave_t *s = repl_find_slave(fd);
+    if (!s) return;
+    kvs_free(s->pending);
+    *s = g_repl.slaves[--g_repl.slave_count];
+    LOG_INFO("[REPL] Slave fd=%d disconnected, total=%d\n", fd, g_repl.slave_count);
 }
 
-void kvs_replication_feed_slaves(char *cmd, char *key, char *value) {
+void kvs_replication_feed(kvs_sbuf_t *b) {
     if (g_repl.role != KVS_ROLE_MASTER) return;
+
+    /* 没有从机时也写入 backlog，断开的从机重连后可以部分同步 */
+    backlog_feed(b->data, b->len);
     if (g_repl.slave_count == 0) return;
 
-    char buf[8192];
-    int pos = 0;
-    size_t key_len = strlen(key);
-    size_t val_len = value ? strlen(value) : 0;
+    LOG_DEBUG("[REPL] Feeding %d slaves: %.*s", g_repl.slave_count, (int)b->len, b->data);
 
-    if (value == NULL) {
-        pos += snprintf(buf + pos, sizeof(buf) - pos, "*2\r\n");
-        pos += snprintf(buf + pos, sizeof(buf) - pos, "$%zu\r\n%s\r\n", strlen(cmd), cmd);
-        pos += snprintf(buf + pos, sizeof(buf) - pos, "$%zu\r\n%s\r\n", key_len, key);
-    } else {
-        pos += snprintf(buf + pos, sizeof(buf) - pos, "*3\r\n");
-        pos += snprintf(buf + pos, sizeof(buf) - pos, "$%zu\r\n%s\r\n", strlen(cmd), cmd);
-        pos += snprintf(buf + pos, sizeof(buf) - pos, "$%zu\r\n%s\r\n", key_len, key);
-        pos += snprintf(buf + pos, sizeof(buf) - pos, "$%zu\r\n%s\r\n", val_len, value);
+    /* 在线从机共享同一份编码；倒序遍历，超出输出缓冲区限制的从机会在写入时被关闭并移出列表 */
+    for (int i = g_repl.slave_count - 1; i >= 0; i--) {
+        kvs_slave_t *s = &g_repl.slaves[i];
+        if (s->state == KVS_SLAVE_SYNCING)
+            repl_slave_pending(s, b->data, b->len);
+        else
+            kvs_client_write_shared(s->fd, b);
     }
+}
 
-    if (pos <= 0 || (size_t)pos >= sizeof(buf)) return;
+/* ---------------- ACK / WAIT ---------------- */
 
-    LOG_DEBUG("[REPL] Feeding %d slaves: %.*s", g_repl.slave_count, pos, buf);
+static long long repl_mstime(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
 
+static int repl_count_acked(long long offset) {
+    int n = 0;
     for (int i = 0; i < g_repl.slave_count; i++) {
-        int fd = g_repl.slave_fds[i];
-        if (send(fd, buf, pos, 0) < 0) {
-            LOG_DEBUG("[REPL] Slave fd=%d disconnected\n", fd);
-            close(fd);
-            g_repl.slave_fds[i] = g_repl.slave_fds[--g_repl.slave_count];
-            i--;
-        }
+        kvs_slave_t *s = &g_repl.slaves[i];
+        if (s->state == KVS_SLAVE_ONLINE && s->ack_offset >= offset) n++;
     }
+    return n;
 }
 
-static int kvs_connect_master(const char *ip, int port) {
-    int fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (fd < 0) return -1;
+/* 通过复制流要求从机立即回报 offset */
+static void repl_feed_getack(void) {
+    kvs_sbuf_t *b = kvs_sbuf_new(REPL_GETACK_CMD, sizeof(REPL_GETACK_CMD) - 1);
+    if (!b) return;
+    kvs_replication_feed(b);
+    kvs_sbuf_release(b);
+}
 
-    int flags = fcntl(fd, F_GETFL, 0);
-    fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+/* 定时器按最早的超时时间设置，没有超时的等待者时停止 */
+static void repl_wait_arm(void) {
+    long long next = 0;
+    for (int i = 0; i < waiters.count; i++) {
+        long long d = waiters.list[i].deadline;
+        if (d && (!next || d < next)) next = d;
+    }
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec = next / 1000;
+    its.it_value.tv_nsec = (next % 1000) * 1000000;
+    timerfd_settime(waiters.tfd, TFD_TIMER_ABSTIME, &its, NULL);
+}
 
-    struct sockaddr_in addr;
-    addr.sin_family = AF_INET;
-    addr.sin_port = htons(port);
-    inet_pton(AF_INET, ip, &addr.sin_addr);
+/* 答复已满足或已超时的 WAIT；客户端已断开的等待者直接丢弃 */
+static void repl_wait_process(void) {
+    long long now = repl_mstime();
+    int i = 0;
+    while (i < waiters.count) {
+        repl_waiter_t w = waiters.list[i];
+        int acked = repl_count_acked(w.target);
+        if (acked < w.numreplicas && (!w.deadline || now < w.deadline) &&
+            kvs_client_blocked(w.fd)) {
+            i++;
+            continue;
+        }
+        waiters.list[i] = waiters.list[--waiters.count];
+        /* 解除阻塞会继续执行该客户端后续命令，可能再次进入 WAIT 并追加等待者 */
+        char reply[32];
+        int n = snprintf(reply, sizeof(reply), ":%d\r\n", acked);
+        kvs_unblock_client(w.fd, w.id, reply, n);
+    }
+    if (waiters.tfd >= 0) repl_wait_arm();
+}
 
-    int ret = connect(fd, (struct sockaddr*)&addr, sizeof(addr));
-    if (ret < 0 && errno != EINPROGRESS) {
-        close(fd);
-        return -1;
+static int repl_wait_timer_cb(int fd) {
+    uint64_t exp;
+    if (read(fd, &exp, sizeof(exp)) < 0 && errno != EAGAIN) return -1;
+    repl_wait_process();
+    return 0;
+}
+
+int kvs_replication_wait(int fd, int numreplicas, long timeout_ms) {
+    long long target = g_repl.master_repl_offset;
+    int acked = repl_count_acked(target);
+    if (acked >= numreplicas || fd < 0 || timeout_ms < 0) return acked;
+
+    if (waiters.tfd < 0) {
+        waiters.tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (waiters.tfd < 0) {
+            LOG_WARN("[REPL] timerfd_create failed: %s\n", strerror(errno));
+            return acked;
+        }
+        event_register_read(waiters.tfd, repl_wait_timer_cb);
+    }
+    if (waiters.count == waiters.cap) {
+        int cap = waiters.cap ? waiters.cap * 2 : 16;
+        repl_waiter_t *list = kvs_realloc(waiters.list, cap * sizeof(repl_waiter_t));
+        if (!list) return acked;
+        waiters.list = list;
+        waiters.cap = cap;
     }
 
-    return fd;
+    repl_waiter_t *w = &waiters.list[waiters.count++];
+    w->fd = fd;
+    w->id = kvs_block_client(fd);
+    w->numreplicas = numreplicas;
+    w->target = target;
+    w->deadline = timeout_ms > 0 ? repl_mstime() + timeout_ms : 0;
+
+    repl_feed_getack();
+    repl_wait_arm();
+    return -1;
 }
 
-int kvs_replication_handle_master_read(int fd) {
-    if (fd != g_repl.master_fd) return -1;
+void kvs_replication_ack(int fd, long long offset) {
+    kvs_slave_t *s = repl_find_slave(fd);
+    if (!s) return;
+    if (offset > s->ack_offset) s->ack_offset = offset;
+    s->ack_time = time(NULL);
+    if (waiters.count > 0) repl_wait_process();
+}
 
-    char buf[4096];
-    ssize_t n = recv(fd, buf, sizeof(buf)-1, 0);
-    if (n <= 0) {
-        LOG_INFO("[REPL] Master connection closed\n");
-        event_unregister_read(fd);
-        close(fd);
+/* ---------------- slave ---------------- */
+
+static void repl_drop_master(void) {
+    if (g_repl.master_fd != -1) {
+        event_unregister_read(g_repl.master_fd);
+        close(g_repl.master_fd);
         g_repl.master_fd = -1;
-        kvs_replication_reconnect();
+    }
+    g_repl.link_state = KVS_REPL_NONE;
+    slave_buf.len = 0;
+    sync_chunk.active = 0;
+    sync_chunk.len = 0;
+}
+
+/* 快照块用批量加载路径写入哈希表，块内只包含完整的条目 */
+static int repl_load_chunk(void) {
+    size_t consumed = 0;
+    uint64_t start = kvs_clock_ns();
+    kvs_rdb_load_buffer(&global_hash, sync_chunk.data, sync_chunk.len, &consumed, NULL);
+    kvs_slowlog_event("sync-load", g_repl.master_fd, kvs_clock_ns() - start);
+    sync_chunk.active = 0;
+    if (consumed != sync_chunk.len) {
+        LOG_WARN("[REPL] Malformed snapshot chunk (%zu of %zu bytes loaded)\n",
+                 consumed, sync_chunk.len);
         return -1;
     }
+    sync_chunk.len = 0;
+    return 0;
+}
+
+/* "#<len>" 开始一个快照块，"#0" 表示快照结束 */
+static int repl_handle_chunk_header(char *line) {
+    char *end;
+    long long len = strtoll(line + 1, &end, 10);
+    if (end == line + 1 || *end != '\0' || len < 0 || len > REPL_SYNC_MAX_CHUNK) return -1;
+    if (g_repl.link_state != KVS_REPL_SYNCING || sync_offset < 0) return -1;
+
+    if (len == 0) {
+        memcpy(g_repl.replid, sync_replid, sizeof(g_repl.replid));
+        backlog_reset(sync_offset);
+        sync_offset = -1;
+        repl_synced = 1;
+        g_repl.link_state = KVS_REPL_CONNECTED;
+        LOG_INFO("[REPL] Full sync finished, %d keys loaded\n", global_hash.count);
+        /* 快照绕过了 AOF，FULLRESYNC 的清空也没有截断它；重写为新数据集，增量命令随后照常追加 */
+        if (g_config.persist_mode == PERSIST_AOF_ONLY || g_config.persist_mode == PERSIST_MIXED)
+            kvs_aof_rewrite();
+        return 0;
+    }
 
-    LOG_DEBUG("[REPL] Received %ld bytes from master\n", n);
+    if (sync_chunk.cap < (size_t)len) {
+        char *data = kvs_realloc(sync_chunk.data, len);
+        if (!data) return -1;
+        sync_chunk.data = data;
+        sync_chunk.cap = len;
+    }
+    sync_chunk.len = 0;
+    sync_chunk.need = len;
+    sync_chunk.active = 1;
+    return 0;
+}
 
-    if (slave_buf.len + n > (ssize_t)sizeof(slave_buf.data)) {
-        LOG_DEBUG("[REPL] Slave buffer full, resetting\n");
-        slave_buf.len = 0;
+/* 处理主机发来的状态行：+FULLRESYNC / +CONTINUE */
+static int repl_handle_control(char *line) {
+    if (strncmp(line, "+FULLRESYNC ", 12) == 0) {
+        if (sscanf(line + 12, "%40s %lld", sync_replid, &sync_offset) != 2) return -1;
+        /* 快照加载完成前数据集不完整，作废当前历史，中途断开只能再次全量同步 */
+        kvs_hash_flush(&global_hash);
+        g_repl.replid2[0] = '\0';
+        g_repl.second_replid_offset = -1;
+        backlog_reset(-1);
+        g_repl.link_state = KVS_REPL_SYNCING;
+        LOG_INFO("[REPL] Full resync from master, replid=%s offset=%lld\n", sync_replid, sync_offset);
+        return 0;
     }
+    if (strncmp(line, "+CONTINUE", 9) == 0) {
+        char replid[KVS_REPLID_LEN + 1];
+        if (sscanf(line + 9, "%40s", replid) == 1 && strcmp(replid, g_repl.replid) != 0) {
+            /* 主机发生过切换，继承新的 replid */
+            memcpy(g_repl.replid2, g_repl.replid, sizeof(g_repl.replid2));
+            g_repl.second_replid_offset = g_repl.master_repl_offset;
+            memcpy(g_repl.replid, replid, sizeof(replid));
+        }
+        repl_synced = 1;
+        g_repl.link_state = KVS_REPL_CONNECTED;
+        LOG_INFO("[REPL] Partial resync accepted, continuing from offset %lld\n",
+                 g_repl.master_repl_offset);
+        return 0;
+    }
+    LOG_WARN("[REPL] Master replied: %s\n", line);
+    return -1;
+}
 
-    memcpy(slave_buf.data + slave_buf.len, buf, n);
-    slave_buf.len += n;
+void kvs_replication_getack(void) {
+    if (g_repl.role == KVS_ROLE_SLAVE) ack_requested = 1;
+}
 
-    int processed = 0;
-    int needed = 0;
-    char dummy[1];
+/* 向主机回报已应用的 offset；命令很小，发送缓冲区放不下说明链路已不正常 */
+static int repl_send_ack(void) {
+    if (g_repl.master_fd < 0 || g_repl.link_state != KVS_REPL_CONNECTED) return 0;
+    char offset[32], cmd[96];
+    int olen = snprintf(offset, sizeof(offset), "%lld", g_repl.master_repl_offset);
+    int n = snprintf(cmd, sizeof(cmd), "*3\r\n$8\r\nREPLCONF\r\n$3\r\nACK\r\n$%d\r\n%s\r\n",
+                     olen, offset);
+    if (send(g_repl.master_fd, cmd, n, MSG_NOSIGNAL | MSG_DONTWAIT) != n) {
+        LOG_WARN("[REPL] Failed to send ACK to master, dropping link\n");
+        repl_drop_master();
+        return -1;
+    }
+    return 0;
+}
 
-    while (slave_buf.len > 0) {
-        int ret = kvs_protocol(slave_buf.data, slave_buf.len, dummy, 0, &processed, &needed);
+static int slave_buf_reserve(size_t need) {
+    if (slave_buf.cap - slave_buf.len >= need) return 0;
+    size_t cap = slave_buf.cap ? slave_buf.cap : REPL_INPUT_INIT;
+    while (cap - slave_buf.len < need) cap *= 2;
+    if (cap > REPL_INPUT_MAX) return -1;
+    char *data = kvs_realloc(slave_buf.data, cap);
+    if (!data) return -1;
+    slave_buf.data = data;
+    slave_buf.cap = cap;
+    return 0;
+}
 
-        if (ret == -2) {
-            LOG_DEBUG("[REPL] Warning: Response too large (%d bytes)\n", needed);
-            break;
-        }
-        if (ret < 0) {
-            LOG_DEBUG("[REPL] Protocol error, resetting buffer\n");
-            slave_buf.len = 0;
-            break;
+/* 解析并执行输入缓冲区中的完整数据，返回消耗的字节数，-1 表示需要断开 */
+static long repl_process_input(void) {
+    size_t consumed = 0;
+    while (consumed < slave_buf.len) {
+        char *p = slave_buf.data + consumed;
+        size_t remain = slave_buf.len - consumed;
+        long len;
+
+        if (sync_chunk.active) {
+            size_t take = sync_chunk.need - sync_chunk.len;
+            if (take > remain) take = remain;
+            memcpy(sync_chunk.data + sync_chunk.len, p, take);
+            sync_chunk.len += take;
+            consumed += take;
+            if (sync_chunk.len == sync_chunk.need && repl_load_chunk() < 0) return -1;
+            continue;
         }
-        if (processed == 0) break;
 
-        if (processed < slave_buf.len) {
-            memmove(slave_buf.data, slave_buf.data + processed, slave_buf.len - processed);
-            slave_buf.len -= processed;
+        if (*p == '+' || *p == '-' || *p == '#') {
+            char *eol = memmem(p, remain, "\r\n", 2);
+            if (!eol) break;
+            *eol = '\0';
+            if ((*p == '#' ? repl_handle_chunk_header(p) : repl_handle_control(p)) < 0)
+                return -1;
+            len = eol - p + 2;
         } else {
-            slave_buf.len = 0;
+            len = kvs_apply_command(p, remain > INT_MAX ? INT_MAX : (int)remain);
+            if (len == 0) break;
+            if (len < 0) {
+                LOG_WARN("[REPL] Protocol error in replication stream, dropping link\n");
+                return -1;
+            }
+            if (g_repl.link_state == KVS_REPL_CONNECTED) backlog_feed(p, len);
+        }
+        consumed += len;
+    }
+    return consumed;
+}
+
+int kvs_replication_handle_master_read(int fd) {
+    if (fd != g_repl.master_fd) return -1;
+
+    /* 快照块直接收进块缓冲区，省去一次拷贝 */
+    int direct = sync_chunk.active && slave_buf.len == 0;
+    ssize_t n;
+    if (direct) {
+        n = recv(fd, sync_chunk.data + sync_chunk.len, sync_chunk.need - sync_chunk.len, 0);
+    } else {
+        if (slave_buf_reserve(REPL_INPUT_READ) < 0) {
+            LOG_WARN("[REPL] Replication input buffer over %d bytes, dropping link\n",
+                     REPL_INPUT_MAX);
+            repl_drop_master();
+            return -1;
         }
+        n = recv(fd, slave_buf.data + slave_buf.len, slave_buf.cap - slave_buf.len, 0);
+    }
+    if (n < 0 && (errno == EAGAIN || errno == EINTR)) return 0;
+    if (n <= 0) {
+        /* 由定时器重连，避免被主机按策略断开后立即重连形成风暴 */
+        if (g_repl.link_state == KVS_REPL_CONNECTING)
+            LOG_DEBUG("[REPL] Failed to connect to master\n");
+        else
+            LOG_INFO("[REPL] Master connection closed\n");
+        repl_drop_master();
+        return -1;
     }
 
+    LOG_DEBUG("[REPL] Received %ld bytes from master\n", n);
+    master_last_io = time(NULL);
+
+    if (direct) {
+        sync_chunk.len += n;
+        if (sync_chunk.len == sync_chunk.need && repl_load_chunk() < 0) {
+            repl_drop_master();
+            return -1;
+        }
+        return 0;
+    }
+
+    slave_buf.len += n;
+    long consumed = repl_process_input();
+    if (consumed < 0) {
+        repl_drop_master();
+        return -1;
+    }
+    if (consumed > 0) {
+        memmove(slave_buf.data, slave_buf.data + consumed, slave_buf.len - consumed);
+        slave_buf.len -= consumed;
+    }
+    /* 大命令处理完后收缩，避免长期占用内存 */
+    if (slave_buf.len == 0 && slave_buf.cap > REPL_INPUT_MAX / 16) {
+        kvs_free(slave_buf.data);
+        slave_buf.data = NULL;
+        slave_buf.cap = 0;
+    }
+    if (ack_requested) {
+        ack_requested = 0;
+        if (repl_send_ack() < 0) return -1;
+    }
     return 0;
 }
 
 void kvs_slaveof(char *ip, int port) {
     if (strcasecmp(ip, "NO") == 0) {
-        if (g_repl.role == KVS_ROLE_SLAVE && g_repl.master_fd != -1) {
-            event_unregister_read(g_repl.master_fd);
-            close(g_repl.master_fd);
-            g_repl.master_fd = -1;
+        if (g_repl.role == KVS_ROLE_SLAVE) {
+            repl_drop_master();
+            /* 保留旧历史为 replid2，其余从机可以对新主机部分同步 */
+            if (g_repl.master_repl_offset >= 0) {
+                memcpy(g_repl.replid2, g_repl.replid, sizeof(g_repl.replid2));
+                g_repl.second_replid_offset = g_repl.master_repl_offset;
+            } else {
+                backlog_reset(0);   /* 快照未加载完成，没有可继承的历史 */
+            }
+            repl_gen_replid(g_repl.replid);
         }
         g_repl.role = KVS_ROLE_MASTER;
-        LOG_INFO("[REPL] Switched to MASTER\n");
+        LOG_INFO("[REPL] Switched to MASTER, replid=%s\n", g_repl.replid);
         return;
     }
 
     LOG_INFO("[REPL] Connecting to master %s:%d\n", ip, port);
 
+    /* 降级为从机时断开自己的从机，它们会重新连接 */
+    while (g_repl.slave_count > 0)
+        kvs_close_client(g_repl.slaves[0].fd);
+
     g_repl.role = KVS_ROLE_SLAVE;
 
     size_t len = strlen(ip);
@@ -268,23 +786,35 @@ void kvs_slaveof(char *ip, int port) {
     g_repl.master_ip[len] = '\0';
     g_repl.master_port = port;
 
-    if (g_repl.master_fd != -1) {
-        event_unregister_read(g_repl.master_fd);
-        close(g_repl.master_fd);
-        g_repl.master_fd = -1;
-    }
+    repl_drop_master();
 
-    g_repl.master_fd = kvs_connect_master(ip, port);
+    g_repl.master_fd = kvs_connect(ip, port, 0);
     if (g_repl.master_fd == -1) {
         LOG_DEBUG("[REPL] Failed to connect to master\n");
         return;
     }
-
-    send(g_repl.master_fd, "PSYNC\r\n", 7, 0);
     event_register_read(g_repl.master_fd, kvs_replication_handle_master_read);
+    g_repl.link_state = KVS_REPL_CONNECTING;
+    master_last_io = time(NULL);
     slave_buf.len = 0;
 
-    LOG_INFO("[REPL] Connected to master, fd=%d\n", g_repl.master_fd);
+    /*
+     * 带上当前的 replid 和 offset，主机据此决定部分同步还是全量同步。
+     * 启动时随机生成的 replid 不对应任何主机的历史，此时发送 "? -1" 直接请求全量同步。
+     */
+    const char *replid = "?";
+    char offset[32] = "-1", cmd[160];
+    if (g_repl.master_repl_offset >= 0 && (repl_synced || g_repl.master_repl_offset > 0)) {
+        replid = g_repl.replid;
+        snprintf(offset, sizeof(offset), "%lld", g_repl.master_repl_offset);
+    }
+    int n = snprintf(cmd, sizeof(cmd), "*3\r\n$5\r\nPSYNC\r\n$%zu\r\n%s\r\n$%zu\r\n%s\r\n",
+                     strlen(replid), replid, strlen(offset), offset);
+    /* 连接尚在建立，PSYNC 先进入写缓冲区，套接字可写后由 Reactor 发出 */
+    if (kvs_client_write(g_repl.master_fd, cmd, n) < 0) return;
+
+    LOG_INFO("[REPL] Connecting to master, fd=%d, PSYNC %s %s\n",
+             g_repl.master_fd, replid, offset);
 }
 
 static void kvs_replication_reconnect(void) {
@@ -294,8 +824,88 @@ static void kvs_replication_reconnect(void) {
     LOG_INFO("[REPL] Reconnecting to master %s:%d\n", g_repl.master_ip, g_repl.master_port);
 
     char ip_copy[64];
-    strncpy(ip_copy, g_repl.master_ip, sizeof(ip_copy) - 1);
-    ip_copy[sizeof(ip_copy) - 1] = '\0';
+    memcpy(ip_copy, g_repl.master_ip, sizeof(ip_copy));
 
     kvs_slaveof(ip_copy, g_repl.master_port);
-}
\ No newline at end of file
+}
+
+/* 定时器回调：从机断开后每秒重连、在线时每秒 ACK；主机空闲时定期 GETACK 保活 */
+void kvs_replication_cron(void) {
+    static long last_ping;
+    long now = time(NULL);
+
+    if (g_repl.role == KVS_ROLE_SLAVE) {
+        if (g_repl.master_fd == -1) {
+            kvs_replication_reconnect();
+        } else if (g_repl.link_state == KVS_REPL_CONNECTING) {
+            /* 主机不可达时非阻塞 connect 可能长时间挂起，超时后断开重试 */
+            if (now - master_last_io >= REPL_CONNECT_TIMEOUT) {
+                LOG_INFO("[REPL] Timeout connecting to master %s:%d\n",
+                         g_repl.master_ip, g_repl.master_port);
+                repl_drop_master();
+            }
+        } else {
+            repl_send_ack();
+        }
+        return;
+    }
+
+    if (g_repl.slave_count > 0 && now - last_ping >= REPL_PING_PERIOD) {
+        repl_feed_getack();
+        last_ping = now;
+    }
+    if (waiters.count > 0) repl_wait_process();
+}
+
+int kvs_replication_info(char *buf, int size) {
+    int len = snprintf(buf, size,
+                       "# Replication\r\n"
+                       "role:%s\r\n",
+                       g_repl.role == KVS_ROLE_MASTER ? "master" : "slave");
+    if (g_repl.role == KVS_ROLE_SLAVE) {
+        len += snprintf(buf + len, size - len,
+                        "master_host:%s\r\n"
+                        "master_port:%d\r\n"
+                        "master_link_status:%s\r\n"
+                        "slave_repl_offset:%lld\r\n"
+                        "slave_read_repl_offset:%lld\r\n"
+                        "slave_input_buffer:%zu\r\n"
+                        "master_last_io_seconds_ago:%ld\r\n",
+                        g_repl.master_ip, g_repl.master_port,
+                        g_repl.link_state == KVS_REPL_CONNECTED ? "up" :
+                        g_repl.link_state == KVS_REPL_SYNCING ? "sync" :
+                        g_repl.link_state == KVS_REPL_CONNECTING ? "connecting" : "down",
+                        g_repl.master_repl_offset,
+                        g_repl.master_repl_offset +
+                            (g_repl.link_state == KVS_REPL_CONNECTED ? (long long)slave_buf.len : 0),
+                        slave_buf.cap,
+                        g_repl.master_fd >= 0 ? (long)time(NULL) - master_last_io : -1L);
+    }
+    len += snprintf(buf + len, size - len, "connected_slaves:%d\r\n", g_repl.slave_count);
+    for (int i = 0; i < g_repl.slave_count && len < size; i++) {
+        kvs_slave_t *s = &g_repl.slaves[i];
+        len += snprintf(buf + len, size - len,
+                        "slave%d:fd=%d,state=%s,offset=%lld,lag=%ld,obuf=%d,pending=%zu\r\n",
+                        i, s->fd, s->state == KVS_SLAVE_ONLINE ? "online" : "sync",
+                        s->ack_offset, (long)time(NULL) - s->ack_time,
+                        kvs_client_output_len(s->fd), s->pending_len);
+    }
+    if (len < size) len += snprintf(buf + len, size - len,
+                    "master_replid:%s\r\n"
+                    "master_replid2:%s\r\n"
+                    "master_repl_offset:%lld\r\n"
+                    "second_repl_offset:%lld\r\n"
+                    "repl_backlog_size:%lld\r\n"
+                    "repl_backlog_first_byte_offset:%lld\r\n"
+                    "repl_backlog_histlen:%lld\r\n"
+                    "sync_full:%lu\r\n"
+                    "sync_partial_ok:%lu\r\n"
+                    "sync_partial_err:%lu\r\n",
+                    g_repl.replid,
+                    g_repl.replid2[0] ? g_repl.replid2 : "0000000000000000000000000000000000000000",
+                    g_repl.master_repl_offset, g_repl.second_replid_offset,
+                    g_repl.backlog_size, backlog_first_offset(), g_repl.backlog_histlen,
+                    repl_stats.sync_full, repl_stats.sync_partial_ok,
+                    repl_stats.sync_partial_err);
+    return len < size ? len : size - 1;
+}
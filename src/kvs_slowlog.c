@@ -0,0 +1,209 @@
+#include "../include/kvs_base.h"
+#include "../include/kvs_slowlog.h"
+#include "../include/kvs_configure.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+/*
+ * 慢日志：环形缓冲区保存最近 max_len 条超过阈值的记录，最新的覆盖最旧的。
+ * 除了命令，RDB 保存、AOF 重写、全量同步等在 reactor 线程上的长耗时工作
+ * 也作为事件记录，客户端报告延迟抖动时可以看到服务端当时在做什么。
+ */
+
+#define SLOWLOG_ARGS_MAX    8       /* 记录长度的参数个数上限 */
+#define SLOWLOG_KEY_MAX     64      /* key 超过该长度时截断 */
+#define SLOWLOG_NAME_MAX    24
+#define SLOWLOG_ENTRY_REPLY 1024    /* 单条记录的回复上限 */
+
+typedef struct {
+    long long id;
+    long timestamp;
+    uint64_t duration_ns;
+    char name[SLOWLOG_NAME_MAX];
+    char key[SLOWLOG_KEY_MAX];
+    size_t key_len;                 /* 原始长度 */
+    int argc;
+    size_t arg_lens[SLOWLOG_ARGS_MAX];
+    int fd;                         /* -1 表示与客户端无关 */
+    int is_event;
+    uint64_t parse_ns, exec_ns, propagate_ns;
+} slowlog_entry_t;
+
+static struct {
+    slowlog_entry_t *entries;
+    int cap;
+    int len;
+    int head;                       /* 下一条写入的位置 */
+    long long next_id;
+} slowlog;
+
+static int slowlog_due(uint64_t ns) {
+    int threshold = g_config.slowlog_log_slower_than;
+    return threshold >= 0 && ns >= (uint64_t)threshold * 1000;
+}
+
+/* 容量跟随 max_len，变化时保留最新的记录 */
+static int slowlog_reserve(void) {
+    int cap = g_config.slowlog_max_len;
+    if (cap <= 0) return -1;
+    if (cap == slowlog.cap) return 0;
+
+    slowlog_entry_t *entries = kvs_malloc(sizeof(slowlog_entry_t) * cap);
+    if (!entries) return -1;
+    int keep = slowlog.len < cap ? slowlog.len : cap;
+    for (int i = 0; i < keep; i++) {
+        int src = (slowlog.head - keep + i + slowlog.cap) % slowlog.cap;
+        entries[i] = slowlog.entries[src];
+    }
+    kvs_free(slowlog.entries);
+    slowlog.entries = entries;
+    slowlog.cap = cap;
+    slowlog.len = keep;
+    slowlog.head = keep % cap;
+    return 0;
+}
+
+static slowlog_entry_t *slowlog_push(const char *name, int fd, uint64_t ns) {
+    if (slowlog_reserve() < 0) return NULL;
+    slowlog_entry_t *e = &slowlog.entries[slowlog.head];
+    slowlog.head = (slowlog.head + 1) % slowlog.cap;
+    if (slowlog.len < slowlog.cap) slowlog.len++;
+
+    memset(e, 0, sizeof(*e));
+    e->id = slowlog.next_id++;
+    e->timestamp = time(NULL);
+    e->duration_ns = ns;
+    e->fd = fd;
+    snprintf(e->name, sizeof(e->name), "%s", name);
+    return e;
+}
+
+void kvs_slowlog_command(char **argv, size_t *lens, int argc, int fd,
+                         uint64_t parse_ns, uint64_t exec_ns, uint64_t propagate_ns) {
+    if (argc < 1 || !slowlog_due(parse_ns + exec_ns)) return;
+    slowlog_entry_t *e = slowlog_push(argv[0], fd, parse_ns + exec_ns);
+    if (!e) return;
+
+    e->argc = argc;
+    if (argc > 1) {
+        e->key_len = lens[1];
+        memcpy(e->key, argv[1], lens[1] < SLOWLOG_KEY_MAX ? lens[1] : SLOWLOG_KEY_MAX);
+    }
+    for (int i = 0; i < argc && i < SLOWLOG_ARGS_MAX; i++) e->arg_lens[i] = lens[i];
+    e->parse_ns = parse_ns;
+    e->exec_ns = exec_ns;
+    e->propagate_ns = propagate_ns;
+}
+
+void kvs_slowlog_event(const char *name, int fd, uint64_t ns) {
+    if (!slowlog_due(ns)) return;
+    slowlog_entry_t *e = slowlog_push(name, fd, ns);
+    if (e) e->is_event = 1;
+}
+
+static int bulk(char *p, const char *data, size_t len) {
+    int n = sprintf(p, "$%zu\r\n", len);
+    memcpy(p + n, data, len);
+    n += len;
+    p[n++] = '\r';
+    p[n++] = '\n';
+    return n;
+}
+
+/*
+ * [id, 时间戳, 耗时(us), [命令, key, "(N bytes)"...], 客户端, 阶段耗时]
+ * 与 Redis 的前四项相同；事件的参数只有事件名，客户端为 "reactor" 或相关连接。
+ */
+static int entry_reply(char *p, const slowlog_entry_t *e) {
+    char *start = p;
+    char buf[160];
+    int n;
+
+    p += sprintf(p, "*6\r\n:%lld\r\n:%ld\r\n:%llu\r\n", e->id, e->timestamp,
+                 (unsigned long long)(e->duration_ns / 1000));
+
+    if (e->is_event) {
+        p += sprintf(p, "*1\r\n");
+        p += bulk(p, e->name, strlen(e->name));
+    } else {
+        int shown = e->argc < SLOWLOG_ARGS_MAX ? e->argc : SLOWLOG_ARGS_MAX;
+        int more = e->argc > shown;
+        p += sprintf(p, "*%d\r\n", shown + more);
+        p += bulk(p, e->name, strlen(e->name));
+        if (shown > 1) {
+            if (e->key_len <= SLOWLOG_KEY_MAX) {
+                p += bulk(p, e->key, e->key_len);
+            } else {
+                n = snprintf(buf, sizeof(buf), "%.*s... (%zu more bytes)", SLOWLOG_KEY_MAX, e->key,
+                             e->key_len - SLOWLOG_KEY_MAX);
+                p += bulk(p, buf, n);
+            }
+        }
+        for (int i = 2; i < shown; i++) {
+            n = snprintf(buf, sizeof(buf), "(%zu bytes)", e->arg_lens[i]);
+            p += bulk(p, buf, n);
+        }
+        if (more) {
+            n = snprintf(buf, sizeof(buf), "... (%d more arguments)", e->argc - shown);
+            p += bulk(p, buf, n);
+        }
+    }
+
+    if (e->fd >= 0) n = snprintf(buf, sizeof(buf), "fd=%d", e->fd);
+    else n = snprintf(buf, sizeof(buf), "reactor");
+    p += bulk(p, buf, n);
+
+    if (e->is_event)
+        n = 0;
+    else
+        n = snprintf(buf, sizeof(buf), "parse=%.1fus execute=%.1fus propagate=%.1fus",
+                     e->parse_ns / 1000.0, e->exec_ns / 1000.0, e->propagate_ns / 1000.0);
+    p += bulk(p, buf, n);
+    return p - start;
+}
+
+int kvs_slowlog_command_reply(char **argv, size_t *lens, int argc,
+                              char *resp, int resp_size, int *needed) {
+    (void)lens;
+    if (argc < 2)
+        return sprintf(resp, "-ERR wrong number of arguments for 'slowlog' command\r\n");
+
+    if (strcasecmp(argv[1], "LEN") == 0)
+        return sprintf(resp, ":%d\r\n", slowlog.len);
+
+    if (strcasecmp(argv[1], "RESET") == 0) {
+        slowlog.len = 0;
+        slowlog.head = 0;
+        return sprintf(resp, "+OK\r\n");
+    }
+
+    if (strcasecmp(argv[1], "GET") != 0)
+        return sprintf(resp, "-ERR Try SLOWLOG GET|LEN|RESET\r\n");
+
+    /* 默认 10 条，-1 表示全部，最新的在前 */
+    int count = 10;
+    if (argc > 2) {
+        char *end;
+        long v = strtol(argv[2], &end, 10);
+        if (*end || v < -1)
+            return sprintf(resp, "-ERR count should be greater than or equal to -1\r\n");
+        count = v == -1 ? slowlog.len : (int)v;
+    }
+    if (count > slowlog.len) count = slowlog.len;
+
+    int need = 32 + count * SLOWLOG_ENTRY_REPLY;
+    if (need > resp_size) {
+        *needed = need;
+        return -2;
+    }
+    char *p = resp;
+    p += sprintf(p, "*%d\r\n", count);
+    for (int i = 0; i < count; i++) {
+        int idx = (slowlog.head - 1 - i + slowlog.cap) % slowlog.cap;
+        p += entry_reply(p, &slowlog.entries[idx]);
+    }
+    return p - resp;
+}
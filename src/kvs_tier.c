@@ -0,0 +1,328 @@
+#include "../include/kvs_base.h"
+#include "../include/kvs_tier.h"
+#include "../include/kvs_hash.h"
+#include "../include/kvs_bitcask.h"
+#include "../include/kvs_configure.h"
+#include "../include/server.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+
+/*
+ * 冷热分层：长时间未访问的 value 被写入本地 value log（复用 bitcask 段文件），
+ * 哈希表中只留下指向磁盘位置的节点。GET 命中冷数据时由 IO 线程池异步 pread，
+ * 期间只阻塞发起请求的客户端，完成后通过 eventfd 回到 Reactor 线程提升为热数据并回复。
+ */
+
+#define TIER_SCAN_BUCKETS       4096
+#define TIER_SPILL_BUDGET       (64 * 1024 * 1024)
+#define TIER_COMPACT_BUDGET     (8 * 1024 * 1024)
+#define TIER_MAX_IO_THREADS     16
+
+extern void event_register_read(int fd, int (*handler)(int));
+
+typedef struct tier_job_s {
+    struct tier_job_s *next;
+    int client_fd;
+    unsigned int client_id;
+    int seg_fd;
+    uint32_t seg_id;
+    uint64_t seg_off;
+    size_t val_len;
+    char *val;
+    int err;
+    size_t key_len;
+    char key[];
+} tier_job_t;
+
+static struct {
+    kvs_hash_t *T;
+    pthread_t threads[TIER_MAX_IO_THREADS];
+    int nthreads;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    tier_job_t *pending_head;
+    tier_job_t *pending_tail;
+    tier_job_t *done;
+    int efd;
+    int cursor;
+    kvs_tier_stats_t stats;
+} tier = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+    .efd = -1
+};
+
+static void *tier_io_worker(void *arg) {
+    (void)arg;
+    for (;;) {
+        pthread_mutex_lock(&tier.lock);
+        while (!tier.pending_head)
+            pthread_cond_wait(&tier.cond, &tier.lock);
+        tier_job_t *job = tier.pending_head;
+        tier.pending_head = job->next;
+        if (!tier.pending_head) tier.pending_tail = NULL;
+        pthread_mutex_unlock(&tier.lock);
+
+        job->val = kvs_malloc(job->val_len ? job->val_len : 1);
+        size_t done = 0;
+        while (job->val && done < job->val_len) {
+            ssize_t n = pread(job->seg_fd, job->val + done, job->val_len - done,
+                              job->seg_off + done);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) break;
+            done += n;
+        }
+        job->err = (!job->val || done < job->val_len);
+
+        pthread_mutex_lock(&tier.lock);
+        job->next = tier.done;
+        tier.done = job;
+        pthread_mutex_unlock(&tier.lock);
+
+        uint64_t one = 1;
+        if (write(tier.efd, &one, sizeof(one)) < 0) {
+            /* eventfd counter overflow is impossible here; nothing to do */
+        }
+    }
+    return NULL;
+}
+
+static int tier_submit(hashnode_t *node, int client_fd, unsigned int client_id) {
+    int seg_fd = kvs_bitcask_segment_fd(tier.T->bc, node->seg_id);
+    if (seg_fd < 0) return -1;
+
+    tier_job_t *job = kvs_calloc(sizeof(tier_job_t) + node->key_len);
+    if (!job) return -1;
+    job->client_fd = client_fd;
+    job->client_id = client_id;
+    job->seg_fd = seg_fd;
+    job->seg_id = node->seg_id;
+    job->seg_off = node->seg_off;
+    job->val_len = node->value_len;
+    job->key_len = node->key_len;
+    memcpy(job->key, node->key, node->key_len);
+
+    pthread_mutex_lock(&tier.lock);
+    if (tier.pending_tail) tier.pending_tail->next = job;
+    else tier.pending_head = job;
+    tier.pending_tail = job;
+    pthread_cond_signal(&tier.cond);
+    pthread_mutex_unlock(&tier.lock);
+
+    tier.stats.inflight++;
+    return 0;
+}
+
+static void tier_reply(tier_job_t *job, const void *val, size_t len, int found) {
+    if (!found) {
+        kvs_unblock_client(job->client_fd, job->client_id, "$-1\r\n", 5);
+        return;
+    }
+    char *reply = kvs_malloc(len + 32);
+    if (!reply) {
+        kvs_unblock_client(job->client_fd, job->client_id, "-ERR out of memory\r\n", 20);
+        return;
+    }
+    int n = sprintf(reply, "$%zu\r\n", len);
+    memcpy(reply + n, val, len);
+    n += len;
+    reply[n++] = '\r';
+    reply[n++] = '\n';
+    kvs_unblock_client(job->client_fd, job->client_id, reply, n);
+    kvs_free(reply);
+}
+
+static int tier_complete_cb(int fd) {
+    uint64_t count;
+    if (read(fd, &count, sizeof(count)) < 0 && errno != EAGAIN) return -1;
+
+    pthread_mutex_lock(&tier.lock);
+    tier_job_t *job = tier.done;
+    tier.done = NULL;
+    pthread_mutex_unlock(&tier.lock);
+
+    while (job) {
+        tier_job_t *next = job->next;
+        tier.stats.inflight--;
+
+        hashnode_t *node = kvs_hash_lookup(tier.T, job->key, job->key_len);
+        if (!node) {
+            tier_reply(job, NULL, 0, 0);
+        } else if (!(node->flags & HASHNODE_ON_DISK)) {
+            /* 读取期间被覆盖写或已被其他请求提升 */
+            tier_reply(job, node->value, node->value_len, 1);
+        } else if (node->seg_id != job->seg_id || node->seg_off != job->seg_off) {
+            if (tier_submit(node, job->client_fd, job->client_id) < 0)
+                kvs_unblock_client(job->client_fd, job->client_id,
+                                   "-ERR tier read failed\r\n", 23);
+        } else if (job->err) {
+            LOG_WARN("[Tier] Failed to read value from segment %u\n", job->seg_id);
+            kvs_unblock_client(job->client_fd, job->client_id, "-ERR tier read failed\r\n", 23);
+        } else {
+            if (kvs_hash_promote(tier.T, node, job->val) == 0) tier.stats.promoted++;
+            tier_reply(job, job->val, job->val_len, 1);
+        }
+
+        kvs_free(job->val);
+        kvs_free(job);
+        job = next;
+    }
+    return 0;
+}
+
+int kvs_tier_init(kvs_hash_t *T) {
+    if (!g_config.tier_enabled) return 0;
+    if (T->bc) {
+        LOG_WARN("[Tier] Storage engine already keeps values on disk, tiering disabled\n");
+        return 0;
+    }
+
+    kvs_bitcask_wipe(g_config.tier_dir);
+    T->bc = kvs_bitcask_open(g_config.tier_dir, 64 * 1024 * 1024, 50);
+    if (!T->bc) return -1;
+    T->tiered = 1;
+    tier.T = T;
+
+    tier.efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (tier.efd < 0) {
+        LOG_WARN("[Tier] eventfd failed: %s\n", strerror(errno));
+        return -1;
+    }
+    event_register_read(tier.efd, tier_complete_cb);
+
+    int n = g_config.tier_io_threads;
+    if (n < 1) n = 1;
+    if (n > TIER_MAX_IO_THREADS) n = TIER_MAX_IO_THREADS;
+    for (int i = 0; i < n; i++) {
+        if (pthread_create(&tier.threads[i], NULL, tier_io_worker, NULL) != 0) break;
+        pthread_detach(tier.threads[i]);
+        tier.nthreads++;
+    }
+    if (tier.nthreads == 0) return -1;
+
+    LOG_INFO("[Tier] Enabled, value log %s, %d io threads\n", g_config.tier_dir, tier.nthreads);
+    return 0;
+}
+
+int kvs_tier_enabled(void) {
+    return tier.T != NULL;
+}
+
+int kvs_tier_get(hashnode_t *node, int client_fd) {
+    if (!node) {
+        tier.stats.misses++;
+        return 0;
+    }
+    node->atime = tier.T->clock;
+    if (!(node->flags & HASHNODE_ON_DISK)) {
+        tier.stats.hot_hits++;
+        return 0;
+    }
+
+    tier.stats.cold_hits++;
+    if (client_fd < 0) return 0;
+
+    unsigned int id = kvs_block_client(client_fd);
+    if (tier_submit(node, client_fd, id) < 0) {
+        kvs_unblock_client(client_fd, id, NULL, 0);
+        return 0;
+    }
+    return 1;
+}
+
+static int tier_spillable(hashnode_t *node) {
+    return !(node->flags & HASHNODE_ON_DISK) && node->value &&
+           node->value_len >= (size_t)g_config.tier_min_value_size;
+}
+
+static size_t tier_spill(hashnode_t *node) {
+    size_t len = node->value_len;
+    if (kvs_hash_spill(tier.T, node) < 0) return 0;
+    tier.stats.spilled++;
+    return len;
+}
+
+/* 采样近似 LRU：随机抽取若干桶，淘汰其中最久未访问的 value */
+static hashnode_t *tier_sample_victim(void) {
+    kvs_hash_t *T = tier.T;
+    hashnode_t *victim = NULL;
+    int sampled = 0;
+    for (int tries = 0; tries < g_config.tier_sample_size * 8 &&
+                        sampled < g_config.tier_sample_size; tries++) {
+        hashnode_t *node = T->nodes[random() % T->max_slots];
+        for (; node; node = node->next) {
+            if (!tier_spillable(node)) continue;
+            sampled++;
+            if (!victim || node->atime < victim->atime) victim = node;
+        }
+    }
+    return victim;
+}
+
+void kvs_tier_cron(void) {
+    if (!tier.T) return;
+    kvs_hash_t *T = tier.T;
+    size_t spilled = 0;
+
+    if (g_config.tier_idle_seconds > 0) {
+        for (int i = 0; i < TIER_SCAN_BUCKETS && spilled < TIER_SPILL_BUDGET; i++) {
+            for (hashnode_t *node = T->nodes[tier.cursor]; node; node = node->next) {
+                if (tier_spillable(node) &&
+                    T->clock - node->atime >= (uint32_t)g_config.tier_idle_seconds)
+                    spilled += tier_spill(node);
+            }
+            tier.cursor = (tier.cursor + 1) % T->max_slots;
+        }
+    }
+
+    if (g_config.tier_max_memory > 0) {
+        size_t limit = (size_t)g_config.tier_max_memory * 1024 * 1024;
+        while (T->mem_bytes > limit && spilled < TIER_SPILL_BUDGET) {
+            hashnode_t *victim = tier_sample_victim();
+            if (!victim) break;
+            size_t n = tier_spill(victim);
+            if (n == 0) break;
+            spilled += n;
+        }
+    }
+
+    /* IO 线程持有段 fd 时不能删除段文件 */
+    if (tier.stats.inflight == 0)
+        kvs_bitcask_compact_step(T->bc, T, TIER_COMPACT_BUDGET);
+}
+
+int kvs_tier_info(char *buf, int size) {
+    if (!tier.T) return snprintf(buf, size, "# Tier\r\ntier_enabled:0\r\n");
+
+    unsigned long hits = tier.stats.hot_hits + tier.stats.cold_hits + tier.stats.misses;
+    double hot_ratio = hits ? (double)tier.stats.hot_hits / hits : 0;
+    double cold_ratio = hits ? (double)tier.stats.cold_hits / hits : 0;
+    int segments = 0;
+    uint64_t disk = 0, dead = 0;
+    kvs_bitcask_stats(tier.T->bc, &segments, &disk, &dead);
+
+    return snprintf(buf, size,
+                    "# Tier\r\n"
+                    "tier_enabled:1\r\n"
+                    "tier_hot_hits:%lu\r\n"
+                    "tier_cold_hits:%lu\r\n"
+                    "tier_misses:%lu\r\n"
+                    "tier_hot_hit_ratio:%.4f\r\n"
+                    "tier_cold_hit_ratio:%.4f\r\n"
+                    "tier_spilled:%lu\r\n"
+                    "tier_promoted:%lu\r\n"
+                    "tier_inflight_reads:%lu\r\n"
+                    "tier_hot_bytes:%zu\r\n"
+                    "tier_log_segments:%d\r\n"
+                    "tier_log_bytes:%lu\r\n"
+                    "tier_log_dead_bytes:%lu\r\n",
+                    tier.stats.hot_hits, tier.stats.cold_hits, tier.stats.misses,
+                    hot_ratio, cold_ratio, tier.stats.spilled, tier.stats.promoted,
+                    tier.stats.inflight, tier.T->mem_bytes, segments,
+                    (unsigned long)disk, (unsigned long)dead);
+}
@@ -0,0 +1,118 @@
+#include "../include/kvs_base.h"
+#include "../include/kvs_watchdog.h"
+#include "../include/kvs_latency.h"
+#include "../include/kvs_configure.h"
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <execinfo.h>
+#include <stdatomic.h>
+
+/*
+ * 事件循环看门狗：reactor 线程在每次迭代开始和每个回调前发布自己的状态，
+ * 看门狗线程周期检查，一次迭代超过 period_ms 仍未回到 epoll_wait 时打印
+ * 当前回调，并向 reactor 线程发送 SIGUSR1，由它在信号处理函数中打印调用栈，
+ * 定位内联 RDB 保存这类阻塞调用。每次迭代只报告一次。
+ */
+
+#define WATCHDOG_BACKTRACE_DEPTH    64
+
+static struct {
+    int enabled;
+    int period_ms;
+    pthread_t reactor;
+    pthread_t thread;
+    _Atomic uint64_t busy_since;            /* 0 表示在 epoll_wait 中 */
+    _Atomic unsigned long long iteration;
+    _Atomic(const char *) what;
+    _Atomic int fd;
+    _Atomic unsigned long long stalls;
+} wd;
+
+static void watchdog_backtrace(int sig) {
+    (void)sig;
+    static const char hdr[] = "[Watchdog] Reactor thread backtrace:\n";
+    void *frames[WATCHDOG_BACKTRACE_DEPTH];
+    int n = backtrace(frames, WATCHDOG_BACKTRACE_DEPTH);
+    ssize_t ret = write(STDOUT_FILENO, hdr, sizeof(hdr) - 1);
+    (void)ret;
+    backtrace_symbols_fd(frames, n, STDOUT_FILENO);
+}
+
+static void *watchdog_main(void *arg) {
+    (void)arg;
+    unsigned long long reported = 0;
+    useconds_t interval = wd.period_ms * 1000 / 4;
+    if (interval < 1000) interval = 1000;
+
+    for (;;) {
+        usleep(interval);
+        uint64_t since = atomic_load_explicit(&wd.busy_since, memory_order_acquire);
+        unsigned long long it = atomic_load_explicit(&wd.iteration, memory_order_relaxed);
+        if (!since || it == reported) continue;
+
+        uint64_t blocked = kvs_clock_ns() - since;
+        if (blocked < (uint64_t)wd.period_ms * 1000000) continue;
+
+        reported = it;
+        atomic_fetch_add_explicit(&wd.stalls, 1, memory_order_relaxed);
+        const char *what = atomic_load_explicit(&wd.what, memory_order_relaxed);
+        LOG_INFO("[Watchdog] Event loop blocked for %llu ms in %s callback (fd=%d)\n",
+                 (unsigned long long)(blocked / 1000000), what ? what : "unknown",
+                 atomic_load_explicit(&wd.fd, memory_order_relaxed));
+        /* 先写出告警，调用栈由信号处理函数直接写 stdout */
+        kvs_log_flush();
+        pthread_kill(wd.reactor, SIGUSR1);
+    }
+    return NULL;
+}
+
+int kvs_watchdog_start(int period_ms) {
+    if (period_ms <= 0 || wd.enabled) return 0;
+
+    /* backtrace() 首次调用会加载 libgcc，先在信号处理函数之外调用一次 */
+    void *frame;
+    backtrace(&frame, 1);
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = watchdog_backtrace;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGUSR1, &sa, NULL);
+
+    wd.period_ms = period_ms;
+    wd.reactor = pthread_self();
+    wd.enabled = 1;
+    if (pthread_create(&wd.thread, NULL, watchdog_main, NULL) != 0) {
+        LOG_WARN("[Watchdog] Failed to start watchdog thread\n");
+        wd.enabled = 0;
+        return -1;
+    }
+    pthread_detach(wd.thread);
+    LOG_INFO("[Watchdog] Reporting event loop stalls over %d ms\n", period_ms);
+    return 0;
+}
+
+void kvs_watchdog_busy(uint64_t now_ns) {
+    if (!wd.enabled) return;
+    atomic_fetch_add_explicit(&wd.iteration, 1, memory_order_relaxed);
+    atomic_store_explicit(&wd.busy_since, now_ns, memory_order_release);
+}
+
+void kvs_watchdog_callback(const char *what, int fd) {
+    if (!wd.enabled) return;
+    atomic_store_explicit(&wd.what, what, memory_order_relaxed);
+    atomic_store_explicit(&wd.fd, fd, memory_order_relaxed);
+}
+
+void kvs_watchdog_idle(void) {
+    if (!wd.enabled) return;
+    atomic_store_explicit(&wd.busy_since, 0, memory_order_release);
+}
+
+unsigned long long kvs_watchdog_stalls(void) {
+    return atomic_load_explicit(&wd.stalls, memory_order_relaxed);
+}
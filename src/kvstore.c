@@ -2,6 +2,15 @@
 #include "../include/kvs_hash.h"
 #include "../include/kvs_persist.h"
 #include "../include/kvs_configure.h"
+#include "../include/kvs_bitcask.h"
+#include "../include/kvs_tier.h"
+#include "../include/kvs_propagate.h"
+#include "../include/kvs_cluster.h"
+#include "../include/kvs_proxy.h"
+#include "../include/kvs_latency.h"
+#include "../include/kvs_slowlog.h"
+#include "../include/kvs_hotkeys.h"
+#include "../include/server.h"
 #ifdef ENABLE_REPL
 #include "../include/kvs_replication.h"
 #endif
@@ -16,12 +25,23 @@ extern int reactor_start(unsigned short port, msg_handler handler);
 extern bool g_is_loading;
 
 static const char *command[] = {
-    "SET", "GET", "DEL", "MOD", "EXISTS", "SAVE"
+    "SET", "GET", "DEL", "MOD", "EXISTS", "SAVE", "INFO", "PSYNC", "SLAVEOF",
+    "REPLCONF", "WAIT", "CLUSTER", "ASKING", "RESTORE", "LATENCY",
+    "SLOWLOG", "CONFIG", "HOTKEYS", "BIGKEYS"
 };
 enum {
-    CMD_SET, CMD_GET, CMD_DEL, CMD_MOD, CMD_EXISTS, CMD_SAVE, CMD_COUNT
+    CMD_SET, CMD_GET, CMD_DEL, CMD_MOD, CMD_EXISTS, CMD_SAVE, CMD_INFO, CMD_PSYNC,
+    CMD_SLAVEOF, CMD_REPLCONF, CMD_WAIT, CMD_CLUSTER, CMD_ASKING, CMD_RESTORE, CMD_LATENCY,
+    CMD_SLOWLOG, CMD_CONFIG, CMD_HOTKEYS, CMD_BIGKEYS, CMD_COUNT
 };
 
+/* Room reserved for any status or integer reply */
+#define KVS_REPLY_RESERVE   64
+#define KVS_INFO_SIZE       16384
+
+/* 当前命令的解析耗时，由 kvs_protocol 设置，供慢日志使用 */
+static uint64_t cur_parse_ns;
+
 static int append_bulk_string(char *resp, const void *data, size_t len) {
     int n = sprintf(resp, "$%zu\r\n", len);
     memcpy(resp + n, data, len);
@@ -31,59 +51,102 @@ static int append_bulk_string(char *resp, const void *data, size_t len) {
     return n;
 }
 
-int kvs_executor(char **tokens, int count, char *response) {
-    if (!tokens || !tokens[0] || count < 1 || !response) return -1;
-
-#ifdef DEBUG
-    printf("[DEBUG] Executing command:");
-    for (int i = 0; i < count; i++) {
-        printf(" %s", tokens[i]);
-    }
-    printf("\n");
+static int kvs_info(char *buf, int size) {
+    int len = snprintf(buf, size,
+                       "# Keyspace\r\n"
+                       "keys:%d\r\n"
+                       "value_memory:%zu\r\n"
+                       "\r\n",
+                       global_hash.count, global_hash.mem_bytes);
+    len += kvs_tier_info(buf + len, size - len);
+    if (len < size) len += snprintf(buf + len, size - len, "\r\n");
+    if (len < size) len += kvs_clients_info(buf + len, size - len);
+#if ENABLE_REPL
+    if (len < size) len += snprintf(buf + len, size - len, "\r\n");
+    if (len < size) len += kvs_replication_info(buf + len, size - len);
 #endif
+    if (len < size) len += snprintf(buf + len, size - len, "\r\n");
+    if (len < size) len += kvs_cluster_info(buf + len, size - len);
+    if (len < size) len += snprintf(buf + len, size - len, "\r\n");
+    if (len < size) len += kvs_latency_info(buf + len, size - len);
+    if (len < size) len += snprintf(buf + len, size - len, "\r\n");
+    if (len < size) len += kvs_eventloop_info(buf + len, size - len);
+    if (len < size) len += snprintf(buf + len, size - len, "\r\n");
+    if (len < size) len += kvs_log_info(buf + len, size - len);
+    if (len < size) len += snprintf(buf + len, size - len, "\r\n");
+    if (len < size) len += kvs_hotkeys_info(buf + len, size - len);
+    return len < size ? len : size - 1;
+}
 
-    int cmd;
-    for (cmd = 0; cmd < CMD_COUNT; cmd++)
-        if (strcmp(tokens[0], command[cmd]) == 0) break;
-    if (cmd >= CMD_COUNT) {
-#ifdef DEBUG
-        printf("[DEBUG] Unknown command: %s\n", tokens[0]);
-#endif
-        return sprintf(response, "-ERR unknown command\r\n");
+/*
+ * Applies SET/DEL/MOD and propagates it on success. Returns the storage
+ * result, 0 meaning the write took effect.
+ */
+static int kvs_apply_write(int cmd, char **tokens, size_t *lens, int count) {
+    int ret;
+    switch (cmd) {
+    case CMD_SET:
+        if (count < 3) return -1;
+        ret = kvs_hash_set(&global_hash, tokens[1], lens[1], tokens[2], lens[2]);
+        break;
+    case CMD_MOD:
+        if (count < 3) return -1;
+        ret = kvs_hash_mod(&global_hash, tokens[1], lens[1], tokens[2], lens[2]);
+        break;
+    case CMD_DEL:
+        if (count < 2) return -1;
+        ret = kvs_hash_del(&global_hash, tokens[1], lens[1]);
+        break;
+    default:
+        return -1;
     }
+    if (ret == 0) kvs_propagate(cmd == CMD_DEL ? 2 : 3, (const char **)tokens, lens);
+    return ret;
+}
 
+static int kvs_execute(int cmd, char **tokens, size_t *lens, int count,
+                       char *response, int resp_size, int *needed) {
     char *key = count > 1 ? tokens[1] : NULL;
     char *val = count > 2 ? tokens[2] : NULL;
     int ret, len = 0;
-    size_t key_len = key ? strlen(key) : 0;
-    size_t val_len = val ? strlen(val) : 0;
+    size_t key_len = key ? lens[1] : 0;
+
+#if ENABLE_REPL
+    /* 从机的数据只来自复制流，客户端只能读 */
+    if ((cmd == CMD_SET || cmd == CMD_DEL || cmd == CMD_MOD) && g_repl.role == KVS_ROLE_SLAVE &&
+        g_config.repl_read_only && !g_is_loading)
+        return sprintf(response, "-READONLY You can't write against a read only replica.\r\n");
+#endif
+
+    /* 集群模式下不属于本节点的键回复 MOVED/ASK，迁移中可能阻塞到在途键被确认 */
+    if (key && cmd <= CMD_EXISTS && g_client_fd >= 0 && kvs_cluster_enabled()) {
+        ret = kvs_cluster_redirect(g_client_fd, key, key_len, response);
+        if (ret != 0) return ret > 0 ? ret : 0;
+    }
 
     switch (cmd) {
     case CMD_SET:
-        ret = kvs_hash_set(&global_hash, key, key_len, val, val_len);
+        ret = kvs_apply_write(cmd, tokens, lens, count);
         if (ret < 0)
             len = sprintf(response, "-ERR internal error\r\n");
-        else if (ret == 0) {
+        else if (ret == 0)
             len = sprintf(response, "+OK\r\n");
-#if ENABLE_PERSIST
-            if (g_config.persist_mode == PERSIST_AOF_ONLY || 
-                g_config.persist_mode == PERSIST_MIXED) {
-                kvs_aof_append("SET", key, val);
-            }
-#endif
-#if ENABLE_REPL
-            if (g_repl.role == KVS_ROLE_MASTER)
-                kvs_replication_feed_slaves("SET", key, val);
-#endif
-        } else
+        else
             len = sprintf(response, "+EXIST\r\n");
         break;
 
     case CMD_GET: {
-        size_t res_len;
-        void *res = kvs_hash_get(&global_hash, key, key_len, &res_len);
+        hashnode_t *node = kvs_hash_lookup(&global_hash, key, key_len);
+        if (node && node->value_len + KVS_REPLY_RESERVE > (size_t)resp_size) {
+            *needed = node->value_len + KVS_REPLY_RESERVE;
+            return -2;
+        }
+        /* 冷数据异步读取，客户端阻塞到回复送达 */
+        if (kvs_tier_enabled() && kvs_tier_get(node, g_client_fd)) break;
+
+        const void *res = node ? kvs_hash_node_value(&global_hash, node) : NULL;
         if (res) {
-            len = append_bulk_string(response, res, res_len);
+            len = append_bulk_string(response, res, node->value_len);
         } else {
             len = sprintf(response, "$-1\r\n");
         }
@@ -91,42 +154,22 @@ int kvs_executor(char **tokens, int count, char *response) {
     }
 
     case CMD_DEL:
-        ret = kvs_hash_del(&global_hash, key, key_len);
+        ret = kvs_apply_write(cmd, tokens, lens, count);
         if (ret < 0)
             len = sprintf(response, "-ERR internal error\r\n");
-        else if (ret == 0) {
+        else if (ret == 0)
             len = sprintf(response, "+OK\r\n");
-#if ENABLE_PERSIST
-            if (g_config.persist_mode == PERSIST_AOF_ONLY || 
-                g_config.persist_mode == PERSIST_MIXED) {
-                kvs_aof_append("DEL", key, NULL);
-            }
-#endif
-#if ENABLE_REPL
-            if (g_repl.role == KVS_ROLE_MASTER)
-                kvs_replication_feed_slaves("DEL", key, NULL);
-#endif
-        } else
+        else
             len = sprintf(response, "$-1\r\n");
         break;
 
     case CMD_MOD:
-        ret = kvs_hash_mod(&global_hash, key, key_len, val, val_len);
+        ret = kvs_apply_write(cmd, tokens, lens, count);
         if (ret < 0)
             len = sprintf(response, "-ERR internal error\r\n");
-        else if (ret == 0) {
+        else if (ret == 0)
             len = sprintf(response, "+OK\r\n");
-#if ENABLE_PERSIST
-            if (g_config.persist_mode == PERSIST_AOF_ONLY || 
-                g_config.persist_mode == PERSIST_MIXED) {
-                kvs_aof_append("MOD", key, val);
-            }
-#endif
-#if ENABLE_REPL
-            if (g_repl.role == KVS_ROLE_MASTER)
-                kvs_replication_feed_slaves("MOD", key, val);
-#endif
-        } else
+        else
             len = sprintf(response, "$-1\r\n");
         break;
 
@@ -139,6 +182,163 @@ int kvs_executor(char **tokens, int count, char *response) {
         kvs_rdb_save();
         len = sprintf(response, "+OK\r\n");
         break;
+
+    case CMD_INFO: {
+        char info[KVS_INFO_SIZE];
+        int info_len = kvs_info(info, sizeof(info));
+        if (info_len + KVS_REPLY_RESERVE > resp_size) {
+            *needed = info_len + KVS_REPLY_RESERVE;
+            return -2;
+        }
+        len = append_bulk_string(response, info, info_len);
+        break;
+    }
+
+    case CMD_PSYNC:
+#if ENABLE_REPL
+        /* 成功时复制模块直接向该连接发送同步数据，这里不再回复 */
+        if (count < 3 || kvs_replication_psync(g_client_fd, key, atoll(val)) < 0)
+            len = sprintf(response, "-ERR PSYNC not possible\r\n");
+#else
+        len = sprintf(response, "-ERR replication disabled\r\n");
+#endif
+        break;
+
+    case CMD_SLAVEOF:
+#if ENABLE_REPL
+        if (count < 3) {
+            len = sprintf(response, "-ERR wrong number of arguments\r\n");
+            break;
+        }
+        kvs_slaveof(key, strcasecmp(key, "NO") == 0 ? 0 : atoi(val));
+        len = sprintf(response, "+OK\r\n");
+#else
+        len = sprintf(response, "-ERR replication disabled\r\n");
+#endif
+        break;
+
+    case CMD_REPLCONF:
+#if ENABLE_REPL
+        /* 从机回报 offset，不回复 */
+        if (count >= 3 && strcasecmp(key, "ACK") == 0) {
+            kvs_replication_ack(g_client_fd, atoll(val));
+            break;
+        }
+#endif
+        len = sprintf(response, "+OK\r\n");
+        break;
+
+    case CMD_WAIT:
+#if ENABLE_REPL
+        if (count < 3) {
+            len = sprintf(response, "-ERR wrong number of arguments\r\n");
+            break;
+        }
+        if (g_repl.role != KVS_ROLE_MASTER) {
+            len = sprintf(response, "-ERR WAIT cannot be used with replica instances\r\n");
+            break;
+        }
+        /* 未满足时客户端被阻塞，由复制模块在 ACK 到达或超时后回复 */
+        ret = kvs_replication_wait(g_client_fd, atoi(key), atol(val));
+        if (ret >= 0) len = sprintf(response, ":%d\r\n", ret);
+#else
+        len = sprintf(response, ":0\r\n");
+#endif
+        break;
+
+    case CMD_CLUSTER:
+        len = kvs_cluster_command(tokens, lens, count, response, resp_size, needed);
+        break;
+
+    case CMD_ASKING:
+        if (!kvs_cluster_enabled()) {
+            len = sprintf(response, "-ERR This instance has cluster support disabled\r\n");
+            break;
+        }
+        kvs_cluster_asking(g_client_fd);
+        len = sprintf(response, "+OK\r\n");
+        break;
+
+    case CMD_RESTORE: {
+        /* 槽位迁移写入：导入中的槽位不需要 ASKING，按 SET 传播 */
+        if (count < 3) {
+            len = sprintf(response, "-ERR wrong number of arguments\r\n");
+            break;
+        }
+        if (!kvs_cluster_enabled() || !kvs_cluster_can_restore(key, key_len)) {
+            len = sprintf(response, "-ERR Slot is not being imported\r\n");
+            break;
+        }
+        char *set[3] = { "SET", key, val };
+        size_t set_lens[3] = { 3, key_len, lens[2] };
+        ret = kvs_apply_write(CMD_SET, set, set_lens, 3);
+        len = ret < 0 ? sprintf(response, "-ERR internal error\r\n") : sprintf(response, "+OK\r\n");
+        break;
+    }
+
+    case CMD_LATENCY:
+        len = kvs_latency_command_reply(tokens, lens, count, response, resp_size, needed);
+        break;
+
+    case CMD_SLOWLOG:
+        len = kvs_slowlog_command_reply(tokens, lens, count, response, resp_size, needed);
+        break;
+
+    case CMD_CONFIG:
+        len = kvs_config_command_reply(tokens, lens, count, response, resp_size, needed);
+        break;
+
+    case CMD_HOTKEYS:
+        len = kvs_hotkeys_command_reply(tokens, lens, count, response, resp_size, needed);
+        break;
+
+    case CMD_BIGKEYS:
+        len = kvs_bigkeys_command_reply(tokens, lens, count, response, resp_size, needed);
+        break;
+    }
+
+    return len;
+}
+
+/*
+ * Executes one command. Returns the reply length, or -2 with *needed set when
+ * the reply does not fit into resp_size; -2 is only returned before any side
+ * effect so the command can be retried after the buffer grows.
+ */
+int kvs_executor(char **tokens, size_t *lens, int count, char *response, int resp_size, int *needed) {
+    if (!tokens || !tokens[0] || count < 1 || !response) return -1;
+
+#ifdef DEBUG
+    printf("[DEBUG] Executing command:");
+    for (int i = 0; i < count; i++) {
+        printf(" %s", tokens[i]);
+    }
+    printf("\n");
+#endif
+
+    int cmd;
+    for (cmd = 0; cmd < CMD_COUNT; cmd++)
+        if (strcmp(tokens[0], command[cmd]) == 0) break;
+    if (cmd >= CMD_COUNT) {
+#ifdef DEBUG
+        printf("[DEBUG] Unknown command: %s\n", tokens[0]);
+#endif
+        return sprintf(response, "-ERR unknown command\r\n");
+    }
+
+    uint64_t parse_ns = cur_parse_ns;
+    uint64_t propagated = kvs_latency_phase_sum(KVS_LAT_PROPAGATE);
+    uint64_t start = kvs_clock_ns();
+    int len = kvs_execute(cmd, tokens, lens, count, response, resp_size, needed);
+    /* -2 时命令尚未执行，扩容后重试再计时；AOF 加载不计入 */
+    if (len != -2 && !g_is_loading) {
+        uint64_t ns = kvs_clock_ns() - start;
+        kvs_latency_command(cmd, ns);
+        kvs_latency_phase(KVS_LAT_EXECUTE, ns);
+        propagated = kvs_latency_phase_sum(KVS_LAT_PROPAGATE) - propagated;
+        kvs_slowlog_command(tokens, lens, count, g_client_fd, parse_ns, ns,
+                            cmd == CMD_LATENCY ? 0 : propagated);
+        if (cmd <= CMD_EXISTS && count > 1) kvs_hotkeys_touch(tokens[1], lens[1]);
     }
 
 #ifdef DEBUG
@@ -148,11 +348,16 @@ int kvs_executor(char **tokens, int count, char *response) {
     return len;
 }
 
-static int parse_resp(char *msg, int len, char *tokens[], int maxtok) {
+/*
+ * Parses one RESP array. With copy set every token is a NUL-terminated
+ * kvs_malloc copy; otherwise tokens point into msg and only lens delimit them.
+ */
+static int parse_resp(char *msg, int len, char *tokens[], size_t lens[], int maxtok, int copy) {
     char *p = msg;
     char *end = msg + len;
 
-    if (len < 4 || *p != '*') return -1;
+    if (len <= 0) return 0;
+    if (*p != '*') return -1;
     p++;
 
     int argc = 0;
@@ -161,8 +366,9 @@ static int parse_resp(char *msg, int len, char *tokens[], int maxtok) {
         argc = argc * 10 + (*p - '0');
         p++;
     }
-    if (p == num_start) return -1;
+    /* 头部尚未收全（如 "*3"）时等待更多数据 */
     if (p >= end) return 0;
+    if (p == num_start) return -1;
     if (*p != '\r') return -1;
     p++;
     if (p >= end) return 0;
@@ -182,8 +388,8 @@ static int parse_resp(char *msg, int len, char *tokens[], int maxtok) {
             blen = blen * 10 + (*p - '0');
             p++;
         }
-        if (p == blen_start) return -1;
         if (p >= end) return 0;
+        if (p == blen_start) return -1;
         if (*p != '\r') return -1;
         p++;
         if (p >= end) return 0;
@@ -192,21 +398,62 @@ static int parse_resp(char *msg, int len, char *tokens[], int maxtok) {
 
         if (p + blen + 2 > end) return 0;
 
-        tokens[i] = kvs_malloc(blen + 1);
-        if (!tokens[i]) {
+        lens[i] = blen;
+        tokens[i] = p;
+        p += blen + 2;
+    }
+    if (!copy) return p - msg;
+
+    /* 整条命令收全后再复制，数据不完整时不会留下已分配的参数 */
+    for (int i = 0; i < argc; i++) {
+        char *tok = kvs_malloc(lens[i] + 1);
+        if (!tok) {
             for (int j = 0; j < i; j++) {
                 kvs_free(tokens[j]);
                 tokens[j] = NULL;
             }
             return -1;
         }
-        memcpy(tokens[i], p, blen);
-        tokens[i][blen] = '\0';
-        p += blen + 2;
+        memcpy(tok, tokens[i], lens[i]);
+        tok[lens[i]] = '\0';
+        tokens[i] = tok;
     }
     return p - msg;
 }
 
+/*
+ * 执行复制流中的一条命令：参数直接引用输入缓冲区，不分配、不生成回复。
+ * 返回消耗的字节数，0 表示数据不完整，-1 表示协议错误。
+ */
+int kvs_apply_command(char *msg, int length) {
+    char *tokens[KVS_MAX_TOKENS];
+    size_t lens[KVS_MAX_TOKENS];
+    int consumed = parse_resp(msg, length, tokens, lens, KVS_MAX_TOKENS, 0);
+    if (consumed <= 0) return consumed;
+
+    /* 命令数 = 解析出的参数个数，取自 RESP 头 */
+    int count = atoi(msg + 1);
+    if (count < 1) return consumed;
+
+    int cmd;
+    for (cmd = 0; cmd < CMD_COUNT; cmd++) {
+        if (lens[0] == strlen(command[cmd]) && memcmp(tokens[0], command[cmd], lens[0]) == 0)
+            break;
+    }
+    if (cmd == CMD_SET || cmd == CMD_DEL || cmd == CMD_MOD) {
+        if (kvs_apply_write(cmd, tokens, lens, count) < 0)
+            LOG_DEBUG("[REPL] Failed to apply %.*s\n", (int)lens[0], tokens[0]);
+#if ENABLE_REPL
+    } else if (cmd == CMD_REPLCONF && count >= 2 && lens[1] == 6 &&
+               strncasecmp(tokens[1], "GETACK", 6) == 0) {
+        kvs_replication_getack();
+#endif
+    } else {
+        LOG_DEBUG("[REPL] Ignoring %.*s in replication stream\n", (int)lens[0], tokens[0]);
+    }
+    return consumed;
+}
+
 int kvs_protocol(char *msg, int length, char *response, int resp_size, int *processed, int *needed) {
     if (!msg || !response || !processed || !needed) return -1;
     if (length <= 0) return 0;
@@ -216,6 +463,7 @@ int kvs_protocol(char *msg, int length, char *response, int resp_size, int *proc
     int total = 0;
     char *resp = response;
     int resp_remain = resp_size;
+    int executed = 0;
     *processed = 0;
     *needed = 0;
 
@@ -247,26 +495,40 @@ int kvs_protocol(char *msg, int length, char *response, int resp_size, int *proc
             }
         }
 
+        if (resp_remain < KVS_REPLY_RESERVE) {
+            if (executed > 0) break;
+            *needed = KVS_REPLY_RESERVE;
+            return -2;
+        }
+
         char *tokens[KVS_MAX_TOKENS] = {0};
-        int consumed = parse_resp(p, remain, tokens, KVS_MAX_TOKENS);
+        size_t lens[KVS_MAX_TOKENS];
+        uint64_t parse_start = kvs_clock_ns();
+        int consumed = parse_resp(p, remain, tokens, lens, KVS_MAX_TOKENS, 1);
         if (consumed > 0) {
+            cur_parse_ns = kvs_clock_ns() - parse_start;
+            kvs_latency_phase(KVS_LAT_PARSE, cur_parse_ns);
             int tokcnt = 0;
             while (tokcnt < KVS_MAX_TOKENS && tokens[tokcnt]) tokcnt++;
 
-            char *temp = kvs_malloc(64 * 1024);
-            if (!temp) {
-                for (int i = 0; i < tokcnt; i++) {
-                    if (tokens[i]) kvs_free(tokens[i]);
-                }
-                return -1;
+            /* PSYNC 之后该连接的写缓冲区由复制模块写入，必须单独执行 */
+            int takeover = tokcnt > 0 && strcmp(tokens[0], "PSYNC") == 0;
+            if (takeover && executed > 0) {
+                for (int i = 0; i < tokcnt; i++) kvs_free(tokens[i]);
+                break;
             }
-            int resp_len = kvs_executor(tokens, tokcnt, temp);
-            kvs_free(temp);
 
-            if (resp_len > resp_remain) {
-                *needed = resp_len;
-                for (int i = 0; i < tokcnt; i++) {
-                    if (tokens[i]) kvs_free(tokens[i]);
+            int resp_len = kvs_executor(tokens, lens, tokcnt, resp, resp_remain, needed);
+            cur_parse_ns = 0;
+            for (int i = 0; i < tokcnt; i++) {
+                if (tokens[i]) kvs_free(tokens[i]);
+            }
+
+            if (resp_len == -2) {
+                /* 已执行的命令先返回，下次调用再扩容重试 */
+                if (executed > 0) {
+                    *needed = 0;
+                    break;
                 }
                 return -2;
             }
@@ -274,11 +536,7 @@ int kvs_protocol(char *msg, int length, char *response, int resp_size, int *proc
 #ifdef DEBUG
             cmd_count++;
 #endif
-            resp_len = kvs_executor(tokens, tokcnt, resp);
-            for (int i = 0; i < tokcnt; i++) {
-                if (tokens[i]) kvs_free(tokens[i]);
-            }
-
+            executed++;
             if (resp_len > 0) {
                 resp += resp_len;
                 resp_remain -= resp_len;
@@ -289,7 +547,9 @@ int kvs_protocol(char *msg, int length, char *response, int resp_size, int *proc
             remain -= consumed;
             *processed += consumed;
 
-            if (g_is_loading) break;
+            if (g_is_loading || takeover) break;
+            if (g_client_fd >= 0 && (kvs_client_blocked(g_client_fd) ||
+                                     kvs_client_charge(g_client_fd, total))) break;
         } else if (consumed == 0) {
             break;
         } else {
@@ -321,7 +581,16 @@ int init_kvengine(void) {
     printf("[DEBUG] Initializing KV engine (hash table)\n");
 #endif
     memset(&global_hash, 0, sizeof(global_hash));
-    return kvs_hash_create(&global_hash);
+    if (kvs_hash_create(&global_hash) < 0) return -1;
+
+    if (g_config.storage_engine == STORAGE_BITCASK) {
+        global_hash.bc = kvs_bitcask_open(g_config.bitcask_dir,
+                                          (size_t)g_config.bitcask_segment_size * 1024 * 1024,
+                                          g_config.bitcask_compact_ratio);
+        if (!global_hash.bc) return -1;
+        kvs_bitcask_rebuild(global_hash.bc, &global_hash);
+    }
+    return kvs_tier_init(&global_hash);
 }
 
 void dest_kvengine(void) {
@@ -372,25 +641,30 @@ int main(int argc, char *argv[]) {
         g_config.master_port = slaveof_port;
     }
 
+    kvs_log_start();
     kvs_config_print();
 
-    init_kvengine();
+    /* 代理模式不加载存储引擎，只按 key 转发到后端 */
+    if (g_config.proxy_enabled) {
+        if (kvs_proxy_init() < 0) return 1;
+        reactor_start(g_config.port, kvs_proxy_protocol);
+        return 0;
+    }
+
+    if (init_kvengine() < 0) {
+        LOG_WARN("Failed to initialize storage engine\n");
+        return 1;
+    }
 
 #if ENABLE_REPL
     kvs_replication_init();
 #endif
+    kvs_cluster_init();
+    kvs_latency_init(command, CMD_COUNT);
 
 #if ENABLE_PERSIST
     kvs_persist_init();
-
-    if (g_config.persist_mode == PERSIST_RDB_ONLY ||
-        g_config.persist_mode == PERSIST_MIXED) {
-        kvs_hash_load_rdb(&global_hash, g_config.rdb_file);
-    }
-    if (g_config.persist_mode == PERSIST_AOF_ONLY ||
-        g_config.persist_mode == PERSIST_MIXED) {
-        if (strlen(g_config.aof_file) > 0) load_aof_file(g_config.aof_file);
-    }
+    kvs_persist_load();
 #endif
 
     reactor_start(g_config.port, kvs_protocol);
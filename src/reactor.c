@@ -2,6 +2,8 @@
 #include <stdio.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <sys/un.h>
+#include <sys/stat.h>
 #include <string.h>
 #include <pthread.h>
 #include <unistd.h>
@@ -11,64 +13,134 @@
 #include <stdlib.h>
 #include <signal.h>
 #include <sys/timerfd.h>
+#include <sys/uio.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <fcntl.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <limits.h>
 
 #include "../include/server.h"
 #include "../include/kvs_replication.h"
 #include "../include/kvs_persist.h"
 #include "../include/kvs_base.h"
 #include "../include/kvs_configure.h"
+#include "../include/kvs_hash.h"
+#include "../include/kvs_tier.h"
+#include "../include/kvs_hotkeys.h"
+#include "../include/kvs_propagate.h"
+#include "../include/kvs_cluster.h"
+#include "../include/kvs_proxy.h"
+#include "../include/kvs_latency.h"
+#include "../include/kvs_watchdog.h"
 
 #define MAX_PORTS			1
+#define CONN_IOV_MAX        64
 #define TIME_SUB_MS(tv1, tv2)  ((tv1.tv_sec - tv2.tv_sec) * 1000 + (tv1.tv_usec - tv2.tv_usec) / 1000)
 
+/* 输出队列节点：多个连接引用同一份编码好的复制流 */
+struct conn_oq_node {
+    struct conn_oq_node *next;
+    kvs_sbuf_t *buf;
+};
+
 static struct conn conn_list[CONNECTION_SIZE] = {0};
+static unsigned int next_conn_id = 0;
+static int conn_max_fd = -1;
+static unsigned long long conns_accepted = 0;
+static int conn_buffer_size = INIT_BUFFER_SIZE;
+
+/*
+ * 用完命令额度、读缓冲区里还有命令的连接。每次事件循环迭代末尾各执行一份
+ * 额度，期间不再从它们的 socket 读取，大流水线与其他连接轮流执行。
+ */
+static int deferred_fds[CONNECTION_SIZE];
+static int deferred_count = 0;
+static unsigned long long budget_exhausted = 0;
+
+/*
+ * 普通客户端待发送的回复达到该值后暂停执行它的命令，发到一半以下再继续；
+ * 此时连接只注册 EPOLLOUT，不再读取
+ */
+#define OUTPUT_HIGH_WATER       (1024 * 1024)
+
+static unsigned long long obuf_disconnects[2];     /* 普通客户端 / 从机 */
+static unsigned long long qbuf_disconnects = 0;
+
+int g_client_fd = -1;
+
+extern kvs_hash_t global_hash;
 
 #if ENABLE_KVSTORE
 static msg_handler kvs_handler;
+/* SIGTERM / SIGINT：事件循环在下一次迭代开始时退出，由 main 完成关闭时的保存 */
+static volatile sig_atomic_t shutdown_requested = 0;
+
+static void shutdown_handler(int sig) {
+    (void)sig;
+    shutdown_requested = 1;
+}
 
 static int expand_rbuffer(struct conn *c, int needed) {
-    int new_capacity = c->rcapacity;
+    long limit = (long)g_config.query_buffer_limit * 1024 * 1024;
+    long new_capacity = c->rcapacity;
     while (new_capacity - c->rlength < needed) {
         new_capacity *= 2;
-        if (new_capacity > 128 * 1024 * 1024) {
-            printf("Read buffer too large for fd=%d\n", c->fd);
+        if (new_capacity > limit) {
+            LOG_WARN("[EVENT] Query buffer of fd=%d over %d MB, disconnecting\n",
+                     c->fd, g_config.query_buffer_limit);
+            qbuf_disconnects++;
             return -1;
         }
     }
     char *new_buf = (char*)kvs_realloc(c->rbuffer, new_capacity);
     if (!new_buf) {
-        printf("Failed to expand read buffer for fd=%d to %d bytes\n", 
-               c->fd, new_capacity);
+        LOG_WARN("[EVENT] Failed to expand read buffer for fd=%d to %ld bytes\n",
+                 c->fd, new_capacity);
         return -1;
     }
     c->rbuffer = new_buf;
     c->rcapacity = new_capacity;
 #ifdef DEBUG
-    printf("Expanded read buffer for fd=%d from %d to %d bytes\n", 
+    printf("Expanded read buffer for fd=%d from %d to %ld bytes\n", 
            c->fd, c->rcapacity/2, new_capacity);
 #endif
     return 0;
 }
 
+#define MAX_WBUFFER_SIZE        (128 * 1024 * 1024)
+#define MAX_REPLICA_WBUFFER     (1024 * 1024 * 1024)
+
 static int expand_wbuffer(struct conn *c, int needed) {
-    int new_capacity = c->wcapacity;
+    /* 先回收已发送的前缀 */
+    if (c->wsent > 0) {
+        memmove(c->wbuffer, c->wbuffer + c->wsent, c->wlength - c->wsent);
+        c->wlength -= c->wsent;
+        c->wsent = 0;
+        if (c->wcapacity - c->wlength >= needed) return 0;
+    }
+
+    /* 从机的输出上限由 kvs_client_write 按配置检查 */
+    long limit = c->replica ? MAX_REPLICA_WBUFFER : MAX_WBUFFER_SIZE;
+    long new_capacity = c->wcapacity;
     while (new_capacity - c->wlength < needed) {
         new_capacity *= 2;
-        if (new_capacity > 128 * 1024 * 1024) {
-            printf("Write buffer too large for fd=%d\n", c->fd);
+        if (new_capacity > limit) {
+            LOG_WARN("[EVENT] Write buffer too large for fd=%d\n", c->fd);
             return -1;
         }
     }
     char *new_buf = (char*)kvs_realloc(c->wbuffer, new_capacity);
     if (!new_buf) {
-        printf("Failed to expand write buffer for fd=%d to %d bytes\n", 
-               c->fd, new_capacity);
+        LOG_WARN("[EVENT] Failed to expand write buffer for fd=%d to %ld bytes\n",
+                 c->fd, new_capacity);
         return -1;
     }
     c->wbuffer = new_buf;
     c->wcapacity = new_capacity;
 #ifdef DEBUG
-    printf("Expanded write buffer for fd=%d from %d to %d bytes\n", 
+    printf("Expanded write buffer for fd=%d from %d to %ld bytes\n", 
            c->fd, c->wcapacity/2, new_capacity);
 #endif
     return 0;
@@ -94,7 +166,7 @@ int kvs_request(struct conn *c) {
         c->wlength += resp_len;
     }
     if (resp_len < 0 && resp_len != -2) {
-        printf("[ERROR] Protocol error on fd=%d\n", c->fd);
+        LOG_WARN("[EVENT] Protocol error on fd=%d\n", c->fd);
         return -1;
     }
     return 0;
@@ -118,7 +190,7 @@ static void ensure_epfd(void) {
     if (epfd <= 0) {
         epfd = epoll_create(1);
         if (epfd < 0) {
-            perror("[EVENT] epoll_create failed");
+            LOG_INFO("[EVENT] epoll_create failed: %s\n", strerror(errno));
             exit(1);
         }
 #ifdef DEBUG
@@ -134,54 +206,73 @@ int set_event(int fd, int event, int flag) {
     ev.data.fd = fd;
     int op = flag ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
     if (epoll_ctl(epfd, op, fd, &ev) < 0) {
-        printf("[EVENT] epoll_ctl failed, fd=%d, op=%s, errno=%d (%s)\n",
-               fd, flag ? "ADD" : "MOD", errno, strerror(errno));
+        LOG_WARN("[EVENT] epoll_ctl failed, fd=%d, op=%s, errno=%d (%s)\n",
+                 fd, flag ? "ADD" : "MOD", errno, strerror(errno));
         return -1;
     }
     return 0;
 }
 
-int event_register(int fd, int event) {
-    if (fd < 0 || fd >= CONNECTION_SIZE) return -1;
+/* 初始化连接状态并分配读写缓冲区 */
+static void conn_init(int fd, RCALLBACK recv) {
+    struct conn *c = &conn_list[fd];
+    if (fd > conn_max_fd) conn_max_fd = fd;
+    c->fd = fd;
+    c->r_action.recv_callback = recv;
+    c->send_callback = send_cb;
+    c->blocked = 0;
+    c->id = ++next_conn_id;
+    c->replica = 0;
+    c->obuf_soft_since = 0;
+    c->recv_ns = 0;
+    c->deferred = 0;
+    c->paused = 0;
+    c->drain_callback = NULL;
+    c->wsent = 0;
+    c->oq_head = c->oq_tail = NULL;
+    c->oq_bytes = c->oq_off = 0;
 
-    conn_list[fd].fd = fd;
-    conn_list[fd].r_action.recv_callback = recv_cb;
-    conn_list[fd].send_callback = send_cb;
+    c->rbuffer = (char*)kvs_malloc(conn_buffer_size);
+    c->rcapacity = conn_buffer_size;
+    c->rlength = 0;
+    memset(c->rbuffer, 0, conn_buffer_size);
 
-    conn_list[fd].rbuffer = (char*)kvs_malloc(INIT_BUFFER_SIZE);
-    conn_list[fd].rcapacity = INIT_BUFFER_SIZE;
-    conn_list[fd].rlength = 0;
-    memset(conn_list[fd].rbuffer, 0, INIT_BUFFER_SIZE);
+    c->wbuffer = (char*)kvs_malloc(conn_buffer_size);
+    c->wcapacity = conn_buffer_size;
+    c->wlength = 0;
+    memset(c->wbuffer, 0, conn_buffer_size);
+}
 
-    conn_list[fd].wbuffer = (char*)kvs_malloc(INIT_BUFFER_SIZE);
-    conn_list[fd].wcapacity = INIT_BUFFER_SIZE;
-    conn_list[fd].wlength = 0;
-    memset(conn_list[fd].wbuffer, 0, INIT_BUFFER_SIZE);
+void kvs_set_conn_buffer_size(int size) {
+    if (size >= 4096) conn_buffer_size = size;
+}
 
+int event_register(int fd, int event) {
+    if (fd < 0 || fd >= CONNECTION_SIZE) return -1;
+
+    conn_init(fd, recv_cb);
     set_event(fd, event, 1);
     return 0;
 }
 
 int accept_cb(int fd) {
-    struct sockaddr_in clientaddr;
+    struct sockaddr_storage clientaddr;
     socklen_t len = sizeof(clientaddr);
-    int clientfd = accept(fd, (struct sockaddr*)&clientaddr, &len);
+    int clientfd = accept4(fd, (struct sockaddr*)&clientaddr, &len, SOCK_NONBLOCK);
     if (clientfd < 0) {
-        printf("accept errno: %d --> %s\n", errno, strerror(errno));
+        LOG_WARN("[EVENT] accept failed: %s\n", strerror(errno));
         return -1;
     }
 
-    int ret = kvs_replication_accept_master(clientfd);
-    if (ret == 0) {
 #ifdef DEBUG
-        printf("[ACCEPT] PSYNC handshake succeeded, fd=%d taken over by replication\n", clientfd);
+    printf("[ACCEPT] Client connected, fd=%d\n", clientfd);
 #endif
-    } else {
-#ifdef DEBUG
-        printf("[ACCEPT] Normal client connected, fd=%d\n", clientfd);
-#endif
-        event_register(clientfd, EPOLLIN);
+    if (event_register(clientfd, EPOLLIN) < 0) {
+        LOG_WARN("[EVENT] Accepted fd=%d exceeds connection table, closing\n", clientfd);
+        close(clientfd);
+        return -1;
     }
+    conns_accepted++;
 
     if ((clientfd % 1000) == 0) {
         struct timeval current;
@@ -195,40 +286,116 @@ int accept_cb(int fd) {
     return 0;
 }
 
-int recv_cb(int fd) {
-    struct conn *c = &conn_list[fd];
-    int remaining = c->rcapacity - c->rlength;
-    if (remaining < 4096) {
-        if (expand_rbuffer(c, 4096) < 0) {
-            close(fd);
-            epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
-            return -1;
-        }
-        remaining = c->rcapacity - c->rlength;
+static void conn_queue_free(struct conn *c) {
+    while (c->oq_head) {
+        struct conn_oq_node *node = c->oq_head;
+        c->oq_head = node->next;
+        kvs_sbuf_release(node->buf);
+        kvs_free(node);
     }
+    c->oq_tail = NULL;
+    c->oq_bytes = c->oq_off = 0;
+}
 
-    int count = recv(fd, c->rbuffer + c->rlength, remaining, 0);
-    if (count == 0) {
-#ifdef DEBUG
-        printf("client disconnect: %d\n", fd);
+static void conn_close(int fd) {
+    struct conn *c = &conn_list[fd];
+#if ENABLE_REPL
+    kvs_replication_slave_closed(fd);
 #endif
-        close(fd);
-        epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
-        return 0;
-    } else if (count < 0) {
-        if (errno == EAGAIN || errno == EWOULDBLOCK) {
-            return 0;
+    kvs_cluster_conn_closed(fd);
+    kvs_proxy_conn_closed(fd);
+    epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
+    close(fd);
+    kvs_free(c->rbuffer);
+    kvs_free(c->wbuffer);
+    c->rbuffer = c->wbuffer = NULL;
+    conn_queue_free(c);
+    c->rlength = c->wlength = 0;
+    c->rcapacity = c->wcapacity = 0;
+    c->wsent = 0;
+    c->blocked = 0;
+    c->replica = 0;
+    c->deferred = 0;
+    c->paused = 0;
+    c->id = 0;
+    c->r_action.recv_callback = NULL;
+    c->send_callback = NULL;
+    c->drain_callback = NULL;
+}
+
+static long conn_pending(struct conn *c) {
+    return c->wlength - c->wsent + c->oq_bytes;
+}
+
+/* 普通客户端与从机各自的输出缓冲区上限，[server] / [replication] output_buffer_* */
+static int conn_output_limit_reached(struct conn *c) {
+    long pending = conn_pending(c);
+    const char *who = c->replica ? "Replica" : "Client";
+    long hard, soft;
+    int seconds;
+    if (c->replica) {
+        hard = (long)g_config.repl_obuf_hard_limit * 1024 * 1024;
+        soft = (long)g_config.repl_obuf_soft_limit * 1024 * 1024;
+        seconds = g_config.repl_obuf_soft_seconds;
+    } else {
+        hard = (long)g_config.client_obuf_hard_limit * 1024 * 1024;
+        soft = (long)g_config.client_obuf_soft_limit * 1024 * 1024;
+        seconds = g_config.client_obuf_soft_seconds;
+    }
+
+    if (hard > 0 && pending > hard) {
+        LOG_WARN("[EVENT] %s fd=%d output buffer %ld bytes over hard limit, disconnecting\n",
+                 who, c->fd, pending);
+        obuf_disconnects[c->replica]++;
+        return 1;
+    }
+    if (soft > 0 && pending > soft) {
+        long now = time(NULL);
+        if (c->obuf_soft_since == 0) {
+            c->obuf_soft_since = now;
+        } else if (now - c->obuf_soft_since >= seconds) {
+            LOG_WARN("[EVENT] %s fd=%d output buffer over soft limit for %lds, disconnecting\n",
+                     who, c->fd, now - c->obuf_soft_since);
+            obuf_disconnects[c->replica]++;
+            return 1;
         }
-        printf("recv error: %d, %s\n", errno, strerror(errno));
-        close(fd);
-        epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
-        return -1;
+    } else {
+        c->obuf_soft_since = 0;
     }
+    return 0;
+}
 
-    c->rlength += count;
+/*
+ * 从机连接在等待发送时仍需读取（关闭检测、ACK）；自定义读回调的连接
+ * （如槽位迁移的出站连接）同样边写边读对端的回复。
+ */
+static void conn_want_write(struct conn *c) {
+    int duplex = c->replica || c->r_action.recv_callback != recv_cb;
+    set_event(c->fd, duplex ? (EPOLLIN | EPOLLOUT) : EPOLLOUT, 0);
+}
+
+/* 回复积压到高水位时暂停执行，从机的输出是复制流，不受此限 */
+static int conn_output_high(struct conn *c, long unqueued) {
+    return !c->replica && conn_pending(c) + unqueued >= OUTPUT_HIGH_WATER;
+}
+
+static void conn_defer(struct conn *c) {
+    c->deferred = 1;
+    deferred_fds[deferred_count++] = c->fd;
+}
+
+/*
+ * 执行读缓冲区中的命令，客户端被阻塞时保留剩余数据等待唤醒；
+ * 执行满 [server] command_budget 条后停下，剩余的命令放到延后列表；
+ * 待发送的回复达到高水位时停下，发出去一半后由 send_cb 继续
+ */
+static int conn_process(struct conn *c) {
+    int fd = c->fd;
     int total_processed = 0;
 
-    while (1) {
+    c->budget = g_config.command_budget > 0 ? g_config.command_budget : INT_MAX;
+    g_client_fd = fd;
+    while (!c->blocked && c->budget > 0 && !conn_output_high(c, 0)) {
         int processed = 0;
         int needed = 0;
         int resp_len = kvs_handler(c->rbuffer + total_processed,
@@ -236,23 +403,30 @@ int recv_cb(int fd) {
                                    c->wbuffer + c->wlength,
                                    c->wcapacity - c->wlength,
                                    &processed, &needed);
+        if (!c->rbuffer) {
+            /* 命令执行期间连接被关闭（如从机超出输出缓冲区限制） */
+            g_client_fd = -1;
+            return -1;
+        }
         if (resp_len == -2) {
             if (expand_wbuffer(c, needed) < 0) {
-                close(fd);
-                epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
+                g_client_fd = -1;
+                conn_close(fd);
                 return -1;
             }
             continue;
         }
         if (resp_len < 0) {
-            printf("[ERROR] Protocol error on fd=%d, resetting buffer\n", fd);
+            LOG_WARN("[EVENT] Protocol error on fd=%d, resetting buffer\n", fd);
             c->rlength = 0;
+            total_processed = 0;
             break;
         }
         if (processed == 0) break;
         c->wlength += resp_len;
         total_processed += processed;
     }
+    g_client_fd = -1;
 
     if (total_processed > 0) {
         if (total_processed < c->rlength) {
@@ -263,9 +437,235 @@ int recv_cb(int fd) {
         }
     }
 
+    if (conn_output_limit_reached(c)) {
+        conn_close(fd);
+        return -1;
+    }
+
+    if (c->rlength > 0 && conn_output_high(c, 0)) {
+        c->paused = 1;
+    } else if (c->budget <= 0 && c->rlength > 0 && !c->deferred) {
+        conn_defer(c);
+        budget_exhausted++;
+    }
+
+    /* 偶尔的大请求撑大的读缓冲区在读完后归还 */
+    if (c->rlength == 0 && c->rcapacity > OUTPUT_HIGH_WATER) {
+        char *buf = kvs_realloc(c->rbuffer, conn_buffer_size);
+        if (buf) {
+            c->rbuffer = buf;
+            c->rcapacity = conn_buffer_size;
+        }
+    }
+
     if (c->wlength > 0) {
-        set_event(fd, EPOLLOUT, 0);
+        conn_want_write(c);
+    }
+    return 0;
+}
+
+/* 每个在 n 之前进入列表的连接再执行一份额度，仍未执行完的重新排到队尾 */
+static void conn_run_deferred(int n) {
+    for (int i = 0; i < n; i++) {
+        struct conn *c = &conn_list[deferred_fds[i]];
+        if (!c->deferred) continue;     /* 已关闭 */
+        c->deferred = 0;
+        if (!c->blocked) conn_process(c);
     }
+    deferred_count -= n;
+    memmove(deferred_fds, deferred_fds + n, sizeof(int) * deferred_count);
+}
+
+int kvs_client_charge(int fd, long reply_bytes) {
+    if (fd < 0 || fd >= CONNECTION_SIZE) return 0;
+    struct conn *c = &conn_list[fd];
+    return --c->budget <= 0 || conn_output_high(c, reply_bytes);
+}
+
+void kvs_close_client(int fd) {
+    if (fd < 0 || fd >= CONNECTION_SIZE || !conn_list[fd].rbuffer) return;
+    conn_close(fd);
+}
+
+static int conn_queue_append(struct conn *c, kvs_sbuf_t *b) {
+    struct conn_oq_node *node = kvs_malloc(sizeof(*node));
+    if (!node) return -1;
+    kvs_sbuf_retain(b);
+    node->buf = b;
+    node->next = NULL;
+    if (c->oq_tail) c->oq_tail->next = node;
+    else c->oq_head = node;
+    c->oq_tail = node;
+    c->oq_bytes += b->len;
+    return 0;
+}
+
+/* 用 writev 批量发送队列中的共享缓冲区，发完的节点释放引用 */
+static ssize_t conn_send_queue(struct conn *c) {
+    struct iovec iov[CONN_IOV_MAX];
+    int n = 0;
+    long off = c->oq_off;
+    for (struct conn_oq_node *node = c->oq_head; node && n < CONN_IOV_MAX; node = node->next) {
+        iov[n].iov_base = node->buf->data + off;
+        iov[n].iov_len = node->buf->len - off;
+        off = 0;
+        n++;
+    }
+
+    ssize_t count = writev(c->fd, iov, n);
+    if (count <= 0) return count;
+
+    c->oq_bytes -= count;
+    size_t left = count;
+    while (left > 0) {
+        struct conn_oq_node *node = c->oq_head;
+        size_t rest = node->buf->len - c->oq_off;
+        if (left < rest) {
+            c->oq_off += left;
+            break;
+        }
+        left -= rest;
+        c->oq_off = 0;
+        c->oq_head = node->next;
+        kvs_sbuf_release(node->buf);
+        kvs_free(node);
+    }
+    if (!c->oq_head) c->oq_tail = NULL;
+    return count;
+}
+
+int kvs_client_write(int fd, const void *data, int len) {
+    if (fd < 0 || fd >= CONNECTION_SIZE || !conn_list[fd].wbuffer) return -1;
+    struct conn *c = &conn_list[fd];
+    int idle = (conn_pending(c) == 0);
+
+    if (c->oq_head) {
+        /* 队列非空时写入必须排在队列之后以保持顺序 */
+        kvs_sbuf_t *b = kvs_sbuf_new(data, len);
+        int ret = b ? conn_queue_append(c, b) : -1;
+        kvs_sbuf_release(b);
+        if (ret < 0) {
+            conn_close(fd);
+            return -1;
+        }
+    } else {
+        if (c->wcapacity - c->wlength < len && expand_wbuffer(c, len) < 0) {
+            conn_close(fd);
+            return -1;
+        }
+        memcpy(c->wbuffer + c->wlength, data, len);
+        c->wlength += len;
+    }
+
+    if (conn_output_limit_reached(c)) {
+        conn_close(fd);
+        return -1;
+    }
+    /* 缓冲区原本为空时才需要注册 EPOLLOUT */
+    if (idle) conn_want_write(c);
+    return 0;
+}
+
+int kvs_client_write_shared(int fd, kvs_sbuf_t *b) {
+    if (fd < 0 || fd >= CONNECTION_SIZE || !conn_list[fd].wbuffer) return -1;
+    struct conn *c = &conn_list[fd];
+    int idle = (conn_pending(c) == 0);
+
+    if (conn_queue_append(c, b) < 0 || conn_output_limit_reached(c)) {
+        conn_close(fd);
+        return -1;
+    }
+    if (idle) conn_want_write(c);
+    return 0;
+}
+
+int kvs_client_output_len(int fd) {
+    if (fd < 0 || fd >= CONNECTION_SIZE || !conn_list[fd].wbuffer) return 0;
+    return conn_pending(&conn_list[fd]);
+}
+
+void kvs_client_set_replica(int fd) {
+    if (fd < 0 || fd >= CONNECTION_SIZE) return;
+    conn_list[fd].replica = 1;
+    conn_list[fd].obuf_soft_since = 0;
+}
+
+void kvs_client_set_drain(int fd, RCALLBACK cb) {
+    if (fd < 0 || fd >= CONNECTION_SIZE) return;
+    conn_list[fd].drain_callback = cb;
+}
+
+unsigned int kvs_client_id(int fd) {
+    if (fd < 0 || fd >= CONNECTION_SIZE || !conn_list[fd].rbuffer) return 0;
+    return conn_list[fd].id;
+}
+
+unsigned int kvs_block_client(int fd) {
+    if (fd < 0 || fd >= CONNECTION_SIZE) return 0;
+    conn_list[fd].blocked = 1;
+    return conn_list[fd].id;
+}
+
+int kvs_client_blocked(int fd) {
+    if (fd < 0 || fd >= CONNECTION_SIZE) return 0;
+    return conn_list[fd].blocked;
+}
+
+void kvs_unblock_client(int fd, unsigned int id, const char *reply, int len) {
+    if (fd < 0 || fd >= CONNECTION_SIZE) return;
+    struct conn *c = &conn_list[fd];
+    if (!c->blocked || c->id != id) return;
+
+    c->blocked = 0;
+    if (len > 0) {
+        if (c->wcapacity - c->wlength < len && expand_wbuffer(c, len) < 0) {
+            conn_close(fd);
+            return;
+        }
+        memcpy(c->wbuffer + c->wlength, reply, len);
+        c->wlength += len;
+    }
+    /*
+     * 唤醒可能发生在另一个连接的 conn_process 内部（如从机的 ACK 满足了 WAIT），
+     * 剩余命令交给延后列表在本轮事件末尾执行，不嵌套执行以免改写 g_client_fd
+     */
+    if (c->rlength > 0 && !c->deferred) conn_defer(c);
+    if (conn_pending(c) > 0) conn_want_write(c);
+}
+
+int recv_cb(int fd) {
+    struct conn *c = &conn_list[fd];
+    /* 缓冲区里的命令执行完之前不再读取，由 TCP 窗口反压客户端 */
+    if (c->deferred || c->paused) return 0;
+    int remaining = c->rcapacity - c->rlength;
+    if (remaining < 4096) {
+        if (expand_rbuffer(c, 4096) < 0) {
+            conn_close(fd);
+            return -1;
+        }
+        remaining = c->rcapacity - c->rlength;
+    }
+
+    int count = recv(fd, c->rbuffer + c->rlength, remaining, 0);
+    if (count == 0) {
+#ifdef DEBUG
+        printf("client disconnect: %d\n", fd);
+#endif
+        conn_close(fd);
+        return 0;
+    } else if (count < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return 0;
+        }
+        LOG_WARN("[EVENT] recv error on fd=%d: %s\n", fd, strerror(errno));
+        conn_close(fd);
+        return -1;
+    }
+
+    c->rlength += count;
+    if (!c->recv_ns && !c->replica) c->recv_ns = kvs_clock_ns();
+    if (c->blocked) return count;
+    if (conn_process(c) < 0) return -1;
     return count;
 }
 
@@ -280,70 +680,256 @@ int send_cb(int fd) {
     kvs_response(c);
 #endif
 
+#if ENABLE_PERSIST
+    /* 回复发出前写入 AOF */
+    kvs_aof_flush();
+#endif
+
     int count = 0;
-    if (c->wlength > 0) {
-        count = send(fd, c->wbuffer, c->wlength, 0);
+    if (c->wlength > c->wsent) {
+        count = send(fd, c->wbuffer + c->wsent, c->wlength - c->wsent, 0);
         if (count > 0) {
-            if (count < c->wlength) {
-                memmove(c->wbuffer, c->wbuffer + count, c->wlength - count);
-                c->wlength -= count;
-            } else {
-                c->wlength = 0;
-            }
+            c->wsent += count;
+            if (c->wsent == c->wlength) c->wsent = c->wlength = 0;
         } else if (count < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
-            printf("send error on fd=%d: %s\n", fd, strerror(errno));
-            close(fd);
-            epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
+            LOG_WARN("[EVENT] send error on fd=%d: %s\n", fd, strerror(errno));
+            conn_close(fd);
+            return -1;
+        }
+    }
+    if (c->wlength == 0 && c->oq_head) {
+        ssize_t n = conn_send_queue(c);
+        if (n > 0) {
+            count += n;
+        } else if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+            LOG_WARN("[EVENT] send error on fd=%d: %s\n", fd, strerror(errno));
+            conn_close(fd);
             return -1;
         }
     }
 
-    if (c->wlength > 0) {
-        set_event(fd, EPOLLOUT, 0);
+    /* 从收到请求到发出第一个回复字节 */
+    if (count > 0 && c->recv_ns) {
+        kvs_latency_phase(KVS_LAT_SEND, kvs_clock_ns() - c->recv_ns);
+        c->recv_ns = 0;
+    }
+
+    if (c->wlength == 0 && c->wcapacity > OUTPUT_HIGH_WATER) {
+        char *buf = kvs_realloc(c->wbuffer, conn_buffer_size);
+        if (buf) {
+            c->wbuffer = buf;
+            c->wcapacity = conn_buffer_size;
+        }
+    }
+
+    /* 回复发出去一半后继续执行暂停时剩下的命令 */
+    if (c->paused && conn_pending(c) < OUTPUT_HIGH_WATER / 2) {
+        c->paused = 0;
+        if (!c->blocked && conn_process(c) < 0) return count;
+    }
+
+    /* 缓冲区发完后由生产者补充数据（如从机全量同步的下一批快照块） */
+    if (conn_pending(c) == 0 && c->drain_callback) {
+        c->drain_callback(fd);
+        if (!c->wbuffer) return count;
+    }
+
+    if (conn_pending(c) > 0) {
+        conn_want_write(c);
     } else {
         set_event(fd, EPOLLIN, 0);
     }
     return count;
 }
 
+/* HTTP 连接：请求读入 rbuffer，回复排入输出后忽略之后的输入，发完即关闭 */
+static int http_drain(int fd) {
+    conn_close(fd);
+    return 0;
+}
+
+static int http_recv_cb(int fd) {
+    struct conn *c = &conn_list[fd];
+    int count = recv(fd, c->rbuffer + c->rlength, c->rcapacity - c->rlength, 0);
+    if (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return 0;
+    if (count <= 0) {
+        conn_close(fd);
+        return -1;
+    }
+    if (c->drain_callback) return count;
+
+    c->rlength += count;
+    int ret = http_request(c);
+    if (!c->rbuffer) return -1;
+    if (ret < 0 || (ret == 0 && c->rlength == c->rcapacity)) {
+        conn_close(fd);
+        return -1;
+    }
+    if (ret > 0) {
+        c->rlength = 0;
+        c->drain_callback = http_drain;
+    }
+    return count;
+}
+
+static int http_accept_cb(int fd) {
+    int clientfd = accept4(fd, NULL, NULL, SOCK_NONBLOCK);
+    if (clientfd < 0) return -1;
+    if (clientfd >= CONNECTION_SIZE) {
+        close(clientfd);
+        return -1;
+    }
+    conn_init(clientfd, http_recv_cb);
+    set_event(clientfd, EPOLLIN, 1);
+    return 0;
+}
+
+void kvs_conn_stats(kvs_conn_stats_t *st) {
+    memset(st, 0, sizeof(*st));
+    st->accepted = conns_accepted;
+    for (int fd = 0; fd <= conn_max_fd; fd++) {
+        struct conn *c = &conn_list[fd];
+        if (!c->r_action.recv_callback) continue;
+        if (c->r_action.recv_callback == recv_cb) {
+            st->clients++;
+            if (c->blocked) st->blocked++;
+            if (c->replica) st->replicas++;
+            if (c->paused) st->paused++;
+            if (conn_pending(c) > st->max_pending) st->max_pending = conn_pending(c);
+        } else {
+            st->other++;
+        }
+        if (c->rbuffer) st->rbuffer_bytes += c->rcapacity;
+        if (c->wbuffer) st->wbuffer_bytes += c->wcapacity;
+        st->pending_bytes += conn_pending(c);
+    }
+    st->obuf_disconnects = obuf_disconnects[0];
+    st->repl_obuf_disconnects = obuf_disconnects[1];
+    st->qbuf_disconnects = qbuf_disconnects;
+}
+
+int kvs_clients_info(char *buf, int size) {
+    kvs_conn_stats_t st;
+    kvs_conn_stats(&st);
+    int len = snprintf(buf, size,
+                       "# Clients\r\n"
+                       "connected_clients:%d\r\n"
+                       "blocked_clients:%d\r\n"
+                       "paused_clients:%d\r\n"
+                       "query_buffer_bytes:%ld\r\n"
+                       "output_buffer_bytes:%ld\r\n"
+                       "output_pending_bytes:%ld\r\n"
+                       "output_pending_max:%ld\r\n"
+                       "output_limit_disconnects:normal=%llu,replica=%llu\r\n"
+                       "query_limit_disconnects:%llu\r\n",
+                       st.clients, st.blocked, st.paused, st.rbuffer_bytes,
+                       st.wbuffer_bytes, st.pending_bytes, st.max_pending,
+                       st.obuf_disconnects, st.repl_obuf_disconnects, st.qbuf_disconnects);
+    return len < size ? len : size - 1;
+}
+
 int r_init_server(unsigned short port) {
     int sockfd = socket(AF_INET, SOCK_STREAM, 0);
+    int on = 1;
+    setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
     struct sockaddr_in servaddr;
     servaddr.sin_family = AF_INET;
     servaddr.sin_addr.s_addr = htonl(INADDR_ANY);
     servaddr.sin_port = htons(port);
 
     if (bind(sockfd, (struct sockaddr*)&servaddr, sizeof(struct sockaddr)) < 0) {
-        printf("bind failed: %s\n", strerror(errno));
+        LOG_INFO("[EVENT] bind port %d failed: %s\n", port, strerror(errno));
         return -1;
     }
-    listen(sockfd, 10);
+    listen(sockfd, SOMAXCONN);
 #ifdef DEBUG
     printf("listen finished: %d\n", sockfd);
 #endif
     return sockfd;
 }
 
+/*
+ * 同机客户端使用的 Unix 域套接字，绕过 TCP/IP 协议栈。上次未正常退出留下的
+ * 同名文件先删除，退出事件循环时再删除。
+ */
+static int r_init_unix_server(const char *path, const char *perm) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        LOG_INFO("[EVENT] unix socket path too long: %s\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    int sockfd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sockfd < 0) return -1;
+    unlink(path);
+    if (bind(sockfd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        LOG_INFO("[EVENT] bind %s failed: %s\n", path, strerror(errno));
+        close(sockfd);
+        return -1;
+    }
+    char *end;
+    long mode = strtol(perm, &end, 8);
+    if (*perm && !*end && chmod(path, (mode_t)mode) < 0)
+        LOG_WARN("[EVENT] chmod %s failed: %s\n", path, strerror(errno));
+    listen(sockfd, SOMAXCONN);
+    return sockfd;
+}
+
+/*
+ * 发起出站连接（非阻塞、TCP_NODELAY）。timeout_ms 为 0 时不等待握手完成，
+ * 连接失败由之后的读事件得知；否则最多阻塞 timeout_ms 毫秒。
+ */
+int kvs_connect(const char *ip, int port, int timeout_ms) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    if (fd >= CONNECTION_SIZE) {
+        close(fd);
+        return -1;
+    }
+
+    int flags = fcntl(fd, F_GETFL, 0);
+    fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+    int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, ip, &addr.sin_addr) != 1) {
+        close(fd);
+        return -1;
+    }
+
+    int ret = connect(fd, (struct sockaddr*)&addr, sizeof(addr));
+    if (ret < 0 && errno != EINPROGRESS) {
+        close(fd);
+        return -1;
+    }
+    if (ret < 0 && timeout_ms > 0) {
+        struct pollfd pfd = { .fd = fd, .events = POLLOUT };
+        int err = 0;
+        socklen_t len = sizeof(err);
+        if (poll(&pfd, 1, timeout_ms) != 1 ||
+            getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err != 0) {
+            close(fd);
+            return -1;
+        }
+    }
+    return fd;
+}
+
 void event_register_read(int fd, int (*handler)(int)) {
     if (fd < 0 || fd >= CONNECTION_SIZE) {
-        fprintf(stderr, "[EVENT] event_register_read: invalid fd %d\n", fd);
+        LOG_WARN("[EVENT] event_register_read: invalid fd %d\n", fd);
         return;
     }
     ensure_epfd();
 
-    conn_list[fd].fd = fd;
-    conn_list[fd].r_action.recv_callback = handler;
-    conn_list[fd].send_callback = NULL;
-
-    conn_list[fd].rbuffer = (char*)kvs_malloc(INIT_BUFFER_SIZE);
-    conn_list[fd].rcapacity = INIT_BUFFER_SIZE;
-    conn_list[fd].rlength = 0;
-    memset(conn_list[fd].rbuffer, 0, INIT_BUFFER_SIZE);
-
-    conn_list[fd].wbuffer = (char*)kvs_malloc(INIT_BUFFER_SIZE);
-    conn_list[fd].wcapacity = INIT_BUFFER_SIZE;
-    conn_list[fd].wlength = 0;
-    memset(conn_list[fd].wbuffer, 0, INIT_BUFFER_SIZE);
+    conn_init(fd, handler);
 
     set_event(fd, EPOLLIN, 1);
 #ifdef DEBUG
@@ -373,23 +959,160 @@ void event_unregister_read(int fd) {
 #endif
 }
 
+/* 不再有新输出的慢客户端也要按 soft_seconds 断开 */
+static void conn_cron_output_limits(void) {
+    for (int fd = 0; fd <= conn_max_fd; fd++) {
+        struct conn *c = &conn_list[fd];
+        if (c->r_action.recv_callback != recv_cb || conn_pending(c) == 0) continue;
+        if (conn_output_limit_reached(c)) conn_close(fd);
+    }
+}
+
 static int timer_cb(int fd) {
     uint64_t exp;
     ssize_t n = read(fd, &exp, sizeof(exp));
     (void)n;
-#if 0
+    conn_cron_output_limits();
+    if (kvs_proxy_enabled()) {
+        kvs_proxy_cron();
+        return 0;
+    }
+#if ENABLE_PERSIST
     if (g_config.persist_mode == PERSIST_RDB_ONLY || g_config.persist_mode == PERSIST_MIXED) {
         kvs_rdb_check_and_save();
     }
     if (g_config.persist_mode == PERSIST_AOF_ONLY || g_config.persist_mode == PERSIST_MIXED) {
         kvs_aof_check_and_rewrite();
     }
+#endif
+    kvs_hash_cron(&global_hash);
+    kvs_cluster_cron();
+    kvs_tier_cron();
+    kvs_hotkeys_cron();
+#if ENABLE_REPL
+    kvs_replication_cron();
 #endif
     return 0;
 }
 
+/*
+ * 事件循环统计：每次迭代（epoll_wait 返回到下一次 epoll_wait 之前）的事件数
+ * 和各类回调的耗时。解析、执行来自延迟统计的累计值之差，recv 是读回调中
+ * 去掉二者后剩下的部分（读 socket、拷贝缓冲区）。最近的迭代耗时保存在环中
+ * 用于计算分位数，最慢的一次保留完整的分解。
+ */
+#define LOOP_SAMPLES    1024
+
+enum { LOOP_ACCEPT, LOOP_READ, LOOP_TIMER, LOOP_IO, LOOP_SEND, LOOP_AOF,
+       LOOP_PARSE, LOOP_EXECUTE, LOOP_PARTS };
+
+static const char *loop_part_names[LOOP_PARTS] = {
+    "accept", "read", "timer", "io", "send", "aof", "parse", "execute"
+};
+
+typedef struct {
+    uint64_t duration;
+    int events;
+    uint64_t parts[LOOP_PARTS];
+} loop_iter_t;
+
+static struct {
+    unsigned long long iterations;
+    unsigned long long events;
+    uint64_t wait_ns;
+    uint64_t busy_ns;
+    uint64_t parts[LOOP_PARTS];
+    loop_iter_t worst;
+    uint64_t samples[LOOP_SAMPLES];
+    int sample_pos, sample_count;
+} loop;
+
+static int loop_part(RCALLBACK cb) {
+    if (cb == accept_cb || cb == http_accept_cb) return LOOP_ACCEPT;
+    if (cb == recv_cb) return LOOP_READ;
+    if (cb == timer_cb) return LOOP_TIMER;
+    return LOOP_IO;         /* 复制、集群、代理等自定义读回调 */
+}
+
+static void loop_record(loop_iter_t *it) {
+    loop.iterations++;
+    loop.events += it->events;
+    loop.busy_ns += it->duration;
+    for (int i = 0; i < LOOP_PARTS; i++) loop.parts[i] += it->parts[i];
+    if (it->duration > loop.worst.duration) loop.worst = *it;
+
+    loop.samples[loop.sample_pos] = it->duration;
+    loop.sample_pos = (loop.sample_pos + 1) % LOOP_SAMPLES;
+    if (loop.sample_count < LOOP_SAMPLES) loop.sample_count++;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static int loop_parts_format(char *buf, int size, const uint64_t *parts) {
+    int len = 0;
+    /* read 中扣除解析和执行，单独显示为 recv */
+    uint64_t inner = parts[LOOP_PARSE] + parts[LOOP_EXECUTE];
+    uint64_t recv = parts[LOOP_READ] > inner ? parts[LOOP_READ] - inner : 0;
+    len += snprintf(buf, size, "recv=%llu", (unsigned long long)(recv / 1000));
+    for (int i = 0; i < LOOP_PARTS && len < size; i++) {
+        if (i == LOOP_READ) continue;
+        len += snprintf(buf + len, size - len, ",%s=%llu", loop_part_names[i],
+                        (unsigned long long)(parts[i] / 1000));
+    }
+    return len;
+}
+
+int kvs_eventloop_info(char *buf, int size) {
+    uint64_t sorted[LOOP_SAMPLES];
+    int n = loop.sample_count;
+    memcpy(sorted, loop.samples, sizeof(uint64_t) * n);
+    qsort(sorted, n, sizeof(uint64_t), cmp_u64);
+    double p50 = n ? sorted[(n - 1) * 50 / 100] / 1000.0 : 0;
+    double p99 = n ? sorted[(n - 1) * 99 / 100] / 1000.0 : 0;
+    double p999 = n ? sorted[(n - 1) * 999 / 1000] / 1000.0 : 0;
+
+    int len = snprintf(buf, size,
+                       "# Eventloop\r\n"
+                       "eventloop_iterations:%llu\r\n"
+                       "eventloop_events:%llu\r\n"
+                       "eventloop_duration_usec:p50=%.3f,p99=%.3f,p99.9=%.3f,samples=%d\r\n"
+                       "eventloop_wait_usec:%llu\r\n"
+                       "eventloop_busy_usec:%llu\r\n"
+                       "eventloop_budget_exhausted:%llu\r\n"
+                       "eventloop_deferred_clients:%d\r\n"
+                       "eventloop_time_usec:",
+                       loop.iterations, loop.events, p50, p99, p999, n,
+                       (unsigned long long)(loop.wait_ns / 1000),
+                       (unsigned long long)(loop.busy_ns / 1000),
+                       budget_exhausted, deferred_count);
+    if (len < size) len += loop_parts_format(buf + len, size - len, loop.parts);
+    if (len < size)
+        len += snprintf(buf + len, size - len, "\r\neventloop_slowest_usec:total=%llu,events=%d,",
+                        (unsigned long long)(loop.worst.duration / 1000), loop.worst.events);
+    if (len < size) len += loop_parts_format(buf + len, size - len, loop.worst.parts);
+    if (len < size)
+        len += snprintf(buf + len, size - len, "\r\neventloop_watchdog_stalls:%llu\r\n",
+                        kvs_watchdog_stalls());
+    return len < size ? len : size - 1;
+}
+
+/* fd 直接索引 conn_list，把软上限提高到表的大小 */
+static void raise_fd_limit(void) {
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) < 0 || rl.rlim_cur >= CONNECTION_SIZE) return;
+    rl.rlim_cur = rl.rlim_max < CONNECTION_SIZE ? rl.rlim_max : CONNECTION_SIZE;
+    if (setrlimit(RLIMIT_NOFILE, &rl) < 0)
+        LOG_WARN("[EVENT] setrlimit(RLIMIT_NOFILE) failed: %s\n", strerror(errno));
+}
+
 int reactor_start(unsigned short port, msg_handler handler) {
     signal(SIGPIPE, SIG_IGN);
+    signal(SIGTERM, shutdown_handler);
+    signal(SIGINT, shutdown_handler);
+    raise_fd_limit();
 
     kvs_handler = handler;
     ensure_epfd();
@@ -403,9 +1126,30 @@ int reactor_start(unsigned short port, msg_handler handler) {
         set_event(sockfd, EPOLLIN, 1);
     }
 
+    int unix_fd = -1;
+    if (g_config.unixsocket[0]) {
+        int sockfd = unix_fd = r_init_unix_server(g_config.unixsocket, g_config.unixsocket_perm);
+        if (sockfd >= 0) {
+            conn_list[sockfd].fd = sockfd;
+            conn_list[sockfd].r_action.recv_callback = accept_cb;
+            set_event(sockfd, EPOLLIN, 1);
+            LOG_INFO("[EVENT] Listening on unix socket %s\n", g_config.unixsocket);
+        }
+    }
+
+    if (g_config.metrics_port > 0) {
+        int sockfd = r_init_server(g_config.metrics_port);
+        if (sockfd >= 0) {
+            conn_list[sockfd].fd = sockfd;
+            conn_list[sockfd].r_action.recv_callback = http_accept_cb;
+            set_event(sockfd, EPOLLIN, 1);
+            LOG_INFO("[EVENT] Metrics listening on port %d\n", g_config.metrics_port);
+        }
+    }
+
     int tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
     if (tfd < 0) {
-        perror("timerfd_create");
+        LOG_INFO("[EVENT] timerfd_create failed: %s\n", strerror(errno));
     } else {
         struct itimerspec its;
         its.it_interval.tv_sec = 1;
@@ -418,27 +1162,84 @@ int reactor_start(unsigned short port, msg_handler handler) {
             printf("[EVENT] Timer fd=%d registered\n", tfd);
 #endif
         } else {
-            perror("timerfd_settime");
+            LOG_INFO("[EVENT] timerfd_settime failed: %s\n", strerror(errno));
             close(tfd);
         }
     }
 
     gettimeofday(&begin, NULL);
+    kvs_watchdog_start(g_config.watchdog_ms);
 
+    loop_iter_t it = {0};
+    uint64_t start = 0;
     while (1) {
+#if ENABLE_PERSIST
+        uint64_t t = kvs_clock_ns();
+        kvs_watchdog_callback("aof-flush", -1);
+        kvs_aof_flush();
+        if (start) it.parts[LOOP_AOF] += kvs_clock_ns() - t;
+#endif
+        /* 上一次迭代到此结束 */
+        uint64_t now = kvs_clock_ns();
+        if (start) {
+            it.duration = now - start;
+            loop_record(&it);
+        }
+        kvs_watchdog_idle();
+        if (shutdown_requested) {
+            LOG_INFO("[EVENT] Shutdown requested, leaving event loop\n");
+            break;
+        }
+
+        /* 有延后的连接时不睡眠 */
         struct epoll_event events[1024] = {0};
-        int nready = epoll_wait(epfd, events, 1024, -1);
+        int deferred = deferred_count;
+        int nready = epoll_wait(epfd, events, 1024, deferred ? 0 : -1);
+
+        start = kvs_clock_ns();
+        loop.wait_ns += start - now;
+        kvs_watchdog_busy(start);
+        memset(&it, 0, sizeof(it));
+        it.events = nready > 0 ? nready : 0;
+        uint64_t parse0 = kvs_latency_phase_sum(KVS_LAT_PARSE);
+        uint64_t exec0 = kvs_latency_phase_sum(KVS_LAT_EXECUTE);
 
         for (i = 0; i < nready; i++) {
             int connfd = events[i].data.fd;
-            if (events[i].events & EPOLLIN) {
-                conn_list[connfd].r_action.recv_callback(connfd);
+            /* 出错或挂断交给读回调，由 recv 的返回值关闭连接 */
+            if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+                RCALLBACK cb = conn_list[connfd].r_action.recv_callback;
+                if (cb) {
+                    int part = loop_part(cb);
+                    kvs_watchdog_callback(loop_part_names[part], connfd);
+                    uint64_t t0 = kvs_clock_ns();
+                    cb(connfd);
+                    it.parts[part] += kvs_clock_ns() - t0;
+                }
             }
             if (events[i].events & EPOLLOUT) {
-                if (conn_list[connfd].send_callback)
+                if (conn_list[connfd].send_callback) {
+                    kvs_watchdog_callback("send", connfd);
+                    uint64_t t0 = kvs_clock_ns();
                     conn_list[connfd].send_callback(connfd);
+                    it.parts[LOOP_SEND] += kvs_clock_ns() - t0;
+                }
             }
         }
+
+        if (deferred > 0) {
+            kvs_watchdog_callback("deferred", -1);
+            uint64_t t0 = kvs_clock_ns();
+            conn_run_deferred(deferred);
+            it.parts[LOOP_READ] += kvs_clock_ns() - t0;
+        }
+
+        /* LATENCY RESET 会清零累计值 */
+        uint64_t parse1 = kvs_latency_phase_sum(KVS_LAT_PARSE);
+        uint64_t exec1 = kvs_latency_phase_sum(KVS_LAT_EXECUTE);
+        it.parts[LOOP_PARSE] = parse1 >= parse0 ? parse1 - parse0 : 0;
+        it.parts[LOOP_EXECUTE] = exec1 >= exec0 ? exec1 - exec0 : 0;
     }
+    if (unix_fd >= 0) unlink(g_config.unixsocket);
     return 0;
 }
\ No newline at end of file
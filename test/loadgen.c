@@ -0,0 +1,494 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/*
+ * 多线程压测工具：每个线程用 epoll 驱动自己的一组连接，每个连接最多保持
+ * pipeline 个未完成的请求。指定 -R 时为开环模式：请求按固定速率排期，
+ * 延迟从排期时刻算起，服务端卡顿期间积压的请求如实计入，避免协调遗漏
+ * （coordinated omission）；不指定时为闭环模式，收到回复立即补发。
+ */
+
+#define KEY_PREFIX          "key:"
+
+/* 延迟直方图：对数-线性分桶，与服务端 LATENCY 相同的精度（约 6%），单位纳秒 */
+#define HIST_SUB_BITS       4
+#define HIST_SUB            (1 << HIST_SUB_BITS)
+#define HIST_MAX_BITS       40
+#define HIST_BUCKETS        ((HIST_MAX_BITS - HIST_SUB_BITS + 1) * HIST_SUB)
+
+typedef struct {
+    uint64_t count;
+    uint64_t max;
+    uint64_t buckets[HIST_BUCKETS];
+} hist_t;
+
+typedef struct {
+    const char *host;
+    int port;
+    const char *socket_path;    /* 非空时通过 Unix 域套接字连接 */
+    int threads;
+    int connections;        /* 总连接数，平均分给各线程 */
+    int pipeline;
+    long requests;          /* 总请求数，duration 为 0 时生效 */
+    int duration;           /* 秒 */
+    long keyspace;
+    double zipf;            /* 0 为均匀分布 */
+    int value_min, value_max;
+    double read_ratio;
+    double rate;            /* 总目标速率（ops/s），0 为闭环 */
+} options_t;
+
+typedef struct {
+    int fd;
+    char *out;
+    int out_len, out_sent;
+    char *in;
+    int in_len;
+    uint64_t *sent_at;      /* 未完成请求的起始时间，环形队列 */
+    int head, inflight;
+} bconn_t;
+
+typedef struct {
+    int id;
+    pthread_t tid;
+    bconn_t *conns;
+    int nconns;
+    long quota;             /* 本线程的请求数，-1 表示按时间 */
+    uint64_t seed;
+    /* 开环排期 */
+    double interval_ns;
+    uint64_t next_due;
+    uint64_t *backlog;      /* 已到期但还没有连接可用的请求 */
+    long backlog_head, backlog_len, backlog_cap;
+    /* 结果 */
+    long issued, completed, errors, hits, misses;
+    hist_t hist;
+} worker_t;
+
+static options_t opt = {
+    .host = "127.0.0.1", .port = 6379, .threads = 1, .connections = 50, .pipeline = 1,
+    .requests = 100000, .duration = 0, .keyspace = 100000, .zipf = 0,
+    .value_min = 64, .value_max = 64, .read_ratio = 0.9, .rate = 0,
+};
+
+static double *zipf_cdf;
+static char *value_data;
+static int out_cap, in_cap;     /* 每个连接的缓冲区，按 pipeline 与 value 大小计算 */
+static uint64_t start_ns, stop_ns;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint64_t rnd(uint64_t *s) {
+    /* xorshift64* */
+    *s ^= *s >> 12;
+    *s ^= *s << 25;
+    *s ^= *s >> 27;
+    return *s * 2685821657736338717ULL;
+}
+
+static double rnd_unit(uint64_t *s) {
+    return (rnd(s) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static int hist_index(uint64_t v) {
+    if (v < HIST_SUB) return (int)v;
+    if (v >> HIST_MAX_BITS) v = (1ULL << HIST_MAX_BITS) - 1;
+    int shift = 63 - __builtin_clzll(v) - HIST_SUB_BITS;
+    return (shift + 1) * HIST_SUB + (int)((v >> shift) & (HIST_SUB - 1));
+}
+
+static uint64_t hist_upper(int idx) {
+    if (idx < HIST_SUB) return idx;
+    int shift = idx / HIST_SUB - 1;
+    uint64_t low = (uint64_t)(HIST_SUB + idx % HIST_SUB) << shift;
+    return low + (1ULL << shift) - 1;
+}
+
+static void hist_record(hist_t *h, uint64_t ns) {
+    h->count++;
+    if (ns > h->max) h->max = ns;
+    h->buckets[hist_index(ns)]++;
+}
+
+static uint64_t hist_percentile(const hist_t *h, double p) {
+    if (h->count == 0) return 0;
+    uint64_t rank = (uint64_t)(h->count * p / 100.0 + 0.5);
+    if (rank < 1) rank = 1;
+    uint64_t seen = 0;
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen >= rank) return hist_upper(i) < h->max ? hist_upper(i) : h->max;
+    }
+    return h->max;
+}
+
+/* Zipf 分布：预先计算累积概率，取样时二分查找，排名 0 的 key 最热 */
+static int zipf_init(long n, double s) {
+    zipf_cdf = malloc(sizeof(double) * n);
+    if (!zipf_cdf) return -1;
+    double sum = 0;
+    for (long i = 0; i < n; i++) {
+        sum += 1.0 / pow((double)(i + 1), s);
+        zipf_cdf[i] = sum;
+    }
+    for (long i = 0; i < n; i++) zipf_cdf[i] /= sum;
+    return 0;
+}
+
+static long next_key(worker_t *w) {
+    if (!zipf_cdf) return (long)(rnd(&w->seed) % opt.keyspace);
+    double u = rnd_unit(&w->seed);
+    long lo = 0, hi = opt.keyspace - 1;
+    while (lo < hi) {
+        long mid = (lo + hi) / 2;
+        if (zipf_cdf[mid] < u) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+/* 完整回复的字节数，不完整时返回 0；bulk 回复按长度跳过，不按换行计数 */
+static long reply_len(const char *p, long len) {
+    if (len < 3) return 0;
+    const char *nl = memchr(p, '\n', len);
+    if (!nl) return 0;
+    long line = nl - p + 1;
+    if (p[0] == '$') {
+        long n = atol(p + 1);
+        if (n < 0) return line;
+        return len >= line + n + 2 ? line + n + 2 : 0;
+    }
+    if (p[0] == '*') {
+        long n = atol(p + 1), off = line;
+        for (long i = 0; i < n; i++) {
+            long r = reply_len(p + off, len - off);
+            if (r == 0) return 0;
+            off += r;
+        }
+        return off;
+    }
+    return line;
+}
+
+static int encode_command(worker_t *w, char *buf) {
+    char key[32];
+    int klen = snprintf(key, sizeof(key), KEY_PREFIX "%010ld", next_key(w));
+    if (rnd_unit(&w->seed) < opt.read_ratio)
+        return sprintf(buf, "*2\r\n$3\r\nGET\r\n$%d\r\n%s\r\n", klen, key);
+
+    int vlen = opt.value_min;
+    if (opt.value_max > opt.value_min)
+        vlen += rnd(&w->seed) % (opt.value_max - opt.value_min + 1);
+    int n = sprintf(buf, "*3\r\n$3\r\nSET\r\n$%d\r\n%s\r\n$%d\r\n", klen, key, vlen);
+    memcpy(buf + n, value_data, vlen);
+    n += vlen;
+    buf[n++] = '\r';
+    buf[n++] = '\n';
+    return n;
+}
+
+static int connect_server(void) {
+    if (opt.socket_path) {
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0) return -1;
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, opt.socket_path, sizeof(addr.sun_path) - 1);
+        if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+            close(fd);
+            return -1;
+        }
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+        return fd;
+    }
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(opt.port);
+    inet_pton(AF_INET, opt.host, &addr.sin_addr);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+    return fd;
+}
+
+static int backlog_push(worker_t *w, uint64_t t) {
+    if (w->backlog_len == w->backlog_cap) {
+        long cap = w->backlog_cap ? w->backlog_cap * 2 : 4096;
+        uint64_t *b = malloc(sizeof(uint64_t) * cap);
+        if (!b) return -1;
+        for (long i = 0; i < w->backlog_len; i++)
+            b[i] = w->backlog[(w->backlog_head + i) % w->backlog_cap];
+        free(w->backlog);
+        w->backlog = b;
+        w->backlog_head = 0;
+        w->backlog_cap = cap;
+    }
+    w->backlog[(w->backlog_head + w->backlog_len++) % w->backlog_cap] = t;
+    return 0;
+}
+
+static int issue_more(worker_t *w, uint64_t now) {
+    return w->quota < 0 ? now < stop_ns : w->issued < w->quota;
+}
+
+/* 把可以发出的请求编码到各连接的输出缓冲区 */
+static void fill(worker_t *w, uint64_t now) {
+    if (opt.rate > 0) {
+        while (w->next_due <= now && issue_more(w, now)) {
+            backlog_push(w, w->next_due);
+            w->issued++;
+            w->next_due = start_ns + (uint64_t)(w->issued * w->interval_ns);
+        }
+    }
+    for (int i = 0; i < w->nconns; i++) {
+        bconn_t *c = &w->conns[i];
+        while (c->inflight < opt.pipeline && out_cap - c->out_len > opt.value_max + 128) {
+            uint64_t t;
+            if (opt.rate > 0) {
+                if (w->backlog_len == 0) return;
+                t = w->backlog[w->backlog_head];
+                w->backlog_head = (w->backlog_head + 1) % w->backlog_cap;
+                w->backlog_len--;
+            } else {
+                if (!issue_more(w, now)) return;
+                w->issued++;
+                t = now;
+            }
+            c->out_len += encode_command(w, c->out + c->out_len);
+            c->sent_at[(c->head + c->inflight++) % opt.pipeline] = t;
+        }
+    }
+}
+
+static int flush_out(bconn_t *c) {
+    while (c->out_sent < c->out_len) {
+        ssize_t n = send(c->fd, c->out + c->out_sent, c->out_len - c->out_sent, 0);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        if (n <= 0) return -1;
+        c->out_sent += n;
+    }
+    if (c->out_sent == c->out_len) c->out_sent = c->out_len = 0;
+    return 0;
+}
+
+static int read_replies(worker_t *w, bconn_t *c) {
+    for (;;) {
+        ssize_t n = recv(c->fd, c->in + c->in_len, in_cap - c->in_len, 0);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return 0;
+        if (n <= 0) return -1;
+        c->in_len += n;
+
+        uint64_t now = now_ns();
+        long off = 0;
+        while (c->inflight > 0) {
+            long r = reply_len(c->in + off, c->in_len - off);
+            if (r == 0) break;
+            char type = c->in[off];
+            if (type == '-') w->errors++;
+            else if (type == '$' && c->in[off + 1] == '-') w->misses++;
+            else if (type == '$') w->hits++;
+            hist_record(&w->hist, now - c->sent_at[c->head]);
+            c->head = (c->head + 1) % opt.pipeline;
+            c->inflight--;
+            w->completed++;
+            off += r;
+        }
+        if (off > 0) {
+            memmove(c->in, c->in + off, c->in_len - off);
+            c->in_len -= off;
+        }
+        if (c->in_len == in_cap) return -1;
+    }
+}
+
+static void *worker_main(void *arg) {
+    worker_t *w = arg;
+    int epfd = epoll_create1(0);
+    for (int i = 0; i < w->nconns; i++) {
+        struct epoll_event ev = { .events = EPOLLIN, .data.u32 = i };
+        epoll_ctl(epfd, EPOLL_CTL_ADD, w->conns[i].fd, &ev);
+    }
+
+    w->next_due = start_ns;
+    for (;;) {
+        uint64_t now = now_ns();
+        fill(w, now);
+        int busy = 0;
+        for (int i = 0; i < w->nconns; i++) {
+            bconn_t *c = &w->conns[i];
+            if (flush_out(c) < 0) {
+                fprintf(stderr, "thread %d: connection lost\n", w->id);
+                goto done;
+            }
+            busy += c->inflight;
+        }
+        if (!busy && w->backlog_len == 0 && !issue_more(w, now)) break;
+
+        /* 开环模式下最多睡到下一个请求的排期时刻 */
+        int timeout = 100;
+        if (opt.rate > 0 && issue_more(w, now)) {
+            uint64_t wait = w->next_due > now ? w->next_due - now : 0;
+            timeout = wait / 1000000 < 100 ? (int)(wait / 1000000) : 100;
+        }
+        struct epoll_event events[64];
+        int n = epoll_wait(epfd, events, 64, timeout);
+        for (int i = 0; i < n; i++) {
+            if (read_replies(w, &w->conns[events[i].data.u32]) < 0) {
+                fprintf(stderr, "thread %d: connection lost\n", w->id);
+                goto done;
+            }
+        }
+    }
+done:
+    close(epfd);
+    return NULL;
+}
+
+static int parse_range(const char *s, int *lo, int *hi) {
+    char *end;
+    *lo = *hi = (int)strtol(s, &end, 10);
+    if (*end == '-') *hi = (int)strtol(end + 1, &end, 10);
+    return *end || *lo <= 0 || *hi < *lo ? -1 : 0;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  -h <host>        server address (default 127.0.0.1)\n"
+            "  -p <port>        server port (default 6379)\n"
+            "  -s <path>        connect through a Unix domain socket instead of TCP\n"
+            "  -t <threads>     client threads (default 1)\n"
+            "  -c <conns>       total connections (default 50)\n"
+            "  -P <depth>       pipeline depth per connection (default 1)\n"
+            "  -n <requests>    total requests (default 100000)\n"
+            "  -d <seconds>     run for a duration instead of -n\n"
+            "  -k <keys>        key space size (default 100000)\n"
+            "  -z <s>           Zipfian keys with exponent s, e.g. 0.99 (default uniform)\n"
+            "  -v <min[-max]>   value size in bytes, uniform in [min, max] (default 64)\n"
+            "  -r <ratio>       fraction of GETs, the rest are SETs (default 0.9)\n"
+            "  -R <ops/s>       open-loop target rate; latency is measured from the\n"
+            "                   scheduled send time (default closed loop)\n",
+            prog);
+}
+
+int main(int argc, char **argv) {
+    int ch;
+    while ((ch = getopt(argc, argv, "h:p:s:t:c:P:n:d:k:z:v:r:R:")) != -1) {
+        switch (ch) {
+            case 'h': opt.host = optarg; break;
+            case 'p': opt.port = atoi(optarg); break;
+            case 's': opt.socket_path = optarg; break;
+            case 't': opt.threads = atoi(optarg); break;
+            case 'c': opt.connections = atoi(optarg); break;
+            case 'P': opt.pipeline = atoi(optarg); break;
+            case 'n': opt.requests = atol(optarg); break;
+            case 'd': opt.duration = atoi(optarg); break;
+            case 'k': opt.keyspace = atol(optarg); break;
+            case 'z': opt.zipf = atof(optarg); break;
+            case 'v':
+                if (parse_range(optarg, &opt.value_min, &opt.value_max) < 0) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'r': opt.read_ratio = atof(optarg); break;
+            case 'R': opt.rate = atof(optarg); break;
+            default: usage(argv[0]); return 1;
+        }
+    }
+    if (opt.threads <= 0 || opt.connections < opt.threads || opt.pipeline <= 0 ||
+        opt.keyspace <= 0 || opt.requests <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (opt.zipf > 0 && zipf_init(opt.keyspace, opt.zipf) < 0) {
+        perror("malloc");
+        return 1;
+    }
+    out_cap = 16384 + opt.pipeline * (opt.value_max + 128);
+    in_cap = 16384 + opt.pipeline * (opt.value_max + 32);
+    value_data = malloc(opt.value_max);
+    memset(value_data, 'x', opt.value_max);
+
+    worker_t *workers = calloc(opt.threads, sizeof(worker_t));
+    for (int t = 0; t < opt.threads; t++) {
+        worker_t *w = &workers[t];
+        w->id = t;
+        w->seed = 0x9E3779B97F4A7C15ULL * (t + 1);
+        w->nconns = opt.connections / opt.threads + (t < opt.connections % opt.threads);
+        w->quota = opt.duration > 0 ? -1 : opt.requests / opt.threads + (t < opt.requests % opt.threads);
+        if (opt.rate > 0) w->interval_ns = 1e9 * opt.threads / opt.rate;
+        w->conns = calloc(w->nconns, sizeof(bconn_t));
+        for (int i = 0; i < w->nconns; i++) {
+            bconn_t *c = &w->conns[i];
+            c->fd = connect_server();
+            if (c->fd < 0) {
+                perror("connect");
+                return 1;
+            }
+            c->out = malloc(out_cap);
+            c->in = malloc(in_cap);
+            c->sent_at = malloc(sizeof(uint64_t) * opt.pipeline);
+        }
+    }
+
+    printf("%d threads, %d connections, pipeline %d, %ld keys (%s), values %d-%d bytes, %.0f%% GET, %s\n",
+           opt.threads, opt.connections, opt.pipeline, opt.keyspace,
+           opt.zipf > 0 ? "zipfian" : "uniform", opt.value_min, opt.value_max,
+           opt.read_ratio * 100, opt.rate > 0 ? "open loop" : "closed loop");
+
+    start_ns = now_ns();
+    stop_ns = start_ns + (uint64_t)opt.duration * 1000000000ULL;
+    for (int t = 0; t < opt.threads; t++)
+        pthread_create(&workers[t].tid, NULL, worker_main, &workers[t]);
+
+    hist_t *total = calloc(1, sizeof(hist_t));
+    long completed = 0, errors = 0, hits = 0, misses = 0;
+    for (int t = 0; t < opt.threads; t++) {
+        worker_t *w = &workers[t];
+        pthread_join(w->tid, NULL);
+        completed += w->completed;
+        errors += w->errors;
+        hits += w->hits;
+        misses += w->misses;
+        total->count += w->hist.count;
+        if (w->hist.max > total->max) total->max = w->hist.max;
+        for (int i = 0; i < HIST_BUCKETS; i++) total->buckets[i] += w->hist.buckets[i];
+    }
+    double secs = (now_ns() - start_ns) / 1e9;
+
+    printf("requests: %ld in %.2f s, %.0f ops/s\n", completed, secs, completed / secs);
+    printf("errors: %ld, GET hits: %ld, misses: %ld\n", errors, hits, misses);
+    printf("latency (us): p50=%.1f p99=%.1f p99.9=%.1f max=%.1f\n",
+           hist_percentile(total, 50.0) / 1000.0, hist_percentile(total, 99.0) / 1000.0,
+           hist_percentile(total, 99.9) / 1000.0, total->max / 1000.0);
+    return 0;
+}
@@ -79,6 +79,29 @@ static int resp_encode_mod(char *buf, int idx) {
                    strlen(key), key, strlen(val), val);
 }
 
+/* 完整回复的字节数，不完整时返回 0；bulk 回复按长度跳过，不能按换行计数 */
+static long reply_len(const char *p, long len) {
+    if (len < 3) return 0;
+    const char *nl = memchr(p, '\n', len);
+    if (!nl) return 0;
+    long line = nl - p + 1;
+    if (p[0] == '$') {
+        long n = atol(p + 1);
+        if (n < 0) return line;
+        return len >= line + n + 2 ? line + n + 2 : 0;
+    }
+    if (p[0] == '*') {
+        long n = atol(p + 1), off = line;
+        for (long i = 0; i < n; i++) {
+            long r = reply_len(p + off, len - off);
+            if (r == 0) return 0;
+            off += r;
+        }
+        return off;
+    }
+    return line;
+}
+
 /* ---------- 性能测试（无验证，只计数） ---------- */
 void benchmark_pipeline(int fd, int count) {
     struct timeval start, end;
@@ -107,7 +130,7 @@ void benchmark_pipeline(int fd, int count) {
     send_all(fd, cmds, pos);
     free(cmds);
 
-    /* 接收所有响应，按行计数 */
+    /* 接收所有响应，按 RESP 回复计数 */
     int received = 0;
     char recv_buf[MAX_BUF_SIZE];
     int buf_len = 0;
@@ -122,12 +145,11 @@ void benchmark_pipeline(int fd, int count) {
         char *p = recv_buf;
         int remaining = buf_len;
         while (remaining > 0 && received < total_cmds) {
-            char *line_end = memchr(p, '\n', remaining);
-            if (!line_end) break;          /* 半包，等待更多数据 */
-            int line_len = line_end - p + 1;
+            long r = reply_len(p, remaining);
+            if (r == 0) break;             /* 半包，等待更多数据 */
             received++;
-            p += line_len;
-            remaining -= line_len;
+            p += r;
+            remaining -= r;
         }
         if (remaining > 0 && p != recv_buf) {
             memmove(recv_buf, p, remaining);